@@ -0,0 +1,32 @@
+# Run by the 'benchmark' target (see CMakeLists.txt): one headless replay run per upload path and shader
+# mode. Each run prints a single "bench: ..." line (fps, CPU ms per frame, GPU ms per frame).
+# Runs from the source directory so shaders, control_ini.txt and the test pattern are found.
+
+set(uploads copy pbo)
+set(modes
+  "--view-mode=0"
+  "--view-mode=0 --tile-mode=remap"
+  "--view-mode=0 --tile-mode=instanced"
+  "--view-mode=0 --crop-upload"
+  "--view-mode=0 --all-segments"
+  "--view-mode=1"
+  "--view-mode=2"
+  "--show-pattern")
+
+foreach(upload IN LISTS uploads)
+  foreach(mode IN LISTS modes)
+    separate_arguments(mode_args UNIX_COMMAND "${mode}")
+    execute_process(
+      COMMAND ${BENCH_EXE} --replay=${BENCH_REPLAY} --replay-size=${BENCH_SIZE} --replay-format=${BENCH_FORMAT}
+              --replay-fps=0 --headless --bench=${BENCH_FRAMES} --upload=${upload} ${mode_args}
+      RESULT_VARIABLE rc
+      OUTPUT_VARIABLE out
+      ERROR_VARIABLE err
+      OUTPUT_STRIP_TRAILING_WHITESPACE)
+    if(NOT rc EQUAL 0)
+      message(WARNING "benchmark --upload=${upload} ${mode} failed (${rc}):\n${err}")
+    else()
+      message(STATUS "${out}")
+    endif()
+  endforeach()
+endforeach()
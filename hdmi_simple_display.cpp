@@ -22,9 +22,15 @@
 #include <linux/videodev2.h>
 #include <poll.h>
 #include <algorithm>
+#ifdef HDMI_GLES
+#include <GLES3/gl3.h>
+#include <SDL2/SDL.h>
+#else
 #include <GL/glew.h>
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_opengl.h>
+#endif
+#include <SDL2/SDL_syswm.h>
 #include <sys/stat.h>
 #include <limits.h>
 #include <sstream>
@@ -36,15 +42,66 @@
 #include <cmath>
 #include <mutex>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <csignal>
+#include <ctime>
+
+#include "image_writer.h"
+#include "yuv_convert.h"
+#include "metrics_exporter.h"
+#include "text_overlay.h"
+
+#ifdef HDMI_HAVE_EGL_DMABUF
+#ifndef EGL_NO_X11
+#define EGL_NO_X11
+#endif
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#ifdef HDMI_HAVE_KMS
+#include "kms_backend.h"
+#endif
 
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb_image_write.h"
+#ifdef HDMI_HAVE_RGA
+#include "rga_offload.h"
+#endif
+
+#ifdef HDMI_HAVE_MPP
+#include "mpp_stream.h"
+#endif
 
 #define DEVICE "/dev/video0"
 #define DEFAULT_WIDTH 1920
 #define DEFAULT_HEIGHT 1080
+#ifdef HDMI_GLES
+#define WINDOW_TITLE "hdmi_simple_display (OpenGL ES YUV Shader)"
+#define VERT_SHADER_FILE "shader_es.vert.glsl"
+#define FRAG_SHADER_FILE "shader_es.frag.glsl"
+#define TILE_VERT_SHADER_FILE "shader_tile_es.vert.glsl"
+#define TILE_FRAG_SHADER_FILE "shader_tile_es.frag.glsl"
+#define OVERLAY_VERT_SHADER_FILE "shader_overlay_es.vert.glsl"
+#define OVERLAY_FRAG_SHADER_FILE "shader_overlay_es.frag.glsl"
+#else
 #define WINDOW_TITLE "hdmi_simple_display (OpenGL YUV Shader)"
-#define BUF_COUNT 4 // MMAP buffer count
+#define VERT_SHADER_FILE "shader.vert.glsl"
+#define FRAG_SHADER_FILE "shader.frag.glsl"
+#define TILE_VERT_SHADER_FILE "shader_tile.vert.glsl"
+#define TILE_FRAG_SHADER_FILE "shader_tile.frag.glsl"
+#define OVERLAY_VERT_SHADER_FILE "shader_overlay.vert.glsl"
+#define OVERLAY_FRAG_SHADER_FILE "shader_overlay.frag.glsl"
+#endif
+#define BUF_COUNT_DEFAULT 4 // MMAP buffer count
+#define BUF_COUNT_MIN 2
+#define BUF_COUNT_MAX 8
 
 static bool opt_auto_resize_window = false;
 static bool opt_cpu_uv_swap = false;
@@ -54,22 +111,405 @@ static int opt_use_bt709 = 1;
 static bool opt_verbose = false;
 static std::string opt_test_pattern_path;
 
+// How capture buffers reach texY/texUV: CPU copy via glTexSubImage2D, zero-copy DMABUF import, or a PBO ring.
+enum UploadMode { UPLOAD_COPY = 0, UPLOAD_DMABUF = 1, UPLOAD_PBO = 2 };
+static UploadMode opt_upload_mode = UPLOAD_COPY;
+static const char* const UPLOAD_MODE_NAMES[] = { "copy", "dmabuf", "pbo" };
+
+// Tile mapping: evaluated per fragment in the shader, looked up in a remap texture built on the CPU, or
+// one instanced quad per tile placed on the CPU (spacing and margins are never shaded).
+enum TileMode { TILE_SHADER = 0, TILE_REMAP = 1, TILE_INSTANCED = 2 };
+static TileMode opt_tile_mode = TILE_SHADER;
+static bool opt_crop_upload = false; // upload only the active segment's sub-block
+static bool opt_all_segments = false; // draw every segment into its own viewport each frame (one upload for the wall)
+static bool opt_render_on_demand = false; // draw/swap only when something visible changed
+
+// Capture queue: throughput dequeues one buffer per wakeup (frames may wait in the driver queue), latency
+// dequeues every ready buffer, requeues the stale ones at once and publishes only the newest.
+enum QueueMode { QUEUE_THROUGHPUT = 0, QUEUE_LATENCY = 1 };
+static QueueMode opt_queue_mode = QUEUE_THROUGHPUT;
+static unsigned opt_buffer_count = BUF_COUNT_DEFAULT; // BUF_COUNT_MIN..BUF_COUNT_MAX
+
+// Presentation: swap interval 1 (vsync), 0 (immediate, may tear), -1 (adaptive: late swaps tear instead of
+// waiting a refresh), or capture-locked (vsync, draws timed against the input frame period, see FramePacer).
+enum PresentMode { PRESENT_VSYNC = 0, PRESENT_IMMEDIATE = 1, PRESENT_ADAPTIVE = 2, PRESENT_CAPTURE = 3 };
+static PresentMode opt_present_mode = PRESENT_VSYNC;
+static const char* const PRESENT_MODE_NAMES[] = { "vsync", "immediate", "adaptive", "capture" };
+
+// Where the picture goes: an SDL window (development, X11/Wayland) or straight to KMS/DRM (no compositor).
+enum OutputBackend { OUTPUT_SDL = 0, OUTPUT_KMS = 1 };
+static OutputBackend opt_output = OUTPUT_SDL;
+static std::string opt_kms_device = "/dev/dri/card0";
+static bool opt_kms_overlay = false; // scan the capture buffer out on an overlay plane when the layout allows it
+static int opt_stats_interval_s = 0;  // --stats: log pipeline latencies every N seconds (0 = off)
+static bool opt_profile_overlay = false; // --profile: GPU/CPU ms and fps drawn over the picture (key 'p')
+static int opt_profile_sweep_frames = 0; // --profile-sweep: measured frames per configuration, then exit (0 = off)
+static std::string opt_device = DEVICE;
+// Capture formats by preference (--capture-formats / captureFormats): the first one VIDIOC_ENUM_FMT offers
+// wins, so a source that can do 4:2:0 is not streamed at twice the chroma bandwidth as NV24.
+static std::vector<uint32_t> opt_capture_formats = { V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_NV16, V4L2_PIX_FMT_NV24, V4L2_PIX_FMT_YUYV };
+
+// --replay: frames from a raw file (or generated in memory) instead of the capture device
+static std::string opt_replay_path;   // empty = V4L2, "synthetic" = generated frames
+static uint32_t opt_replay_width = 3840, opt_replay_height = 2160;
+static uint32_t opt_replay_pixfmt = V4L2_PIX_FMT_NV24;
+static int opt_replay_fps = 60;       // 0 = next frame as soon as the previous one was taken
+// --headless: render into an offscreen FBO (SDL offscreen driver, hidden window), nothing is shown
+static bool opt_headless = false;
+static int opt_headless_width = 1920, opt_headless_height = 1080;
+static int opt_bench_frames = 0;      // --bench=N: print fps and CPU/GPU time per frame after N frames, then exit
+static int opt_view_mode = 0;         // initial view_mode (0 = picture, 1/2 = debug views)
+static int opt_rotation = 0;          // initial rotation in quarter turns ('r' turns by 180 degrees)
+static bool opt_show_pattern = false; // start with the test pattern forced on (as if 't' was pressed)
+// screenshots ('s' = input frame, 'c' = rendered output): encoder, directory, frames per 'c'
+static ImageFormat opt_screenshot_format = ImageFormat::PNG;
+static std::string opt_screenshot_dir = ".";
+static int opt_capture_burst = 1;
+static std::string opt_metrics_listen; // --metrics: Prometheus endpoint, empty = off
+static bool opt_shader_cache = true;
+static std::string opt_shader_cache_dir; // --shader-cache=DIR, empty = $XDG_CACHE_HOME (~/.cache)/hdmi-in-display
+// --rga: crop/rotate/mirror/subsample on the RGA into a second DMABUF pool before the GPU sees the frame
+static bool opt_rga = false;
+static uint32_t opt_rga_pixfmt = V4L2_PIX_FMT_NV12;
+static std::string opt_rga_heap; // dma-heap for the RGA output pool, empty = first suitable one
+// --stream: hardware-encoded monitoring stream of the rendered output as RTP over UDP (mpp_stream.h)
+static std::string opt_stream_dest; // HOST:PORT, empty = off
+static int opt_stream_width = 960, opt_stream_height = 540, opt_stream_fps = 10, opt_stream_bitrate_kbps = 2000;
+static bool opt_stream_hevc = false;
+static std::string opt_stream_sdp;  // where the SDP description is written, empty = log only
+
+// capture buffers are exported as DMABUF fds for GPU import, overlay scanout and the RGA
+static inline bool want_dmabuf_export() { return opt_upload_mode == UPLOAD_DMABUF || opt_kms_overlay || opt_rga; }
+
+// SIGINT/SIGTERM: set the flag and wake the render loop (SDL's own handler only queues an SDL_QUIT,
+// which nothing would wake up for)
+static volatile sig_atomic_t quit_signal_received = 0;
+static volatile sig_atomic_t quit_signal_efd = -1;
+static void on_quit_signal(int) {
+    int saved = errno; uint64_t one = 1;
+    quit_signal_received = 1;
+    if (quit_signal_efd >= 0) { ssize_t r = write(quit_signal_efd, &one, sizeof(one)); (void)r; }
+    errno = saved;
+}
+
 static const bool ENABLE_SHADER_TEST_PATTERN = true;
 static const int PATTERN_TIMEOUT_MS = 800;
 static const int RECOVERY_GRACE_MS = 3000;
 static const int QBUF_RETRIES = 5;
 static const int QBUF_RETRY_MS = 10;
-static const int EINVAL_RESTART_THRESHOLD = 8;
-static const int STREAM_RESTART_RETRIES = 3;
-static const int STREAM_RESTART_BACKOFF_MS = 150;
 
-// Verification/retry parameters for background reopen
-static const int BG_REOPEN_VERIFY_MAX_ATTEMPTS = 6;
-static const int BG_REOPEN_VERIFY_POLL_MS = 200; // poll fd to check frames
+// Signal recovery (capture thread): retries back off exponentially from RECOVER_BACKOFF_MIN_MS. Without a
+// locked signal the DV timings are re-queried at most every RECOVER_QUERY_MAX_MS (SOURCE_CHANGE usually
+// comes first); a device that fails outright is reopened at most every RECOVER_BACKOFF_MAX_MS.
+static const int RECOVER_BACKOFF_MIN_MS = 20;
+static const int RECOVER_QUERY_MAX_MS = 100;
+static const int RECOVER_BACKOFF_MAX_MS = 2000;
+static const int RECOVER_FIRST_FRAME_MS = 500; // streaming again but no frame this long: try again
+
+// Render loop: windows whose input has no fd to wait on (anything but X11) are pumped this often; GPU
+// work the loop polls without an event (output readbacks, retiring DMABUF images) this often.
+static const int INPUT_POLL_MS = 10;
+static const int FENCE_POLL_MS = 2;
 
 static inline void vlog(const std::string &s) { if (opt_verbose) std::cerr << s; }
 static inline void vlogln(const std::string &s) { if (opt_verbose) std::cerr << s << std::endl; }
 
+static inline int64_t steady_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+// same clock (CLOCK_MONOTONIC) as V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC buffer timestamps
+static inline int64_t steady_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+// CPU time consumed so far (CLOCK_THREAD_CPUTIME_ID / CLOCK_PROCESS_CPUTIME_ID), for --bench
+static inline int64_t cpu_time_us(clockid_t clock) {
+    timespec ts; if (clock_gettime(clock, &ts) != 0) return 0;
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Single-producer/single-consumer ring of frame tokens (no locks, no allocation).
+template<size_t N> struct SpscRing {
+    int64_t slots[N];
+    std::atomic<size_t> head{0}, tail{0};
+    bool push(int64_t v) {
+        size_t h = head.load(std::memory_order_relaxed), next = (h + 1) % N;
+        if (next == tail.load(std::memory_order_acquire)) return false;
+        slots[h] = v; head.store(next, std::memory_order_release);
+        return true;
+    }
+    bool pop(int64_t &v) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) return false;
+        v = slots[t]; tail.store((t + 1) % N, std::memory_order_release);
+        return true;
+    }
+};
+
+// What the capture thread knows about a dequeued buffer; read by the render thread after acquiring its token.
+struct CapturedFrame {
+    unsigned num_planes = 0;
+    size_t bytesused0 = 0;
+    uint32_t width = 0, height = 0, pixfmt = 0;
+    uint32_t sequence = 0;
+    int64_t capture_us = 0; // driver timestamp (0 if not monotonic)
+    int64_t dqbuf_us = 0;   // when VIDIOC_DQBUF returned
+    // --rga: the frame was converted into RGA output 'index' (width/height/pixfmt describe that buffer),
+    // showing the full input or only the active segment, with only flip_y (or nothing) left for the shader
+    bool rga = false, rga_full = false;
+    int rga_flip_y = 1;
+    uint32_t source_pixfmt = 0; // capture format
+};
+
+// Capture -> render handoff. 'latest' holds the newest dequeued buffer (newest wins, older ones are
+// requeued by the capture thread); consumed buffers come back through 'returned'. Tokens carry the
+// buffer generation so frames published before a stream restart are never touched again.
+struct FrameHandoff {
+    CapturedFrame meta[VIDEO_MAX_FRAME];
+    std::atomic<int64_t> latest{-1};
+    SpscRing<VIDEO_MAX_FRAME + 1> returned;
+    std::atomic<uint32_t> generation{0};
+    int render_efd = -1;   // wakes the render thread (new frame / state change)
+    int capture_efd = -1;  // wakes the capture thread (buffer returned / reopen request / quit)
+
+    // buffer release handshake: capture thread asks, render thread drops GPU references and acks
+    std::atomic<bool> release_requested{false};
+    std::mutex release_mutex;
+    std::condition_variable release_cv;
+    bool released = false;
+    // drop counters (sequence gaps, superseded, stale) live in PipelineMetrics
+
+    static int64_t make_token(uint32_t gen, unsigned index) { return ((int64_t)gen << 16) | (int64_t)(index & 0xFFFF); }
+    static unsigned token_index(int64_t token) { return (unsigned)(token & 0xFFFF); }
+    static uint32_t token_generation(int64_t token) { return (uint32_t)(token >> 16); }
+    static void signal(int efd) { uint64_t one = 1; if (efd >= 0) { ssize_t r = write(efd, &one, sizeof(one)); (void)r; } }
+    static void drain(int efd) { uint64_t v; while (read(efd, &v, sizeof(v)) > 0) {} }
+};
+
+// Render thread reactor: one epoll set over the wake eventfd (capture thread, config watcher, signals),
+// a timerfd for the next deadline (pattern timeout, recovery grace, --stats) and the KMS / window input
+// fds. wait() returns the sources that fired; the timer is drained here, eventfds by their owners.
+class EventLoop {
+public:
+    enum Source { SRC_WAKE = 1, SRC_TIMER = 2, SRC_KMS = 4, SRC_INPUT = 8 };
+
+    bool open() {
+        epfd_ = epoll_create1(EPOLL_CLOEXEC);
+        tfd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        return epfd_ >= 0 && tfd_ >= 0 && add(tfd_, SRC_TIMER);
+    }
+    bool add(int fd, Source src) {
+        struct epoll_event ev; memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN; ev.data.u32 = src;
+        return fd >= 0 && epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) == 0;
+    }
+    // SRC_TIMER once steady_ms() reaches deadline_ms (steady_clock is CLOCK_MONOTONIC); 0 = none
+    void arm(int64_t deadline_ms) {
+        if (deadline_ms == armed_ms_) return;
+        struct itimerspec its; memset(&its, 0, sizeof(its));
+        if (deadline_ms > 0) { its.it_value.tv_sec = deadline_ms / 1000; its.it_value.tv_nsec = (long)(deadline_ms % 1000) * 1000000L; }
+        if (timerfd_settime(tfd_, TFD_TIMER_ABSTIME, &its, nullptr) == 0) armed_ms_ = deadline_ms;
+    }
+    // Block for at most timeout_ms (-1 = until a source fires). SRC_* bits, 0 on timeout / EINTR, -1 on error.
+    int wait(int timeout_ms) {
+        struct epoll_event ev[4];
+        int n = epoll_wait(epfd_, ev, 4, timeout_ms);
+        if (n < 0) return errno == EINTR ? 0 : -1;
+        int fired = 0;
+        for (int i = 0; i < n; ++i) fired |= (int)ev[i].data.u32;
+        if (fired & SRC_TIMER) { uint64_t v; while (read(tfd_, &v, sizeof(v)) > 0) {} armed_ms_ = 0; }
+        return fired;
+    }
+    void close_fds() {
+        if (tfd_ >= 0) close(tfd_);
+        if (epfd_ >= 0) close(epfd_);
+        tfd_ = epfd_ = -1;
+    }
+
+private:
+    int epfd_ = -1, tfd_ = -1;
+    int64_t armed_ms_ = 0;
+};
+
+// fd the window system delivers input on, -1 if SDL does not expose one (the loop then pumps SDL every INPUT_POLL_MS)
+static int sdl_input_fd(SDL_Window* win) {
+#if defined(SDL_VIDEO_DRIVER_X11)
+    SDL_SysWMinfo info; SDL_VERSION(&info.version);
+    if (win && SDL_GetWindowWMInfo(win, &info) && info.subsystem == SDL_SYSWM_X11) return ConnectionNumber(info.info.x11.display);
+#else
+    (void)win;
+#endif
+    return -1;
+}
+
+// Last N samples of one pipeline stage (microseconds) for the --stats percentiles.
+struct LatencyWindow {
+    static const size_t N = 1024;
+    int64_t v[N];
+    size_t n = 0, head = 0;
+    int64_t sum = 0; uint64_t count = 0; // all samples, for the --bench means
+    void add(int64_t us) { v[head] = us; head = (head + 1) % N; if (n < N) ++n; sum += us; ++count; }
+    double mean_ms() const { return count ? (double)sum / (double)count / 1000.0 : 0.0; }
+    // mean of the newest k samples (the --profile overlay's rolling values)
+    double recent_mean_ms(size_t k) const {
+        k = std::min(k, n);
+        if (k == 0) return 0.0;
+        int64_t t = 0;
+        for (size_t i = 1; i <= k; ++i) t += v[(head + N - i) % N];
+        return (double)t / (double)k / 1000.0;
+    }
+    std::string summary() const {
+        if (n == 0) return "-";
+        std::vector<int64_t> s(v, v + n);
+        auto at = [&](size_t k) { std::nth_element(s.begin(), s.begin() + k, s.end()); return s[k]; };
+        char buf[64];
+        int64_t p50 = at(n / 2), p99 = at(std::min(n - 1, n * 99 / 100)), mx = *std::max_element(s.begin(), s.end());
+        snprintf(buf, sizeof(buf), "%.1f/%.1f/%.1f", p50 / 1000.0, p99 / 1000.0, mx / 1000.0);
+        return buf;
+    }
+};
+
+// Per-stage latencies of shown frames: capture timestamp -> DQBUF -> upload done -> swap returned.
+struct PipelineStats {
+    LatencyWindow driver;   // capture timestamp -> DQBUF
+    LatencyWindow upload;   // DQBUF -> upload/bind done (includes waiting in the handoff slot)
+    LatencyWindow gpu;      // GL_TIME_ELAPSED of the upload commands
+    LatencyWindow gpu_draw; // GL_TIME_ELAPSED of clear + draw
+    LatencyWindow gpu_overlay; // GL_TIME_ELAPSED of the --profile overlay
+    LatencyWindow cpu;      // render thread CPU time per present (--profile)
+    LatencyWindow present;  // upload done -> swap returned
+    LatencyWindow total;    // capture timestamp (or DQBUF) -> swap returned
+    uint64_t shown = 0, last_gaps = 0, last_superseded = 0, last_stale = 0, last_held = 0;
+    int64_t last_report_ms = 0;
+    // frame waiting for its swap
+    bool pending = false;
+    int64_t capture_us = 0, dqbuf_us = 0, upload_us = 0;
+};
+
+// --present-mode=capture: running estimates of the input frame period (capture timestamps of the frames
+// taken), the display refresh period and vblank phase (swaps that blocked, or KMS page-flip timestamps)
+// and the CPU time from taking a frame to submitting it. From these pacer_hold() decides whether a frame
+// waiting in the handoff slot is drawn now or held until the latest point that still makes the next
+// vblank: only when another frame is due before that point, which then replaces it. Presentation stays
+// on vsync, so nothing tears; late frames still wait for the following refresh.
+struct FramePacer {
+    double input_period_us = 0, refresh_us = 0, draw_us = 0; // 0 = no estimate yet
+    double arrival_lag_us = 0;     // capture timestamp -> published (driver + DQBUF)
+    int input_rejected = 0, refresh_rejected = 0; // outliers in a row; many mean the rate changed
+    int64_t last_capture_us = 0; uint32_t last_sequence = 0;
+    int64_t last_vblank_us = 0;
+    int64_t presented_for_us = 0;  // vblank the last present was drawn for
+    int64_t hold_until_us = 0;     // latch point of the current hold, 0 = none
+    uint64_t held = 0;             // frames left in the slot for a newer one
+};
+
+static const int64_t PACE_MARGIN_US = 1500; // slack on top of the measured draw time before a vblank
+static const int64_t SWAP_BLOCKED_US = 1000; // a swap taking longer waited for a vblank
+
+static void pacer_ewma(double &v, double sample) { v = v == 0 ? sample : v + (sample - v) / 16.0; }
+// EWMA that skips samples off by more than 'tolerance' (relative), unless 8 in a row are: then re-lock
+static void pacer_track(double &est, int &rejected, double sample, double tolerance) {
+    if (est == 0 || std::fabs(sample - est) < est * tolerance) { pacer_ewma(est, sample); rejected = 0; }
+    else if (++rejected >= 8) { est = sample; rejected = 0; }
+}
+
+// a frame was taken from the handoff slot
+static void pacer_frame(FramePacer &p, int64_t capture_us, int64_t dqbuf_us, uint32_t sequence) {
+    int64_t t = capture_us > 0 ? capture_us : dqbuf_us;
+    pacer_ewma(p.arrival_lag_us, (double)std::max<int64_t>(dqbuf_us - t, 0));
+    uint32_t n = sequence - p.last_sequence;
+    // frames superseded in between are still whole periods; a gap of many frames is a stall, not a rate
+    if (p.last_capture_us > 0 && t > p.last_capture_us && n >= 1 && n <= 8)
+        pacer_track(p.input_period_us, p.input_rejected, (double)(t - p.last_capture_us) / n, 0.25);
+    p.last_capture_us = t; p.last_sequence = sequence;
+}
+
+// a vblank happened at 't' (flip event, or a swap that blocked until it); 'nominal_us' seeds the period
+static void pacer_vblank(FramePacer &p, int64_t t, double nominal_us) {
+    if (p.refresh_us == 0) p.refresh_us = nominal_us;
+    if (p.last_vblank_us > 0 && p.refresh_us > 0 && t > p.last_vblank_us) {
+        double n = std::max(std::round((t - p.last_vblank_us) / p.refresh_us), 1.0);
+        if (n <= 8) pacer_track(p.refresh_us, p.refresh_rejected, (t - p.last_vblank_us) / n, 0.125);
+    }
+    p.last_vblank_us = t;
+}
+
+// first vblank at or after 't' (0 while the phase is unknown)
+static int64_t pacer_next_vblank(const FramePacer &p, int64_t t) {
+    if (p.last_vblank_us <= 0 || p.refresh_us <= 0) return 0;
+    if (t <= p.last_vblank_us) return p.last_vblank_us;
+    return p.last_vblank_us + (int64_t)(std::ceil((t - p.last_vblank_us) / p.refresh_us) * p.refresh_us);
+}
+
+// 0 = draw now, otherwise hold the slot frame (and deferred redraws) until this steady_us() time
+static int64_t pacer_hold(FramePacer &p, int64_t now) {
+    if (p.hold_until_us > 0) {
+        if (now < p.hold_until_us) return p.hold_until_us;
+        p.hold_until_us = 0;
+        return 0; // latch point reached: draw whatever is newest
+    }
+    if (p.input_period_us <= 0 || p.last_capture_us <= 0) return 0;
+    int64_t budget = (int64_t)(p.draw_us * 1.25) + PACE_MARGIN_US;
+    int64_t v = pacer_next_vblank(p, now + budget);
+    if (v == 0) return 0;
+    if (p.presented_for_us > 0 && v - p.presented_for_us < (int64_t)(p.refresh_us / 2)) v += (int64_t)p.refresh_us; // one present per refresh
+    int64_t latch = v - budget;
+    // next frame after the one in the slot, as the render thread will see it
+    int64_t due = p.last_capture_us + (int64_t)p.arrival_lag_us;
+    if (due <= now) due += (int64_t)(std::ceil((now - due) / p.input_period_us + 1e-6) * p.input_period_us);
+    if (due + PACE_MARGIN_US > latch) return 0;
+    return p.hold_until_us = latch;
+}
+
+// the frame drawn at 'start' (taken from the slot, or a redraw) is about to be submitted
+static void pacer_presenting(FramePacer &p, int64_t start, int64_t now) {
+    pacer_ewma(p.draw_us, (double)(now - start));
+    p.presented_for_us = pacer_next_vblank(p, now);
+    p.hold_until_us = 0;
+}
+
+// GPU passes timed per frame (--stats, --profile); a new pass gets an entry here and a begin/end pair
+enum GpuPass { GPU_PASS_UPLOAD, GPU_PASS_DRAW, GPU_PASS_OVERLAY, GPU_PASS_COUNT };
+
+#ifndef HDMI_GLES
+// Small ring of GL_TIME_ELAPSED queries around one stage (uploads, draw); results are collected frames
+// later so reading them never stalls the pipeline. Stages are timed one after the other, never nested.
+// (GLES 3.0 has no timer queries.)
+struct GpuTimer {
+    static const int N = 4;
+    GLuint q[N] = {0, 0, 0, 0};
+    bool busy[N] = {false, false, false, false};
+    int cur = -1, next = 0;
+    bool ok = false;
+};
+
+static void gpu_timer_init(GpuTimer &t) {
+    t.ok = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+    if (t.ok) glGenQueries(GpuTimer::N, t.q);
+}
+static void gpu_timer_begin(GpuTimer &t) {
+    t.cur = -1;
+    if (!t.ok || t.busy[t.next]) return; // previous result not collected yet: skip this frame
+    t.cur = t.next; t.next = (t.next + 1) % GpuTimer::N;
+    glBeginQuery(GL_TIME_ELAPSED, t.q[t.cur]);
+}
+static void gpu_timer_end(GpuTimer &t) {
+    if (t.cur < 0) return;
+    glEndQuery(GL_TIME_ELAPSED);
+    t.busy[t.cur] = true; t.cur = -1;
+}
+static void gpu_timer_collect(GpuTimer &t, LatencyWindow &w, MetricsHistogram *h = nullptr) {
+    for (int i = 0; i < GpuTimer::N; ++i) {
+        if (!t.busy[i]) continue;
+        GLint avail = 0; glGetQueryObjectiv(t.q[i], GL_QUERY_RESULT_AVAILABLE, &avail);
+        if (!avail) continue;
+        GLuint64 ns = 0; glGetQueryObjectui64v(t.q[i], GL_QUERY_RESULT, &ns);
+        w.add((int64_t)(ns / 1000)); t.busy[i] = false;
+        if (h) h->observe_us((int64_t)(ns / 1000));
+    }
+}
+static void gpu_timer_release(GpuTimer &t) { if (t.ok) glDeleteQueries(GpuTimer::N, t.q); t.ok = false; }
+#endif
+
 std::string loadShaderSource(const char* filename) {
     std::ifstream file(filename);
     return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
@@ -96,14 +536,99 @@ GLuint compileShader(const std::string& source, GLenum type) {
     return shader;
 }
 
+// Program binary cache (--shader-cache): compiling and linking the fragment shaders is a large part of
+// startup on Mali/panfrost, so linked programs are stored as glGetProgramBinary blobs. The file name hashes
+// the driver strings and both sources, so an edited shader or a driver update just misses; a blob the
+// driver rejects anyway is relinked from source and overwritten.
+static const char PROGRAM_CACHE_MAGIC[8] = { 'H','D','M','I','P','B','1','\0' };
+
+#ifndef HDMI_GLES
+static bool gl_program_binary_supported() { return GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary; }
+#else
+static bool gl_program_binary_supported() { return true; } // core in ES 3.0
+#endif
+
+static uint64_t fnv1a64(const std::string &s, uint64_t h = 1469598103934665603ULL) {
+    for (unsigned char c : s) { h ^= c; h *= 1099511628211ULL; }
+    return h;
+}
+
+// mkdir -p
+static bool make_dirs(const std::string &dir) {
+    for (size_t i = 1; i <= dir.size(); ++i) {
+        if (i < dir.size() && dir[i] != '/') continue;
+        if (mkdir(dir.substr(0, i).c_str(), 0755) != 0 && errno != EEXIST) return false;
+    }
+    return true;
+}
+
+// cache file for this source pair on the current driver, empty = cache off or unsupported
+static std::string program_cache_path(const std::string &vert_source, const std::string &frag_source) {
+    if (!opt_shader_cache || !gl_program_binary_supported()) return "";
+    GLint formats = 0; glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    if (formats <= 0) return "";
+    std::string dir = opt_shader_cache_dir;
+    if (dir.empty()) {
+        const char *xdg = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+        if (xdg && *xdg) dir = std::string(xdg) + "/hdmi-in-display";
+        else if (home && *home) dir = std::string(home) + "/.cache/hdmi-in-display";
+        else return "";
+    }
+    std::string key;
+    for (GLenum e : { GL_VENDOR, GL_RENDERER, GL_VERSION }) { const GLubyte *v = glGetString(e); key += v ? (const char*)v : ""; key += '\n'; }
+    key += vert_source; key += '\0'; key += frag_source;
+    char name[32]; snprintf(name, sizeof(name), "/%016llx.bin", (unsigned long long)fnv1a64(key));
+    return dir + name;
+}
+
+static GLuint program_cache_load(const std::string &path) {
+    std::ifstream f(path, std::ios::binary);
+    if (!f) return 0;
+    std::string blob((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+    const size_t hdr = sizeof(PROGRAM_CACHE_MAGIC) + sizeof(uint32_t);
+    if (blob.size() <= hdr || memcmp(blob.data(), PROGRAM_CACHE_MAGIC, sizeof(PROGRAM_CACHE_MAGIC)) != 0) return 0;
+    uint32_t format = 0; memcpy(&format, blob.data() + sizeof(PROGRAM_CACHE_MAGIC), sizeof(format));
+    GLuint prog = glCreateProgram();
+    glProgramBinary(prog, (GLenum)format, blob.data() + hdr, (GLsizei)(blob.size() - hdr));
+    GLint status = 0; glGetProgramiv(prog, GL_LINK_STATUS, &status);
+    if (!status) { glDeleteProgram(prog); vlogln("shader cache: " + path + " rejected by the driver, relinking"); return 0; }
+    return prog;
+}
+
+// written to a temporary name and renamed, so a concurrent instance never reads half a blob
+static void program_cache_store(GLuint prog, const std::string &path) {
+    GLint len = 0; glGetProgramiv(prog, GL_PROGRAM_BINARY_LENGTH, &len);
+    if (len <= 0) return;
+    const size_t hdr = sizeof(PROGRAM_CACHE_MAGIC) + sizeof(uint32_t);
+    std::string blob(hdr + (size_t)len, '\0');
+    GLsizei got = 0; GLenum format = 0;
+    glGetProgramBinary(prog, len, &got, &format, &blob[hdr]);
+    if (got <= 0) return;
+    blob.resize(hdr + (size_t)got);
+    uint32_t f32 = format;
+    memcpy(&blob[0], PROGRAM_CACHE_MAGIC, sizeof(PROGRAM_CACHE_MAGIC)); memcpy(&blob[sizeof(PROGRAM_CACHE_MAGIC)], &f32, sizeof(f32));
+    if (!make_dirs(path.substr(0, path.rfind('/')))) { vlogln("shader cache: cannot create directory for " + path + ": " + strerror(errno)); return; }
+    std::string tmp = path + "." + std::to_string(getpid());
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out.write(blob.data(), (std::streamsize)blob.size())) { vlogln("shader cache: cannot write " + tmp); out.close(); unlink(tmp.c_str()); return; }
+    }
+    if (rename(tmp.c_str(), path.c_str()) != 0) { vlogln("shader cache: cannot store " + path + ": " + strerror(errno)); unlink(tmp.c_str()); }
+}
+
 GLuint createShaderProgram(const char* vert_path, const char* frag_path) {
     auto vert_source = loadShaderSource(vert_path);
     auto frag_source = loadShaderSource(frag_path);
+    const std::string cache_path = program_cache_path(vert_source, frag_source);
+    if (!cache_path.empty()) {
+        if (GLuint cached = program_cache_load(cache_path)) { vlogln(std::string("shader cache: ") + frag_path + " loaded from " + cache_path); return cached; }
+    }
     GLuint vert = compileShader(vert_source, GL_VERTEX_SHADER);
     GLuint frag = compileShader(frag_source, GL_FRAGMENT_SHADER);
     GLuint prog = glCreateProgram();
     glAttachShader(prog, vert);
     glAttachShader(prog, frag);
+    if (!cache_path.empty()) glProgramParameteri(prog, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glLinkProgram(prog);
     GLint status; glGetProgramiv(prog, GL_LINK_STATUS, &status);
     if (!status) {
@@ -113,10 +638,190 @@ GLuint createShaderProgram(const char* vert_path, const char* frag_path) {
         exit(EXIT_FAILURE);
     }
     glDeleteShader(vert); glDeleteShader(frag);
+    if (!cache_path.empty()) program_cache_store(prog, cache_path);
     return prog;
 }
 
-struct PlaneMap { void* addr; size_t length; };
+struct PlaneMap { void* addr; size_t length; int dmabuf_fd = -1; uint32_t stride = 0; }; // stride: bytesperline, 0 = tightly packed
+
+// How the GL path (and the overlay) treats a capture format. Semi-planar: R8 luma plus RG8 chroma, the
+// chroma plane subsampled by 1 << x_shift / 1 << y_shift. Packed 4:2:2 (YUYV/UYVY): the one plane is an
+// RG8 luma texture and, at half width, an RGBA8 chroma texture; texture swizzles pick Y and Cb,Cr out of
+// them, so the shaders sample every format the same way.
+struct PixelLayout {
+    bool supported = false, packed = false;
+    bool vu = false; // chroma stored Cr,Cb
+    int x_shift = 0, y_shift = 0;
+};
+
+static PixelLayout pixel_layout(uint32_t pixfmt) {
+    PixelLayout l; l.supported = true;
+    switch (pixfmt) {
+    case V4L2_PIX_FMT_NV12: l.x_shift = l.y_shift = 1; break;
+    case V4L2_PIX_FMT_NV21: l.x_shift = l.y_shift = 1; l.vu = true; break;
+    case V4L2_PIX_FMT_NV16: l.x_shift = 1; break;
+    case V4L2_PIX_FMT_NV61: l.x_shift = 1; l.vu = true; break;
+    case V4L2_PIX_FMT_NV24: break;
+    case V4L2_PIX_FMT_NV42: l.vu = true; break;
+    case V4L2_PIX_FMT_YUYV: case V4L2_PIX_FMT_UYVY: l.packed = true; l.x_shift = 1; break;
+    default: l.supported = false; break;
+    }
+    return l;
+}
+
+// Row pitch of the luma (packed: the only) plane, from bytesperline or tightly packed
+static size_t luma_stride(const PixelLayout &l, const PlaneMap &plane, uint32_t width) {
+    return plane.stride ? plane.stride : (l.packed ? (size_t)width * 2 : (size_t)width);
+}
+// Chroma row pitch; single-plane semi-planar formats derive it from the luma pitch, as V4L2 does
+static size_t chroma_stride(const PixelLayout &l, const std::vector<PlaneMap> &planes, unsigned num_planes, size_t y_stride) {
+    if (num_planes >= 2 && planes.size() >= 2 && planes[1].stride) return planes[1].stride;
+    return l.x_shift ? y_stride : y_stride * 2;
+}
+
+// Where the planes of a frame are at the driver's bytesperline. Packed 4:2:2 has one plane that feeds both
+// textures (RG8 luma and half-width RGBA8 chroma), so there uvbase == ybase; uvbase is null when a
+// single-plane semi-planar frame is too short to hold the chroma.
+struct FramePlanes {
+    unsigned char *ybase = nullptr, *uvbase = nullptr;
+    size_t y_stride = 0, uv_stride = 0, Y_len = 0, UV_len = 0;
+    bool two_planes = false;
+};
+static FramePlanes frame_planes(const PixelLayout &lay, const std::vector<PlaneMap> &planes, unsigned num_planes, size_t bytesused0, uint32_t width, uint32_t height) {
+    FramePlanes f;
+    unsigned char* base = planes.empty() ? nullptr : (unsigned char*)planes[0].addr;
+    f.two_planes = num_planes >= 2 && planes.size() >= 2;
+    if (planes.empty()) return f;
+    f.y_stride = luma_stride(lay, planes[0], width);
+    f.uv_stride = lay.packed ? f.y_stride : chroma_stride(lay, planes, num_planes, f.y_stride);
+    f.Y_len = f.y_stride * (size_t)height;
+    f.UV_len = lay.packed ? 0 : f.uv_stride * (size_t)(height >> lay.y_shift);
+    if (!lay.supported || !base) {
+        // no texture layout for this fourcc (warned when it was negotiated)
+    } else if (lay.packed) {
+        f.ybase = f.uvbase = base;
+    } else if (f.two_planes) {
+        f.ybase = base; f.uvbase = (unsigned char*)planes[1].addr;
+    } else if (bytesused0 >= f.Y_len + f.UV_len) {
+        f.ybase = base; f.uvbase = base + f.Y_len;
+    } else f.ybase = base;
+    return f;
+}
+
+// munmap all planes and close exported DMABUF fds (EGL images keep their own reference)
+static void unmap_buffers(std::vector<std::vector<PlaneMap>> &buffers) {
+    for (auto &bvec : buffers) {
+        for (auto &pm : bvec) {
+            if (pm.addr && pm.length) { munmap(pm.addr, pm.length); pm.addr=nullptr; pm.length=0; }
+            if (pm.dmabuf_fd >= 0) { close(pm.dmabuf_fd); pm.dmabuf_fd = -1; }
+        }
+    }
+}
+
+// Export every plane of every capture buffer once via VIDIOC_EXPBUF (V4L2-only, safe off the GL thread).
+static bool export_dmabufs(int fd, std::vector<std::vector<PlaneMap>> &buffers) {
+    for (unsigned i=0;i<buffers.size();++i) {
+        for (unsigned p=0;p<buffers[i].size();++p) {
+            if (buffers[i][p].dmabuf_fd >= 0) continue;
+            v4l2_exportbuffer exp; memset(&exp,0,sizeof(exp));
+            exp.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE; exp.index = i; exp.plane = p; exp.flags = O_RDONLY | O_CLOEXEC;
+            if (xioctl(fd, VIDIOC_EXPBUF, &exp) < 0) {
+                vlogln(std::string("export_dmabufs: VIDIOC_EXPBUF failed: ") + strerror(errno));
+                for (auto &bvec : buffers) for (auto &pm : bvec) if (pm.dmabuf_fd >= 0) { close(pm.dmabuf_fd); pm.dmabuf_fd = -1; }
+                return false;
+            }
+            buffers[i][p].dmabuf_fd = exp.fd;
+        }
+    }
+    return true;
+}
+
+std::string fourcc_to_str(uint32_t f);
+
+// --replay source: a read-only mapping of the recorded file (or of generated frames) plus the frame
+// geometry. The capture thread copies one frame per tick into one of opt_buffer_count anonymous buffers that
+// stand in for the driver's DMA, so the render thread sees the same single-plane buffers as with V4L2.
+struct ReplaySource {
+    const unsigned char* frames = nullptr;
+    size_t map_size = 0;
+    size_t frame_bytes = 0, frame_count = 0;
+    uint32_t width = 0, height = 0, pixfmt = 0;
+};
+
+static size_t replay_frame_bytes(uint32_t w, uint32_t h, uint32_t pixfmt) {
+    return yuv_frame_size(pixfmt, (int)w, (int)h);
+}
+
+// moving diagonal luma ramp over a slow chroma sweep, so consecutive frames differ
+static void replay_synthesize(unsigned char* dst, uint32_t w, uint32_t h, uint32_t pixfmt, unsigned frame) {
+    const PixelLayout l = pixel_layout(pixfmt);
+    uint32_t cw = w >> l.x_shift, ch = h >> l.y_shift;
+    auto luma = [&](uint32_t x, uint32_t y) { return (unsigned char)(16 + (x + y + frame * 8) % 220); };
+    auto cb = [&](uint32_t x) { return (unsigned char)(80 + (x * 96 / cw + frame * 4) % 96); };
+    auto cr = [&](uint32_t y) { return (unsigned char)(80 + (y * 96 / ch + frame * 4) % 96); };
+    if (l.packed) {
+        bool uyvy = pixfmt == V4L2_PIX_FMT_UYVY;
+        for (uint32_t y = 0; y < h; ++y) {
+            unsigned char* row = dst + (size_t)y * w * 2;
+            for (uint32_t x = 0; x < cw; ++x) {
+                unsigned char y0 = luma(x*2, y), y1 = luma(x*2+1, y), u = cb(x), v = cr(y);
+                unsigned char* px = row + (size_t)x * 4;
+                if (uyvy) { px[0] = u; px[1] = y0; px[2] = v; px[3] = y1; }
+                else { px[0] = y0; px[1] = u; px[2] = y1; px[3] = v; }
+            }
+        }
+        return;
+    }
+    for (uint32_t y = 0; y < h; ++y) {
+        unsigned char* row = dst + (size_t)y * w;
+        for (uint32_t x = 0; x < w; ++x) row[x] = luma(x, y);
+    }
+    unsigned char* uv = dst + (size_t)w * h;
+    for (uint32_t y = 0; y < ch; ++y) {
+        unsigned char* row = uv + (size_t)y * cw * 2;
+        for (uint32_t x = 0; x < cw; ++x) { row[x*2+0] = cb(x); row[x*2+1] = cr(y); }
+    }
+}
+
+static void replay_close(ReplaySource &r) {
+    if (r.frames) munmap((void*)r.frames, r.map_size);
+    r.frames = nullptr; r.map_size = 0; r.frame_count = 0;
+}
+
+// Map the replay file ("synthetic": generate a short loop) and allocate the stand-in capture buffers.
+static bool replay_open(ReplaySource &r, const std::string &path, uint32_t w, uint32_t h, uint32_t pixfmt,
+                        std::vector<std::vector<PlaneMap>> &buffers) {
+    r.width = w; r.height = h; r.pixfmt = pixfmt;
+    r.frame_bytes = replay_frame_bytes(w, h, pixfmt);
+    if (path == "synthetic") {
+        const unsigned SYNTHETIC_FRAMES = 8;
+        r.map_size = r.frame_bytes * SYNTHETIC_FRAMES;
+        void* m = mmap(nullptr, r.map_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (m == MAP_FAILED) { perror("replay: mmap"); return false; }
+        for (unsigned i = 0; i < SYNTHETIC_FRAMES; ++i) replay_synthesize((unsigned char*)m + i * r.frame_bytes, w, h, pixfmt, i);
+        r.frames = (const unsigned char*)m; r.frame_count = SYNTHETIC_FRAMES;
+    } else {
+        int ffd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (ffd < 0) { perror(("replay: " + path).c_str()); return false; }
+        struct stat st;
+        if (fstat(ffd, &st) != 0 || (size_t)st.st_size < r.frame_bytes) {
+            std::cerr << "replay: " << path << " holds less than one " << w << "x" << h << " " << fourcc_to_str(pixfmt) << " frame\n";
+            close(ffd); return false;
+        }
+        r.map_size = (size_t)st.st_size;
+        void* m = mmap(nullptr, r.map_size, PROT_READ, MAP_PRIVATE, ffd, 0);
+        close(ffd);
+        if (m == MAP_FAILED) { perror("replay: mmap"); return false; }
+        r.frames = (const unsigned char*)m; r.frame_count = r.map_size / r.frame_bytes;
+    }
+    buffers.assign(opt_buffer_count, std::vector<PlaneMap>(1));
+    for (auto &b : buffers) {
+        void* a = mmap(nullptr, r.frame_bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (a == MAP_FAILED) { perror("replay: buffer mmap"); unmap_buffers(buffers); replay_close(r); return false; }
+        b[0].addr = a; b[0].length = r.frame_bytes;
+    }
+    return true;
+}
 
 std::string fourcc_to_str(uint32_t f) {
     char s[5] = { (char)(f & 0xFF), (char)((f>>8)&0xFF), (char)((f>>16)&0xFF), (char)((f>>24)&0xFF), 0 };
@@ -131,42 +836,386 @@ bool get_v4l2_format(int fd, uint32_t &width, uint32_t &height, uint32_t &pixelf
     return true;
 }
 
-void reallocate_textures(GLuint texY, GLuint texUV, int newW, int newH, int uvW, int uvH) {
+// nv12,nv16,... (case-insensitive) -> fourccs; false on an unknown name or an empty list
+static bool parse_pixfmt_list(const std::string &list, std::vector<uint32_t> &out) {
+    static const struct { const char* name; uint32_t fourcc; } NAMES[] = {
+        { "nv12", V4L2_PIX_FMT_NV12 }, { "nv21", V4L2_PIX_FMT_NV21 }, { "nv16", V4L2_PIX_FMT_NV16 }, { "nv61", V4L2_PIX_FMT_NV61 },
+        { "nv24", V4L2_PIX_FMT_NV24 }, { "nv42", V4L2_PIX_FMT_NV42 }, { "yuyv", V4L2_PIX_FMT_YUYV }, { "uyvy", V4L2_PIX_FMT_UYVY },
+    };
+    std::vector<uint32_t> r; std::stringstream ss(list); std::string item;
+    while (std::getline(ss, item, ',')) {
+        item.erase(std::remove_if(item.begin(), item.end(), [](unsigned char c) { return std::isspace(c); }), item.end());
+        std::transform(item.begin(), item.end(), item.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+        if (item.empty()) continue;
+        auto it = std::find_if(std::begin(NAMES), std::end(NAMES), [&](const decltype(NAMES[0]) &n) { return item == n.name; });
+        if (it == std::end(NAMES)) return false;
+        if (std::find(r.begin(), r.end(), it->fourcc) == r.end()) r.push_back(it->fourcc);
+    }
+    if (r.empty()) return false;
+    out = r;
+    return true;
+}
+
+// vsync|immediate|adaptive|capture -> PresentMode
+static bool parse_present_mode(const std::string &v, int &out) {
+    for (int i = 0; i < (int)(sizeof(PRESENT_MODE_NAMES) / sizeof(PRESENT_MODE_NAMES[0])); ++i)
+        if (v == PRESENT_MODE_NAMES[i]) { out = i; return true; }
+    return false;
+}
+
+// Swap interval of the current SDL GL context for 'mode'; adaptive falls back to vsync where the driver
+// lacks EXT_swap_control_tear.
+static void set_swap_interval(PresentMode mode) {
+    int interval = mode == PRESENT_IMMEDIATE ? 0 : mode == PRESENT_ADAPTIVE ? -1 : 1;
+    if (SDL_GL_SetSwapInterval(interval) == 0) { vlogln(std::string("present: ") + PRESENT_MODE_NAMES[mode] + ", swap interval " + std::to_string(interval)); return; }
+    std::cerr << "Warning: swap interval " << interval << " not supported (" << SDL_GetError() << ")" << (interval < 0 ? ", using vsync" : "") << "\n";
+    if (interval < 0) SDL_GL_SetSwapInterval(1);
+}
+
+// Pixel format for S_FMT: the first opt_capture_formats entry VIDIOC_ENUM_FMT lists; failing that the
+// device's current format if the GL path can show it, else the list's first entry (the driver adjusts)
+static uint32_t negotiate_pixfmt(int fd, uint32_t current) {
+    std::vector<uint32_t> offered; std::string names;
+    for (uint32_t i = 0; ; ++i) {
+        v4l2_fmtdesc d; memset(&d, 0, sizeof(d));
+        d.index = i; d.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+        if (xioctl(fd, VIDIOC_ENUM_FMT, &d) < 0) break;
+        offered.push_back(d.pixelformat); names += " " + fourcc_to_str(d.pixelformat);
+    }
+    for (uint32_t want : opt_capture_formats)
+        if (std::find(offered.begin(), offered.end(), want) != offered.end()) {
+            vlogln("capture: " + fourcc_to_str(want) + " (offered:" + names + ")");
+            return want;
+        }
+    uint32_t pick = (offered.empty() || !pixel_layout(current).supported) ? opt_capture_formats.front() : current;
+    if (!offered.empty()) std::cerr << "Warning: no preferred capture format among" << names << ", requesting " << fourcc_to_str(pick) << "\n";
+    return pick;
+}
+
+// S_FMT with the negotiated pixel format at w x h; the result (and bytesperline) is read back with G_FMT
+static void request_capture_format(int fd, uint32_t w, uint32_t h, uint32_t current_pixfmt) {
+    v4l2_format fmt; memset(&fmt,0,sizeof(fmt)); fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    fmt.fmt.pix_mp.width = w; fmt.fmt.pix_mp.height = h; fmt.fmt.pix_mp.pixelformat = negotiate_pixfmt(fd, current_pixfmt);
+    fmt.fmt.pix_mp.field = V4L2_FIELD_NONE; fmt.fmt.pix_mp.num_planes = 1;
+    if (xioctl(fd, VIDIOC_S_FMT, &fmt) < 0) vlogln(std::string("request_capture_format: VIDIOC_S_FMT failed: ") + strerror(errno));
+    else if (!pixel_layout(fmt.fmt.pix_mp.pixelformat).supported) std::cerr << "Warning: capture format " << fourcc_to_str(fmt.fmt.pix_mp.pixelformat) << " cannot be shown\n";
+}
+
+// bytesperline of every plane of the mapped buffers (the QUERYBUF/mmap loops only see plane sizes)
+static void set_plane_strides(int fd, std::vector<std::vector<PlaneMap>> &buffers) {
+    v4l2_format fmt; memset(&fmt,0,sizeof(fmt)); fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    if (xioctl(fd, VIDIOC_G_FMT, &fmt) < 0) return;
+    for (auto &b : buffers)
+        for (unsigned p = 0; p < b.size() && p < fmt.fmt.pix_mp.num_planes; ++p) b[p].stride = fmt.fmt.pix_mp.plane_fmt[p].bytesperline;
+}
+
+#ifndef HDMI_GLES
+static bool gl_swizzle_supported() { return GLEW_VERSION_3_3 || GLEW_ARB_texture_swizzle; }
+#else
+static bool gl_swizzle_supported() { return true; } // core in ES 3.0
+#endif
+
+// Packed 4:2:2: point .r of the luma texture and .rg of the chroma texture at the right bytes of the
+// Y0 Cb Y1 Cr (YUYV) or Cb Y0 Cr Y1 (UYVY) texels; identity for everything else.
+static void set_plane_swizzle(GLuint tex, uint32_t pixfmt, bool chroma) {
+    if (!gl_swizzle_supported()) return;
+    GLint r = GL_RED, g = GL_GREEN;
+    if (pixfmt == V4L2_PIX_FMT_YUYV) { if (chroma) { r = GL_GREEN; g = GL_ALPHA; } }
+    else if (pixfmt == V4L2_PIX_FMT_UYVY) { if (chroma) g = GL_BLUE; else r = GL_GREEN; }
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_R, r);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_G, g);
+}
+
+// texY/texUV for a w x h frame (or crop rectangle) of 'pixfmt', see PixelLayout
+void reallocate_textures(GLuint texY, GLuint texUV, uint32_t pixfmt, int newW, int newH) {
+    PixelLayout l = pixel_layout(pixfmt);
     glBindTexture(GL_TEXTURE_2D, texY);
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, newW, newH, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+    if (l.packed) glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8, newW, newH, 0, GL_RG, GL_UNSIGNED_BYTE, nullptr);
+    else glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, newW, newH, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
     glBindTexture(GL_TEXTURE_2D, texUV);
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8, uvW, uvH, 0, GL_RG, GL_UNSIGNED_BYTE, nullptr);
+    if (l.packed) glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, newW >> l.x_shift, newH, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    else glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8, newW >> l.x_shift, newH >> l.y_shift, 0, GL_RG, GL_UNSIGNED_BYTE, nullptr);
+    set_plane_swizzle(texY, pixfmt, false); set_plane_swizzle(texUV, pixfmt, true);
+    if (l.packed && !gl_swizzle_supported()) std::cerr << "Warning: " << fourcc_to_str(pixfmt) << " needs texture swizzle (GL 3.3 / ARB_texture_swizzle), colours will be wrong\n";
 }
 
+// Works on client memory or, with a GL_PIXEL_UNPACK_BUFFER bound, on an offset into it (src = offset).
+// Columns wider than maxTexSize are addressed with GL_UNPACK_ROW_LENGTH/SKIP_PIXELS, no staging copy.
+// srcRowTexels: distance between source rows (bytesperline / texel size), 0 = srcW.
 void upload_texture_tiled(GLenum format, GLuint tex, int srcW, int srcH,
-                          const unsigned char* src, int maxTexSize, int pixelSizePerTexel) {
+                          const unsigned char* src, int maxTexSize, int pixelSizePerTexel, int srcRowTexels = 0) {
     int tileW = std::min(srcW, maxTexSize), tileH = std::min(srcH, maxTexSize);
-    static std::vector<unsigned char> tileBuf;
+    int row = srcRowTexels > 0 ? srcRowTexels : srcW;
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
     for (int y = 0; y < srcH; y += tileH) {
         int h = std::min(tileH, srcH - y);
         if (srcW <= maxTexSize) {
-            const unsigned char* ptr = src + (size_t)y * (size_t)srcW * pixelSizePerTexel;
-            glBindTexture(GL_TEXTURE_2D, tex);
-            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            const unsigned char* ptr = src + (size_t)y * (size_t)row * pixelSizePerTexel;
+            if (row != srcW) glPixelStorei(GL_UNPACK_ROW_LENGTH, row);
             glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y, srcW, h, format, GL_UNSIGNED_BYTE, ptr);
+            if (row != srcW) glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
         } else {
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, row);
+            glPixelStorei(GL_UNPACK_SKIP_ROWS, y);
             for (int x = 0; x < srcW; x += tileW) {
                 int w = std::min(tileW, srcW - x);
-                tileBuf.resize((size_t)h * (size_t)w * pixelSizePerTexel);
-                for (int row = 0; row < h; ++row) {
-                    const unsigned char* srcRow = src + (size_t)(y + row) * (size_t)srcW * pixelSizePerTexel + (size_t)x * pixelSizePerTexel;
-                    unsigned char* dstRow = tileBuf.data() + (size_t)row * (size_t)w * pixelSizePerTexel;
-                    memcpy(dstRow, srcRow, (size_t)w * pixelSizePerTexel);
-                }
-                glBindTexture(GL_TEXTURE_2D, tex);
-                glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-                glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, format, GL_UNSIGNED_BYTE, tileBuf.data());
+                glPixelStorei(GL_UNPACK_SKIP_PIXELS, x);
+                glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, format, GL_UNSIGNED_BYTE, src);
             }
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+            glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+            glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+        }
+    }
+}
+
+// --upload=pbo: ring of pixel unpack buffers. A frame's planes are written into the next mapped PBO and
+// the texture update is sourced from it, so the driver copy overlaps with rendering. Each slot is reused
+// only after the fence placed behind its glTexSubImage2D calls has signalled.
+static const int PBO_RING_SIZE = 3;
+
+struct PboRing {
+    GLuint pbo[PBO_RING_SIZE] = {0,0,0};
+    size_t size[PBO_RING_SIZE] = {0,0,0};
+    GLsync fence[PBO_RING_SIZE] = {0,0,0};
+    int cur = -1; // slot mapped/used by the frame in flight
+    int next = 0;
+};
+
+static bool pbo_ring_init(PboRing &ring) {
+    glGenBuffers(PBO_RING_SIZE, ring.pbo);
+    for (int i = 0; i < PBO_RING_SIZE; ++i) if (!ring.pbo[i]) return false;
+    return true;
+}
+
+static void pbo_ring_release(PboRing &ring) {
+    for (int i = 0; i < PBO_RING_SIZE; ++i) { if (ring.fence[i]) glDeleteSync(ring.fence[i]); ring.fence[i] = 0; ring.size[i] = 0; }
+    glDeleteBuffers(PBO_RING_SIZE, ring.pbo);
+    for (int i = 0; i < PBO_RING_SIZE; ++i) ring.pbo[i] = 0;
+}
+
+// Bind the next slot as GL_PIXEL_UNPACK_BUFFER and map 'bytes' of it for writing; nullptr on failure (unbound).
+static unsigned char* pbo_ring_map(PboRing &ring, size_t bytes) {
+    int i = ring.next; ring.next = (ring.next + 1) % PBO_RING_SIZE;
+    if (ring.fence[i]) {
+        GLenum st = glClientWaitSync(ring.fence[i], GL_SYNC_FLUSH_COMMANDS_BIT, 100ull * 1000 * 1000);
+        if (st == GL_TIMEOUT_EXPIRED || st == GL_WAIT_FAILED) vlogln("pbo: slot fence not signalled, mapping anyway");
+        glDeleteSync(ring.fence[i]); ring.fence[i] = 0;
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring.pbo[i]);
+    if (ring.size[i] < bytes) { glBufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr)bytes, nullptr, GL_STREAM_DRAW); ring.size[i] = bytes; }
+    void* p = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr)bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    if (!p) { glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0); return nullptr; }
+    ring.cur = i;
+    return (unsigned char*)p;
+}
+
+static bool pbo_ring_unmap(PboRing &ring) {
+    if (ring.cur < 0) return false;
+    if (glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) != GL_TRUE) { glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0); ring.cur = -1; return false; }
+    return true;
+}
+
+// After the texture updates from the mapped slot have been issued: fence it and unbind.
+static void pbo_ring_submit(PboRing &ring) {
+    if (ring.cur >= 0) ring.fence[ring.cur] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    ring.cur = -1;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+// 'c': the rendered output is read back without stalling: glReadPixels into the next PBO of this ring,
+// fenced, and copied out a frame or two later once the fence has signalled.
+static const int READBACK_RING_SIZE = 3;
+
+struct ReadbackRing {
+    GLuint pbo[READBACK_RING_SIZE] = {0,0,0};
+    size_t size[READBACK_RING_SIZE] = {0,0,0};
+    GLsync fence[READBACK_RING_SIZE] = {0,0,0};
+    int width[READBACK_RING_SIZE] = {0,0,0}, height[READBACK_RING_SIZE] = {0,0,0};
+    int64_t start_us[READBACK_RING_SIZE] = {0,0,0}; // when the read was issued
+    int next = 0; // slot for the next read; also the oldest one in flight
+};
+
+static bool readback_ring_init(ReadbackRing &ring) {
+    glGenBuffers(READBACK_RING_SIZE, ring.pbo);
+    for (int i = 0; i < READBACK_RING_SIZE; ++i) if (!ring.pbo[i]) return false;
+    return true;
+}
+
+static void readback_ring_release(ReadbackRing &ring) {
+    for (int i = 0; i < READBACK_RING_SIZE; ++i) { if (ring.fence[i]) glDeleteSync(ring.fence[i]); ring.fence[i] = 0; ring.size[i] = 0; }
+    glDeleteBuffers(READBACK_RING_SIZE, ring.pbo);
+    for (int i = 0; i < READBACK_RING_SIZE; ++i) ring.pbo[i] = 0;
+}
+
+// Queue a read of the w x h RGBA output of the current framebuffer; false while every slot is in flight.
+static bool readback_start(ReadbackRing &ring, int w, int h) {
+    int i = ring.next;
+    if (ring.fence[i] || w <= 0 || h <= 0) return false;
+    size_t bytes = (size_t)w * (size_t)h * 4;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, ring.pbo[i]);
+    if (ring.size[i] != bytes) { glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)bytes, nullptr, GL_STREAM_READ); ring.size[i] = bytes; }
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    ring.fence[i] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    ring.width[i] = w; ring.height[i] = h; ring.start_us[i] = steady_us();
+    ring.next = (i + 1) % READBACK_RING_SIZE;
+    return true;
+}
+
+static bool readback_pending(const ReadbackRing &ring) {
+    for (int i = 0; i < READBACK_RING_SIZE; ++i) if (ring.fence[i]) return true;
+    return false;
+}
+
+// Copy out the oldest finished read (bottom row first, as GL returns it) and when it was issued; never waits.
+static bool readback_collect(ReadbackRing &ring, std::vector<unsigned char> &out, int &w, int &h, int64_t *start_us = nullptr) {
+    for (int k = 0; k < READBACK_RING_SIZE; ++k) {
+        int i = (ring.next + k) % READBACK_RING_SIZE;
+        if (!ring.fence[i]) continue;
+        GLenum st = glClientWaitSync(ring.fence[i], 0, 0);
+        if (st != GL_ALREADY_SIGNALED && st != GL_CONDITION_SATISFIED) return false; // newer reads are not done either
+        glDeleteSync(ring.fence[i]); ring.fence[i] = 0;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, ring.pbo[i]);
+        const unsigned char* p = (const unsigned char*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)ring.size[i], GL_MAP_READ_BIT);
+        if (p) { out.assign(p, p + ring.size[i]); glUnmapBuffer(GL_PIXEL_PACK_BUFFER); }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        w = ring.width[i]; h = ring.height[i];
+        if (start_us) *start_us = ring.start_us[i];
+        if (!p) { vlogln("readback: mapping the PBO failed, capture dropped"); return false; }
+        return true;
+    }
+    return false;
+}
+
+// Upload the w x h rectangle at (x,y) of a plane whose rows are srcRowTexels wide, without a staging copy.
+void upload_texture_rect(GLenum format, GLuint tex, const unsigned char* src, int srcRowTexels, int x, int y, int w, int h) {
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, srcRowTexels);
+    glPixelStorei(GL_UNPACK_SKIP_PIXELS, x);
+    glPixelStorei(GL_UNPACK_SKIP_ROWS, y);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, format, GL_UNSIGNED_BYTE, src);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+    glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+}
+
+// One plane, or the w x h rectangle at (x,y) of it, into 'tex'. Rows are srcRowTexels apart, so the
+// driver's bytesperline padding is skipped by GL_UNPACK_ROW_LENGTH instead of being repacked.
+static void upload_plane(GLenum format, int texelBytes, GLuint tex, const unsigned char* src, int srcRowTexels,
+                         int x, int y, int w, int h, int maxTexSize) {
+    if (w <= maxTexSize && h <= maxTexSize) upload_texture_rect(format, tex, src, srcRowTexels, x, y, w, h);
+    else upload_texture_tiled(format, tex, w, h, src + ((size_t)y * (size_t)srcRowTexels + (size_t)x) * (size_t)texelBytes, maxTexSize, texelBytes, srcRowTexels);
+}
+
+#ifdef HDMI_HAVE_EGL_DMABUF
+#ifndef DRM_FORMAT_R8
+#define DRM_FORMAT_R8 v4l2_fourcc('R','8',' ',' ')
+#endif
+#ifndef DRM_FORMAT_GR88
+#define DRM_FORMAT_GR88 v4l2_fourcc('G','R','8','8')
+#endif
+#ifndef DRM_FORMAT_ABGR8888
+#define DRM_FORMAT_ABGR8888 v4l2_fourcc('A','B','2','4')
+#endif
+
+typedef void (*PFN_glEGLImageTargetTexture2DOES)(GLenum target, void* image);
+
+// One EGLImage + GL texture per plane and capture buffer. Built on the GL thread from the
+// DMABUF fds exported by export_dmabufs(); the Y plane is imported as R8 and the interleaved
+// chroma plane as GR88 (packed 4:2:2: GR88 + ABGR8888, swizzled) so the shaders sample them exactly like texY/texUV.
+struct DmabufImageSet {
+    EGLDisplay dpy = EGL_NO_DISPLAY;
+    PFNEGLCREATEIMAGEKHRPROC createImage = nullptr;
+    PFNEGLDESTROYIMAGEKHRPROC destroyImage = nullptr;
+    PFN_glEGLImageTargetTexture2DOES imageTargetTexture = nullptr;
+    std::vector<EGLImageKHR> imgY, imgUV;
+    std::vector<GLuint> texY, texUV;
+    bool valid() const { return !texY.empty(); }
+};
+
+// Resolve the EGL/GL entry points; false if the current context cannot import DMABUFs.
+static bool dmabuf_init(DmabufImageSet &set) {
+    set.dpy = eglGetCurrentDisplay();
+    if (set.dpy == EGL_NO_DISPLAY) { vlogln("dmabuf: no current EGL display (GLX context?)"); return false; }
+    const char* exts = eglQueryString(set.dpy, EGL_EXTENSIONS);
+    if (!exts || !strstr(exts, "EGL_EXT_image_dma_buf_import")) { vlogln("dmabuf: EGL_EXT_image_dma_buf_import not supported"); return false; }
+    set.createImage = (PFNEGLCREATEIMAGEKHRPROC)eglGetProcAddress("eglCreateImageKHR");
+    set.destroyImage = (PFNEGLDESTROYIMAGEKHRPROC)eglGetProcAddress("eglDestroyImageKHR");
+    set.imageTargetTexture = (PFN_glEGLImageTargetTexture2DOES)eglGetProcAddress("glEGLImageTargetTexture2DOES");
+    if (!set.createImage || !set.destroyImage || !set.imageTargetTexture) { vlogln("dmabuf: EGL image entry points missing"); return false; }
+    return true;
+}
+
+static void dmabuf_images_release(DmabufImageSet &set) {
+    if (!set.texY.empty()) glDeleteTextures((GLsizei)set.texY.size(), set.texY.data());
+    if (!set.texUV.empty()) glDeleteTextures((GLsizei)set.texUV.size(), set.texUV.data());
+    for (auto img : set.imgY) if (img != EGL_NO_IMAGE_KHR) set.destroyImage(set.dpy, img);
+    for (auto img : set.imgUV) if (img != EGL_NO_IMAGE_KHR) set.destroyImage(set.dpy, img);
+    set.imgY.clear(); set.imgUV.clear(); set.texY.clear(); set.texUV.clear();
+}
+
+static EGLImageKHR dmabuf_import_plane(DmabufImageSet &set, int dmafd, uint32_t drmFormat, int w, int h, size_t offset, int pitch) {
+    EGLint attrs[] = {
+        EGL_WIDTH, w, EGL_HEIGHT, h,
+        EGL_LINUX_DRM_FOURCC_EXT, (EGLint)drmFormat,
+        EGL_DMA_BUF_PLANE0_FD_EXT, dmafd,
+        EGL_DMA_BUF_PLANE0_OFFSET_EXT, (EGLint)offset,
+        EGL_DMA_BUF_PLANE0_PITCH_EXT, pitch,
+        EGL_NONE
+    };
+    return set.createImage(set.dpy, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT, nullptr, attrs);
+}
+
+static GLuint dmabuf_bind_texture(DmabufImageSet &set, EGLImageKHR img) {
+    GLuint tex = 0; glGenTextures(1, &tex); glBindTexture(GL_TEXTURE_2D, tex);
+    glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_NEAREST); glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE); glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+    set.imageTargetTexture(GL_TEXTURE_2D, img);
+    return tex;
+}
+
+// (Re)build the image set for the current buffer pool. Handles both real multi-plane buffers
+// (one fd per plane) and single-plane layouts where chroma follows luma in one fd, at the buffers'
+// bytesperline. Packed 4:2:2 imports its one plane twice: GR88 luma and, at half width, ABGR8888 chroma.
+// Only the crop rectangle is imported (plane offset + full-frame pitch); pass 0,0,width,height for all of it.
+static bool dmabuf_images_build(DmabufImageSet &set, const std::vector<std::vector<PlaneMap>> &buffers,
+                                int width, int height, uint32_t pixfmt,
+                                int cropX, int cropY, int cropW, int cropH) {
+    dmabuf_images_release(set);
+    PixelLayout l = pixel_layout(pixfmt);
+    if (!l.supported) { vlogln(std::string("dmabuf: unsupported pixfmt ") + fourcc_to_str(pixfmt)); return false; }
+    int uvW = cropW >> l.x_shift, uvH = cropH >> l.y_shift;
+    for (size_t i=0;i<buffers.size();++i) {
+        const auto &b = buffers[i];
+        if (b.empty() || b[0].dmabuf_fd < 0) { dmabuf_images_release(set); return false; }
+        size_t yPitch = luma_stride(l, b[0], (uint32_t)width);
+        size_t uvPitch = l.packed ? yPitch : chroma_stride(l, b, (unsigned)b.size(), yPitch);
+        int uvFd = b[0].dmabuf_fd; size_t uvOffset = l.packed ? 0 : yPitch * (size_t)height;
+        if (!l.packed && b.size() >= 2) { uvFd = b[1].dmabuf_fd; uvOffset = 0; }
+        size_t yCropOffset = (size_t)cropY * yPitch + (size_t)cropX * (l.packed ? 2 : 1);
+        size_t uvCropOffset = (size_t)(cropY >> l.y_shift) * uvPitch + (size_t)(cropX >> l.x_shift) * (l.packed ? 4 : 2);
+        EGLImageKHR iy = dmabuf_import_plane(set, b[0].dmabuf_fd, l.packed ? DRM_FORMAT_GR88 : DRM_FORMAT_R8, cropW, cropH, yCropOffset, (int)yPitch);
+        EGLImageKHR iuv = (iy != EGL_NO_IMAGE_KHR && uvFd >= 0) ? dmabuf_import_plane(set, uvFd, l.packed ? DRM_FORMAT_ABGR8888 : DRM_FORMAT_GR88, uvW, uvH, uvOffset + uvCropOffset, (int)uvPitch) : EGL_NO_IMAGE_KHR;
+        if (iy == EGL_NO_IMAGE_KHR || iuv == EGL_NO_IMAGE_KHR) {
+            vlogln(std::string("dmabuf: eglCreateImageKHR failed for buffer ") + std::to_string(i) + " (EGL error " + std::to_string(eglGetError()) + ")");
+            if (iy != EGL_NO_IMAGE_KHR) set.destroyImage(set.dpy, iy);
+            dmabuf_images_release(set); return false;
         }
+        set.imgY.push_back(iy); set.imgUV.push_back(iuv);
+        set.texY.push_back(dmabuf_bind_texture(set, iy)); set.texUV.push_back(dmabuf_bind_texture(set, iuv));
+        set_plane_swizzle(set.texY.back(), pixfmt, false); set_plane_swizzle(set.texUV.back(), pixfmt, true);
     }
+    vlogln(std::string("dmabuf: imported ") + std::to_string(buffers.size()) + " capture buffers as EGL images (" + fourcc_to_str(pixfmt) + ")");
+    return true;
 }
+#endif
 
 void print_usage(const char* prog) {
     std::cerr << "Usage: " << prog << " [options]\n"
@@ -176,6 +1225,44 @@ void print_usage(const char* prog) {
               << "  --auto-resize-window\n"
               << "  --cpu-uv-swap\n"
               << "  --test-pattern=<path>\n"
+              << "  --upload=copy|dmabuf|pbo\n"
+              << "  --tile-mode=shader|remap|instanced\n"
+              << "  --crop-upload\n"
+              << "  --all-segments               draw all segmentsX*segmentsY sub-blocks side by side in one window\n"
+              << "  --render-on-demand\n"
+              << "  --output=sdl|kms\n"
+              << "  --kms-device=<path>          (default /dev/dri/card0)\n"
+              << "  --kms-overlay\n"
+              << "  --rga[=nv12|nv16|nv24]       crop/rotate/convert on the RK3588 RGA before the GPU (output format, default nv12)\n"
+              << "  --rga-heap=<path>            dma-heap for the RGA output buffers (default: first of the system heaps)\n"
+              << "  --stream=HOST:PORT           RTP/UDP monitoring stream of the rendered output, encoded by the RK3588 VPU (MPP)\n"
+              << "  --stream-size=WxH            streamed picture size (default 960x540)\n"
+              << "  --stream-fps=N               streamed frames per second (default 10)\n"
+              << "  --stream-codec=h264|h265     (default h264)\n"
+              << "  --stream-bitrate=KBPS        (default 2000)\n"
+              << "  --stream-sdp=<file>          write the SDP description players open (ffplay, VLC)\n"
+              << "  --stats[=seconds]            log latency percentiles and drops (default every 5 s)\n"
+              << "  --profile                    show GPU ms per pass, CPU ms and fps over the picture (toggle: p)\n"
+              << "  --profile-sweep[=N]          time every upload path x view mode / pattern for N frames each (default 120), print a table, exit\n"
+              << "  --present-mode=vsync|immediate|adaptive|capture  swap interval 1 / 0 / -1, or vsync timed to the capture rate (default vsync)\n"
+              << "  --queue-mode=throughput|latency  one buffer per wakeup, or drain to the newest (default throughput)\n"
+              << "  --buffers=N                  capture buffers, 2..8 (default 4)\n"
+              << "  --capture-formats=LIST       capture formats by preference, of nv12,nv21,nv16,nv61,nv24,nv42,yuyv,uyvy (default nv12,nv16,nv24,yuyv)\n"
+              << "  --device=<path>              capture device (default " DEVICE ")\n"
+              << "  --replay=<file>|synthetic    play raw frames instead of capturing (file: frames back to back, looped)\n"
+              << "  --replay-size=WxH            replay frame size (default 3840x2160)\n"
+              << "  --replay-format=FMT          replay pixel format, one of the --capture-formats names (default nv24)\n"
+              << "  --replay-fps=N               replay rate, 0 = as fast as frames are taken (default 60)\n"
+              << "  --headless[=WxH]             render into an offscreen FBO (default 1920x1080)\n"
+              << "  --bench=N                    after N shown frames print fps and CPU/GPU time per frame, then exit\n"
+              << "  --view-mode=0|1|2            initial view mode\n"
+              << "  --rotate=0|90|180|270        initial rotation of the input (default 0)\n"
+              << "  --show-pattern               start with the test pattern shown\n"
+              << "  --screenshot-format=png|qoi|raw  encoder for 's' (input) and 'c' (rendered output) captures (default png)\n"
+              << "  --screenshot-dir=<dir>       where captures are written (default .)\n"
+              << "  --capture-burst=N            consecutive output frames captured per 'c' (default 1)\n"
+              << "  --metrics=PORT|HOST:PORT|unix:PATH  serve Prometheus metrics (GET /metrics) on its own thread\n"
+              << "  --shader-cache=DIR|off       linked shader program cache (default $XDG_CACHE_HOME or ~/.cache/hdmi-in-display)\n"
               << "  --verbose\n"
               << "  -h, --help\n";
 }
@@ -216,7 +1303,13 @@ static std::string findShaderFile(const std::string &name, std::vector<std::stri
     return std::string();
 }
 
-// ControlParams (unchanged)
+// calibration<serial> in control_ini.txt: out = gain * in^gamma per channel (in, out 0..1)
+struct ModuleCalibration {
+    float gain[3] = { 1.0f, 1.0f, 1.0f };
+    float gamma = 1.0f;
+};
+
+// Everything control_ini.txt can set: wall layout, module calibration, capture sources and queueing, presentation and profiling.
 struct ControlParams {
     float fullInputW = 3840.0f; float fullInputH = 2160.0f;
     int segmentsX = 3; int segmentsY = 3;
@@ -225,15 +1318,111 @@ struct ControlParams {
     float spacingX = 98.0f; float spacingY = 90.0f;
     float marginX = 0.0f; int numTilesPerRow = 10; int numTilesPerCol = 15;
     int inputTilesTopToBottom = 1;
-    int moduleSerials[3] = {0,0,0};
+    std::vector<int> moduleSerials = {0,0,0};      // modul<K>Serial, any number of modules; 0 = modul<K>.txt
+    std::vector<std::vector<int>> segmentSerials;  // [N-1] = segment<N>Serials, empty / all 0 = segment N uses moduleSerials
+    std::vector<int> gapRows = {5, 10};            // tile rows without spacing above them
+    std::map<int, ModuleCalibration> calibration;  // module serial -> colour calibration (at most MAX_MODULES)
+    int bufferCount = 0; int queueMode = -1; // capture queue, 0 / -1 = not set (the CLI wins over both)
+    int presentMode = -1;                    // PresentMode, -1 = not set (the CLI wins); also applied on reload
+    int profileOverlay = -1;                 // --profile overlay on/off, -1 = not set; also applied on reload
+    std::vector<uint32_t> captureFormats;    // preference list, empty = not set (the CLI wins)
+    // captureSource<N> / captureSource<N>Segments: [N-1] = device of source N (1 = --device) and the segments it
+    // feeds; segments no source lists come from source 1. Devices are opened at startup, segments follow reloads.
+    std::vector<std::string> sourceDevices;
+    std::vector<std::vector<int>> sourceSegments;
+    int verbose = -1; std::string testPattern; // -1 / empty = not set; applied by the caller (never from a watcher thread)
 };
 
-static std::array<std::string,3> buildModuleFilenames(const ControlParams &ctrl) {
-    std::array<std::string,3> names;
-    for (int i=0;i<3;++i) names[i] = (ctrl.moduleSerials[i]==0) ? std::string("modul") + std::to_string(i+1) + ".txt" : std::string("m") + std::to_string(ctrl.moduleSerials[i]) + ".txt";
+// Limits of the layout table (texLayout) the shaders read offsets and gap rows from; raising them needs no
+// shader change. The table is LAYOUT_TABLE_WIDTH texels wide, at most MAX_SEGMENTS * MAX_TILES_PER_SEGMENT fit
+// in the 2048 rows every GLES 3 driver supports.
+static const int MAX_SEGMENTS = 64;
+static const int MAX_TILES_PER_SEGMENT = 16384;
+static const int MAX_MODULES = 256;
+static const int LAYOUT_TABLE_WIDTH = 1024;
+static const int COLOR_LUT_SIZE = 256; // entries per calibration LUT row (8-bit input)
+static const int MAX_CAPTURE_SOURCES = 8;
+
+static bool any_nonzero(const std::vector<int> &v) { return std::any_of(v.begin(), v.end(), [](int x) { return x != 0; }); }
+
+// Module serials of segment 1..N: its own segment<N>Serials if set, else modul<K>Serial
+static const std::vector<int>& segmentModuleSerials(const ControlParams &ctrl, int segment) {
+    size_t i = (size_t)std::max(segment, 1) - 1;
+    return (i < ctrl.segmentSerials.size() && any_nonzero(ctrl.segmentSerials[i])) ? ctrl.segmentSerials[i] : ctrl.moduleSerials;
+}
+
+static std::vector<std::string> buildModuleFilenames(const ControlParams &ctrl, int segment = 1) {
+    const std::vector<int> &serials = segmentModuleSerials(ctrl, segment);
+    std::vector<std::string> names(serials.size());
+    for (size_t i=0;i<serials.size();++i) names[i] = (serials[i]==0) ? std::string("modul") + std::to_string(i+1) + ".txt" : std::string("m") + std::to_string(serials[i]) + ".txt";
     return names;
 }
 
+// "a,b,c,..." -> ints (spaces allowed, parsing stops at the first non-number)
+static std::vector<int> parse_int_list(const std::string &val) {
+    std::vector<int> out; const char *p = val.c_str(); char *end = nullptr;
+    while (*p) {
+        long v = strtol(p, &end, 10);
+        if (end == p) break;
+        out.push_back((int)v);
+        p = end; while (*p == ',' || *p == ' ' || *p == '\t') ++p;
+    }
+    return out;
+}
+
+// Part of the capture frame that is uploaded into texY (texUV at chroma resolution).
+struct UploadRect {
+    int x = 0, y = 0, w = 0, h = 0;
+    bool cropped = false; // true = only the active segment's sub-block, shader runs with u_textureIsFull=0
+};
+
+// std140 image of the LayoutParams uniform block in shader.frag.glsl (same member order).
+struct LayoutParamsStd140 {
+    float fullInputSize[2];
+    float subBlockSize[2];
+    float windowSize[2];
+    float outputSize[2];
+    float gridSize[2];
+    float tileW, tileH, spacingX, spacingY, marginX;
+    int32_t segmentsX, segmentsY, numTilesPerRow, numTilesPerCol;
+    int32_t segmentIndex, rot, flip_x, flip_y;
+    int32_t gap_count, inputTilesTopToBottom, view_mode;
+    int32_t textureIsFull, alignTopLeft, showPattern, useRemap, colorLut;
+    int32_t pad0[1];
+    int32_t layoutTable[4];   // ivec4 u_layoutTable: first tile entry in texLayout, tiles per segment, segments, unused
+    float colorMatrix[12];    // vec4 u_colorMatrix[3]: yuv_color_matrix() rows
+};
+static_assert(offsetof(LayoutParamsStd140, layoutTable) == 128, "LayoutParams std140 offset");
+static_assert(offsetof(LayoutParamsStd140, colorMatrix) == 144, "LayoutParams std140 offset");
+static_assert(sizeof(LayoutParamsStd140) == 192, "LayoutParams std140 size");
+
+// The active segment's sub-block in full-input pixels (not checked against any frame).
+static UploadRect segment_rect(const ControlParams &c, int segmentIndex) {
+    UploadRect r;
+    int maxSeg = std::max(1, c.segmentsX * c.segmentsY);
+    int segIdx = std::min(std::max(segmentIndex, 1), maxSeg) - 1;
+    r.x = (segIdx % std::max(1, c.segmentsX)) * (int)c.subBlockW;
+    r.y = (segIdx / std::max(1, c.segmentsX)) * (int)c.subBlockH;
+    r.w = (int)c.subBlockW; r.h = (int)c.subBlockH;
+    r.cropped = r.w != (int)c.fullInputW || r.h != (int)c.fullInputH;
+    return r;
+}
+
+// --crop-upload: only the active segment's sub-block when the frame is the full input and the rectangle
+// fits (chroma-aligned, within GL limits); otherwise the whole frame.
+static UploadRect compute_upload_rect(const ControlParams &c, int segmentIndex, int frameW, int frameH, uint32_t pixfmt, int maxTex) {
+    UploadRect r; r.w = frameW; r.h = frameH;
+    if (!opt_crop_upload || frameW != (int)c.fullInputW || frameH != (int)c.fullInputH) return r;
+    UploadRect seg = segment_rect(c, segmentIndex);
+    int sx = seg.x, sy = seg.y, sw = seg.w, sh = seg.h;
+    PixelLayout l = pixel_layout(pixfmt);
+    if (sw <= 0 || sh <= 0 || sx + sw > frameW || sy + sh > frameH || sw > maxTex || sh > maxTex) return r;
+    if (((sx | sw) & ((1 << l.x_shift) - 1)) || ((sy | sh) & ((1 << l.y_shift) - 1))) return r;
+    r.x = sx; r.y = sy; r.w = sw; r.h = sh; r.cropped = (sw != frameW || sh != frameH);
+    if (!r.cropped) { r.x = 0; r.y = 0; }
+    return r;
+}
+
 static bool loadControlIni(const std::string &path, ControlParams &out) {
     std::ifstream f; std::string exeDir = getExecutableDir(); std::string candidates[2] = { exeDir + path, path };
     for (int c=0;c<2;++c) {
@@ -255,108 +1444,169 @@ static bool loadControlIni(const std::string &path, ControlParams &out) {
             else if (key=="marginX") out.marginX = (float)atoi(val.c_str());
             else if (key=="numTiles") { int a=0,b=0; if (sscanf(val.c_str(), "%d,%d",&a,&b)==2) { out.numTilesPerRow=a; out.numTilesPerCol=b; } }
             else if (key=="inputTilesTopToBottom") out.inputTilesTopToBottom = atoi(val.c_str())?1:0;
-            else if (key=="moduleSerials") { int a=0,b=0,c2=0; if (sscanf(val.c_str(), "%d,%d,%d",&a,&b,&c2)>=1) { out.moduleSerials[0]=a; out.moduleSerials[1]=b; out.moduleSerials[2]=c2; } }
-            else if (key=="modul1Serial") out.moduleSerials[0] = atoi(val.c_str());
-            else if (key=="modul2Serial") out.moduleSerials[1] = atoi(val.c_str());
-            else if (key=="modul3Serial") out.moduleSerials[2] = atoi(val.c_str());
-            else if (key=="verbose") opt_verbose = atoi(val.c_str()) != 0;
-            else if (key=="testPattern") opt_test_pattern_path = val;
+            else if (key=="moduleSerials") { std::vector<int> v = parse_int_list(val); if (!v.empty() && (int)v.size() <= MAX_MODULES) out.moduleSerials = v; }
+            else if (key.compare(0, 5, "modul") == 0 && key.size() > 11 && key.compare(key.size() - 6, 6, "Serial") == 0) {
+                int k = atoi(key.c_str() + 5);
+                if (k >= 1 && k <= MAX_MODULES) { if ((int)out.moduleSerials.size() < k) out.moduleSerials.resize(k, 0); out.moduleSerials[k-1] = atoi(val.c_str()); }
+            }
+            else if (key.compare(0, 7, "segment") == 0 && key.size() > 14 && key.compare(key.size() - 7, 7, "Serials") == 0) {
+                int n = atoi(key.c_str() + 7); std::vector<int> v = parse_int_list(val);
+                if (n >= 1 && n <= MAX_SEGMENTS && !v.empty() && (int)v.size() <= MAX_MODULES) { if ((int)out.segmentSerials.size() < n) out.segmentSerials.resize(n); out.segmentSerials[n-1] = v; }
+            }
+            else if (key=="gapRows") out.gapRows = (val == "none") ? std::vector<int>() : parse_int_list(val);
+            else if (key.compare(0, 11, "calibration") == 0 && key.size() > 11) {
+                // gain | gain,gamma | gainR,gainG,gainB,gamma
+                int serial = atoi(key.c_str() + 11); float v[4] = { 0, 0, 0, 0 }; ModuleCalibration cal;
+                int n = sscanf(val.c_str(), "%f,%f,%f,%f", &v[0], &v[1], &v[2], &v[3]);
+                if (n == 1 || n == 2) { cal.gain[0] = cal.gain[1] = cal.gain[2] = v[0]; if (n == 2) cal.gamma = v[1]; }
+                else if (n == 4) { cal.gain[0] = v[0]; cal.gain[1] = v[1]; cal.gain[2] = v[2]; cal.gamma = v[3]; }
+                else n = 0;
+                bool ok = n && serial > 0 && cal.gamma > 0.0f && cal.gain[0] >= 0.0f && cal.gain[1] >= 0.0f && cal.gain[2] >= 0.0f;
+                if (ok && ((int)out.calibration.size() < MAX_MODULES || out.calibration.count(serial))) out.calibration[serial] = cal;
+            }
+            else if (key=="bufferCount") out.bufferCount = std::min(std::max(atoi(val.c_str()), BUF_COUNT_MIN), BUF_COUNT_MAX);
+            else if (key.compare(0, 13, "captureSource") == 0 && key.size() > 13) {
+                int n = atoi(key.c_str() + 13);
+                bool segs = key.size() > 21 && key.compare(key.size() - 8, 8, "Segments") == 0;
+                if (n < 1 || n > MAX_CAPTURE_SOURCES) continue;
+                if (segs) { if ((int)out.sourceSegments.size() < n) out.sourceSegments.resize(n); out.sourceSegments[n-1] = parse_int_list(val); }
+                else { if ((int)out.sourceDevices.size() < n) out.sourceDevices.resize(n); out.sourceDevices[n-1] = val; }
+            }
+            else if (key=="captureFormats") { if (!parse_pixfmt_list(val, out.captureFormats)) std::cerr << "Warning: control_ini.txt: invalid captureFormats '" << val << "'\n"; }
+            else if (key=="profileOverlay") out.profileOverlay = atoi(val.c_str()) != 0 ? 1 : 0;
+            else if (key=="presentMode") { if (!parse_present_mode(val, out.presentMode)) std::cerr << "Warning: control_ini.txt: invalid presentMode '" << val << "'\n"; }
+            else if (key=="queueMode") { if (val=="throughput") out.queueMode = QUEUE_THROUGHPUT; else if (val=="latency") out.queueMode = QUEUE_LATENCY; }
+            else if (key=="verbose") out.verbose = atoi(val.c_str()) != 0 ? 1 : 0;
+            else if (key=="testPattern") out.testPattern = val;
         }
         f.close(); return true;
     }
     return false;
 }
 
-// async save frame unchanged
-static void async_save_frame_to_png(std::vector<unsigned char> ybuf,
-                                    std::vector<unsigned char> uvbuf,
-                                    std::vector<unsigned char> packed,
-                                    size_t packedSize,
-                                    int width, int height,
-                                    uint32_t pixfmt,
-                                    int uv_swap_flag, int use_bt709_flag, int full_range_flag,
-                                    std::string filename_png)
-{
-    std::string fourcc = fourcc_to_str(pixfmt);
-    const int comp = 3;
+// One screenshot: a single copy of the frame taken when it was requested, plus the colour settings of that moment.
+// Input screenshot: y holds the luma plane (packed 4:2:2: the whole frame), uv the interleaved chroma plane.
+// Output capture: rgba holds the rendered picture as read back by glReadPixels (bottom row first).
+struct ScreenshotJob {
+    std::vector<unsigned char> y, uv;
+    size_t y_stride = 0, uv_stride = 0; // bytesperline of the copied planes, 0 = tightly packed
+    uint32_t pixfmt = 0;
+    YuvColor color;
+    std::vector<unsigned char> rgba;
+    int width = 0, height = 0;
+    ImageFormat format = ImageFormat::PNG;
+    std::string filename;
+};
+
+// <dir>/<kind>_<YYYYmmdd-HHMMSS.mmm>[_m<serials>]_<n>.<ext>; unique per process, so bursts never overwrite
+static std::string screenshot_filename(const char* kind, const std::vector<int> &serials, int width, int height, ImageFormat format) {
+    static std::atomic<unsigned> counter{0};
+    auto now = std::chrono::system_clock::now();
+    time_t t = std::chrono::system_clock::to_time_t(now);
+    int ms = (int)(std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count() % 1000);
+    struct tm tmv; localtime_r(&t, &tmv);
+    char stamp[32]; strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tmv);
+    char buf[64]; snprintf(buf, sizeof(buf), "%s.%03d", stamp, ms);
+    std::string name = opt_screenshot_dir + "/" + kind + "_" + buf;
+    if (any_nonzero(serials)) { name += "_m"; for (size_t i = 0; i < serials.size(); ++i) name += (i ? "-" : "") + std::to_string(serials[i]); }
+    snprintf(buf, sizeof(buf), "_%04u", counter.fetch_add(1));
+    name += buf;
+    if (format == ImageFormat::RAW) name += "_" + std::to_string(width) + "x" + std::to_string(height);
+    return name + "." + image_file_extension(format, 3);
+}
+
+static bool save_output_capture(const ScreenshotJob &job) {
+    if (job.rgba.size() < (size_t)job.width * (size_t)job.height * 4) return false;
     std::vector<unsigned char> rgb;
-    try { rgb.resize((size_t)width * (size_t)height * comp); } catch (...) { return; }
-    size_t ylen = (size_t)width * (size_t)height;
-    size_t uvlen = (size_t)width * ((size_t)height / 2);
-    if (pixfmt == V4L2_PIX_FMT_NV12 || pixfmt == V4L2_PIX_FMT_NV21 ||
-        (ybuf.empty() && uvbuf.empty() && packedSize == (ylen + uvlen))) {
-        if (ybuf.empty() && uvbuf.empty()) {
-            ybuf.assign(packed.begin(), packed.begin() + ylen);
-            uvbuf.assign(packed.begin() + ylen, packed.begin() + ylen + uvlen);
-        }
-        for (int yy = 0; yy < height; ++yy) {
-            int uv_row = yy / 2;
-            for (int xx = 0; xx < width; ++xx) {
-                int yi = yy * width + xx;
-                int uv_col = (xx / 2);
-                size_t uvIndex = (size_t)uv_row * (size_t)width + (size_t)uv_col * 2;
-                unsigned char Yc = (yi < (int)ybuf.size()) ? ybuf[yi] : 0;
-                unsigned char Uc = (uvIndex + 1 < uvbuf.size() && uvbuf.size()>0) ? uvbuf[uvIndex + (uv_swap_flag ? 1 : 0)] : 128;
-                unsigned char Vc = (uvIndex + 1 < uvbuf.size() && uvbuf.size()>0) ? uvbuf[uvIndex + (uv_swap_flag ? 0 : 1)] : 128;
-                float Yf = (float)Yc;
-                float Uf = (float)Uc - 128.0f;
-                float Vf = (float)Vc - 128.0f;
-                float rf, gf, bf;
-                if (full_range_flag == 1) {
-                    if (use_bt709_flag == 1) {
-                        rf = Yf + 1.792741f * Vf;
-                        gf = Yf - 0.213249f * Uf - 0.532909f * Vf;
-                        bf = Yf + 2.112402f * Uf;
-                    } else {
-                        rf = Yf + 1.596027f * Vf;
-                        gf = Yf - 0.391762f * Uf - 0.812968f * Vf;
-                        bf = Yf + 2.017232f * Uf;
-                    }
-                } else {
-                    float y_lin = 1.164383f * (Yf - 16.0f);
-                    if (use_bt709_flag == 1) {
-                        rf = y_lin + 1.792741f * Vf;
-                        gf = y_lin - 0.213249f * Uf - 0.532909f * Vf;
-                        bf = y_lin + 2.112402f * Uf;
-                    } else {
-                        rf = y_lin + 1.596027f * Vf;
-                        gf = y_lin - 0.391762f * Uf - 0.812968f * Vf;
-                        bf = y_lin + 2.017232f * Uf;
-                    }
-                }
-                int r = (int)std::round(std::max(0.0f, std::min(255.0f, rf)));
-                int g = (int)std::round(std::max(0.0f, std::min(255.0f, gf)));
-                int b = (int)std::round(std::max(0.0f, std::min(255.0f, bf)));
-                size_t outIdx = ((size_t)yy * (size_t)width + (size_t)xx) * comp;
-                rgb[outIdx + 0] = (unsigned char)r;
-                rgb[outIdx + 1] = (unsigned char)g;
-                rgb[outIdx + 2] = (unsigned char)b;
-            }
+    try { rgb.resize((size_t)job.width * (size_t)job.height * 3); } catch (...) { return false; }
+    for (int y = 0; y < job.height; ++y) {
+        const unsigned char* src = job.rgba.data() + (size_t)(job.height - 1 - y) * (size_t)job.width * 4;
+        unsigned char* dst = rgb.data() + (size_t)y * (size_t)job.width * 3;
+        for (int x = 0; x < job.width; ++x) { dst[x*3+0] = src[x*4+0]; dst[x*3+1] = src[x*4+1]; dst[x*3+2] = src[x*4+2]; }
+    }
+    return write_image(job.filename, job.format, job.width, job.height, 3, rgb.data());
+}
+
+static bool save_screenshot(const ScreenshotJob &job) {
+    if (!job.rgba.empty()) return save_output_capture(job);
+    YuvFrame in;
+    in.v4l2_pixfmt = job.pixfmt; in.width = job.width; in.height = job.height;
+    in.y = job.y.data(); in.uv = job.uv.empty() ? nullptr : job.uv.data();
+    in.y_stride = job.y_stride; in.uv_stride = job.uv_stride;
+    if (!yuv_convert_supported(job.pixfmt)) { std::cerr << "Screenshot: no CPU conversion for " << fourcc_to_str(job.pixfmt) << "\n"; return false; }
+    if (job.y.size() + job.uv.size() < yuv_frame_size(job.pixfmt, job.width, job.height)) { std::cerr << "Screenshot: incomplete frame, not saved\n"; return false; }
+    std::vector<unsigned char> rgb;
+    try { rgb.resize((size_t)job.width * (size_t)job.height * 3); } catch (...) { return false; }
+    if (!yuv_to_rgb24(in, job.color, rgb.data())) { std::cerr << "Screenshot: incomplete frame, not saved\n"; return false; }
+    return write_image(job.filename, job.format, job.width, job.height, 3, rgb.data());
+}
+
+// Single background thread working off a bounded queue (screenshots, the --stream encoder). Up to
+// max_queued jobs wait or run at a time; submit() refuses more, which bounds the memory they hold and
+// never makes the render thread wait.
+template <typename Job>
+class BoundedWorker {
+public:
+    BoundedWorker(size_t max_queued, std::function<void(Job&)> work) : max_queued_(max_queued), work_(std::move(work)) {}
+    ~BoundedWorker() { stop(); }
+    bool full() { std::lock_guard<std::mutex> lk(m_); return jobs_.size() + (running_ ? 1 : 0) >= max_queued_; }
+    bool submit(Job &&job) {
+        std::lock_guard<std::mutex> lk(m_);
+        if (jobs_.size() + (running_ ? 1 : 0) >= max_queued_) return false;
+        if (!th_.joinable()) th_ = std::thread(&BoundedWorker::run, this);
+        jobs_.push_back(std::move(job));
+        cv_.notify_one();
+        return true;
+    }
+    void stop() {
+        { std::lock_guard<std::mutex> lk(m_); quit_ = true; }
+        cv_.notify_one();
+        if (th_.joinable()) th_.join();
+    }
+private:
+    void run() {
+        std::unique_lock<std::mutex> lk(m_);
+        while (true) {
+            cv_.wait(lk, [this]{ return !jobs_.empty() || quit_; });
+            if (jobs_.empty()) break;
+            Job job = std::move(jobs_.front()); jobs_.pop_front(); running_ = true;
+            lk.unlock();
+            work_(job);
+            lk.lock();
+            running_ = false;
         }
-    } else {
-        for (size_t i=0;i<rgb.size();++i) rgb[i]=0;
     }
-    int stride = width * comp;
-    stbi_write_png(filename_png.c_str(), width, height, comp, rgb.data(), stride);
+    const size_t max_queued_;
+    std::function<void(Job&)> work_;
+    std::mutex m_;
+    std::condition_variable cv_;
+    std::thread th_;
+    std::deque<Job> jobs_;
+    bool running_ = false, quit_ = false;
+};
+
+// Screenshot conversion/encoding; 8 queued jobs are enough for a short --capture-burst.
+static const size_t SCREENSHOT_QUEUE = 8;
+static void run_screenshot_job(ScreenshotJob &job) {
+    vlogln(std::string("[screenshot-worker] start: ") + job.filename + " " + std::to_string(job.width) + "x" + std::to_string(job.height) + " " + (job.rgba.empty() ? fourcc_to_str(job.pixfmt) : std::string("output")));
+    int64_t t0 = steady_ms();
+    if (!save_screenshot(job)) std::cerr << "Screenshot: writing " << job.filename << " failed\n";
+    else vlogln(std::string("[screenshot-worker] saved: ") + job.filename + " in " + std::to_string(steady_ms() - t0) + "ms");
 }
 
-// restart_v4l_stream unchanged (V4L2-only)
+// Stop the stream, re-request, map and queue the buffers, re-export them as DMABUFs when a zero-copy path needs them, restart.
 static bool restart_v4l_stream(int &fd, std::vector<std::vector<PlaneMap>> &buffers) {
     if (fd >= 0) {
         int typeoff = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
         if (ioctl(fd, VIDIOC_STREAMOFF, &typeoff) < 0) {
             if (opt_verbose) vlogln(std::string("restart_v4l_stream: STREAMOFF failed: ") + strerror(errno));
         }
-        for (auto &bvec : buffers) {
-            for (auto &pm : bvec) {
-                if (pm.addr && pm.length) { munmap(pm.addr, pm.length); pm.addr=nullptr; pm.length=0; }
-            }
-        }
+        unmap_buffers(buffers);
         buffers.clear();
     }
 
     v4l2_requestbuffers req; memset(&req,0,sizeof(req));
-    req.count = BUF_COUNT; req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE; req.memory = V4L2_MEMORY_MMAP;
+    req.count = opt_buffer_count; req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE; req.memory = V4L2_MEMORY_MMAP;
     if (xioctl(fd, VIDIOC_REQBUFS, &req) < 0) {
         if (opt_verbose) vlogln(std::string("restart_v4l_stream: VIDIOC_REQBUFS failed: ") + strerror(errno));
         return false;
@@ -370,7 +1620,7 @@ static bool restart_v4l_stream(int &fd, std::vector<std::vector<PlaneMap>> &buff
         bufq.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE; bufq.index = i; bufq.memory = V4L2_MEMORY_MMAP; bufq.m.planes = planes; bufq.length = VIDEO_MAX_PLANES;
         if (xioctl(fd, VIDIOC_QUERYBUF, &bufq) < 0) {
             if (opt_verbose) vlogln(std::string("restart_v4l_stream: VIDIOC_QUERYBUF failed: ") + strerror(errno));
-            for (auto &bvec : buffers) for (auto &pm : bvec) if (pm.addr && pm.length) munmap(pm.addr, pm.length);
+            unmap_buffers(buffers);
             buffers.clear(); return false;
         }
         buffers[i].resize(bufq.length);
@@ -379,34 +1629,171 @@ static bool restart_v4l_stream(int &fd, std::vector<std::vector<PlaneMap>> &buff
             buffers[i][p].addr = mmap(nullptr, planes[p].length, PROT_READ|PROT_WRITE, MAP_SHARED, fd, planes[p].m.mem_offset);
             if (buffers[i][p].addr == MAP_FAILED) {
                 if (opt_verbose) vlogln(std::string("restart_v4l_stream: mmap failed: ") + strerror(errno));
-                for (auto &bvec : buffers) for (auto &pm : bvec) if (pm.addr && pm.length) munmap(pm.addr, pm.length);
+                unmap_buffers(buffers);
                 buffers.clear(); return false;
             }
         }
         if (xioctl(fd, VIDIOC_QBUF, &bufq) < 0) {
             if (opt_verbose) vlogln(std::string("restart_v4l_stream: VIDIOC_QBUF failed: ") + strerror(errno));
-            for (auto &bvec : buffers) for (auto &pm : bvec) if (pm.addr && pm.length) munmap(pm.addr, pm.length);
+            unmap_buffers(buffers);
             buffers.clear(); return false;
         }
     }
 
+    set_plane_strides(fd, buffers);
+    if (want_dmabuf_export() && !export_dmabufs(fd, buffers)) vlogln("restart_v4l_stream: DMABUF export failed, falling back to copy upload");
+
     int t = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
     if (xioctl(fd, VIDIOC_STREAMON, &t) < 0) {
         if (opt_verbose) vlogln(std::string("restart_v4l_stream: VIDIOC_STREAMON failed: ") + strerror(errno));
-        for (auto &bvec : buffers) for (auto &pm : bvec) if (pm.addr && pm.length) munmap(pm.addr, pm.length);
+        unmap_buffers(buffers);
         buffers.clear(); return false;
     }
     if (opt_verbose) vlogln("restart_v4l_stream: stream restart successful");
     return true;
 }
 
+enum RecoverResult { RECOVER_OK = 0, RECOVER_NO_SIGNAL = 1, RECOVER_FAILED = 2 };
+
+static bool same_dv_timings(const v4l2_dv_timings &a, const v4l2_dv_timings &b) {
+    return a.type == b.type && a.bt.width == b.bt.width && a.bt.height == b.bt.height &&
+           a.bt.interlaced == b.bt.interlaced && a.bt.pixelclock == b.bt.pixelclock;
+}
+
+// The receiver's current input timings. RECOVER_OK with has_dv=false for devices without DV timings
+// (ENOTTY/ENODATA, e.g. USB grabbers); RECOVER_NO_SIGNAL while nothing is locked (ENOLINK/ENOLCK/ERANGE).
+static RecoverResult query_dv_timings(int fd, v4l2_dv_timings &t, bool &has_dv) {
+    memset(&t, 0, sizeof(t)); has_dv = false;
+    if (xioctl(fd, VIDIOC_QUERY_DV_TIMINGS, &t) == 0) { has_dv = true; return RECOVER_OK; }
+    int e = errno;
+    if (e == ENOTTY || e == ENODATA || e == EINVAL) return RECOVER_OK;
+    if (e == ENOLINK || e == ENOLCK || e == ERANGE) return RECOVER_NO_SIGNAL;
+    vlogln(std::string("query_dv_timings: VIDIOC_QUERY_DV_TIMINGS failed: ") + strerror(e));
+    return RECOVER_FAILED;
+}
+
+// Does a SOURCE_CHANGE need the stream restarted? false when timings and format are what we stream.
+static bool source_changed(int fd, uint32_t w, uint32_t h, uint32_t pf) {
+    v4l2_dv_timings now; bool has_dv = false;
+    if (query_dv_timings(fd, now, has_dv) != RECOVER_OK) return true;
+    if (has_dv) {
+        v4l2_dv_timings cur; memset(&cur, 0, sizeof(cur));
+        if (xioctl(fd, VIDIOC_G_DV_TIMINGS, &cur) < 0 || !same_dv_timings(now, cur)) return true;
+    }
+    uint32_t nw = 0, nh = 0, npf = 0;
+    return !get_v4l2_format(fd, nw, nh, npf) || nw != w || nh != h || npf != pf;
+}
+
+// unmap and free all capture buffers; S_DV_TIMINGS and S_FMT are refused (EBUSY) while any exist
+static void free_capture_buffers(int fd, std::vector<std::vector<PlaneMap>> &buffers) {
+    unmap_buffers(buffers); buffers.clear();
+    v4l2_requestbuffers req; memset(&req,0,sizeof(req));
+    req.count = 0; req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE; req.memory = V4L2_MEMORY_MMAP;
+    (void)xioctl(fd, VIDIOC_REQBUFS, &req);
+}
+
+// Restart streaming on an open device after the signal came back or changed: follow new DV timings and
+// requeue the mapped buffers. Buffers are only reallocated (with the format set again) when the new frame
+// no longer fits them, which new timings always imply.
+static RecoverResult recover_stream(int fd, std::vector<std::vector<PlaneMap>> &buffers, uint32_t &w, uint32_t &h, uint32_t &pf) {
+    v4l2_dv_timings timings; bool has_dv = false;
+    RecoverResult q = query_dv_timings(fd, timings, has_dv);
+    if (q != RECOVER_OK) return q;
+
+    int type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    if (ioctl(fd, VIDIOC_STREAMOFF, &type) < 0) vlogln(std::string("recover_stream: STREAMOFF failed: ") + strerror(errno));
+    if (has_dv) {
+        v4l2_dv_timings cur; memset(&cur, 0, sizeof(cur));
+        if (xioctl(fd, VIDIOC_G_DV_TIMINGS, &cur) < 0 || !same_dv_timings(timings, cur)) {
+            free_capture_buffers(fd, buffers);
+            if (xioctl(fd, VIDIOC_S_DV_TIMINGS, &timings) < 0) { vlogln(std::string("recover_stream: VIDIOC_S_DV_TIMINGS failed: ") + strerror(errno)); return RECOVER_FAILED; }
+            vlogln("recover_stream: new DV timings " + std::to_string(timings.bt.width) + "x" + std::to_string(timings.bt.height) + (timings.bt.interlaced ? "i" : "p"));
+        }
+    }
+
+    v4l2_format fmt; memset(&fmt,0,sizeof(fmt)); fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    if (xioctl(fd, VIDIOC_G_FMT, &fmt) < 0) { vlogln(std::string("recover_stream: VIDIOC_G_FMT failed: ") + strerror(errno)); return RECOVER_FAILED; }
+    bool fits = !buffers.empty();
+    for (auto &b : buffers) {
+        if (b.size() != fmt.fmt.pix_mp.num_planes) { fits = false; break; }
+        for (unsigned p = 0; p < b.size(); ++p) if (b[p].length < fmt.fmt.pix_mp.plane_fmt[p].sizeimage) fits = false;
+    }
+    if (!fits) {
+        if (!buffers.empty()) { vlogln("recover_stream: frame no longer fits the buffers, reallocating"); free_capture_buffers(fd, buffers); }
+        // same request as at startup: the preferred format at the size the receiver reports
+        request_capture_format(fd, has_dv ? timings.bt.width : fmt.fmt.pix_mp.width, has_dv ? timings.bt.height : fmt.fmt.pix_mp.height, fmt.fmt.pix_mp.pixelformat);
+        if (!get_v4l2_format(fd, w, h, pf) || w == 0 || h == 0) return RECOVER_NO_SIGNAL;
+        int rfd = fd;
+        return restart_v4l_stream(rfd, buffers) ? RECOVER_OK : RECOVER_FAILED;
+    }
+    w = fmt.fmt.pix_mp.width; h = fmt.fmt.pix_mp.height; pf = fmt.fmt.pix_mp.pixelformat;
+    // STREAMOFF dequeued everything: hand all buffers back to the driver as they are
+    for (unsigned i = 0; i < buffers.size(); ++i) {
+        v4l2_buffer b; v4l2_plane planes[VIDEO_MAX_PLANES]; memset(&b,0,sizeof(b)); memset(planes,0,sizeof(planes));
+        b.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE; b.memory = V4L2_MEMORY_MMAP; b.index = i;
+        b.m.planes = planes; b.length = (unsigned)buffers[i].size();
+        if (xioctl(fd, VIDIOC_QBUF, &b) < 0) { vlogln(std::string("recover_stream: VIDIOC_QBUF failed: ") + strerror(errno)); return RECOVER_FAILED; }
+    }
+    if (xioctl(fd, VIDIOC_STREAMON, &type) < 0) { vlogln(std::string("recover_stream: VIDIOC_STREAMON failed: ") + strerror(errno)); return RECOVER_FAILED; }
+    return RECOVER_OK;
+}
+
+// Close and reopen the capture device, then recover_stream() on the fresh fd (capture thread).
+static RecoverResult reopen_capture_device(const std::string &device, int &fd, std::vector<std::vector<PlaneMap>> &buffers, uint32_t &w, uint32_t &h, uint32_t &pf) {
+    unmap_buffers(buffers); buffers.clear();
+    if (fd >= 0) { close(fd); fd = -1; }
+    fd = open(device.c_str(), O_RDWR | O_NONBLOCK);
+    if (fd < 0) { vlogln("reopen_capture_device: open " + device + " failed: " + strerror(errno)); return RECOVER_FAILED; }
+    v4l2_event_subscription sub; memset(&sub,0,sizeof(sub)); sub.type = V4L2_EVENT_SOURCE_CHANGE;
+    (void)ioctl(fd, VIDIOC_SUBSCRIBE_EVENT, &sub);
+    RecoverResult r = recover_stream(fd, buffers, w, h, pf);
+    if (r == RECOVER_FAILED) { unmap_buffers(buffers); buffers.clear(); close(fd); fd = -1; }
+    return r;
+}
+
+// One capture device. Source 0 is --device (or --replay) and takes every upload path; the others
+// (captureSource<N> in control_ini.txt) feed their segments through a copy upload into their own texture
+// pair. Each runs its own capture thread with its own buffer pool and recovery state machine, and losing
+// one only puts the pattern on the segments it feeds. Every input carries the fullInputSize layout: a
+// segment is read from the same sub-block of whichever source feeds it.
+struct CaptureSource {
+    int index = 0;
+    std::string device;
+    // capture thread (the render thread reads cur_* under restart_mutex after need_gl_update)
+    int fd = -1;
+    std::vector<std::vector<PlaneMap>> buffers;
+    uint32_t cur_width = DEFAULT_WIDTH, cur_height = DEFAULT_HEIGHT, cur_pixfmt = 0;
+    bool recovering = false, awaiting_first_frame = false, recover_released = false, counted_recovering = false;
+    int recover_attempt = 0;
+    int64_t recover_started_ms = 0, recover_next_ms = 0, first_frame_deadline_ms = 0;
+    uint32_t last_sequence = 0, last_sequence_gen = 0; bool last_sequence_valid = false;
+    // shared with the render thread
+    FrameHandoff handoff;
+    std::mutex restart_mutex;
+    std::atomic<int64_t> last_good_frame_ms{0}, last_recovered_ms{0}; // every good frame, for the pattern timeout
+    std::atomic<bool> auto_reopen_in_progress{false};
+    std::atomic<bool> need_gl_update{false};
+    std::atomic<bool> capture_signal_lost{false}; // capture -> render: show the pattern now
+    std::atomic<bool> reopen_requested{false};    // render -> capture: run the background reopen
+    std::thread thread;
+    // render thread, sources other than 0 (source 0 keeps its textures in main)
+    GLuint texY = 0, texUV = 0;
+    uint32_t tex_width = 0, tex_height = 0, tex_pixfmt = 0;
+    bool signal_lost = false;
+    std::vector<unsigned char> uv_swapped;
+};
+
 // Forward declarations so loadOffsetsFromModuleFiles can appear earlier if needed:
 static std::string joinPath(const std::string &dir, const std::string &name);
 static bool parseXYLine(const std::string &line, int &x, int &y);
 
 // Implementation of loadOffsetsFromModuleFiles
-static bool loadOffsetsFromModuleFiles(const std::array<std::string,3> &names, std::vector<GLint> &out) {
-    out.assign(150 * 2, 0);
+// 'tiles' x/y pairs, filled from the module files in order (missing lines stay 0,0); tileModule (optional)
+// gets the index into 'names' each tile's offset came from, -1 for tiles no file covered
+static bool loadOffsetsFromModuleFiles(const std::vector<std::string> &names, int tiles, std::vector<GLint> &out,
+                                       std::vector<int> *tileModule = nullptr) {
+    out.assign((size_t)std::max(tiles, 0) * 2, 0);
+    if (tileModule) tileModule->assign((size_t)std::max(tiles, 0), -1);
     size_t fillIndex = 0;
     std::string exeDir = getExecutableDir();
     for (size_t m = 0; m < names.size(); ++m) {
@@ -420,6 +1807,7 @@ static bool loadOffsetsFromModuleFiles(const std::array<std::string,3> &names, s
             while (std::getline(f, line) && fillIndex < out.size()) {
                 int x = 0, y = 0;
                 if (!parseXYLine(line, x, y)) continue;
+                if (tileModule) (*tileModule)[fillIndex / 2] = (int)m;
                 out[fillIndex++] = (GLint)x;
                 out[fillIndex++] = (GLint)y;
             }
@@ -429,6 +1817,320 @@ static bool loadOffsetsFromModuleFiles(const std::array<std::string,3> &names, s
     return true;
 }
 
+// Reject layouts the layout table cannot hold or the shaders cannot draw.
+static bool validate_control_params(const ControlParams &c, std::string &err) {
+    if (c.fullInputW <= 0 || c.fullInputH <= 0 || c.subBlockW <= 0 || c.subBlockH <= 0) err = "fullInputSize/subBlockSize must be positive";
+    else if (c.segmentsX < 1 || c.segmentsY < 1) err = "segments must be at least 1,1";
+    else if (c.tileW <= 0 || c.tileH <= 0 || c.spacingX < 0 || c.spacingY < 0 || c.marginX < 0) err = "tileSize must be positive, spacing/marginX not negative";
+    else if (c.numTilesPerRow < 1 || c.numTilesPerCol < 1 || (long)c.numTilesPerRow * c.numTilesPerCol > MAX_TILES_PER_SEGMENT) err = "numTiles must give 1.." + std::to_string(MAX_TILES_PER_SEGMENT) + " tiles";
+    else if ((long)c.segmentsX * c.segmentsY > MAX_SEGMENTS) err = "more than " + std::to_string(MAX_SEGMENTS) + " segments";
+    else return true;
+    return false;
+}
+
+// Everything a control_ini.txt / m<serial>.txt change affects, parsed off the render thread. Published
+// through ConfigWatcher as a shared_ptr and never modified afterwards.
+struct ConfigSnapshot {
+    ControlParams ctrl;
+    int tiles = 0;                           // numTilesPerRow * numTilesPerCol
+    std::vector<std::vector<GLint>> offsets; // tile x/y offsets of segment 1..N, N = segmentsX*segmentsY (at most MAX_SEGMENTS)
+    // texLayout (RGBA32I, LAYOUT_TABLE_WIDTH wide, row-major): entry r < numTilesPerCol has x = 1 if tile row r
+    // is a gap row, then from layoutTileBase the offsets (xy) and colorLut row (z) of every segment, 'tiles' entries each
+    std::vector<GLint> layoutTable;
+    int layoutTileBase = 0, layoutRows = 0;
+    // texColorLut (RGBA8, COLOR_LUT_SIZE wide): row 0 identity, then one row per ctrl.calibration entry;
+    // colorLutRows == 1 means no calibration and the shaders skip the lookup
+    std::vector<uint8_t> colorLut;
+    int colorLutRows = 1;
+    std::vector<int> segmentSource;          // capture source (0-based, 0 = --device) of segment 1..N
+    const std::vector<GLint>& segment_offsets(int segment) const {
+        return offsets[(size_t)(std::min(std::max(segment, 1), (int)offsets.size()) - 1)];
+    }
+    int segment_source(int segment) const {
+        return segmentSource[(size_t)(std::min(std::max(segment, 1), (int)segmentSource.size()) - 1)];
+    }
+};
+
+static std::shared_ptr<const ConfigSnapshot> build_config_snapshot(const ControlParams &ctrl) {
+    auto snap = std::make_shared<ConfigSnapshot>();
+    snap->ctrl = ctrl;
+    snap->tiles = std::min(std::max(1, ctrl.numTilesPerRow * ctrl.numTilesPerCol), MAX_TILES_PER_SEGMENT);
+    snap->offsets.resize((size_t)std::min(std::max(1, ctrl.segmentsX * ctrl.segmentsY), MAX_SEGMENTS));
+    std::vector<std::vector<int>> tileModule(snap->offsets.size());
+    for (size_t i = 0; i < snap->offsets.size(); ++i)
+        loadOffsetsFromModuleFiles(buildModuleFilenames(ctrl, (int)i + 1), snap->tiles, snap->offsets[i], &tileModule[i]);
+    // the first source listing a segment feeds it
+    snap->segmentSource.assign(snap->offsets.size(), -1);
+    for (size_t src = 0; src < ctrl.sourceSegments.size(); ++src)
+        for (int seg : ctrl.sourceSegments[src])
+            if (seg >= 1 && seg <= (int)snap->segmentSource.size() && snap->segmentSource[(size_t)seg - 1] < 0) snap->segmentSource[(size_t)seg - 1] = (int)src;
+    for (int &src : snap->segmentSource) if (src < 0) src = 0;
+
+    // one LUT row per calibrated serial, in map order
+    std::map<int, int> lutRow;
+    snap->colorLutRows = 1 + (int)ctrl.calibration.size();
+    snap->colorLut.resize((size_t)snap->colorLutRows * COLOR_LUT_SIZE * 4);
+    for (int i = 0; i < COLOR_LUT_SIZE; ++i) for (int c = 0; c < 4; ++c) snap->colorLut[(size_t)i * 4 + c] = c == 3 ? 255 : (uint8_t)i;
+    for (const auto &kv : ctrl.calibration) {
+        int row = 1 + (int)lutRow.size(); lutRow[kv.first] = row;
+        uint8_t *dst = &snap->colorLut[(size_t)row * COLOR_LUT_SIZE * 4];
+        for (int i = 0; i < COLOR_LUT_SIZE; ++i) {
+            float in = std::pow(i / (float)(COLOR_LUT_SIZE - 1), kv.second.gamma);
+            for (int c = 0; c < 3; ++c) dst[i * 4 + c] = (uint8_t)std::lround(std::min(std::max(kv.second.gain[c] * in, 0.0f), 1.0f) * 255.0f);
+            dst[i * 4 + 3] = 255;
+        }
+    }
+
+    const int rows = std::max(ctrl.numTilesPerCol, 0);
+    snap->layoutTileBase = rows;
+    size_t entries = (size_t)rows + snap->offsets.size() * (size_t)snap->tiles;
+    snap->layoutRows = (int)((entries + LAYOUT_TABLE_WIDTH - 1) / LAYOUT_TABLE_WIDTH);
+    snap->layoutTable.assign((size_t)snap->layoutRows * LAYOUT_TABLE_WIDTH * 4, 0);
+    for (int r : ctrl.gapRows) if (r >= 0 && r < rows) snap->layoutTable[(size_t)r * 4] = 1;
+    for (size_t i = 0; i < snap->offsets.size(); ++i) {
+        const std::vector<int> &serials = segmentModuleSerials(ctrl, (int)i + 1);
+        GLint *e = &snap->layoutTable[((size_t)rows + i * (size_t)snap->tiles) * 4];
+        for (int t = 0; t < snap->tiles; ++t, e += 4) {
+            e[0] = snap->offsets[i][(size_t)t * 2]; e[1] = snap->offsets[i][(size_t)t * 2 + 1];
+            int m = tileModule[i][(size_t)t];
+            auto it = m >= 0 ? lutRow.find(serials[(size_t)m]) : lutRow.end();
+            e[2] = it != lutRow.end() ? it->second : 0;
+        }
+    }
+    return snap;
+}
+
+// Background reload of control_ini.txt and the module offset files: inotify on the directories they are
+// looked up in (editors replace files by rename, so single-file watches would go stale), a short debounce,
+// then a complete, validated snapshot is swapped in. current() is all the render thread ever calls; 'k'
+// only asks for an immediate rebuild.
+class ConfigWatcher {
+public:
+    static const int DEBOUNCE_MS = 50;
+    ~ConfigWatcher() { stop(); }
+    void start(std::shared_ptr<const ConfigSnapshot> initial, int wake_efd) {
+        std::atomic_store(&snap_, initial);
+        wake_efd_ = wake_efd;
+        efd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        ifd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (ifd_ < 0) std::cerr << "Warning: inotify unavailable (" << strerror(errno) << "), control_ini.txt reloads only with 'k'\n";
+        std::string exeDir = getExecutableDir();
+        const std::string dirs[2] = { exeDir.empty() ? std::string(".") : exeDir, "." };
+        for (const std::string &d : dirs)
+            if (ifd_ >= 0 && inotify_add_watch(ifd_, d.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) vlogln("config: cannot watch " + d + ": " + strerror(errno));
+        if (efd_ >= 0) th_ = std::thread(&ConfigWatcher::run, this);
+    }
+    void request_reload() { FrameHandoff::signal(efd_); }
+    std::shared_ptr<const ConfigSnapshot> current() const { return std::atomic_load(&snap_); }
+    void stop() {
+        if (th_.joinable()) { quit_.store(true); FrameHandoff::signal(efd_); th_.join(); }
+        if (ifd_ >= 0) { close(ifd_); ifd_ = -1; }
+        if (efd_ >= 0) { close(efd_); efd_ = -1; }
+    }
+private:
+    static bool relevant(const char* name) {
+        std::string n(name);
+        if (n == "control_ini.txt") return true;
+        // m<serial>.txt / modul<N>.txt; serials may have changed with the ini, so any of them counts
+        return n.size() > 5 && n[0] == 'm' && n.compare(n.size() - 4, 4, ".txt") == 0;
+    }
+    bool drain_inotify() {
+        alignas(inotify_event) char buf[4096]; bool hit = false;
+        ssize_t len;
+        while ((len = read(ifd_, buf, sizeof(buf))) > 0) {
+            for (char* p = buf; p < buf + len; ) {
+                const inotify_event* ev = (const inotify_event*)p;
+                if (ev->len > 0 && relevant(ev->name)) hit = true;
+                p += sizeof(inotify_event) + ev->len;
+            }
+        }
+        return hit;
+    }
+    void reload() {
+        int64_t t0 = steady_ms();
+        ControlParams ctrl; std::string err;
+        if (!loadControlIni("control_ini.txt", ctrl)) { std::cerr << "config: control_ini.txt not found, keeping the current configuration\n"; return; }
+        if (!validate_control_params(ctrl, err)) { std::cerr << "config: control_ini.txt rejected (" << err << "), keeping the current configuration\n"; return; }
+        std::atomic_store(&snap_, build_config_snapshot(ctrl));
+        FrameHandoff::signal(wake_efd_);
+        vlogln("config: reloaded in " + std::to_string(steady_ms() - t0) + "ms");
+    }
+    void run() {
+        bool pending = false;
+        while (!quit_.load()) {
+            struct pollfd p[2]; int n = 0;
+            p[n].fd = efd_; p[n].events = POLLIN; p[n].revents = 0; ++n;
+            if (ifd_ >= 0) { p[n].fd = ifd_; p[n].events = POLLIN; p[n].revents = 0; ++n; }
+            int ret = poll(p, n, pending ? DEBOUNCE_MS : -1);
+            if (ret < 0) { if (errno == EINTR) continue; perror("config: poll"); break; }
+            if (quit_.load()) break;
+            if (ret == 0) { pending = false; reload(); continue; } // quiet for DEBOUNCE_MS after the last write
+            if (p[0].revents & POLLIN) { FrameHandoff::drain(efd_); pending = false; reload(); continue; }
+            if (n > 1 && (p[1].revents & POLLIN) && drain_inotify()) pending = true;
+        }
+    }
+    std::shared_ptr<const ConfigSnapshot> snap_;
+    std::thread th_;
+    std::atomic<bool> quit_{false};
+    int ifd_ = -1, efd_ = -1, wake_efd_ = -1;
+};
+
+// Precomputed tile mapping (--tile-mode=remap): for each logical output pixel of the tile grid, the texY
+// texel the analytic path in shader.frag.glsl would sample. Stored as RG16UI, REMAP_NONE = black.
+static const uint16_t REMAP_NONE = 0xFFFF;
+
+struct RemapTable {
+    int width = 0, height = 0;     // texels (grid size rounded up)
+    float gridW = 0, gridH = 0;    // exact logical grid size, used by the shader for scaling
+    std::vector<uint16_t> data;    // width*height RG pairs, row 0 = top of the grid
+};
+
+static bool remap_is_gap(const std::vector<int> &gap_rows, int idx) {
+    return std::find(gap_rows.begin(), gap_rows.end(), idx) != gap_rows.end();
+}
+
+// Logical grid size as computed by shader.frag.glsl (rows listed in gap_rows have no spacing above them).
+static void tile_grid_size(const ControlParams &c, const std::vector<int> &gap_rows, float &gridW, float &gridH) {
+    gridW = 2.0f * c.marginX + (float)c.numTilesPerRow * c.tileW + (float)(c.numTilesPerRow - 1) * c.spacingX;
+    gridH = 0.0f;
+    for (int r = 0; r < c.numTilesPerCol; ++r) { gridH += c.tileH; if (r < c.numTilesPerCol - 1 && !remap_is_gap(gap_rows, r + 1)) gridH += c.spacingY; }
+}
+
+// Mirrors the fragment shader math (same float steps, sampling at output pixel centres) so both modes match.
+static bool build_remap_table(const ControlParams &c, const std::vector<int> &gap_rows, const std::vector<GLint> &offsets,
+                              int segmentIndex, int textureIsFull, int rot, int flip_x, int flip_y,
+                              int texW, int texH, RemapTable &out)
+{
+    if (texW <= 0 || texH <= 0 || texW >= REMAP_NONE || texH >= REMAP_NONE) return false;
+    if (c.numTilesPerRow <= 0 || c.numTilesPerCol <= 0) return false;
+    float gridW = 0.0f, gridH = 0.0f;
+    tile_grid_size(c, gap_rows, gridW, gridH);
+    out.gridW = std::max(gridW, 1.0f); out.gridH = std::max(gridH, 1.0f);
+    out.width = (int)std::ceil(out.gridW); out.height = (int)std::ceil(out.gridH);
+    out.data.assign((size_t)out.width * (size_t)out.height * 2, REMAP_NONE);
+
+    int segIdx = std::min(std::max(segmentIndex, 1), std::max(1, c.segmentsX * c.segmentsY)) - 1;
+    int segCol = segIdx % std::max(1, c.segmentsX);
+    int segRow = segIdx / std::max(1, c.segmentsX);
+    float subOriginX = (float)segCol * c.subBlockW, subOriginY = (float)segRow * c.subBlockH;
+    float cellW = c.tileW + c.spacingX;
+
+    // tile column only depends on x, tile row only on y: resolve them once per column/row
+    std::vector<int> colTile(out.width, -1);
+    for (int gx = 0; gx < out.width; ++gx) {
+        float x = (float)gx + 0.5f;
+        if (x >= out.gridW) continue;
+        int tc = (int)std::floor((x - c.marginX + 1e-6f) / cellW);
+        if (tc >= 0 && tc < c.numTilesPerRow) colTile[gx] = tc;
+    }
+
+    for (int t = 0; t < out.height; ++t) {
+        float lby = (float)(out.height - 1 - t) + 0.5f; // shader works bottom-up (gl_FragCoord)
+        if (lby >= out.gridH) continue;
+        float y = out.gridH - 1.0f - lby;
+        int tileRow = -1; float yAcc = 0.0f;
+        for (int r = 0; r < c.numTilesPerCol; ++r) {
+            float rowStart = yAcc, rowEnd = rowStart + c.tileH;
+            if (y >= rowStart && y < rowEnd) { tileRow = r; break; }
+            yAcc = remap_is_gap(gap_rows, r + 1) ? rowEnd : rowEnd + c.spacingY;
+        }
+        if (tileRow < 0) continue;
+        float tileStartY = 0.0f;
+        for (int r = 0; r < tileRow; ++r) { tileStartY += c.tileH; if (!remap_is_gap(gap_rows, r + 1)) tileStartY += c.spacingY; }
+        if (!(y >= tileStartY && y < tileStartY + c.tileH)) continue;
+        float pxInTileY = y - tileStartY;
+        int sourceTileRow = c.inputTilesTopToBottom == 1 ? tileRow : (c.numTilesPerCol - 1 - tileRow);
+        uint16_t *row = &out.data[(size_t)t * (size_t)out.width * 2];
+
+        for (int gx = 0; gx < out.width; ++gx) {
+            int tileCol = colTile[gx];
+            if (tileCol < 0) continue;
+            float x = (float)gx + 0.5f;
+            float tileStartX = c.marginX + (float)tileCol * cellW;
+            if (!(x >= tileStartX && x < tileStartX + c.tileW)) continue;
+            int ci = tileRow * c.numTilesPerRow + tileCol;
+            float offx = ((size_t)ci * 2 + 1 < offsets.size()) ? (float)offsets[ci * 2 + 0] : 0.0f;
+            float offy = ((size_t)ci * 2 + 1 < offsets.size()) ? (float)offsets[ci * 2 + 1] : 0.0f;
+            float fetchX = c.tileW * (float)tileCol + (x - tileStartX) - offx;
+            float fetchY = c.tileH * (float)sourceTileRow + pxInTileY - offy;
+            float srcX0 = c.tileW * (float)tileCol, srcY0 = c.tileH * (float)sourceTileRow;
+            if (fetchX < srcX0 || fetchX >= srcX0 + c.tileW || fetchY < srcY0 || fetchY >= srcY0 + c.tileH) continue;
+
+            float inX = std::min(std::max(subOriginX + fetchX, 0.0f), c.fullInputW - 1.0f);
+            float inY = std::min(std::max(subOriginY + fetchY, 0.0f), c.fullInputH - 1.0f);
+            float u, v;
+            if (textureIsFull == 1) { u = inX / c.fullInputW; v = 1.0f - inY / c.fullInputH; }
+            else { u = (inX - subOriginX) / c.subBlockW; v = 1.0f - (inY - subOriginY) / c.subBlockH; }
+            u = std::min(std::max(u, 0.0f), 1.0f); v = std::min(std::max(v, 0.0f), 1.0f);
+
+            float px = u - 0.5f, py = v - 0.5f, ru, rv;
+            switch (rot & 3) {
+                case 0: ru = px; rv = py; break;
+                case 1: ru = py; rv = -px; break;
+                case 2: ru = -px; rv = -py; break;
+                default: ru = -py; rv = px; break;
+            }
+            u = ru + 0.5f; v = rv + 0.5f;
+            if (flip_x == 1) u = 1.0f - u;
+            if (flip_y == 1) v = 1.0f - v;
+            u = std::min(std::max(u, 0.0f), 1.0f); v = std::min(std::max(v, 0.0f), 1.0f);
+
+            // GL_NEAREST texel selection
+            int ti = std::min(std::max((int)std::floor(u * (float)texW), 0), texW - 1);
+            int tj = std::min(std::max((int)std::floor(v * (float)texH), 0), texH - 1);
+            row[gx * 2 + 0] = (uint16_t)ti; row[gx * 2 + 1] = (uint16_t)tj;
+        }
+    }
+    return true;
+}
+
+// --tile-mode=instanced: one instance per tile for shader_tile.vert.glsl (attribute layout = member order).
+struct TileInstance {
+    float dst[4];   // visible part of the tile in logical grid pixels: x, y (top-down, as outPxTL in the shader), w, h
+    float src[2];   // sub-block pixel (fetch coordinates) shown at dst x/y
+    float index;    // tile index within the sub-block (view mode 2)
+};
+
+// Same placement, offsets and clipping as the fragment path of shader.frag.glsl: a tile shifted by its offset
+// only shows the part that still falls inside its own source tile, everything else stays black.
+static void build_tile_instances(const ControlParams &c, const std::vector<int> &gap_rows, const std::vector<GLint> &offsets,
+                                 std::vector<TileInstance> &out) {
+    float gridW = 0.0f, gridH = 0.0f;
+    tile_grid_size(c, gap_rows, gridW, gridH);
+    float tileStartY = 0.0f;
+    for (int r = 0; r < c.numTilesPerCol; ++r) {
+        int sourceTileRow = c.inputTilesTopToBottom == 1 ? r : (c.numTilesPerCol - 1 - r);
+        for (int col = 0; col < c.numTilesPerRow; ++col) {
+            int ci = r * c.numTilesPerRow + col;
+            float offx = ((size_t)ci * 2 + 1 < offsets.size()) ? (float)offsets[ci * 2 + 0] : 0.0f;
+            float offy = ((size_t)ci * 2 + 1 < offsets.size()) ? (float)offsets[ci * 2 + 1] : 0.0f;
+            float x0 = c.marginX + (float)col * (c.tileW + c.spacingX) + std::max(0.0f, offx);
+            float x1 = c.marginX + (float)col * (c.tileW + c.spacingX) + std::min(c.tileW, c.tileW + offx);
+            float y0 = tileStartY + std::max(0.0f, offy), y1 = tileStartY + std::min(c.tileH, c.tileH + offy);
+            float sx = c.tileW * (float)col + std::max(0.0f, offx) - offx;
+            float sy = c.tileH * (float)sourceTileRow + std::max(0.0f, offy) - offy;
+            // the shader maps outPxTL.y = gridH - 1 - logical bottom-up y, so the visible rows are [-1, gridH - 1)
+            if (x0 < 0.0f) { sx -= x0; x0 = 0.0f; }
+            if (y0 < -1.0f) { sy -= y0 + 1.0f; y0 = -1.0f; }
+            x1 = std::min(x1, gridW); y1 = std::min(y1, gridH - 1.0f);
+            if (x1 <= x0 || y1 <= y0) continue;
+            out.push_back({ { x0, y0, x1 - x0, y1 - y0 }, { sx, sy }, (float)(r * c.numTilesPerRow + col) });
+        }
+        tileStartY += c.tileH;
+        if (!remap_is_gap(gap_rows, r + 1)) tileStartY += c.spacingY;
+    }
+}
+
+#ifndef HDMI_GLES
+static bool gl_instancing_supported() { return GLEW_VERSION_3_3 || GLEW_ARB_instanced_arrays; }
+static void vertex_attrib_divisor(GLuint index, GLuint divisor) {
+    if (GLEW_VERSION_3_3) glVertexAttribDivisor(index, divisor); else glVertexAttribDivisorARB(index, divisor);
+}
+#else
+static bool gl_instancing_supported() { return true; } // core in ES 3.0
+static void vertex_attrib_divisor(GLuint index, GLuint divisor) { glVertexAttribDivisor(index, divisor); }
+#endif
+
 // Provide definitions for the small helpers (joinPath/parseXYLine) so the linker is happy:
 static std::string joinPath(const std::string &dir, const std::string &name) {
     if (dir.empty()) return name;
@@ -449,6 +2151,7 @@ static bool parseXYLine(const std::string &line, int &x, int &y) {
 }
 
 int main(int argc, char** argv) {
+    const int64_t startup_begin_ms = steady_ms();
     vlogln("startup: begin");
 
     static struct option longopts[] = {
@@ -458,11 +2161,50 @@ int main(int argc, char** argv) {
       {"auto-resize-window", no_argument, nullptr, 0},
       {"cpu-uv-swap", no_argument, nullptr, 0},
       {"test-pattern", required_argument, nullptr, 0},
+      {"upload", required_argument, nullptr, 0},
+      {"tile-mode", required_argument, nullptr, 0},
+      {"crop-upload", no_argument, nullptr, 0},
+      {"all-segments", no_argument, nullptr, 0},
+      {"render-on-demand", no_argument, nullptr, 0},
+      {"output", required_argument, nullptr, 0},
+      {"kms-device", required_argument, nullptr, 0},
+      {"kms-overlay", no_argument, nullptr, 0},
+      {"rga", optional_argument, nullptr, 0},
+      {"rga-heap", required_argument, nullptr, 0},
+      {"stream", required_argument, nullptr, 0},
+      {"stream-size", required_argument, nullptr, 0},
+      {"stream-fps", required_argument, nullptr, 0},
+      {"stream-codec", required_argument, nullptr, 0},
+      {"stream-bitrate", required_argument, nullptr, 0},
+      {"stream-sdp", required_argument, nullptr, 0},
+      {"stats", optional_argument, nullptr, 0},
+      {"profile", no_argument, nullptr, 0},
+      {"profile-sweep", optional_argument, nullptr, 0},
+      {"queue-mode", required_argument, nullptr, 0},
+      {"present-mode", required_argument, nullptr, 0},
+      {"buffers", required_argument, nullptr, 0},
+      {"capture-formats", required_argument, nullptr, 0},
+      {"device", required_argument, nullptr, 0},
+      {"replay", required_argument, nullptr, 0},
+      {"replay-size", required_argument, nullptr, 0},
+      {"replay-format", required_argument, nullptr, 0},
+      {"replay-fps", required_argument, nullptr, 0},
+      {"headless", optional_argument, nullptr, 0},
+      {"bench", required_argument, nullptr, 0},
+      {"view-mode", required_argument, nullptr, 0},
+      {"rotate", required_argument, nullptr, 0},
+      {"show-pattern", no_argument, nullptr, 0},
+      {"screenshot-format", required_argument, nullptr, 0},
+      {"screenshot-dir", required_argument, nullptr, 0},
+      {"capture-burst", required_argument, nullptr, 0},
+      {"metrics", required_argument, nullptr, 0},
+      {"shader-cache", required_argument, nullptr, 0},
       {"verbose", no_argument, nullptr, 0},
       {"help", no_argument, nullptr, 'h'},
       {0,0,0,0}
     };
 
+    bool cli_queue_mode = false, cli_buffer_count = false, cli_capture_formats = false, cli_present_mode = false, cli_profile = false, cli_device = false;
     for (;;) {
       int idx = 0;
       int c = getopt_long(argc, argv, "h", longopts, &idx);
@@ -475,74 +2217,287 @@ int main(int argc, char** argv) {
         else if (name == "matrix") { std::string v = optarg ? optarg : "709"; if (v=="709") opt_use_bt709=1; else if (v=="601") opt_use_bt709=0; else { std::cerr<<"Invalid matrix\n"; print_usage(argv[0]); return 1; } }
         else if (name == "auto-resize-window") opt_auto_resize_window = true;
         else if (name == "cpu-uv-swap") opt_cpu_uv_swap = true;
-        else if (name == "test-pattern") if (optarg) opt_test_pattern_path = std::string(optarg);
+        else if (name == "test-pattern") { if (optarg) opt_test_pattern_path = std::string(optarg); }
+        else if (name == "upload") { std::string v = optarg ? optarg : "copy"; if (v=="copy") opt_upload_mode=UPLOAD_COPY; else if (v=="dmabuf") opt_upload_mode=UPLOAD_DMABUF; else if (v=="pbo") opt_upload_mode=UPLOAD_PBO; else { std::cerr<<"Invalid upload\n"; print_usage(argv[0]); return 1; } }
+        else if (name == "tile-mode") { std::string v = optarg ? optarg : "shader"; if (v=="shader") opt_tile_mode=TILE_SHADER; else if (v=="remap") opt_tile_mode=TILE_REMAP; else if (v=="instanced") opt_tile_mode=TILE_INSTANCED; else { std::cerr<<"Invalid tile-mode\n"; print_usage(argv[0]); return 1; } }
+        else if (name == "crop-upload") opt_crop_upload = true;
+        else if (name == "all-segments") opt_all_segments = true;
+        else if (name == "render-on-demand") opt_render_on_demand = true;
+        else if (name == "output") { std::string v = optarg ? optarg : "sdl"; if (v=="sdl") opt_output=OUTPUT_SDL; else if (v=="kms") opt_output=OUTPUT_KMS; else { std::cerr<<"Invalid output\n"; print_usage(argv[0]); return 1; } }
+        else if (name == "kms-device") { if (optarg) opt_kms_device = std::string(optarg); }
+        else if (name == "kms-overlay") opt_kms_overlay = true;
+        else if (name == "rga") {
+            opt_rga = true;
+            std::vector<uint32_t> f;
+            if (optarg && (!parse_pixfmt_list(optarg, f) || f.size() != 1 || pixel_layout(f[0]).packed || pixel_layout(f[0]).vu)) { std::cerr<<"Invalid rga output format\n"; print_usage(argv[0]); return 1; }
+            if (!f.empty()) opt_rga_pixfmt = f[0];
+        }
+        else if (name == "rga-heap") opt_rga_heap = optarg ? optarg : "";
+        else if (name == "stream") { opt_stream_dest = optarg ? optarg : ""; size_t colon = opt_stream_dest.rfind(':'); if (colon == std::string::npos || colon == 0 || colon + 1 >= opt_stream_dest.size()) { std::cerr<<"Invalid stream destination\n"; print_usage(argv[0]); return 1; } }
+        else if (name == "stream-size") { int w=0,h=0; if (!optarg || sscanf(optarg, "%dx%d", &w, &h) != 2 || w < 64 || h < 64 || (w & 1) || (h & 1)) { std::cerr<<"Invalid stream-size\n"; print_usage(argv[0]); return 1; } opt_stream_width=w; opt_stream_height=h; }
+        else if (name == "stream-fps") { opt_stream_fps = optarg ? atoi(optarg) : 0; if (opt_stream_fps <= 0 || opt_stream_fps > 60) { std::cerr<<"Invalid stream-fps\n"; print_usage(argv[0]); return 1; } }
+        else if (name == "stream-codec") { std::string v = optarg ? optarg : "h264"; if (v=="h264") opt_stream_hevc=false; else if (v=="h265"||v=="hevc") opt_stream_hevc=true; else { std::cerr<<"Invalid stream-codec\n"; print_usage(argv[0]); return 1; } }
+        else if (name == "stream-bitrate") { opt_stream_bitrate_kbps = optarg ? atoi(optarg) : 0; if (opt_stream_bitrate_kbps < 100) { std::cerr<<"Invalid stream-bitrate\n"; print_usage(argv[0]); return 1; } }
+        else if (name == "stream-sdp") { if (optarg) opt_stream_sdp = std::string(optarg); }
+        else if (name == "device") { if (optarg) { opt_device = std::string(optarg); cli_device = true; } }
+        else if (name == "replay") { if (optarg) opt_replay_path = std::string(optarg); }
+        else if (name == "replay-size") { unsigned w=0,h=0; if (!optarg || sscanf(optarg, "%ux%u", &w, &h) != 2 || w < 2 || h < 2 || (w & 1) || (h & 1)) { std::cerr<<"Invalid replay-size\n"; print_usage(argv[0]); return 1; } opt_replay_width=w; opt_replay_height=h; }
+        else if (name == "replay-format") { std::vector<uint32_t> f; if (!parse_pixfmt_list(optarg ? optarg : "", f) || f.size() != 1) { std::cerr<<"Invalid replay-format\n"; print_usage(argv[0]); return 1; } opt_replay_pixfmt = f[0]; }
+        else if (name == "replay-fps") { opt_replay_fps = optarg ? atoi(optarg) : 60; if (opt_replay_fps < 0) { std::cerr<<"Invalid replay-fps\n"; print_usage(argv[0]); return 1; } }
+        else if (name == "headless") { opt_headless = true; int w=0,h=0; if (optarg) { if (sscanf(optarg, "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0) { std::cerr<<"Invalid headless size\n"; print_usage(argv[0]); return 1; } opt_headless_width=w; opt_headless_height=h; } }
+        else if (name == "bench") { opt_bench_frames = optarg ? atoi(optarg) : 0; if (opt_bench_frames <= 0) { std::cerr<<"Invalid bench frame count\n"; print_usage(argv[0]); return 1; } }
+        else if (name == "rotate") { std::string v = optarg ? optarg : "0"; if (v=="0") opt_rotation=0; else if (v=="90") opt_rotation=1; else if (v=="180") opt_rotation=2; else if (v=="270") opt_rotation=3; else { std::cerr<<"Invalid rotate\n"; print_usage(argv[0]); return 1; } }
+        else if (name == "view-mode") { std::string v = optarg ? optarg : "0"; if (v=="0"||v=="1"||v=="2") opt_view_mode = v[0]-'0'; else { std::cerr<<"Invalid view-mode\n"; print_usage(argv[0]); return 1; } }
+        else if (name == "show-pattern") opt_show_pattern = true;
+        else if (name == "screenshot-format") { if (!optarg || !parse_image_format(optarg, opt_screenshot_format)) { std::cerr<<"Invalid screenshot-format\n"; print_usage(argv[0]); return 1; } }
+        else if (name == "screenshot-dir") { if (optarg && *optarg) opt_screenshot_dir = std::string(optarg); }
+        else if (name == "shader-cache") { std::string v = optarg ? optarg : ""; if (v.empty()) { std::cerr<<"Invalid shader-cache\n"; print_usage(argv[0]); return 1; } if (v=="off") opt_shader_cache=false; else opt_shader_cache_dir=v; }
+        else if (name == "metrics") { opt_metrics_listen = optarg ? optarg : ""; if (opt_metrics_listen.empty()) { std::cerr<<"Invalid metrics address\n"; print_usage(argv[0]); return 1; } }
+        else if (name == "capture-burst") { opt_capture_burst = optarg ? atoi(optarg) : 1; if (opt_capture_burst <= 0) { std::cerr<<"Invalid capture-burst\n"; print_usage(argv[0]); return 1; } }
+        else if (name == "stats") { opt_stats_interval_s = optarg ? atoi(optarg) : 5; if (opt_stats_interval_s <= 0) { std::cerr<<"Invalid stats interval\n"; print_usage(argv[0]); return 1; } }
+        else if (name == "profile") { opt_profile_overlay = true; cli_profile = true; }
+        else if (name == "profile-sweep") { int n = optarg ? atoi(optarg) : 120; if (n <= 0) { std::cerr<<"Invalid profile-sweep\n"; print_usage(argv[0]); return 1; } opt_profile_sweep_frames = n; }
+        else if (name == "present-mode") { int v = 0; if (!parse_present_mode(optarg ? optarg : "", v)) { std::cerr<<"Invalid present-mode\n"; print_usage(argv[0]); return 1; } opt_present_mode = (PresentMode)v; cli_present_mode = true; }
+        else if (name == "queue-mode") { std::string v = optarg ? optarg : "throughput"; if (v=="throughput") opt_queue_mode=QUEUE_THROUGHPUT; else if (v=="latency") opt_queue_mode=QUEUE_LATENCY; else { std::cerr<<"Invalid queue-mode\n"; print_usage(argv[0]); return 1; } cli_queue_mode = true; }
+        else if (name == "buffers") { int n = optarg ? atoi(optarg) : 0; if (n < BUF_COUNT_MIN || n > BUF_COUNT_MAX) { std::cerr<<"Invalid buffers\n"; print_usage(argv[0]); return 1; } opt_buffer_count = (unsigned)n; cli_buffer_count = true; }
+        else if (name == "capture-formats") { if (!optarg || !parse_pixfmt_list(optarg, opt_capture_formats)) { std::cerr<<"Invalid capture-formats\n"; print_usage(argv[0]); return 1; } cli_capture_formats = true; }
         else if (name == "verbose") opt_verbose = true;
       }
     }
+#ifndef HDMI_HAVE_KMS
+    if (opt_output == OUTPUT_KMS) { std::cerr << "--output=kms: built without KMS support (HDMI_ENABLE_KMS)\n"; return 1; }
+#endif
+    if (opt_headless && opt_output != OUTPUT_SDL) { std::cerr << "--headless renders offscreen and cannot be combined with --output=kms\n"; return 1; }
+    // --all-segments samples every sub-block from the one full-frame texture
+    if (opt_all_segments && opt_crop_upload) { std::cerr << "Warning: --crop-upload uploads one segment only, ignored with --all-segments\n"; opt_crop_upload = false; }
+#ifndef HDMI_HAVE_MPP
+    if (!opt_stream_dest.empty()) { std::cerr << "Warning: built without HDMI_ENABLE_MPP, --stream ignored\n"; opt_stream_dest.clear(); }
+#endif
+    if (opt_all_segments && opt_tile_mode == TILE_REMAP) { std::cerr << "Warning: the remap table holds one segment, using shader tile mapping with --all-segments\n"; opt_tile_mode = TILE_SHADER; }
 
-    int fd = open(DEVICE, O_RDWR | O_NONBLOCK);
-    if (fd < 0) { perror("open video0"); return 1; }
+    // read before the device is opened: bufferCount / queueMode size the capture queue, captureFormats picks its format
+    ControlParams ctrl; loadControlIni("control_ini.txt", ctrl);
+    if (ctrl.verbose >= 0) opt_verbose = ctrl.verbose != 0;
+    if (!ctrl.testPattern.empty()) opt_test_pattern_path = ctrl.testPattern;
+    if (!cli_buffer_count && ctrl.bufferCount > 0) opt_buffer_count = (unsigned)ctrl.bufferCount;
+    if (!cli_queue_mode && ctrl.queueMode >= 0) opt_queue_mode = (QueueMode)ctrl.queueMode;
+    if (!cli_present_mode && ctrl.presentMode >= 0) opt_present_mode = (PresentMode)ctrl.presentMode;
+    if (!cli_profile && ctrl.profileOverlay >= 0) opt_profile_overlay = ctrl.profileOverlay != 0;
+    if (!cli_capture_formats && !ctrl.captureFormats.empty()) opt_capture_formats = ctrl.captureFormats;
 
-    uint32_t cur_width = DEFAULT_WIDTH, cur_height = DEFAULT_HEIGHT, cur_pixfmt = 0;
-    if (!get_v4l2_format(fd, cur_width, cur_height, cur_pixfmt)) { cur_width = DEFAULT_WIDTH; cur_height = DEFAULT_HEIGHT; }
+    // capture sources: 0 = --device (or captureSource1) / --replay, then captureSource2.. up to the first gap
+    if (!cli_device && !ctrl.sourceDevices.empty() && !ctrl.sourceDevices[0].empty()) opt_device = ctrl.sourceDevices[0];
+    std::vector<std::unique_ptr<CaptureSource>> sources;
+    sources.emplace_back(new CaptureSource());
+    sources[0]->device = opt_device;
+    for (size_t i = 1; i < ctrl.sourceDevices.size(); ++i) {
+        const std::string &dev = ctrl.sourceDevices[i];
+        bool listed = false;
+        for (const auto &src : sources) listed = listed || src->device == dev;
+        if (dev.empty() || listed) {
+            std::cerr << "Warning: control_ini.txt: captureSource" << i + 1 << (dev.empty() ? " missing" : " repeats " + dev) << ", ignoring it and the sources after it\n";
+            break;
+        }
+        sources.emplace_back(new CaptureSource());
+        sources.back()->index = (int)i; sources.back()->device = dev;
+    }
+    if (sources.size() > 1) {
+        vlogln("startup: " + std::to_string(sources.size()) + " capture sources");
+        if (opt_rga) { std::cerr << "Warning: --rga handles a single capture source, transforming in the shader\n"; opt_rga = false; }
+    }
+    CaptureSource &primary = *sources[0];
 
-    v4l2_format fmt; memset(&fmt,0,sizeof(fmt)); fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-    fmt.fmt.pix_mp.width = cur_width; fmt.fmt.pix_mp.height = cur_height; fmt.fmt.pix_mp.pixelformat = v4l2_fourcc('N','V','2','4');
-    fmt.fmt.pix_mp.field = V4L2_FIELD_NONE; fmt.fmt.pix_mp.num_planes = 1;
-    (void)xioctl(fd, VIDIOC_S_FMT, &fmt);
-    get_v4l2_format(fd, cur_width, cur_height, cur_pixfmt);
+    // Startup runs three workers next to the window/GL context creation below: the offset files and LUTs
+    // of the first config snapshot, the test pattern decode and the capture device setup. The render
+    // thread joins each one right before it first needs the result.
+    std::string config_err;
+    if (!validate_control_params(ctrl, config_err)) std::cerr << "Warning: control_ini.txt: " << config_err << "\n";
+    std::future<std::shared_ptr<const ConfigSnapshot>> config_init = std::async(std::launch::async, [&ctrl]() { return build_config_snapshot(ctrl); });
+    struct PatternImage { std::string path; unsigned char *pixels = nullptr; int w = 0, h = 0; bool auto_found = false; };
+    std::future<PatternImage> pattern_init = std::async(std::launch::async, []() {
+        PatternImage p; p.path = opt_test_pattern_path;
+        if (p.path.empty()) {
+            std::vector<std::string> cands = { "testimage.jpg","test_image.jpg","testpattern.png","testpattern.jpg","resources/testimage.jpg","assets/testimage.jpg" };
+            std::string exe = getExecutableDir();
+            if (!exe.empty()) { cands.push_back(exe + "testimage.jpg"); cands.push_back(exe + "shaders/testimage.jpg"); }
+            for (auto &c : cands) if (!c.empty() && fileExists(c)) { p.path = c; p.auto_found = true; break; }
+        }
+        if (!p.path.empty() && fileExists(p.path)) {
+            int comp = 0;
+            p.pixels = stbi_load(p.path.c_str(), &p.w, &p.h, &comp, 3);
+            if (!p.pixels && !p.auto_found) std::cerr<<"Failed to load test pattern image: "<<p.path<<"\n";
+        }
+        return p;
+    });
 
-    v4l2_event_subscription sub; memset(&sub,0,sizeof(sub)); sub.type = V4L2_EVENT_SOURCE_CHANGE;
-    if (ioctl(fd, VIDIOC_SUBSCRIBE_EVENT, &sub) < 0) { /* not fatal */ }
+    // --replay: no capture device (fd stays -1); the capture thread plays the frames from 'replay'
+    const bool replaying = !opt_replay_path.empty();
+    ReplaySource replay;
+    // source 0's capture state under the names the rest of main uses
+    int &fd = primary.fd;
+    uint32_t &cur_width = primary.cur_width, &cur_height = primary.cur_height, &cur_pixfmt = primary.cur_pixfmt;
+    std::vector<std::vector<PlaneMap>> &buffers = primary.buffers;
+    // --rga: the output pool belongs to the capture thread like 'buffers'; rga_buffers is the PlaneMap view
+    // of it the render thread reads for frames with CapturedFrame::rga (the RGA module owns the memory, the
+    // render thread sets the strides for the output geometry it applies)
+    std::vector<std::vector<PlaneMap>> rga_buffers;
+#ifdef HDMI_HAVE_RGA
+    RgaEngine* rga = nullptr;
+    if (opt_rga && replaying) std::cerr << "Warning: replay buffers are not DMABUFs, --rga is off\n";
+    else if (opt_rga && !(rga = rga_open(opt_rga_heap.c_str(), opt_verbose))) std::cerr << "Warning: RGA unavailable, transforming in the shader\n";
+#else
+    if (opt_rga) std::cerr << "Warning: built without HDMI_ENABLE_RGA, transforming in the shader\n";
+#endif
+    // capture thread: size the RGA pool for the current capture buffers (startup, after release_gpu_buffers)
+    auto rga_prepare = [&]() {
+        rga_buffers.clear();
+#ifdef HDMI_HAVE_RGA
+        if (!rga) return;
+        if (!rga_alloc(rga, (unsigned)buffers.size(), cur_width, cur_height)) { std::cerr << "Warning: no RGA output buffers, transforming in the shader\n"; return; }
+        for (unsigned i = 0; i < rga_buffer_count(rga); ++i) {
+            const RgaOutputBuffer &b = rga_buffer(rga, i);
+            PlaneMap pm; pm.addr = b.addr; pm.length = b.length; pm.dmabuf_fd = b.fd;
+            rga_buffers.push_back(std::vector<PlaneMap>(1, pm));
+        }
+#endif
+    };
+    int64_t capture_ready_ms = 0;
+    std::future<bool> capture_init = std::async(std::launch::async, [&]() -> bool {
+        if (replaying) {
+            if (!replay_open(replay, opt_replay_path, opt_replay_width, opt_replay_height, opt_replay_pixfmt, buffers)) return false;
+            cur_width = replay.width; cur_height = replay.height; cur_pixfmt = replay.pixfmt;
+            vlogln("startup: replaying " + std::to_string(replay.frame_count) + " " + std::to_string(cur_width) + "x" + std::to_string(cur_height) + " " + fourcc_to_str(cur_pixfmt) + " frames from " + opt_replay_path);
+            if (opt_upload_mode == UPLOAD_DMABUF || opt_kms_overlay) std::cerr << "Warning: replay buffers are not DMABUFs, zero-copy paths fall back to copy upload\n";
+        } else {
+            fd = open(opt_device.c_str(), O_RDWR | O_NONBLOCK);
+            if (fd < 0) { perror(("open " + opt_device).c_str()); return false; }
 
-    v4l2_requestbuffers req; memset(&req,0,sizeof(req));
-    req.count = BUF_COUNT; req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE; req.memory = V4L2_MEMORY_MMAP;
-    if (xioctl(fd, VIDIOC_REQBUFS, &req) < 0) { perror("VIDIOC_REQBUFS"); close(fd); return 1; }
+            // lock onto the receiver's current timings first so the format below matches the source
+            v4l2_dv_timings dv; bool has_dv = false;
+            if (query_dv_timings(fd, dv, has_dv) == RECOVER_OK && has_dv) (void)xioctl(fd, VIDIOC_S_DV_TIMINGS, &dv);
+            if (!get_v4l2_format(fd, cur_width, cur_height, cur_pixfmt)) { cur_width = DEFAULT_WIDTH; cur_height = DEFAULT_HEIGHT; }
 
-    std::vector<std::vector<PlaneMap>> buffers(req.count);
-    for (unsigned i=0;i<req.count;++i) {
-        v4l2_buffer buf; v4l2_plane planes[VIDEO_MAX_PLANES] = {0};
-        memset(&buf,0,sizeof(buf)); buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE; buf.index = i; buf.memory = V4L2_MEMORY_MMAP;
-        buf.m.planes = planes; buf.length = VIDEO_MAX_PLANES;
-        if (xioctl(fd, VIDIOC_QUERYBUF, &buf) < 0) { perror("VIDIOC_QUERYBUF"); close(fd); return 1; }
-        buffers[i].resize(buf.length);
-        for (unsigned p=0;p<buf.length;++p) {
-            buffers[i][p].length = planes[p].length;
-            buffers[i][p].addr = mmap(nullptr, planes[p].length, PROT_READ|PROT_WRITE, MAP_SHARED, fd, planes[p].m.mem_offset);
-            if (buffers[i][p].addr == MAP_FAILED) { perror("mmap plane"); close(fd); return 1; }
-        }
-        if (xioctl(fd, VIDIOC_QBUF, &buf) < 0) { perror("VIDIOC_QBUF"); close(fd); return 1; }
-    }
+            request_capture_format(fd, cur_width, cur_height, cur_pixfmt);
+            get_v4l2_format(fd, cur_width, cur_height, cur_pixfmt);
 
-    int buf_type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-    if (xioctl(fd, VIDIOC_STREAMON, &buf_type) < 0) { perror("VIDIOC_STREAMON"); close(fd); return 1; }
+            v4l2_event_subscription sub; memset(&sub,0,sizeof(sub)); sub.type = V4L2_EVENT_SOURCE_CHANGE;
+            if (ioctl(fd, VIDIOC_SUBSCRIBE_EVENT, &sub) < 0) { /* not fatal */ }
 
-    if (SDL_Init(SDL_INIT_VIDEO) != 0) { std::cerr << "SDL_Init failed: " << SDL_GetError() << std::endl; close(fd); return 1; }
-    vlogln("startup: SDL initialized");
+            v4l2_requestbuffers req; memset(&req,0,sizeof(req));
+            req.count = opt_buffer_count; req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE; req.memory = V4L2_MEMORY_MMAP;
+            if (xioctl(fd, VIDIOC_REQBUFS, &req) < 0) { perror("VIDIOC_REQBUFS"); return false; }
 
-    SDL_Window* win = SDL_CreateWindow(WINDOW_TITLE, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, (int)cur_width, (int)cur_height, SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE);
-    if (!win) { std::cerr << "SDL_CreateWindow failed: " << SDL_GetError() << std::endl; close(fd); return 1; }
-    vlogln("startup: SDL window created");
+            buffers.resize(req.count);
+            for (unsigned i=0;i<req.count;++i) {
+                v4l2_buffer buf; v4l2_plane planes[VIDEO_MAX_PLANES] = {0};
+                memset(&buf,0,sizeof(buf)); buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE; buf.index = i; buf.memory = V4L2_MEMORY_MMAP;
+                buf.m.planes = planes; buf.length = VIDEO_MAX_PLANES;
+                if (xioctl(fd, VIDIOC_QUERYBUF, &buf) < 0) { perror("VIDIOC_QUERYBUF"); return false; }
+                buffers[i].resize(buf.length);
+                for (unsigned p=0;p<buf.length;++p) {
+                    buffers[i][p].length = planes[p].length;
+                    buffers[i][p].addr = mmap(nullptr, planes[p].length, PROT_READ|PROT_WRITE, MAP_SHARED, fd, planes[p].m.mem_offset);
+                    if (buffers[i][p].addr == MAP_FAILED) { perror("mmap plane"); return false; }
+                }
+                if (xioctl(fd, VIDIOC_QBUF, &buf) < 0) { perror("VIDIOC_QBUF"); return false; }
+            }
+            set_plane_strides(fd, buffers);
+            if (want_dmabuf_export() && !export_dmabufs(fd, buffers)) std::cerr << "Warning: VIDIOC_EXPBUF failed, using copy upload\n";
+            rga_prepare();
 
-    if (SDL_SetWindowFullscreen(win, SDL_WINDOW_FULLSCREEN_DESKTOP) != 0) { std::cerr << "Warning: could not set fullscreen: " << SDL_GetError() << "\n"; }
-    else vlogln("Window set to FULLSCREEN_DESKTOP on startup");
+            int buf_type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+            if (xioctl(fd, VIDIOC_STREAMON, &buf_type) < 0) { perror("VIDIOC_STREAMON"); return false; }
+            vlogln("startup: streaming with " + std::to_string(buffers.size()) + " buffers, " + (opt_queue_mode == QUEUE_LATENCY ? "latency" : "throughput") + " queue mode");
+        }
+        capture_ready_ms = steady_ms();
+        return true;
+    });
+    // GL init failures below: fd may only be closed once the capture setup is done with it
+    auto abort_startup = [&]() { if (capture_init.valid()) capture_init.wait(); if (fd >= 0) close(fd); return 1; };
 
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3); SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 0);
-    SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
+    SDL_Window* win = nullptr;
+    SDL_GLContext glc = nullptr;
+#ifdef HDMI_HAVE_KMS
+    KmsOutput* kms = nullptr;
+    bool kms_overlay_failed = false;
+    if (opt_output == OUTPUT_KMS) {
+        kms = kms_open(opt_kms_device.c_str(), opt_verbose);
+        if (!kms) { std::cerr << "KMS output on " << opt_kms_device << " failed" << std::endl; return abort_startup(); }
+        vlogln("startup: KMS output ready, GL context created");
+        if (opt_present_mode == PRESENT_IMMEDIATE || opt_present_mode == PRESENT_ADAPTIVE)
+            std::cerr << "Warning: --present-mode=" << PRESENT_MODE_NAMES[opt_present_mode] << " needs the SDL output, KMS page flips always wait for vblank\n";
+    }
+#endif
+    if (opt_output == OUTPUT_SDL) {
+#if defined(HDMI_GLES) && defined(SDL_HINT_VIDEO_X11_FORCE_EGL)
+        // GLES context through EGL, also on X11 (where SDL would otherwise try GLX_EXT_create_context_es_profile)
+        SDL_SetHint(SDL_HINT_VIDEO_X11_FORCE_EGL, "1");
+#elif defined(HDMI_HAVE_EGL_DMABUF) && defined(SDL_HINT_VIDEO_X11_FORCE_EGL)
+        // DMABUF import needs an EGL-backed context; on X11 SDL defaults to GLX.
+        if (opt_upload_mode == UPLOAD_DMABUF) SDL_SetHint(SDL_HINT_VIDEO_X11_FORCE_EGL, "1");
+#endif
+        // --headless: no display needed; an explicit SDL_VIDEODRIVER from the environment still wins
+        if (opt_headless) setenv("SDL_VIDEODRIVER", "offscreen", 0);
+        if (SDL_Init(SDL_INIT_VIDEO) != 0) { std::cerr << "SDL_Init failed: " << SDL_GetError() << std::endl; return abort_startup(); }
+        vlogln("startup: SDL initialized");
 
-    SDL_GLContext glc = SDL_GL_CreateContext(win);
-    if (!glc) { std::cerr << "SDL_GL_CreateContext failed: " << SDL_GetError() << std::endl; close(fd); return 1; }
-    vlogln("startup: GL context created");
+        if (opt_headless) win = SDL_CreateWindow(WINDOW_TITLE, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, opt_headless_width, opt_headless_height, SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+        // the capture format is not known yet; a window that did not go fullscreen is resized once it is
+        else win = SDL_CreateWindow(WINDOW_TITLE, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, DEFAULT_WIDTH, DEFAULT_HEIGHT, SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE);
+        if (!win) { std::cerr << "SDL_CreateWindow failed: " << SDL_GetError() << std::endl; return abort_startup(); }
+        vlogln("startup: SDL window created");
 
-    if (glewInit() != GLEW_OK) { std::cerr << "GLEW init failed!" << std::endl; close(fd); return 1; }
+        if (opt_headless) { /* hidden window, only used for its GL context */ }
+        else if (SDL_SetWindowFullscreen(win, SDL_WINDOW_FULLSCREEN_DESKTOP) != 0) { std::cerr << "Warning: could not set fullscreen: " << SDL_GetError() << "\n"; }
+        else vlogln("Window set to FULLSCREEN_DESKTOP on startup");
+
+#ifdef HDMI_GLES
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_ES);
+#endif
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3); SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 0);
+        SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
+
+        glc = SDL_GL_CreateContext(win);
+        if (!glc) { std::cerr << "SDL_GL_CreateContext failed: " << SDL_GetError() << std::endl; return abort_startup(); }
+        vlogln("startup: GL context created");
+        if (!opt_headless) set_swap_interval(opt_present_mode); // headless never swaps
+    }
+    signal(SIGINT, on_quit_signal); signal(SIGTERM, on_quit_signal); // after SDL_Init, which installs its own
+
+#ifndef HDMI_GLES
+    GLenum glew_status = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+    if (glew_status == GLEW_ERROR_NO_GLX_DISPLAY) glew_status = GLEW_OK; // EGL-backed context: GL entry points are loaded, only GLX is missing
+#endif
+    if (glew_status != GLEW_OK) { std::cerr << "GLEW init failed!" << std::endl; return abort_startup(); }
+#endif
+    vlogln(std::string("startup: ") + (const char*)glGetString(GL_VERSION) + " / " + (const char*)glGetString(GL_RENDERER));
 
     GLint gl_max_tex=0; glGetIntegerv(GL_MAX_TEXTURE_SIZE, &gl_max_tex);
-    int win_w=0, win_h=0; SDL_GetWindowSize(win, &win_w, &win_h); glViewport(0,0,win_w,win_h);
+    int win_w=0, win_h=0;
+    if (win) SDL_GetWindowSize(win, &win_w, &win_h);
+#ifdef HDMI_HAVE_KMS
+    if (kms) { win_w = kms_width(kms); win_h = kms_height(kms); }
+#endif
+    // --headless: everything is drawn into this FBO instead of the (hidden) window's back buffer
+    GLuint headless_fbo = 0, headless_rb = 0;
+    GLsync headless_fences[2] = {0, 0}; int headless_fence_next = 0;
+    if (opt_headless) {
+        glGenFramebuffers(1, &headless_fbo); glGenRenderbuffers(1, &headless_rb);
+        glBindRenderbuffer(GL_RENDERBUFFER, headless_rb);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, opt_headless_width, opt_headless_height);
+        glBindFramebuffer(GL_FRAMEBUFFER, headless_fbo);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, headless_rb);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) { std::cerr << "headless: framebuffer incomplete\n"; return abort_startup(); }
+        win_w = opt_headless_width; win_h = opt_headless_height;
+        vlogln("startup: rendering headless into a " + std::to_string(win_w) + "x" + std::to_string(win_h) + " FBO");
+    }
+    glViewport(0,0,win_w,win_h);
 
-    std::vector<std::string> attempts; std::string vertPath = findShaderFile("shader.vert.glsl",&attempts);
-    if (vertPath.empty()) { std::cerr<<"Vertex shader not found\n"; close(fd); return 1; }
-    attempts.clear(); std::string fragPath = findShaderFile("shader.frag.glsl",&attempts);
-    if (fragPath.empty()) { std::cerr<<"Fragment shader not found\n"; close(fd); return 1; }
+    std::vector<std::string> attempts; std::string vertPath = findShaderFile(VERT_SHADER_FILE,&attempts);
+    if (vertPath.empty()) { std::cerr<<"Vertex shader not found\n"; return abort_startup(); }
+    attempts.clear(); std::string fragPath = findShaderFile(FRAG_SHADER_FILE,&attempts);
+    if (fragPath.empty()) { std::cerr<<"Fragment shader not found\n"; return abort_startup(); }
 
     GLuint program = createShaderProgram(vertPath.c_str(), fragPath.c_str()); glUseProgram(program);
     vlogln("startup: shader program created");
@@ -554,6 +2509,14 @@ int main(int argc, char** argv) {
     glEnableVertexAttribArray(1); glVertexAttribPointer(1,2,GL_FLOAT,GL_FALSE,4*sizeof(float),(void*)(2*sizeof(float)));
     glBindBuffer(GL_ARRAY_BUFFER,0); glBindVertexArray(0);
 
+    const int64_t gl_ready_ms = steady_ms();
+    if (!capture_init.get()) { if (fd >= 0) close(fd); return 1; }
+    vlogln("startup: GL ready after " + std::to_string(gl_ready_ms - startup_begin_ms) + " ms, capture after " + std::to_string(capture_ready_ms - startup_begin_ms) + " ms");
+    if (win && !opt_headless && !(SDL_GetWindowFlags(win) & SDL_WINDOW_FULLSCREEN_DESKTOP)) {
+        SDL_SetWindowSize(win, (int)cur_width, (int)cur_height);
+        SDL_GetWindowSize(win, &win_w, &win_h); glViewport(0,0,win_w,win_h);
+    }
+
     GLuint texY=0, texUV=0, texPattern=0; glGenTextures(1,&texY); glBindTexture(GL_TEXTURE_2D,texY);
     glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_NEAREST); glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE); glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
@@ -561,36 +2524,45 @@ int main(int argc, char** argv) {
     glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_NEAREST); glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE); glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
 
-    int uv_w = (cur_pixfmt == V4L2_PIX_FMT_NV12 || cur_pixfmt == V4L2_PIX_FMT_NV21) ? (int)(cur_width/2) : (int)cur_width;
-    int uv_h = (cur_pixfmt == V4L2_PIX_FMT_NV12 || cur_pixfmt == V4L2_PIX_FMT_NV21) ? (int)(cur_height/2) : (int)cur_height;
-    reallocate_textures(texY, texUV, (int)cur_width, (int)cur_height, uv_w, uv_h);
+    reallocate_textures(texY, texUV, cur_pixfmt, (int)cur_width, (int)cur_height);
+    // format texY/texUV are currently allocated for (render thread); cur_* follow the device (capture thread)
+    uint32_t tex_width = cur_width, tex_height = cur_height, tex_pixfmt = cur_pixfmt;
+    UploadRect upload_rect; upload_rect.w = (int)cur_width; upload_rect.h = (int)cur_height;
+    // --rga: the textures hold RGA output of a tex_source_pixfmt capture (already cropped and turned, Cb/Cr
+    // in display order), covering the full input or the active segment; the shader only applies tex_rga_flip_y
+    bool tex_rga = false, tex_rga_full = false;
+    int tex_rga_flip_y = 1;
+    uint32_t tex_source_pixfmt = cur_pixfmt;
 
-    bool haveTestPattern = false; int patternW=0,patternH=0,patternComp=0;
-    if (!opt_test_pattern_path.empty() && fileExists(opt_test_pattern_path)) {
-        unsigned char *img = stbi_load(opt_test_pattern_path.c_str(), &patternW, &patternH, &patternComp, 3);
-        if (img) {
+#ifdef HDMI_HAVE_EGL_DMABUF
+    DmabufImageSet dmabuf;
+    bool dmabuf_ok = false;
+    if (opt_upload_mode == UPLOAD_DMABUF && !opt_cpu_uv_swap && (int)cur_width <= gl_max_tex && (int)cur_height <= gl_max_tex) dmabuf_ok = dmabuf_init(dmabuf);
+    if (dmabuf_ok) dmabuf_images_build(dmabuf, buffers, (int)cur_width, (int)cur_height, cur_pixfmt, 0, 0, (int)cur_width, (int)cur_height);
+    if (opt_upload_mode == UPLOAD_DMABUF && !dmabuf.valid()) std::cerr << "Warning: DMABUF import unavailable, using glTexSubImage2D upload\n";
+#else
+    if (opt_upload_mode == UPLOAD_DMABUF) std::cerr << "Warning: built without HDMI_ENABLE_DMABUF, using glTexSubImage2D upload\n";
+#endif
+    PboRing pbo;
+    bool pbo_ok = opt_upload_mode == UPLOAD_PBO && pbo_ring_init(pbo);
+    if (opt_upload_mode == UPLOAD_PBO && !pbo_ok) std::cerr << "Warning: PBO ring unavailable, using glTexSubImage2D upload\n";
+    // upload path in use (render thread): --upload or what it fell back to; the profile sweep switches it
+    UploadMode upload_path = pbo_ok ? UPLOAD_PBO : UPLOAD_COPY;
+#ifdef HDMI_HAVE_EGL_DMABUF
+    if (dmabuf.valid()) upload_path = UPLOAD_DMABUF;
+#endif
+
+    bool haveTestPattern = false;
+    {
+        PatternImage pattern = pattern_init.get();
+        opt_test_pattern_path = pattern.path;
+        if (pattern.pixels) {
             glGenTextures(1,&texPattern); glBindTexture(GL_TEXTURE_2D, texPattern);
-            glPixelStorei(GL_UNPACK_ALIGNMENT,1); glTexImage2D(GL_TEXTURE_2D,0,GL_RGB,patternW,patternH,0,GL_RGB,GL_UNSIGNED_BYTE,img);
+            glPixelStorei(GL_UNPACK_ALIGNMENT,1); glTexImage2D(GL_TEXTURE_2D,0,GL_RGB,pattern.w,pattern.h,0,GL_RGB,GL_UNSIGNED_BYTE,pattern.pixels);
             glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_NEAREST); glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
             glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE); glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
-            stbi_image_free(img); haveTestPattern=true; vlogln("Loaded test pattern image into GL texture");
-        } else std::cerr<<"Failed to load test pattern image: "<<opt_test_pattern_path<<"\n";
-    } else {
-        if (opt_test_pattern_path.empty()) {
-            std::vector<std::string> cands = { "testimage.jpg","test_image.jpg","testpattern.png","testpattern.jpg","resources/testimage.jpg","assets/testimage.jpg" };
-            std::string exe = getExecutableDir();
-            if (!exe.empty()) { cands.push_back(exe + "testimage.jpg"); cands.push_back(exe + "shaders/testimage.jpg"); }
-            for (auto &p : cands) if (!p.empty() && fileExists(p)) { opt_test_pattern_path = p; break; }
-            if (!opt_test_pattern_path.empty()) {
-                unsigned char *img = stbi_load(opt_test_pattern_path.c_str(), &patternW, &patternH, &patternComp, 3);
-                if (img) {
-                    glGenTextures(1,&texPattern); glBindTexture(GL_TEXTURE_2D, texPattern);
-                    glPixelStorei(GL_UNPACK_ALIGNMENT,1); glTexImage2D(GL_TEXTURE_2D,0,GL_RGB,patternW,patternH,0,GL_RGB,GL_UNSIGNED_BYTE,img);
-                    glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_NEAREST); glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
-                    glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE); glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
-                    stbi_image_free(img); haveTestPattern=true; vlogln(std::string("Auto-loaded test pattern: ") + opt_test_pattern_path);
-                }
-            }
+            stbi_image_free(pattern.pixels); haveTestPattern=true;
+            vlogln(pattern.auto_found ? "Auto-loaded test pattern: " + pattern.path : std::string("Loaded test pattern image into GL texture"));
         }
     }
 
@@ -601,553 +2573,1474 @@ int main(int argc, char** argv) {
     if (loc_texUV >= 0) glUniform1i(loc_texUV, 1);
 
     GLint loc_texPattern = glGetUniformLocation(program, "texPattern");
-    GLint loc_u_showPattern = glGetUniformLocation(program, "u_showPattern");
     if (loc_texPattern >= 0) glUniform1i(loc_texPattern, 2);
-    if (loc_u_showPattern >= 0) glUniform1i(loc_u_showPattern, 0);
+    GLint loc_texRemap = glGetUniformLocation(program, "texRemap");
+    if (loc_texRemap >= 0) glUniform1i(loc_texRemap, 3);
+    GLint loc_texLayout = glGetUniformLocation(program, "texLayout");
+    if (loc_texLayout >= 0) glUniform1i(loc_texLayout, 4);
+    GLint loc_texColorLut = glGetUniformLocation(program, "texColorLut");
+    if (loc_texColorLut >= 0) glUniform1i(loc_texColorLut, 5);
 
-    // central helper to set the pattern uniform in one place
-    auto setPattern = [&](bool on) {
-        if (!ENABLE_SHADER_TEST_PATTERN) return;
-        if (loc_u_showPattern >= 0) {
+    // Layout/colour parameters live in the LayoutParams uniform block (binding 0)
+    GLuint layoutBlock = glGetUniformBlockIndex(program, "LayoutParams");
+    if (layoutBlock == GL_INVALID_INDEX) { std::cerr << "Shader has no LayoutParams uniform block\n"; return abort_startup(); }
+    GLint layoutBlockSize = 0; glGetActiveUniformBlockiv(program, layoutBlock, GL_UNIFORM_BLOCK_DATA_SIZE, &layoutBlockSize);
+    if (layoutBlockSize != (GLint)sizeof(LayoutParamsStd140)) std::cerr << "Warning: LayoutParams block is " << layoutBlockSize << " bytes, expected " << sizeof(LayoutParamsStd140) << "\n";
+    glUniformBlockBinding(program, layoutBlock, 0);
+    GLuint layoutUbo = 0; glGenBuffers(1, &layoutUbo);
+    glBindBuffer(GL_UNIFORM_BUFFER, layoutUbo);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(LayoutParamsStd140), nullptr, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, 0, layoutUbo);
+
+    // --tile-mode=instanced: second program drawing one quad per tile; tile_vao holds the corner quad
+    // (per vertex) and the TileInstance buffer (per instance, re-pointed for each --all-segments segment)
+    GLuint tile_program = 0, tile_vao = 0, tile_corner_vbo = 0, tile_instance_vbo = 0;
+    GLint tile_loc_viewport = -1, tile_loc_drawSegment = -1;
+    GLint tile_attr[3] = { -1, -1, -1 }; // tileDst, tileSrc, tileIndex
+    if (opt_tile_mode == TILE_INSTANCED) {
+        std::string tileVertPath = findShaderFile(TILE_VERT_SHADER_FILE), tileFragPath = findShaderFile(TILE_FRAG_SHADER_FILE);
+        if (!gl_instancing_supported()) std::cerr << "Warning: no instanced arrays (GL 3.3 / ARB_instanced_arrays), using shader tile mapping\n";
+        else if (tileVertPath.empty() || tileFragPath.empty()) std::cerr << "Warning: " TILE_VERT_SHADER_FILE " / " TILE_FRAG_SHADER_FILE " not found, using shader tile mapping\n";
+        else {
+            tile_program = createShaderProgram(tileVertPath.c_str(), tileFragPath.c_str()); glUseProgram(tile_program);
+            GLint l = glGetUniformLocation(tile_program, "texY"); if (l >= 0) glUniform1i(l, 0);
+            l = glGetUniformLocation(tile_program, "texUV"); if (l >= 0) glUniform1i(l, 1);
+            l = glGetUniformLocation(tile_program, "texLayout"); if (l >= 0) glUniform1i(l, 4);
+            l = glGetUniformLocation(tile_program, "texColorLut"); if (l >= 0) glUniform1i(l, 5);
+            tile_loc_viewport = glGetUniformLocation(tile_program, "u_viewport");
+            tile_loc_drawSegment = glGetUniformLocation(tile_program, "u_drawSegment");
+            GLuint tileBlock = glGetUniformBlockIndex(tile_program, "LayoutParams");
+            if (tileBlock != GL_INVALID_INDEX) glUniformBlockBinding(tile_program, tileBlock, 0);
+            tile_attr[0] = glGetAttribLocation(tile_program, "tileDst");
+            tile_attr[1] = glGetAttribLocation(tile_program, "tileSrc");
+            tile_attr[2] = glGetAttribLocation(tile_program, "tileIndex");
+            float corners[] = { 0,0, 1,0, 0,1, 1,1 };
+            glGenVertexArrays(1,&tile_vao); glGenBuffers(1,&tile_corner_vbo); glGenBuffers(1,&tile_instance_vbo);
+            glBindVertexArray(tile_vao); glBindBuffer(GL_ARRAY_BUFFER, tile_corner_vbo); glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+            GLint corner = glGetAttribLocation(tile_program, "corner");
+            if (corner >= 0) { glEnableVertexAttribArray(corner); glVertexAttribPointer(corner,2,GL_FLOAT,GL_FALSE,2*sizeof(float),(void*)0); }
+            glBindBuffer(GL_ARRAY_BUFFER,0); glBindVertexArray(0);
             glUseProgram(program);
-            glUniform1i(loc_u_showPattern, on ? 1 : 0);
+            vlogln("startup: instanced tile program created");
         }
-    };
-    setPattern(false);
-
-    GLint loc_uv_swap = glGetUniformLocation(program, "uv_swap");
-    GLint loc_use_bt709 = glGetUniformLocation(program, "use_bt709");
-    GLint loc_full_range = glGetUniformLocation(program, "full_range");
-    GLint loc_view_mode = glGetUniformLocation(program, "view_mode");
-    GLint loc_segmentIndex = glGetUniformLocation(program, "segmentIndex");
-    GLint loc_offsetxy1 = glGetUniformLocation(program, "offsetxy1");
-    GLint loc_textureIsFull = glGetUniformLocation(program, "u_textureIsFull");
-    GLint loc_u_windowSize = glGetUniformLocation(program, "u_windowSize");
-    GLint loc_u_outputSize = glGetUniformLocation(program, "u_outputSize");
-    GLint loc_u_alignTopLeft = glGetUniformLocation(program, "u_alignTopLeft");
-    GLint loc_rot = glGetUniformLocation(program, "rot");
-    GLint loc_flip_x = glGetUniformLocation(program, "flip_x");
-    GLint loc_flip_y = glGetUniformLocation(program, "flip_y");
-    GLint loc_gap_count = glGetUniformLocation(program, "gap_count");
-    GLint loc_gap_rows = glGetUniformLocation(program, "gap_rows");
-    GLint loc_u_fullInputSize = glGetUniformLocation(program, "u_fullInputSize");
-    GLint loc_u_segmentsX = glGetUniformLocation(program, "u_segmentsX");
-    GLint loc_u_segmentsY = glGetUniformLocation(program, "u_segmentsY");
-    GLint loc_u_subBlockSize = glGetUniformLocation(program, "u_subBlockSize");
-    GLint loc_u_tileW = glGetUniformLocation(program, "u_tileW");
-    GLint loc_u_tileH = glGetUniformLocation(program, "u_tileH");
-    GLint loc_u_spacingX = glGetUniformLocation(program, "u_spacingX");
-    GLint loc_u_spacingY = glGetUniformLocation(program, "u_spacingY");
-    GLint loc_u_marginX = glGetUniformLocation(program, "u_marginX");
-    GLint loc_u_numTilesPerRow = glGetUniformLocation(program, "u_numTilesPerRow");
-    GLint loc_u_numTilesPerCol = glGetUniformLocation(program, "u_numTilesPerCol");
-    GLint loc_inputTilesTopToBottom = glGetUniformLocation(program, "inputTilesTopToBottom");
-    GLint loc_moduleSerials = glGetUniformLocation(program, "moduleSerials");
+        if (!tile_program) opt_tile_mode = TILE_SHADER;
+    }
 
     int uv_swap = 0;
     if (opt_uv_swap_override >= 0) uv_swap = opt_uv_swap_override;
-    else { if (cur_pixfmt == V4L2_PIX_FMT_NV21) uv_swap = 1; else if (cur_pixfmt == V4L2_PIX_FMT_NV12) uv_swap = 0; else uv_swap = 0; }
+    else uv_swap = pixel_layout(cur_pixfmt).vu ? 1 : 0;
     if (opt_cpu_uv_swap) uv_swap = 0;
-    if (loc_uv_swap >= 0) glUniform1i(loc_uv_swap, uv_swap);
-    if (loc_use_bt709 >= 0) glUniform1i(loc_use_bt709, opt_use_bt709);
-    if (loc_full_range >= 0) glUniform1i(loc_full_range, opt_full_range);
-    if (loc_view_mode >= 0) glUniform1i(loc_view_mode, 0);
+    int view_mode = opt_view_mode;
+    bool profile_overlay = opt_profile_overlay; // --profile / 'p' / profileOverlay
+    bool sweep_running = false;                 // --profile-sweep / Shift+P in progress
 
-    ControlParams ctrl; loadControlIni("control_ini.txt", ctrl);
-    std::array<std::string,3> modFiles = buildModuleFilenames(ctrl);
+    int activeSegment = 1;
+    // ctrl and the offset tables come from 'config', the snapshot last published by config_watcher
+    std::shared_ptr<const ConfigSnapshot> config = config_init.get();
+    ConfigWatcher config_watcher;
+    // Offsets and gap rows of every segment live in texLayout (unit 4), the calibration LUTs in texColorLut
+    // (unit 5), both uploaded once per config snapshot; the shader picks the segment, so segment switches
+    // and --all-segments draws upload nothing.
+    // offsetData: the active segment's offsets for the CPU-side tile mappings (remap, instances, overlay).
+    GLuint texLayout = 0, texColorLut = 0;
     std::vector<GLint> offsetData;
-    glUseProgram(program);
-    if (loc_u_fullInputSize >= 0) glUniform2f(loc_u_fullInputSize, ctrl.fullInputW, ctrl.fullInputH);
-    if (loc_u_segmentsX >= 0) glUniform1i(loc_u_segmentsX, ctrl.segmentsX);
-    if (loc_u_segmentsY >= 0) glUniform1i(loc_u_segmentsY, ctrl.segmentsY);
-    if (loc_u_subBlockSize >= 0) glUniform2f(loc_u_subBlockSize, ctrl.subBlockW, ctrl.subBlockH);
-    if (loc_u_tileW >= 0) glUniform1f(loc_u_tileW, ctrl.tileW);
-    if (loc_u_tileH >= 0) glUniform1f(loc_u_tileH, ctrl.tileH);
-    if (loc_u_spacingX >= 0) glUniform1f(loc_u_spacingX, ctrl.spacingX);
-    if (loc_u_spacingY >= 0) glUniform1f(loc_u_spacingY, ctrl.spacingY);
-    if (loc_u_marginX >= 0) glUniform1f(loc_u_marginX, ctrl.marginX);
-    if (loc_u_numTilesPerRow >= 0) glUniform1i(loc_u_numTilesPerRow, ctrl.numTilesPerRow);
-    if (loc_u_numTilesPerCol >= 0) glUniform1i(loc_u_numTilesPerCol, ctrl.numTilesPerCol);
-    if (loc_inputTilesTopToBottom >= 0) glUniform1i(loc_inputTilesTopToBottom, ctrl.inputTilesTopToBottom);
-    if (loc_moduleSerials >= 0) glUniform1iv(loc_moduleSerials, 3, ctrl.moduleSerials);
-
-    if (loadOffsetsFromModuleFiles(modFiles, offsetData)) {
-        if (loc_offsetxy1 >= 0 && offsetData.size() >= 150*2) { glUseProgram(program); glUniform2iv(loc_offsetxy1, 150, offsetData.data()); }
-    }
-
-    if (loc_textureIsFull >= 0) {
-        int textureIsFullInitial = ((int)cur_width == (int)ctrl.fullInputW && (int)cur_height == (int)ctrl.fullInputH) ? 1 : 0;
-        glUseProgram(program); glUniform1i(loc_textureIsFull, textureIsFullInitial);
-    }
-
-    if (loc_u_windowSize >= 0) glUniform2f(loc_u_windowSize, (float)win_w, (float)win_h);
-    if (loc_u_outputSize >= 0) glUniform2f(loc_u_outputSize, ctrl.subBlockW, ctrl.subBlockH);
-    if (loc_u_alignTopLeft >= 0) glUniform1i(loc_u_alignTopLeft, 1);
-
-    int flip_x = 0, flip_y = 1, rotation = 0;
-    if (loc_flip_x >= 0) { glUseProgram(program); glUniform1i(loc_flip_x, flip_x); }
-    if (loc_flip_y >= 0) { glUseProgram(program); glUniform1i(loc_flip_y, flip_y); }
-    if (loc_rot >= 0) { glUseProgram(program); glUniform1i(loc_rot, rotation); }
+    int wall_segments = 1;
+    bool tiles_dirty = false; // --tile-mode=instanced: tile instances need a rebuild
+    auto upload_layout_table = [&]() {
+        if (loc_texLayout < 0) return;
+        if (!texLayout) {
+            glGenTextures(1, &texLayout);
+            glActiveTexture(GL_TEXTURE4); glBindTexture(GL_TEXTURE_2D, texLayout);
+            glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_NEAREST); glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE); glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+        }
+        glActiveTexture(GL_TEXTURE4); glBindTexture(GL_TEXTURE_2D, texLayout);
+        glPixelStorei(GL_UNPACK_ALIGNMENT,4);
+        glTexImage2D(GL_TEXTURE_2D,0,GL_RGBA32I,LAYOUT_TABLE_WIDTH,config->layoutRows,0,GL_RGBA_INTEGER,GL_INT,config->layoutTable.data());
+        if (loc_texColorLut >= 0) {
+            if (!texColorLut) {
+                glGenTextures(1, &texColorLut);
+                glActiveTexture(GL_TEXTURE5); glBindTexture(GL_TEXTURE_2D, texColorLut);
+                glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_NEAREST); glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+                glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE); glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+            }
+            glActiveTexture(GL_TEXTURE5); glBindTexture(GL_TEXTURE_2D, texColorLut);
+            glTexImage2D(GL_TEXTURE_2D,0,GL_RGBA8,COLOR_LUT_SIZE,config->colorLutRows,0,GL_RGBA,GL_UNSIGNED_BYTE,config->colorLut.data());
+        }
+        glActiveTexture(GL_TEXTURE0);
+        vlogln("layout: " + std::to_string(config->offsets.size()) + " segment(s) x " + std::to_string(config->tiles) + " tiles in a " +
+               std::to_string(LAYOUT_TABLE_WIDTH) + "x" + std::to_string(config->layoutRows) + " table, " +
+               std::to_string(config->colorLutRows - 1) + " calibrated module(s)");
+    };
+    auto load_offsets = [&]() {
+        tiles_dirty = (opt_tile_mode == TILE_INSTANCED);
+        offsetData = config->segment_offsets(activeSegment);
+        wall_segments = opt_all_segments ? (int)config->offsets.size() : 1;
+    };
+    upload_layout_table();
+    load_offsets();
+    GLint loc_viewport = glGetUniformLocation(program, "u_viewport");
+    GLint loc_drawSegment = glGetUniformLocation(program, "u_drawSegment");
+    if (opt_all_segments) vlogln("startup: drawing all " + std::to_string(wall_segments) + " segments per frame");
 
-    int activeSegment = 1;
-    if (loc_segmentIndex >= 0) { glUseProgram(program); glUniform1i(loc_segmentIndex, activeSegment); }
+    int flip_x = 0, flip_y = 1, rotation = opt_rotation;
+    // what the shader applies: the whole rotation/mirroring, or for RGA output the mirror the RGA left over
+    struct ShaderTransform { int rot, flip_x, flip_y; };
+    auto shader_transform = [&]() -> ShaderTransform { return tex_rga ? ShaderTransform{0, 0, tex_rga_flip_y} : ShaderTransform{rotation, flip_x, flip_y}; };
+    auto texture_is_full = [&]() -> int {
+        if (tex_rga) return tex_rga_full ? 1 : 0;
+        return (!upload_rect.cropped && (int)tex_width == (int)ctrl.fullInputW && (int)tex_height == (int)ctrl.fullInputH) ? 1 : 0;
+    };
+
+    // gap rows that fall inside the grid (row 0 never has spacing above it)
+    auto gap_count = [&]() { int n = 0; for (int r : ctrl.gapRows) if (r >= 1 && r < ctrl.numTilesPerCol) ++n; return n; };
+
+    // --render-on-demand: set by anything that changes the picture (new frame, uniforms, textures, window)
+    bool need_redraw = true;
+
+    // Remap texture (unit 3) for --tile-mode=remap; rebuilt whenever anything the tile mapping depends on changes
+    GLuint texRemap = 0;
+    bool remap_active = false;
+    float remap_gridW = 0.0f, remap_gridH = 0.0f;
+    bool remap_dirty = (opt_tile_mode == TILE_REMAP);
+    auto mark_remap_dirty = [&]() { if (opt_tile_mode == TILE_REMAP) remap_dirty = true; };
+    auto rebuild_remap = [&]() {
+        remap_dirty = false;
+        int64_t t0 = steady_ms();
+        int textureIsFull = texture_is_full();
+        ShaderTransform xf = shader_transform();
+        int maxSeg = std::max(1, ctrl.segmentsX * ctrl.segmentsY);
+        RemapTable table;
+        // texRemap only knows source pixels, not which module a tile belongs to
+        if (config->colorLutRows > 1) { remap_active = false; vlogln("remap: module calibration set, using shader tile mapping"); return; }
+        bool ok = loc_texRemap >= 0 &&
+                  build_remap_table(ctrl, ctrl.gapRows, offsetData, std::min(std::max(1, activeSegment), maxSeg), textureIsFull,
+                                    xf.rot, xf.flip_x, xf.flip_y, upload_rect.w, upload_rect.h, table);
+        if (ok && (table.width > gl_max_tex || table.height > gl_max_tex)) {
+            std::cerr << "Warning: remap table " << table.width << "x" << table.height << " exceeds GL_MAX_TEXTURE_SIZE, using shader tile mapping\n";
+            ok = false;
+        }
+        if (!ok) {
+            remap_active = false;
+            vlogln("remap: not available, using shader tile mapping");
+            return;
+        }
+        if (!texRemap) {
+            glGenTextures(1, &texRemap); glBindTexture(GL_TEXTURE_2D, texRemap);
+            glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_NEAREST); glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE); glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+        }
+        glActiveTexture(GL_TEXTURE3); glBindTexture(GL_TEXTURE_2D, texRemap);
+        glPixelStorei(GL_UNPACK_ALIGNMENT,1);
+        glTexImage2D(GL_TEXTURE_2D,0,GL_RG16UI,table.width,table.height,0,GL_RG_INTEGER,GL_UNSIGNED_SHORT,table.data.data());
+        remap_gridW = table.gridW; remap_gridH = table.gridH;
+        remap_active = true;
+        need_redraw = true;
+        vlogln(std::string("remap: built ") + std::to_string(table.width) + "x" + std::to_string(table.height) + " table in " + std::to_string(steady_ms() - t0) + "ms");
+    };
 
-    const int GAP_ARRAY_SIZE = 8;
-    int gap_count = 2;
-    int gap_rows_arr[GAP_ARRAY_SIZE] = { 5,10,0,0,0,0,0,0 };
-    if (loc_gap_count >= 0) { glUseProgram(program); glUniform1i(loc_gap_count, gap_count); }
-    if (loc_gap_rows >= 0) { glUseProgram(program); glUniform1iv(loc_gap_rows, GAP_ARRAY_SIZE, gap_rows_arr); }
+    // Tile instances for --tile-mode=instanced, one run per drawn segment; rebuilt when control_ini or the offsets change
+    std::vector<TileInstance> tile_instances;
+    std::vector<int> tile_first, tile_count;
+    float tile_gridW = 0.0f, tile_gridH = 0.0f;
+    auto rebuild_tiles = [&]() {
+        tiles_dirty = false;
+        tile_instances.clear(); tile_first.clear(); tile_count.clear();
+        for (int seg = 0; seg < wall_segments; ++seg) {
+            tile_first.push_back((int)tile_instances.size());
+            build_tile_instances(ctrl, ctrl.gapRows, opt_all_segments ? config->segment_offsets(seg + 1) : offsetData, tile_instances);
+            tile_count.push_back((int)tile_instances.size() - tile_first.back());
+        }
+        tile_grid_size(ctrl, ctrl.gapRows, tile_gridW, tile_gridH);
+        tile_gridW = std::max(tile_gridW, 1.0f); tile_gridH = std::max(tile_gridH, 1.0f);
+        glBindBuffer(GL_ARRAY_BUFFER, tile_instance_vbo);
+        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(tile_instances.size() * sizeof(TileInstance)), tile_instances.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        need_redraw = true;
+        vlogln("tiles: " + std::to_string(tile_instances.size()) + " tile instances for " + std::to_string(wall_segments) + " segment(s)");
+    };
+    // point the per-instance attributes of tile_vao at the run starting at instance 'first'
+    auto bind_tile_instances = [&](int first) {
+        static const int comps[3] = { 4, 2, 1 };
+        static const size_t offs[3] = { offsetof(TileInstance, dst), offsetof(TileInstance, src), offsetof(TileInstance, index) };
+        glBindBuffer(GL_ARRAY_BUFFER, tile_instance_vbo);
+        for (int i = 0; i < 3; ++i) {
+            if (tile_attr[i] < 0) continue;
+            glEnableVertexAttribArray(tile_attr[i]);
+            glVertexAttribPointer(tile_attr[i], comps[i], GL_FLOAT, GL_FALSE, sizeof(TileInstance), (void*)((size_t)first * sizeof(TileInstance) + offs[i]));
+            vertex_attrib_divisor(tile_attr[i], 1);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    };
+
+    // Fill the LayoutParams block from the current render state and upload it only if anything changed.
+    LayoutParamsStd140 layout_uploaded; bool layout_uploaded_valid = false;
+    int layout_flags[2] = { -1, -1 }; // showPattern, textureIsFull as currently in the block (see patch_layout_flags)
+    bool signal_lost = false;
+    // NEW: manual override to show test pattern with 't' (toggle)
+    bool manual_show_pattern = opt_show_pattern;
+    auto sync_layout_ubo = [&]() -> bool {
+        LayoutParamsStd140 L; memset(&L, 0, sizeof(L));
+        L.fullInputSize[0] = ctrl.fullInputW; L.fullInputSize[1] = ctrl.fullInputH;
+        L.subBlockSize[0] = ctrl.subBlockW; L.subBlockSize[1] = ctrl.subBlockH;
+        L.windowSize[0] = (float)win_w; L.windowSize[1] = (float)win_h;
+        L.outputSize[0] = ctrl.subBlockW; L.outputSize[1] = ctrl.subBlockH;
+        L.gridSize[0] = tile_program ? tile_gridW : remap_gridW; L.gridSize[1] = tile_program ? tile_gridH : remap_gridH;
+        L.tileW = ctrl.tileW; L.tileH = ctrl.tileH;
+        L.spacingX = ctrl.spacingX; L.spacingY = ctrl.spacingY; L.marginX = ctrl.marginX;
+        L.segmentsX = ctrl.segmentsX; L.segmentsY = ctrl.segmentsY;
+        L.numTilesPerRow = ctrl.numTilesPerRow; L.numTilesPerCol = ctrl.numTilesPerCol;
+        int maxSeg = std::max(1, ctrl.segmentsX * ctrl.segmentsY);
+        L.segmentIndex = std::min(std::max(1, activeSegment), maxSeg);
+        ShaderTransform xf = shader_transform();
+        L.rot = xf.rot; L.flip_x = xf.flip_x; L.flip_y = xf.flip_y;
+        L.gap_count = gap_count();
+        L.inputTilesTopToBottom = ctrl.inputTilesTopToBottom;
+        L.view_mode = view_mode;
+        L.textureIsFull = texture_is_full();
+        L.alignTopLeft = 1;
+        // show pattern if signal_lost OR manual_show_pattern (toggle with 't')
+        L.showPattern = (ENABLE_SHADER_TEST_PATTERN && (signal_lost || manual_show_pattern)) ? 1 : 0;
+        L.useRemap = remap_active ? 1 : 0;
+        L.colorLut = (config->colorLutRows > 1 && texColorLut) ? 1 : 0;
+        YuvColor color; color.bt709 = opt_use_bt709 != 0; color.full_range = opt_full_range != 0; color.swap_uv = !opt_cpu_uv_swap && uv_swap && !tex_rga;
+        yuv_color_matrix(color, L.colorMatrix);
+        L.layoutTable[0] = config->layoutTileBase; L.layoutTable[1] = config->tiles; L.layoutTable[2] = (int)config->offsets.size();
+        if (layout_uploaded_valid && memcmp(&L, &layout_uploaded, sizeof(L)) == 0) return false;
+        glBindBuffer(GL_UNIFORM_BUFFER, layoutUbo);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(L), &L);
+        layout_uploaded = L; layout_uploaded_valid = true;
+        layout_flags[0] = L.showPattern; layout_flags[1] = L.textureIsFull;
+        return true;
+    };
+    // Several capture sources: segments of another source than 0 draw with their own pattern / full-texture
+    // flags. Only those two words of the block are rewritten, and put back after the draw, so
+    // sync_layout_ubo() keeps comparing against what source 0 needs.
+    auto patch_layout_flags = [&](int show_pattern, int texture_full) {
+        if (!layout_uploaded_valid || (layout_flags[0] == show_pattern && layout_flags[1] == texture_full)) return;
+        const int32_t v[3] = { texture_full, layout_uploaded.alignTopLeft, show_pattern };
+        glBindBuffer(GL_UNIFORM_BUFFER, layoutUbo);
+        glBufferSubData(GL_UNIFORM_BUFFER, offsetof(LayoutParamsStd140, textureIsFull), sizeof(v), v);
+        layout_flags[0] = show_pattern; layout_flags[1] = texture_full;
+    };
+    // capture source of a segment (sources missing from the list fall back to 0) and its pattern state
+    auto segment_source = [&](int segment) -> int {
+        int src = config->segment_source(segment);
+        return src < (int)sources.size() ? src : 0;
+    };
+    auto source_lost = [&](int src) -> bool { return src == 0 ? signal_lost : sources[(size_t)src]->signal_lost; };
 
     const int POLL_TIMEOUT_MS = 200;
     const uint64_t CHECK_FMT_INTERVAL = 120;
     uint64_t frame_count = 0;
-    struct pollfd pfd; pfd.fd = fd; pfd.events = POLLIN | POLLPRI;
 
     std::vector<unsigned char> tmpUVbuf, tmpFallback;
-    std::vector<unsigned char> lastY, lastUV, lastPacked;
-    size_t lastPackedSize = 0; int last_stride = 0; int last_width=0, last_height=0;
-    bool lastIsNV12_NV21=false; uint32_t last_pixfmt=0;
+    // 's' only arms snapshot_requested; the next live frame is copied once and handed to the worker
+    BoundedWorker<ScreenshotJob> screenshot_worker(SCREENSHOT_QUEUE, run_screenshot_job);
+    bool snapshot_requested = false;
+    // 'c': output frames still to be read back (--capture-burst)
+    ReadbackRing readback;
+    bool readback_ok = readback_ring_init(readback);
+    int output_capture_remaining = 0;
 
     vlogln("startup: entering main loop");
 
-    using clock = std::chrono::steady_clock;
-    auto last_good_frame = clock::now();
-    auto last_recovered_time = clock::time_point();
+    // Written by the capture threads on every good frame, read by the render thread for the pattern timeout.
+    for (auto &src : sources) src->last_good_frame_ms.store(steady_ms());
 
-    bool signal_lost = false;
-    // NEW: manual override to show test pattern with 't' (toggle)
-    bool manual_show_pattern = false;
+    // cur_width/cur_height/cur_pixfmt, fd and buffers belong to a source's capture thread once it runs;
+    // restart_mutex guards the format fields the render thread copies on need_gl_update (after a recovery).
+    std::mutex &restart_mutex = primary.restart_mutex;
+    std::atomic<int64_t> &last_good_frame_ms = primary.last_good_frame_ms, &last_recovered_ms = primary.last_recovered_ms;
+    std::atomic<bool> &need_gl_update = primary.need_gl_update, &capture_signal_lost = primary.capture_signal_lost;
+    std::atomic<bool> capture_quit(false); // every capture thread
 
-    int einval_count = 0;
-    std::mutex restart_mutex;
+#ifdef HDMI_HAVE_RGA
+    // --rga: what the render thread wants done to the next frames, picked up by the capture thread per
+    // frame. The crop only applies to frames of crop_frame_w x crop_frame_h (the full input).
+    struct RgaRequest { RgaTransform xf; uint32_t crop_frame_w = 0, crop_frame_h = 0; };
+    auto same_request = [](const RgaRequest &a, const RgaRequest &b) {
+        return a.xf.crop_x == b.xf.crop_x && a.xf.crop_y == b.xf.crop_y && a.xf.crop_w == b.xf.crop_w && a.xf.crop_h == b.xf.crop_h &&
+               a.xf.rot == b.xf.rot && a.xf.flip_x == b.xf.flip_x && a.xf.flip_y == b.xf.flip_y && a.xf.swap_uv == b.xf.swap_uv &&
+               a.xf.out_pixfmt == b.xf.out_pixfmt && a.crop_frame_w == b.crop_frame_w && a.crop_frame_h == b.crop_frame_h;
+    };
+    std::mutex rga_mutex;
+    RgaRequest rga_request;          // guarded by rga_mutex
+    bool rga_request_valid = false;  // guarded by rga_mutex
+    RgaRequest rga_published;        // render thread: last one handed over
+    bool rga_published_valid = false;
+    // render thread: hand the current segment, rotation/mirroring and Cb/Cr order to the capture thread
+    auto publish_rga_request = [&]() {
+        if (!rga) return;
+        RgaRequest req;
+        UploadRect seg = segment_rect(ctrl, activeSegment);
+        if (!opt_all_segments && seg.cropped && seg.w > 0 && seg.h > 0) {
+            req.xf.crop_x = (uint32_t)seg.x; req.xf.crop_y = (uint32_t)seg.y; req.xf.crop_w = (uint32_t)seg.w; req.xf.crop_h = (uint32_t)seg.h;
+        }
+        req.crop_frame_w = (uint32_t)ctrl.fullInputW; req.crop_frame_h = (uint32_t)ctrl.fullInputH;
+        req.xf.rot = rotation; req.xf.flip_x = flip_x; req.xf.flip_y = flip_y;
+        req.xf.swap_uv = opt_cpu_uv_swap ? pixel_layout(tex_source_pixfmt).vu : uv_swap != 0;
+        req.xf.out_pixfmt = opt_rga_pixfmt;
+        if (rga_published_valid && same_request(req, rga_published)) return;
+        rga_published = req; rga_published_valid = true;
+        std::lock_guard<std::mutex> lk(rga_mutex);
+        rga_request = req; rga_request_valid = true;
+    };
+    // capture thread: run the frame in buffer 'index' through the RGA into rga_buffers[index]; 'm' then
+    // describes the output. Without a DMABUF holding both planes the frame is left as it is.
+    auto rga_convert = [&](unsigned index, CapturedFrame &m) {
+        if (!rga || index >= rga_buffers.size() || m.num_planes != 1 || buffers[index][0].dmabuf_fd < 0) return;
+        RgaRequest req;
+        { std::lock_guard<std::mutex> lk(rga_mutex); if (!rga_request_valid) return; req = rga_request; }
+        bool full_input = m.width == req.crop_frame_w && m.height == req.crop_frame_h;
+        if (!full_input) req.xf.crop_w = req.xf.crop_h = 0;
+        const PlaneMap &p0 = buffers[index][0];
+        PixelLayout l = pixel_layout(m.pixfmt);
+        RgaSource src; src.fd = p0.dmabuf_fd; src.length = p0.length;
+        src.width = m.width; src.height = m.height; src.v4l2_pixfmt = m.pixfmt;
+        src.stride = (uint32_t)luma_stride(l, p0, m.width); src.uv_offset = l.packed ? 0 : (size_t)src.stride * m.height;
+        RgaResult r;
+        if (!rga_process(rga, index, src, req.xf, r)) return;
+        m.rga = true; m.rga_full = full_input && !r.cropped; m.rga_flip_y = r.shader_flip_y;
+        m.width = r.width; m.height = r.height; m.pixfmt = req.xf.out_pixfmt; m.bytesused0 = r.bytes;
+    };
+#endif
+
+    FrameHandoff &handoff = primary.handoff;
+    PipelineMetrics metrics; // --stats and --metrics; the exporter thread only reads it
+    metrics.width.store(cur_width); metrics.height.store(cur_height); metrics.pixfmt.store(cur_pixfmt);
+    EventLoop loop;
+    // wakeup/reactor setup failed: close the fds created so far (unset ones are -1), then unmap and close every source
+    auto abort_setup = [&](const char *what) {
+        perror(what);
+        quit_signal_efd = -1;
+        loop.close_fds();
+        for (auto &src : sources) if (src->handoff.capture_efd >= 0) close(src->handoff.capture_efd);
+        if (handoff.render_efd >= 0) close(handoff.render_efd);
+        for (size_t i = 1; i < sources.size(); ++i) {
+            unmap_buffers(sources[i]->buffers);
+            if (sources[i]->fd >= 0) close(sources[i]->fd);
+        }
+        unmap_buffers(buffers);
+        if (fd >= 0) close(fd);
+        return 1;
+    };
+    handoff.render_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    handoff.capture_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (handoff.render_efd < 0 || handoff.capture_efd < 0) return abort_setup("eventfd");
+    for (size_t i = 1; i < sources.size(); ++i) {
+        FrameHandoff &h = sources[i]->handoff;
+        h.render_efd = handoff.render_efd; // one reactor wakeup for every source
+        h.capture_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (h.capture_efd < 0) return abort_setup("eventfd");
+    }
+    metrics.capture_sources.store((int)sources.size(), std::memory_order_relaxed);
+    quit_signal_efd = handoff.render_efd;
+    if (!loop.open() || !loop.add(handoff.render_efd, EventLoop::SRC_WAKE)) return abort_setup("epoll");
+#ifdef HDMI_HAVE_KMS
+    if (kms && !loop.add(kms_fd(kms), EventLoop::SRC_KMS)) return abort_setup("epoll: kms");
+#endif
+    const bool input_fd_ok = loop.add(sdl_input_fd(win), EventLoop::SRC_INPUT);
+    if (win) vlogln(input_fd_ok ? "startup: waiting on the X11 connection for input" : "startup: no input fd, polling SDL every " + std::to_string(INPUT_POLL_MS) + "ms");
+
+    // source 0 logs as before, the others with their number and device
+    auto source_log = [&](const CaptureSource &s, const std::string &msg) {
+        vlogln(s.index == 0 ? msg : "source " + std::to_string(s.index + 1) + " (" + s.device + "): " + msg);
+    };
+    // requeue a capture buffer, retrying transient failures (capture thread)
+    auto queue_buffer = [&](CaptureSource &s, v4l2_buffer &b) -> bool {
+        for (int attempt=0; attempt < QBUF_RETRIES; ++attempt) {
+            if (xioctl(s.fd, VIDIOC_QBUF, &b) == 0) { if (opt_verbose && attempt>0) vlogln(std::string("VIDIOC_QBUF succeeded after ") + std::to_string(attempt) + " retries"); return true; }
+            else { int e = errno; if (opt_verbose) vlogln(std::string("VIDIOC_QBUF failed (attempt ") + std::to_string(attempt+1) + "): " + strerror(e)); usleep(QBUF_RETRY_MS*1000); }
+        }
+        return false;
+    };
+    auto queue_index = [&](CaptureSource &s, unsigned index) {
+        if (index >= s.buffers.size()) return;
+        v4l2_buffer b; v4l2_plane planes[VIDEO_MAX_PLANES]; memset(&b,0,sizeof(b)); memset(planes,0,sizeof(planes));
+        b.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE; b.memory = V4L2_MEMORY_MMAP; b.index = index;
+        b.m.planes = planes; b.length = (unsigned)s.buffers[index].size();
+        if (!queue_buffer(s, b)) std::cerr<<"VIDIOC_QBUF failed after retries; will fallback to pattern if no subsequent good frames\n";
+    };
+    // render thread: give a consumed frame back to the capture thread for requeueing
+    auto return_frame = [&](int64_t token) {
+        if (token < 0) return;
+        handoff.returned.push(token);
+        FrameHandoff::signal(handoff.capture_efd);
+    };
+    // capture thread: sleep that ends early on shutdown
+    auto capture_sleep = [&](CaptureSource &s, int ms) {
+        struct pollfd wp; wp.fd = s.handoff.capture_efd; wp.events = POLLIN; wp.revents = 0;
+        auto until = steady_ms() + ms;
+        for (int64_t left = ms; left > 0 && !capture_quit.load(); left = until - steady_ms()) {
+            if (poll(&wp, 1, (int)left) > 0) FrameHandoff::drain(s.handoff.capture_efd);
+        }
+    };
+    // capture thread: invalidate published frames and wait until the render thread has dropped every
+    // reference (uploads in flight, DMABUF images) before buffers are unmapped or reallocated
+    auto release_gpu_buffers = [&](CaptureSource &s) -> bool {
+        FrameHandoff &h = s.handoff;
+        { std::lock_guard<std::mutex> lk(h.release_mutex); h.released = false; }
+        h.generation.fetch_add(1, std::memory_order_acq_rel);
+        h.latest.store(-1, std::memory_order_release);
+        h.release_requested.store(true, std::memory_order_release);
+        FrameHandoff::signal(h.render_efd);
+        std::unique_lock<std::mutex> lk(h.release_mutex);
+        while (!h.released && !capture_quit.load()) h.release_cv.wait_for(lk, std::chrono::milliseconds(50));
+        return h.released;
+    };
+
+#ifdef HDMI_HAVE_EGL_DMABUF
+    // Zero-copy buffers stay with the render thread while the GPU samples them: the shown buffer is
+    // handed back only once a fence placed after its last draw has signalled.
+    struct RetiringBuffer { int64_t token; GLsync fence; };
+    int64_t dmabuf_shown = -1; GLsync dmabuf_shown_fence = 0;
+    std::vector<RetiringBuffer> dmabuf_retiring;
+    bool dmabuf_stale = false; // the capture buffers were recreated: import them again with the next frame
+    bool dmabuf_available = dmabuf.valid(); // images were built once, so the profile sweep may switch to DMABUF
 
-    std::atomic<bool> auto_reopen_in_progress(false);
-    std::atomic<bool> need_gl_update(false);
-
-    // V4L2-only manual restart helper (no GL calls)
-    auto manual_restart_v4l_only = [&]() -> bool {
-        std::lock_guard<std::mutex> lk(restart_mutex);
-        vlogln("manual_restart_v4l_only: attempting restart_v4l_stream()");
-        if (fd >= 0) {
-            if (restart_v4l_stream(fd, buffers)) {
-                last_good_frame = clock::now();
-                last_recovered_time = last_good_frame;
-                einval_count = 0;
-                signal_lost = false;
-                need_gl_update.store(true, std::memory_order_release);
-                vlogln("manual_restart_v4l_only: restart_v4l_stream succeeded (V4L2-only)");
-                return true;
+    // hand back retired buffers whose GPU reads have completed (never blocks)
+    auto dmabuf_retire = [&]() {
+        for (size_t i=0; i<dmabuf_retiring.size();) {
+            auto &rb = dmabuf_retiring[i];
+            if (rb.fence) {
+                GLenum st = glClientWaitSync(rb.fence, 0, 0);
+                if (st != GL_ALREADY_SIGNALED && st != GL_CONDITION_SATISFIED) { ++i; continue; }
+                glDeleteSync(rb.fence);
             }
-            vlogln("manual_restart_v4l_only: restart_v4l_stream failed, will try full reopen");
+            return_frame(rb.token);
+            dmabuf_retiring.erase(dmabuf_retiring.begin() + i);
         }
-        if (fd >= 0) { close(fd); fd = -1; }
-        const int OPEN_RETRIES = 10; const int OPEN_RETRY_MS = 200;
-        int newfd = -1;
-        for (int i=0;i<OPEN_RETRIES;++i) {
-            newfd = open(DEVICE, O_RDWR | O_NONBLOCK);
-            if (newfd >= 0) break;
-            std::this_thread::sleep_for(std::chrono::milliseconds(OPEN_RETRY_MS));
+    };
+    // drop all images and held buffers; requeue=false when the stream is about to be restarted anyway
+    auto dmabuf_forget = [&](bool requeue) {
+        if (requeue) glFinish();
+        if (dmabuf_shown >= 0) dmabuf_retiring.push_back({dmabuf_shown, dmabuf_shown_fence});
+        dmabuf_shown = -1; dmabuf_shown_fence = 0;
+        for (auto &rb : dmabuf_retiring) { if (rb.fence) glDeleteSync(rb.fence); if (requeue) return_frame(rb.token); }
+        dmabuf_retiring.clear();
+        dmabuf_images_release(dmabuf);
+    };
+    auto dmabuf_rebuild = [&]() {
+        if (!dmabuf_ok || upload_path != UPLOAD_DMABUF) return;
+        dmabuf_forget(false);
+        if (upload_rect.w <= gl_max_tex && upload_rect.h <= gl_max_tex &&
+            !dmabuf_images_build(dmabuf, tex_rga ? rga_buffers : buffers, (int)tex_width, (int)tex_height, tex_pixfmt, upload_rect.x, upload_rect.y, upload_rect.w, upload_rect.h))
+            vlogln("dmabuf: rebuild failed, falling back to copy upload");
+        if (dmabuf.valid()) dmabuf_available = true;
+    };
+    // leave the DMABUF path but keep the images for a switch back; the shown buffer goes back once the GPU is done
+    auto dmabuf_park = [&]() {
+        if (dmabuf_shown >= 0) dmabuf_retiring.push_back({dmabuf_shown, dmabuf_shown_fence});
+        dmabuf_shown = -1; dmabuf_shown_fence = 0;
+    };
+#endif
+    // path the next frame really takes (a failed DMABUF import falls back to copying)
+    auto upload_in_use = [&]() -> UploadMode {
+#ifdef HDMI_HAVE_EGL_DMABUF
+        if (upload_path == UPLOAD_DMABUF && !dmabuf.valid()) return UPLOAD_COPY;
+#endif
+        return upload_path;
+    };
+    // profile sweep: change the upload path at run time; false if 'mode' is not available in this run.
+    // DMABUF only once its images have been built (--upload=dmabuf): the sweep never reads the capture
+    // buffers itself, so an image set dropped by a recovery is rebuilt with the next frame, as usual.
+    auto set_upload_path = [&](UploadMode mode) -> bool {
+        if (mode == upload_path) return true;
+        if (mode == UPLOAD_PBO && !pbo_ok && !(pbo_ok = pbo_ring_init(pbo))) return false;
+#ifdef HDMI_HAVE_EGL_DMABUF
+        if (mode == UPLOAD_DMABUF && !dmabuf_available) return false;
+        if (upload_path == UPLOAD_DMABUF) dmabuf_park();
+        upload_path = mode;
+        if (mode == UPLOAD_DMABUF && !dmabuf.valid()) dmabuf_stale = true;
+#else
+        if (mode == UPLOAD_DMABUF) return false;
+        upload_path = mode;
+#endif
+        need_redraw = true;
+        return true;
+    };
+
+#ifdef HDMI_HAVE_MPP
+    MppStream* stream = nullptr; // --stream encoder, opened once GL and the metrics are up
+#endif
+
+#ifdef HDMI_HAVE_KMS
+    // --kms-overlay: the capture buffer is scanned out unchanged, which is only right while the layout maps
+    // the input 1:1 (one segment holding one unshifted tile, no rotation/mirroring/gaps) and no pattern is up
+    auto overlay_eligible = [&]() -> bool {
+        if (!kms || !opt_kms_overlay || kms_overlay_failed || signal_lost || manual_show_pattern || view_mode != 0) return false;
+        if (profile_overlay || sweep_running) return false; // the text is drawn by GL, and the sweep times the GL path
+#ifdef HDMI_HAVE_MPP
+        if (stream) return false; // the stream reads back the GL output, which the overlay plane bypasses
+#endif
+        if (ctrl.segmentsX != 1 || ctrl.segmentsY != 1 || ctrl.numTilesPerRow != 1 || ctrl.numTilesPerCol != 1 || gap_count() != 0) return false;
+        if (ctrl.tileW != ctrl.subBlockW || ctrl.tileH != ctrl.subBlockH || ctrl.subBlockW != ctrl.fullInputW || ctrl.subBlockH != ctrl.fullInputH) return false;
+        if (offsetData.size() >= 2 && (offsetData[0] != 0 || offsetData[1] != 0)) return false;
+        if (config->colorLutRows > 1) return false; // calibration needs the shader
+        ShaderTransform xf = shader_transform();
+        return xf.rot == 0 && xf.flip_x == 0 && xf.flip_y == 1 && kms_overlay_supported(kms, tex_pixfmt);
+    };
+    // hand back capture buffers the overlay plane no longer scans out
+    auto kms_return_released = [&]() { int64_t t; while (kms_take_released(kms, t)) return_frame(t); };
+    // capture buffers are about to change: take the overlay down and drop their framebuffers
+    auto kms_forget = [&](bool requeue) {
+        if (!kms) return;
+        kms_forget_framebuffers(kms);
+        int64_t t; while (kms_take_released(kms, t)) if (requeue) return_frame(t);
+    };
+#endif
+
+    // GL-side reaction to a new capture format (render thread)
+    auto apply_capture_format = [&](uint32_t w, uint32_t h, uint32_t pf) {
+        tex_width = w; tex_height = h; tex_pixfmt = pf;
+        need_redraw = true;
+        if (tex_rga) { upload_rect = UploadRect(); upload_rect.w = (int)w; upload_rect.h = (int)h; } // the RGA did the crop
+        else upload_rect = compute_upload_rect(ctrl, activeSegment, (int)tex_width, (int)tex_height, tex_pixfmt, gl_max_tex);
+        if (upload_rect.cropped) vlogln(std::string("upload: cropping to segment rect ") + std::to_string(upload_rect.w) + "x" + std::to_string(upload_rect.h) + "+" + std::to_string(upload_rect.x) + "+" + std::to_string(upload_rect.y));
+        mark_remap_dirty();
+        reallocate_textures(texY, texUV, tex_pixfmt, upload_rect.w, upload_rect.h);
+#ifdef HDMI_HAVE_EGL_DMABUF
+        dmabuf_rebuild();
+#endif
+        if (opt_auto_resize_window && win) SDL_SetWindowSize(win, (int)tex_width, (int)tex_height);
+        if (opt_uv_swap_override < 0 && !opt_cpu_uv_swap && pixel_layout(tex_source_pixfmt).supported) uv_swap = pixel_layout(tex_source_pixfmt).vu ? 1 : 0;
+    };
+    // segment switch / control_ini reload: move the crop rectangle (clients keep streaming)
+    auto refresh_upload_rect = [&]() {
+        if (!opt_crop_upload || tex_rga) return;
+        UploadRect r = compute_upload_rect(ctrl, activeSegment, (int)tex_width, (int)tex_height, tex_pixfmt, gl_max_tex);
+        if (r.x == upload_rect.x && r.y == upload_rect.y && r.w == upload_rect.w && r.h == upload_rect.h && r.cropped == upload_rect.cropped) return;
+#ifdef HDMI_HAVE_EGL_DMABUF
+        dmabuf_forget(true);
+#endif
+        apply_capture_format(tex_width, tex_height, tex_pixfmt);
+    };
+
+    // render thread: ask a capture thread for a background reopen
+    auto request_reopen = [&](CaptureSource &s) {
+        if (s.auto_reopen_in_progress.load()) return;
+        s.reopen_requested.store(true);
+        FrameHandoff::signal(s.handoff.capture_efd);
+    };
+
+    // Signal recovery, a state machine driven by each source's capture loop (it owns fd and buffers).
+    // begin_recovery() shows the pattern on the source's segments; recover_step() then tries
+    // recover_stream() (DV timings, buffers reused if they fit) and, if the device itself fails, a full
+    // reopen. Retries wait for a SOURCE_CHANGE event or the backoff, whichever comes first. The first frame
+    // after a successful step ends the recovery. Sources other than 0 start here, with no device open.
+    auto begin_recovery = [&](CaptureSource &s, const std::string &why) {
+        s.capture_signal_lost.store(true); FrameHandoff::signal(s.handoff.render_efd);
+        if (s.recovering) return;
+        source_log(s, "recovery: " + why);
+        if (!s.counted_recovering) { metrics.recovering.fetch_add(1, std::memory_order_relaxed); s.counted_recovering = true; }
+        if (!s.awaiting_first_frame) { s.recover_attempt = 0; s.recover_started_ms = steady_ms(); } // else: the last try brought no frame, keep backing off
+        s.recovering = true; s.awaiting_first_frame = false; s.recover_released = false;
+        s.recover_next_ms = steady_ms();
+        s.auto_reopen_in_progress.store(true);
+    };
+    auto recover_step = [&](CaptureSource &s) {
+        // once per recovery: the render thread drops every frame reference before buffers are touched
+        if (!s.recover_released && !release_gpu_buffers(s)) return; // shutting down
+        s.recover_released = true;
+        uint32_t w = s.cur_width, h = s.cur_height, pf = s.cur_pixfmt;
+        RecoverResult r = s.fd >= 0 ? recover_stream(s.fd, s.buffers, w, h, pf) : RECOVER_FAILED;
+        if (r == RECOVER_FAILED) {
+            source_log(s, (s.fd >= 0 ? "recovery: stream restart failed, reopening " : "recovery: opening ") + s.device);
+            r = reopen_capture_device(s.device, s.fd, s.buffers, w, h, pf);
         }
-        if (newfd < 0) { vlogln("manual_restart_v4l_only: open device failed"); return false; }
-        fd = newfd;
-        uint32_t nw=0, nh=0, npf=0;
-        if (!get_v4l2_format(fd, nw, nh, npf)) { nw = cur_width; nh = cur_height; npf = cur_pixfmt; }
-        // update shared format/state under mutex
-        {
-            std::lock_guard<std::mutex> lk2(restart_mutex);
-            cur_width = nw; cur_height = nh; cur_pixfmt = npf;
+        int64_t now = steady_ms();
+        if (r == RECOVER_OK) {
+            if (s.index == 0) {
+                if (want_dmabuf_export() && !export_dmabufs(s.fd, s.buffers)) vlogln("recovery: DMABUF export failed, falling back to copy upload");
+                rga_prepare();
+                metrics.width.store(w, std::memory_order_relaxed); metrics.height.store(h, std::memory_order_relaxed); metrics.pixfmt.store(pf, std::memory_order_relaxed);
+            }
+            { std::lock_guard<std::mutex> lk(s.restart_mutex); s.cur_width = w; s.cur_height = h; s.cur_pixfmt = pf; }
+            s.recovering = false; s.awaiting_first_frame = true; s.first_frame_deadline_ms = now + RECOVER_FIRST_FRAME_MS;
+            s.last_recovered_ms.store(now);
+            s.auto_reopen_in_progress.store(false);
+            s.need_gl_update.store(true, std::memory_order_release); FrameHandoff::signal(s.handoff.render_efd);
+            source_log(s, "recovery: streaming " + std::to_string(w) + "x" + std::to_string(h) + " " + fourcc_to_str(pf) + " again after " + std::to_string(now - s.recover_started_ms) + "ms");
+            return;
         }
-        v4l2_format sfmt; memset(&sfmt,0,sizeof(sfmt));
-        sfmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-        sfmt.fmt.pix_mp.width = cur_width; sfmt.fmt.pix_mp.height = cur_height;
-        sfmt.fmt.pix_mp.pixelformat = v4l2_fourcc('N','V','2','4');
-        sfmt.fmt.pix_mp.field = V4L2_FIELD_NONE; sfmt.fmt.pix_mp.num_planes = 1;
-        (void)xioctl(fd, VIDIOC_S_FMT, &sfmt);
-        get_v4l2_format(fd, cur_width, cur_height, cur_pixfmt);
-
-        v4l2_requestbuffers req2; memset(&req2,0,sizeof(req2));
-        req2.count = BUF_COUNT; req2.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE; req2.memory = V4L2_MEMORY_MMAP;
-        if (xioctl(fd, VIDIOC_REQBUFS, &req2) < 0) { vlogln(std::string("Manual restart: VIDIOC_REQBUFS failed: ")+strerror(errno)); close(fd); fd=-1; return false; }
-        if (req2.count == 0) { vlogln("Manual restart: VIDIOC_REQBUFS returned zero buffers"); close(fd); fd=-1; return false; }
-        buffers.clear(); buffers.resize(req2.count);
-        for (unsigned i=0;i<req2.count;++i) {
-            v4l2_buffer bufq; v4l2_plane planes[VIDEO_MAX_PLANES]; memset(&bufq,0,sizeof(bufq)); memset(planes,0,sizeof(planes));
-            bufq.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE; bufq.index = i; bufq.memory = V4L2_MEMORY_MMAP; bufq.m.planes = planes; bufq.length = VIDEO_MAX_PLANES;
-            if (xioctl(fd, VIDIOC_QUERYBUF, &bufq) < 0) {
-                vlogln(std::string("Manual restart: VIDIOC_QUERYBUF failed: ") + strerror(errno));
-                for (auto &bvec : buffers) for (auto &pm : bvec) if (pm.addr && pm.length) munmap(pm.addr, pm.length);
-                buffers.clear(); close(fd); fd=-1; return false;
+        ++s.recover_attempt;
+        int delay = std::min(RECOVER_BACKOFF_MIN_MS << std::min(s.recover_attempt - 1, 10), r == RECOVER_NO_SIGNAL ? RECOVER_QUERY_MAX_MS : RECOVER_BACKOFF_MAX_MS);
+        s.recover_next_ms = now + delay;
+        if (opt_verbose) source_log(s, std::string("recovery: ") + (r == RECOVER_NO_SIGNAL ? "no signal" : "device not ready") + ", next try in " + std::to_string(delay) + "ms (attempt " + std::to_string(s.recover_attempt) + ")");
+    };
+    // while recovering: wait for the retry time, a SOURCE_CHANGE event (retry now) or a wakeup
+    auto recover_wait = [&](CaptureSource &s) {
+        struct pollfd wp[2]; int n = 0;
+        wp[n].fd = s.handoff.capture_efd; wp[n].events = POLLIN; wp[n].revents = 0; ++n;
+        if (s.fd >= 0) { wp[n].fd = s.fd; wp[n].events = POLLPRI; wp[n].revents = 0; ++n; }
+        int64_t left = s.recover_next_ms - steady_ms();
+        if (left <= 0) return;
+        if (poll(wp, n, (int)left) <= 0) return;
+        if (wp[0].revents & POLLIN) FrameHandoff::drain(s.handoff.capture_efd);
+        if (n > 1 && (wp[1].revents & POLLPRI)) {
+            v4l2_event ev; bool source_change = false;
+            while (ioctl(s.fd, VIDIOC_DQEVENT, &ev) == 0) if (ev.type == V4L2_EVENT_SOURCE_CHANGE) source_change = true;
+            if (source_change) { source_log(s, "recovery: SOURCE_CHANGE, retrying now"); s.recover_next_ms = steady_ms(); }
+        }
+    };
+
+    // Capture thread of one source: poll() + VIDIOC_DQBUF, publish the newest frame, requeue returned
+    // buffers, and run all stream recovery so no other thread touches its fd or buffers while streaming.
+    auto capture_main = [&](CaptureSource &s) {
+        source_log(s, "capture thread: started");
+        FrameHandoff &h = s.handoff;
+        auto count_sequence = [&](uint32_t sequence, uint32_t gen) {
+            metrics.frames_captured.fetch_add(1, std::memory_order_relaxed);
+            // the sequence restarts with every STREAMON, i.e. with every buffer generation
+            if (s.last_sequence_valid && s.last_sequence_gen == gen && sequence > s.last_sequence + 1)
+                metrics.dropped_by_source.fetch_add(sequence - s.last_sequence - 1, std::memory_order_relaxed);
+            s.last_sequence = sequence; s.last_sequence_gen = gen; s.last_sequence_valid = true;
+        };
+        while (!capture_quit.load()) {
+            // requeue buffers handed back by the render thread (stale generations are dropped)
+            int64_t tok;
+            while (h.returned.pop(tok)) {
+                if (FrameHandoff::token_generation(tok) == h.generation.load(std::memory_order_acquire)) queue_index(s, FrameHandoff::token_index(tok));
+            }
+            if (s.reopen_requested.exchange(false)) begin_recovery(s, "requested by the render thread");
+            else if (s.fd < 0 && !s.recovering) begin_recovery(s, "no capture device");
+            if (s.recovering) {
+                if (steady_ms() >= s.recover_next_ms) recover_step(s);
+                if (s.recovering) recover_wait(s);
+                continue;
             }
-            buffers[i].resize(bufq.length);
-            for (unsigned p=0;p<bufq.length;++p) {
-                buffers[i][p].length = planes[p].length;
-                buffers[i][p].addr = mmap(nullptr, planes[p].length, PROT_READ|PROT_WRITE, MAP_SHARED, fd, planes[p].m.mem_offset);
-                if (buffers[i][p].addr == MAP_FAILED) {
-                    vlogln(std::string("Manual restart: mmap failed: ") + strerror(errno));
-                    for (auto &bvec : buffers) for (auto &pm : bvec) if (pm.addr && pm.length) munmap(pm.addr, pm.length);
-                    buffers.clear(); close(fd); fd=-1; return false;
+            if (s.awaiting_first_frame && steady_ms() > s.first_frame_deadline_ms) { begin_recovery(s, "no frame after restart"); continue; }
+
+            struct pollfd pfds[2];
+            pfds[0].fd = s.fd; pfds[0].events = POLLIN | POLLPRI; pfds[0].revents = 0;
+            pfds[1].fd = h.capture_efd; pfds[1].events = POLLIN; pfds[1].revents = 0;
+            int ret = poll(pfds, 2, POLL_TIMEOUT_MS);
+            if (ret < 0) { if (errno == EINTR) continue; perror("poll"); capture_quit.store(true); FrameHandoff::signal(h.render_efd); break; }
+            if (pfds[1].revents & POLLIN) FrameHandoff::drain(h.capture_efd);
+            bool try_dequeue = ret == 0 || (pfds[0].revents & (POLLIN | POLLERR));
+
+            if (try_dequeue) {
+              v4l2_buffer buf; v4l2_plane planes[VIDEO_MAX_PLANES];
+              memset(&buf,0,sizeof(buf)); memset(planes,0,sizeof(planes));
+              buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE; buf.memory = V4L2_MEMORY_MMAP; buf.m.planes = planes; buf.length = VIDEO_MAX_PLANES;
+
+              if (xioctl(s.fd, VIDIOC_DQBUF, &buf) < 0) {
+                int e = errno;
+                if (e != EAGAIN && e != EWOULDBLOCK) metrics.count_dqbuf_error(e);
+                if (e == EAGAIN || e == EWOULDBLOCK) {
+                    // no frame
+                } else if (e == EINVAL || e == EPIPE || e == ENODEV || e == EIO) {
+                    // stream stopped (signal gone / resolution changed) or device lost
+                    begin_recovery(s, std::string("VIDIOC_DQBUF failed: ") + strerror(e));
+                    continue;
+                } else {
+                    source_log(s, std::string("VIDIOC_DQBUF non-fatal failure: ") + strerror(e));
+                    capture_sleep(s, QBUF_RETRY_MS);
+                }
+              } else if (planes[0].bytesused == 0) {
+                queue_buffer(s, buf);
+                begin_recovery(s, "dequeued an empty buffer");
+                continue;
+              } else {
+                uint32_t gen = h.generation.load(std::memory_order_acquire);
+                // latency mode: take everything that is ready, older buffers go straight back to the driver
+                while (opt_queue_mode == QUEUE_LATENCY) {
+                    v4l2_buffer next; v4l2_plane next_planes[VIDEO_MAX_PLANES];
+                    memset(&next,0,sizeof(next)); memset(next_planes,0,sizeof(next_planes));
+                    next.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE; next.memory = V4L2_MEMORY_MMAP; next.m.planes = next_planes; next.length = VIDEO_MAX_PLANES;
+                    if (xioctl(s.fd, VIDIOC_DQBUF, &next) < 0) break; // EAGAIN: 'buf' is the newest (errors show up on the next dequeue)
+                    if (next_planes[0].bytesused == 0) { queue_buffer(s, next); break; }
+                    count_sequence(buf.sequence, gen);
+                    queue_buffer(s, buf);
+                    metrics.stale.fetch_add(1, std::memory_order_relaxed);
+                    buf = next; memcpy(planes, next_planes, sizeof(planes)); buf.m.planes = planes;
+                }
+                CapturedFrame &m = h.meta[buf.index];
+                m.num_planes = buf.length; m.bytesused0 = planes[0].bytesused;
+                m.width = s.cur_width; m.height = s.cur_height; m.pixfmt = m.source_pixfmt = s.cur_pixfmt;
+                m.sequence = buf.sequence; m.dqbuf_us = steady_us();
+                m.capture_us = ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+                    ? (int64_t)buf.timestamp.tv_sec * 1000000 + buf.timestamp.tv_usec : 0;
+                m.rga = false;
+#ifdef HDMI_HAVE_RGA
+                if (s.index == 0) rga_convert(buf.index, m);
+#endif
+                count_sequence(buf.sequence, gen);
+                int64_t old = h.latest.exchange(FrameHandoff::make_token(gen, buf.index), std::memory_order_acq_rel);
+                // newest frame wins: the render thread never saw the previous one, requeue it right away
+                if (old >= 0 && FrameHandoff::token_generation(old) == gen) {
+                    queue_index(s, FrameHandoff::token_index(old));
+                    metrics.superseded.fetch_add(1, std::memory_order_relaxed);
+                }
+                int64_t now_ms = steady_ms();
+                s.last_good_frame_ms.store(now_ms); s.last_recovered_ms.store(now_ms);
+                if (s.awaiting_first_frame) {
+                    s.awaiting_first_frame = false;
+                    source_log(s, "recovery: live again after " + std::to_string(now_ms - s.recover_started_ms) + "ms");
+                    metrics.recoveries.fetch_add(1, std::memory_order_relaxed);
+                    metrics.recovery_ms_total.fetch_add((uint64_t)(now_ms - s.recover_started_ms), std::memory_order_relaxed);
+                    metrics.last_recovery_ms.store(now_ms - s.recover_started_ms, std::memory_order_relaxed);
+                    if (s.counted_recovering) { metrics.recovering.fetch_sub(1, std::memory_order_relaxed); s.counted_recovering = false; }
                 }
+                FrameHandoff::signal(h.render_efd);
+              }
             }
-            if (xioctl(fd, VIDIOC_QBUF, &bufq) < 0) {
-                vlogln(std::string("Manual restart: VIDIOC_QBUF failed: ") + strerror(errno));
-                for (auto &bvec : buffers) for (auto &pm : bvec) if (pm.addr && pm.length) munmap(pm.addr, pm.length);
-                buffers.clear(); close(fd); fd=-1; return false;
+
+            // SOURCE_CHANGE: restart only if the timings or the format really changed
+            if (pfds[0].revents & POLLPRI) {
+                v4l2_event ev; bool source_change = false;
+                while (ioctl(s.fd, VIDIOC_DQEVENT, &ev) == 0) if (ev.type == V4L2_EVENT_SOURCE_CHANGE) source_change = true;
+                if (source_change && source_changed(s.fd, s.cur_width, s.cur_height, s.cur_pixfmt)) begin_recovery(s, "SOURCE_CHANGE");
             }
         }
-        int t = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-        if (xioctl(fd, VIDIOC_STREAMON, &t) < 0) {
-            vlogln(std::string("Manual restart: VIDIOC_STREAMON failed: ") + strerror(errno));
-            for (auto &bvec : buffers) for (auto &pm : bvec) if (pm.addr && pm.length) munmap(pm.addr, pm.length);
-            buffers.clear(); close(fd); fd=-1; return false;
+        source_log(s, "capture thread: exiting");
+    };
+
+    // --replay: runs instead of capture_main. Copies the next recorded frame into a free buffer at the
+    // requested rate (or whenever the previous frame was taken) and publishes it like a dequeued one.
+    auto replay_main = [&]() {
+        vlogln("replay thread: started");
+        std::vector<char> busy(buffers.size(), 0); // published or held by the render thread
+        const uint32_t gen = handoff.generation.load(std::memory_order_acquire);
+        const int64_t period_us = opt_replay_fps > 0 ? 1000000 / opt_replay_fps : 0;
+        int64_t next_due_us = steady_us();
+        size_t next_frame = 0; uint32_t sequence = 0;
+        while (!capture_quit.load()) {
+            int64_t tok;
+            while (handoff.returned.pop(tok)) { unsigned i = FrameHandoff::token_index(tok); if (i < busy.size()) busy[i] = 0; }
+            primary.reopen_requested.store(false); // nothing to reopen
+            int64_t now = steady_us();
+            if (period_us > 0 && now < next_due_us) { capture_sleep(primary, (int)((next_due_us - now + 999) / 1000)); continue; }
+            if (period_us == 0 && handoff.latest.load(std::memory_order_acquire) >= 0) { capture_sleep(primary, POLL_TIMEOUT_MS); continue; }
+            unsigned index = 0;
+            while (index < busy.size() && busy[index]) ++index;
+            if (index == busy.size()) { capture_sleep(primary, POLL_TIMEOUT_MS); continue; } // render thread holds every buffer
+
+            memcpy(buffers[index][0].addr, replay.frames + next_frame * replay.frame_bytes, replay.frame_bytes);
+            next_frame = (next_frame + 1) % replay.frame_count;
+            CapturedFrame &m = handoff.meta[index];
+            m.num_planes = 1; m.bytesused0 = replay.frame_bytes;
+            m.width = replay.width; m.height = replay.height; m.pixfmt = m.source_pixfmt = replay.pixfmt; m.rga = false;
+            m.sequence = sequence++; m.dqbuf_us = steady_us();
+            m.capture_us = period_us > 0 ? next_due_us : 0; // "driver" stage = copy + lateness against the schedule
+            busy[index] = 1;
+            metrics.frames_captured.fetch_add(1, std::memory_order_relaxed);
+            int64_t old = handoff.latest.exchange(FrameHandoff::make_token(gen, index), std::memory_order_acq_rel);
+            if (old >= 0) { busy[FrameHandoff::token_index(old)] = 0; metrics.superseded.fetch_add(1, std::memory_order_relaxed); }
+            int64_t now_ms = steady_ms();
+            last_good_frame_ms.store(now_ms); last_recovered_ms.store(now_ms);
+            FrameHandoff::signal(handoff.render_efd);
+            // keep the average rate, but do not burst to catch up after a stall
+            if (period_us > 0) next_due_us = std::max(next_due_us + period_us, now - period_us);
+        }
+        vlogln("replay thread: exiting");
+    };
+
+    // --present-mode=capture; the estimates are kept in every mode for --stats / --metrics
+    FramePacer pacer;
+    double nominal_refresh_us = 0; // display mode rate, until observed vblanks refine it
+    if (win && !opt_headless) {
+        SDL_DisplayMode dm;
+        if (SDL_GetCurrentDisplayMode(std::max(SDL_GetWindowDisplayIndex(win), 0), &dm) == 0 && dm.refresh_rate > 0) nominal_refresh_us = 1e6 / dm.refresh_rate;
+    }
+#ifdef HDMI_HAVE_KMS
+    if (kms && kms_refresh_hz(kms) > 0) nominal_refresh_us = 1e6 / kms_refresh_hz(kms);
+    int64_t kms_seen_flip_us = 0;
+#endif
+    metrics.present_mode.store(opt_present_mode, std::memory_order_relaxed);
+
+    PipelineStats stats;
+    stats.last_report_ms = steady_ms();
+    const bool stats_enabled = opt_stats_interval_s > 0 || opt_bench_frames > 0 || !opt_metrics_listen.empty();
+#ifndef HDMI_GLES
+    GpuTimer gpu_timers[GPU_PASS_COUNT];
+    for (GpuTimer &t : gpu_timers) gpu_timer_init(t); // only run while profiling, see below
+#endif
+    bool frame_fresh = false; // a new frame was uploaded since the last present
+    bool profiling = stats_enabled; // GPU timers and CPU time per present; also while the overlay / sweep runs
+    uint64_t presents = 0; int64_t last_present_cpu_us = 0;
+    auto observe = [&](LatencyWindow &w, MetricsStage stage, int64_t us) { w.add(us); metrics.latency[stage].observe_us(us); };
+    // something reached the screen (swap returned or overlay commit): count it, account a new frame's stages
+    auto stats_presented = [&]() {
+        (frame_fresh ? metrics.frames_presented : metrics.frames_duplicated).fetch_add(1, std::memory_order_relaxed);
+        if (frame_fresh && metrics.startup_ms.load(std::memory_order_relaxed) == 0) {
+            int64_t ms = std::max<int64_t>(steady_ms() - startup_begin_ms, 1);
+            metrics.startup_ms.store(ms, std::memory_order_relaxed);
+            vlogln("startup: first frame on screen after " + std::to_string(ms) + " ms");
         }
-        last_good_frame = clock::now(); last_recovered_time = last_good_frame; einval_count = 0; signal_lost = false;
-        need_gl_update.store(true, std::memory_order_release);
-        vlogln("manual_restart_v4l_only: full reopen succeeded (V4L2-only)");
+        frame_fresh = false;
+        ++presents;
+        if (profiling) {
+            int64_t c = cpu_time_us(CLOCK_THREAD_CPUTIME_ID);
+            if (last_present_cpu_us > 0) stats.cpu.add(c - last_present_cpu_us);
+            last_present_cpu_us = c;
+        } else last_present_cpu_us = 0;
+        metrics.input_period_us.store((int64_t)pacer.input_period_us, std::memory_order_relaxed);
+        metrics.refresh_period_us.store((int64_t)pacer.refresh_us, std::memory_order_relaxed);
+        metrics.frames_held.store(pacer.held, std::memory_order_relaxed);
+        if (!stats_enabled || !stats.pending) return;
+        int64_t now = steady_us();
+        if (stats.capture_us > 0) observe(stats.driver, STAGE_DRIVER, stats.dqbuf_us - stats.capture_us);
+        observe(stats.upload, STAGE_UPLOAD, stats.upload_us - stats.dqbuf_us);
+        observe(stats.present, STAGE_PRESENT, now - stats.upload_us);
+        observe(stats.total, STAGE_TOTAL, now - (stats.capture_us > 0 ? stats.capture_us : stats.dqbuf_us));
+        stats.shown++; stats.pending = false;
+    };
+    auto stats_report = [&]() {
+        if (opt_stats_interval_s <= 0) return;
+        int64_t now = steady_ms();
+        if (now - stats.last_report_ms < (int64_t)opt_stats_interval_s * 1000) return;
+        uint64_t gaps = metrics.dropped_by_source.load(std::memory_order_relaxed), sup = metrics.superseded.load(std::memory_order_relaxed);
+        uint64_t stale = metrics.stale.load(std::memory_order_relaxed);
+        char fps[32]; snprintf(fps, sizeof(fps), "%.1f", stats.shown * 1000.0 / (double)(now - stats.last_report_ms));
+        auto hz = [](double period_us) { if (period_us <= 0) return std::string("-"); char b[32]; snprintf(b, sizeof(b), "%.2f", 1e6 / period_us); return std::string(b); };
+        std::cerr << "stats: " << fps << " fps shown, ms p50/p99/max: total " << stats.total.summary()
+                  << " | driver " << stats.driver.summary() << " | upload " << stats.upload.summary()
+                  << " | gpu upload " << stats.gpu.summary() << " | gpu draw " << stats.gpu_draw.summary() << " | present " << stats.present.summary()
+                  << " | dropped " << (gaps - stats.last_gaps) << " by source, " << (sup - stats.last_superseded) << " superseded, "
+                  << (stale - stats.last_stale) << " stale in queue | present " << PRESENT_MODE_NAMES[opt_present_mode]
+                  << ", in " << hz(pacer.input_period_us) << " Hz, out " << hz(pacer.refresh_us) << " Hz, " << (pacer.held - stats.last_held) << " held" << std::endl;
+        stats.last_gaps = gaps; stats.last_superseded = sup; stats.last_stale = stale; stats.last_held = pacer.held;
+        stats.shown = 0; stats.last_report_ms = now;
+    };
+
+    // --bench: after a warmup, measure opt_bench_frames shown frames; true once the result is printed
+    const uint64_t BENCH_WARMUP_FRAMES = 30;
+    bool bench_running = false;
+    int64_t bench_start_us = 0, bench_thread_cpu_us = 0, bench_process_cpu_us = 0;
+    auto bench_step = [&]() -> bool {
+        if (opt_bench_frames <= 0) return false;
+        if (!bench_running) {
+            if (stats.total.count < BENCH_WARMUP_FRAMES) return false;
+            stats.total = LatencyWindow(); stats.gpu = LatencyWindow(); stats.gpu_draw = LatencyWindow();
+            bench_start_us = steady_us();
+            bench_thread_cpu_us = cpu_time_us(CLOCK_THREAD_CPUTIME_ID); bench_process_cpu_us = cpu_time_us(CLOCK_PROCESS_CPUTIME_ID);
+            bench_running = true;
+            return false;
+        }
+        uint64_t n = stats.total.count;
+        if (n < (uint64_t)opt_bench_frames) return false;
+        double secs = (steady_us() - bench_start_us) / 1e6;
+        double render_cpu = (cpu_time_us(CLOCK_THREAD_CPUTIME_ID) - bench_thread_cpu_us) / 1000.0 / (double)n;
+        double process_cpu = (cpu_time_us(CLOCK_PROCESS_CPUTIME_ID) - bench_process_cpu_us) / 1000.0 / (double)n;
+        auto gpu_ms = [](const LatencyWindow &w) { if (!w.count) return std::string("n/a"); char b[32]; snprintf(b, sizeof(b), "%.3f", w.mean_ms()); return std::string(b); };
+        const char* upload = UPLOAD_MODE_NAMES[upload_in_use()];
+        char line[512];
+        snprintf(line, sizeof(line), "bench: present=%s upload=%s tile=%s view=%d pattern=%d crop=%d segments=%d input=%ux%u %s output=%dx%d frames=%llu fps=%.1f cpu_render_ms=%.3f cpu_process_ms=%.3f gpu_upload_ms=%s gpu_draw_ms=%s latency_ms=%.2f",
+                 PRESENT_MODE_NAMES[opt_present_mode], upload, tile_program ? "instanced" : remap_active ? "remap" : "shader", view_mode, manual_show_pattern ? 1 : 0, upload_rect.cropped ? 1 : 0, wall_segments,
+                 tex_width, tex_height, fourcc_to_str(tex_pixfmt).c_str(), win_w, win_h, (unsigned long long)n, n / secs,
+                 render_cpu, process_cpu, gpu_ms(stats.gpu).c_str(), gpu_ms(stats.gpu_draw).c_str(), stats.total.mean_ms());
+        std::cout << line << std::endl;
         return true;
     };
 
-    // Background reopen starter: spawns thread that does V4L2-only restart + verification
-    auto start_background_reopen = [&]() {
-        bool expected = false;
-        if (!auto_reopen_in_progress.compare_exchange_strong(expected, true)) return;
-        std::thread([&]() {
-            vlogln("Background reopen thread started");
-            int attempt = 0;
-            while (auto_reopen_in_progress.load()) {
-                attempt++;
-                // Try to perform V4L2-only restart
-                bool restart_ok = manual_restart_v4l_only();
-                if (!restart_ok) {
-                    vlogln(std::string("Background reopen: V4L2 restart failed, retrying in 1000ms (attempt ") + std::to_string(attempt) + ")");
-                    std::this_thread::sleep_for(std::chrono::milliseconds(1000 + std::min(attempt*500, 5000)));
-                    continue;
-                }
-                // After restart succeeded, verify we can actually dequeue a frame.
-                bool verified = false;
-                for (int v=0; v < BG_REOPEN_VERIFY_MAX_ATTEMPTS; ++v) {
-                    // Poll fd for input
-                    struct pollfd vpfd; vpfd.fd = fd; vpfd.events = POLLIN;
-                    int pres = poll(&vpfd, 1, BG_REOPEN_VERIFY_POLL_MS);
-                    if (pres > 0 && (vpfd.revents & POLLIN)) {
-                        std::lock_guard<std::mutex> lk(restart_mutex);
-                        v4l2_buffer buf; v4l2_plane planes[VIDEO_MAX_PLANES]; memset(&buf,0,sizeof(buf)); memset(planes,0,sizeof(planes));
-                        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE; buf.memory = V4L2_MEMORY_MMAP; buf.m.planes = planes; buf.length = VIDEO_MAX_PLANES;
-                        int dq = ioctl(fd, VIDIOC_DQBUF, &buf);
-                        if (dq == 0) {
-                            size_t bytesused0 = planes[0].bytesused;
-                            if (bytesused0 > 0) {
-                                // Got a valid frame — requeue and accept
-                                if (ioctl(fd, VIDIOC_QBUF, &buf) == 0) {
-                                    verified = true;
-                                    last_good_frame = clock::now();
-                                    last_recovered_time = last_good_frame;
-                                    einval_count = 0;
-                                    vlogln("Background reopen: successfully dequeued+requeued a frame -> verified");
-                                    break;
-                                } else {
-                                    // QBUF failed: try again
-                                    vlogln(std::string("Background reopen: QBUF after DQBUF failed: ") + strerror(errno));
-                                }
-                            } else {
-                                // bytesused==0: requeue and continue
-                                if (ioctl(fd, VIDIOC_QBUF, &buf) != 0) {
-                                    vlogln(std::string("Background reopen: QBUF after empty frame failed: ") + strerror(errno));
-                                }
-                            }
-                        } else {
-                            // DQBUF failed; continue waiting
-                            if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                                vlogln(std::string("Background reopen: VIDIOC_DQBUF failed during verify: ") + strerror(errno));
-                            }
-                        }
-                    }
-                    std::this_thread::sleep_for(std::chrono::milliseconds(200));
-                } // end verify loop
+    // --profile overlay: a few lines of text (TextBitmap, unit 6) in the top left corner, refreshed twice a
+    // second from the rolling windows; program and texture are created the first time it is shown
+    const size_t PROFILE_WINDOW = 60;      // presents the rolling values average over
+    const int64_t PROFILE_UPDATE_MS = 500;
+    GLuint overlay_program = 0, texText = 0;
+    GLint overlay_loc_rect = -1;
+    bool overlay_unavailable = false;
+    TextBitmap overlay_text;
+    int64_t overlay_next_ms = 0, overlay_last_ms = 0;
+    uint64_t overlay_last_presents = 0;
+    double overlay_fps = 0.0;
+    std::string sweep_label; // current sweep step, shown on the overlay
+    auto overlay_init = [&]() -> bool {
+        if (overlay_program) return true;
+        if (overlay_unavailable) return false;
+        std::string vp = findShaderFile(OVERLAY_VERT_SHADER_FILE), fp = findShaderFile(OVERLAY_FRAG_SHADER_FILE);
+        if (vp.empty() || fp.empty()) {
+            std::cerr << "Warning: " OVERLAY_VERT_SHADER_FILE " / " OVERLAY_FRAG_SHADER_FILE " not found, no profile overlay\n";
+            overlay_unavailable = true; return false;
+        }
+        overlay_program = createShaderProgram(vp.c_str(), fp.c_str()); glUseProgram(overlay_program);
+        GLint l = glGetUniformLocation(overlay_program, "texText"); if (l >= 0) glUniform1i(l, 6);
+        overlay_loc_rect = glGetUniformLocation(overlay_program, "u_rect");
+        glUseProgram(program);
+        glGenTextures(1, &texText); glActiveTexture(GL_TEXTURE6); glBindTexture(GL_TEXTURE_2D, texText);
+        glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_NEAREST); glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE); glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+        glActiveTexture(GL_TEXTURE0);
+        vlogln("profile: overlay program created");
+        return true;
+    };
+    auto overlay_refresh = [&]() {
+        int64_t now = steady_ms();
+        if (overlay_last_ms > 0 && now > overlay_last_ms) overlay_fps = (presents - overlay_last_presents) * 1000.0 / (double)(now - overlay_last_ms);
+        overlay_last_ms = now; overlay_last_presents = presents; overlay_next_ms = now + PROFILE_UPDATE_MS;
+        char line[160];
+        std::vector<std::string> lines;
+#ifndef HDMI_GLES
+        if (gpu_timers[GPU_PASS_DRAW].ok) {
+            snprintf(line, sizeof(line), "GPU MS  UPLOAD %.2f  DRAW %.2f  OVERLAY %.2f", stats.gpu.recent_mean_ms(PROFILE_WINDOW),
+                     stats.gpu_draw.recent_mean_ms(PROFILE_WINDOW), stats.gpu_overlay.recent_mean_ms(PROFILE_WINDOW));
+            lines.push_back(line);
+        } else lines.push_back("GPU MS  N/A (NO TIMER QUERIES)");
+#else
+        lines.push_back("GPU MS  N/A (NO TIMER QUERIES IN GLES 3.0)");
+#endif
+        snprintf(line, sizeof(line), "CPU MS  %.2f PER FRAME  %.1f FPS", stats.cpu.recent_mean_ms(PROFILE_WINDOW), overlay_fps);
+        lines.push_back(line);
+        snprintf(line, sizeof(line), "UPLOAD %s  VIEW %d  TILES %s %dX%d  GAPS %d%s", UPLOAD_MODE_NAMES[upload_in_use()], view_mode,
+                 tile_program ? "INSTANCED" : remap_active ? "REMAP" : "SHADER", ctrl.numTilesPerRow, ctrl.numTilesPerCol, gap_count(),
+                 (signal_lost || manual_show_pattern) ? "  PATTERN" : "");
+        lines.push_back(line);
+        if (sweep_running) lines.push_back("SWEEP " + sweep_label);
+        text_rasterize(lines, overlay_text);
+        glActiveTexture(GL_TEXTURE6); glBindTexture(GL_TEXTURE_2D, texText);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, overlay_text.width, overlay_text.height, 0, GL_RED, GL_UNSIGNED_BYTE, overlay_text.pixels.data());
+        glActiveTexture(GL_TEXTURE0);
+    };
+    // the overlay pass: after the picture (and its readback), blended over the top left corner
+    auto overlay_draw = [&]() {
+        if (!overlay_text.width || !texText) return;
+#ifndef HDMI_GLES
+        if (profiling) gpu_timer_begin(gpu_timers[GPU_PASS_OVERLAY]);
+#endif
+        const int scale = win_h >= 2000 ? 3 : 2, margin = 8;
+        float left = -1.0f + 2.0f * margin / (float)win_w, top = 1.0f - 2.0f * margin / (float)win_h;
+        float right = left + 2.0f * (float)(overlay_text.width * scale) / (float)win_w, bottom = top - 2.0f * (float)(overlay_text.height * scale) / (float)win_h;
+        glUseProgram(overlay_program);
+        if (overlay_loc_rect >= 0) glUniform4f(overlay_loc_rect, left, bottom, right, top);
+        glActiveTexture(GL_TEXTURE6); glBindTexture(GL_TEXTURE_2D, texText);
+        glEnable(GL_BLEND); glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glBindVertexArray(vao); glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        glDisable(GL_BLEND);
+        glActiveTexture(GL_TEXTURE0); glUseProgram(program);
+#ifndef HDMI_GLES
+        gpu_timer_end(gpu_timers[GPU_PASS_OVERLAY]);
+#endif
+    };
 
-                if (verified) {
-                    need_gl_update.store(true, std::memory_order_release);
-                    vlogln("Background reopen: verified, signalling GL thread to reinit textures");
-                    break;
-                } else {
-                    vlogln("Background reopen: verification failed after restart, will retry full reopen");
-                    std::this_thread::sleep_for(std::chrono::milliseconds(800));
-                    // continue loop to attempt reopen again
+    // --profile-sweep / Shift+P: every upload path x view mode 0/1/2 plus the test pattern (the procedural
+    // u_showPattern path), each measured over opt_profile_sweep_frames presents after a short warmup, then
+    // one table on stdout. The picture's own settings are restored afterwards.
+    struct SweepStep { UploadMode upload; int view; bool pattern; };
+    const uint64_t SWEEP_WARMUP_PRESENTS = 15;
+    std::vector<SweepStep> sweep_steps;
+    std::vector<std::string> sweep_rows;
+    size_t sweep_index = 0;
+    bool sweep_measuring = false, sweep_step_ok = false;
+    uint64_t sweep_presents0 = 0, sweep_gpu_count0[2] = {0, 0};
+    int64_t sweep_t0_us = 0, sweep_cpu0_us = 0, sweep_gpu_sum0[2] = {0, 0};
+    UploadMode sweep_saved_upload = upload_path; int sweep_saved_view = 0; bool sweep_saved_pattern = false;
+    int sweep_frames = opt_profile_sweep_frames > 0 ? opt_profile_sweep_frames : 120;
+    auto sweep_start = [&]() {
+        if (sweep_running) return;
+        sweep_steps.clear(); sweep_rows.clear();
+        for (UploadMode u : { UPLOAD_COPY, UPLOAD_PBO, UPLOAD_DMABUF }) {
+            for (int v = 0; v < 3; ++v) sweep_steps.push_back({ u, v, false });
+            sweep_steps.push_back({ u, 0, true });
+        }
+        sweep_saved_upload = upload_path; sweep_saved_view = view_mode; sweep_saved_pattern = manual_show_pattern;
+        sweep_index = 0; sweep_measuring = false; sweep_step_ok = false; sweep_running = true;
+        std::cerr << "profile: sweep of " << sweep_steps.size() << " configurations, " << sweep_frames << " frames each" << std::endl;
+    };
+    // true once a --profile-sweep run has printed its table (the program then exits)
+    auto sweep_step = [&]() -> bool {
+        if (!sweep_running) return false;
+        // no frames (and possibly a recovery reallocating the buffers): run the step's warmup again afterwards
+        if (signal_lost) { sweep_measuring = false; sweep_presents0 = presents; return false; }
+        if (!sweep_step_ok) {
+            // apply the next available configuration
+            while (sweep_index < sweep_steps.size()) {
+                const SweepStep &st = sweep_steps[sweep_index];
+                if (set_upload_path(st.upload)) break;
+                char row[128]; snprintf(row, sizeof(row), "%-7s %4d %7d  unavailable", UPLOAD_MODE_NAMES[st.upload], st.view, st.pattern ? 1 : 0);
+                sweep_rows.push_back(row); ++sweep_index;
+            }
+            if (sweep_index >= sweep_steps.size()) {
+                std::cout << "profile: upload  view pattern  frames     fps  cpu_ms  gpu_upload_ms  gpu_draw_ms\n";
+                for (const std::string &r : sweep_rows) std::cout << "profile: " << r << "\n";
+                std::cout << std::flush;
+                set_upload_path(sweep_saved_upload); view_mode = sweep_saved_view; manual_show_pattern = sweep_saved_pattern;
+                sweep_running = false; need_redraw = true;
+                return opt_profile_sweep_frames > 0;
+            }
+            const SweepStep &st = sweep_steps[sweep_index];
+            view_mode = st.view; manual_show_pattern = st.pattern;
+            sweep_label = std::to_string(sweep_index + 1) + "/" + std::to_string(sweep_steps.size()) + " " + UPLOAD_MODE_NAMES[st.upload] +
+                          (st.pattern ? " PATTERN" : " VIEW " + std::to_string(st.view));
+            sweep_step_ok = true; sweep_measuring = false; sweep_presents0 = presents; need_redraw = true;
+            return false;
+        }
+        if (!sweep_measuring) {
+            if (presents - sweep_presents0 < SWEEP_WARMUP_PRESENTS) return false;
+            const SweepStep &st = sweep_steps[sweep_index];
+            if (upload_in_use() != st.upload) { // e.g. the DMABUF images could not be rebuilt
+                char row[128]; snprintf(row, sizeof(row), "%-7s %4d %7d  unavailable", UPLOAD_MODE_NAMES[st.upload], st.view, st.pattern ? 1 : 0);
+                sweep_rows.push_back(row); ++sweep_index; sweep_step_ok = false;
+                return false;
+            }
+            sweep_measuring = true; sweep_presents0 = presents; sweep_t0_us = steady_us(); sweep_cpu0_us = cpu_time_us(CLOCK_THREAD_CPUTIME_ID);
+            sweep_gpu_sum0[0] = stats.gpu.sum; sweep_gpu_count0[0] = stats.gpu.count;
+            sweep_gpu_sum0[1] = stats.gpu_draw.sum; sweep_gpu_count0[1] = stats.gpu_draw.count;
+            return false;
+        }
+        uint64_t n = presents - sweep_presents0;
+        if (n < (uint64_t)sweep_frames) return false;
+        double secs = (steady_us() - sweep_t0_us) / 1e6;
+        double cpu = (cpu_time_us(CLOCK_THREAD_CPUTIME_ID) - sweep_cpu0_us) / 1000.0 / (double)n;
+        auto gpu = [&](const LatencyWindow &w, int i) {
+            uint64_t c = w.count - sweep_gpu_count0[i];
+            if (!c) return std::string("n/a");
+            char b[32]; snprintf(b, sizeof(b), "%.3f", (double)(w.sum - sweep_gpu_sum0[i]) / (double)c / 1000.0); return std::string(b);
+        };
+        const SweepStep &st = sweep_steps[sweep_index];
+        char row[160];
+        snprintf(row, sizeof(row), "%-7s %4d %7d %7llu %7.1f %7.3f %14s %12s", UPLOAD_MODE_NAMES[upload_in_use()], st.view, st.pattern ? 1 : 0,
+                 (unsigned long long)n, n / secs, cpu, gpu(stats.gpu, 0).c_str(), gpu(stats.gpu_draw, 1).c_str());
+        sweep_rows.push_back(row);
+        ++sweep_index; sweep_step_ok = false;
+        return false;
+    };
+    if (opt_profile_sweep_frames > 0) {
+        if (opt_bench_frames > 0) { std::cerr << "Warning: --profile-sweep ignored with --bench\n"; opt_profile_sweep_frames = 0; }
+        else sweep_start();
+    }
+
+    if (opt_crop_upload) refresh_upload_rect();
+    std::thread capture_thread([&]() { if (replaying) replay_main(); else capture_main(primary); });
+    for (size_t i = 1; i < sources.size(); ++i) sources[i]->thread = std::thread([&, i]() { capture_main(*sources[i]); });
+    config_watcher.start(config, handoff.render_efd);
+    MetricsExporter metrics_exporter;
+    if (!opt_metrics_listen.empty()) {
+        std::string err;
+        if (metrics_exporter.start(opt_metrics_listen, &metrics, err)) vlogln("startup: metrics on " + opt_metrics_listen);
+        else std::cerr << "Warning: --metrics: " << err << ", metrics disabled\n";
+    }
+
+#ifdef HDMI_HAVE_MPP
+    // --stream: every 1/opt_stream_fps s the finished picture is scaled into stream_fbo on the GPU (flipped, so
+    // it reads back top row first as the encoder wants it) and read back through a ring of its own; the
+    // worker copies it into the encoder's DMABUF, encodes and sends. The render thread never waits for
+    // either: a stream frame is skipped while every slot or the worker is busy.
+    GLuint stream_fbo = 0, stream_rb = 0;
+    ReadbackRing stream_readback;
+    bool stream_readback_ok = false;
+    int64_t stream_next_us = 0;
+    struct StreamJob { std::vector<unsigned char> rgba; int64_t pts_us = 0; };
+    BoundedWorker<StreamJob> stream_worker(2, [&](StreamJob &job) {
+        size_t bytes = mpp_stream_send(stream, job.rgba.data(), job.pts_us);
+        if (bytes == 0) { metrics.stream_dropped.fetch_add(1, std::memory_order_relaxed); return; }
+        metrics.stream_frames.fetch_add(1, std::memory_order_relaxed);
+        metrics.stream_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    });
+    const GLuint output_fbo = opt_headless ? headless_fbo : 0;
+    if (!opt_stream_dest.empty()) {
+        MppStreamConfig sc;
+        mpp_stream_parse_destination(opt_stream_dest, sc);
+        sc.width = opt_stream_width; sc.height = opt_stream_height; sc.fps = opt_stream_fps;
+        sc.hevc = opt_stream_hevc; sc.bitrate_kbps = opt_stream_bitrate_kbps;
+        glGenFramebuffers(1, &stream_fbo); glGenRenderbuffers(1, &stream_rb);
+        glBindRenderbuffer(GL_RENDERBUFFER, stream_rb);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, sc.width, sc.height);
+        glBindFramebuffer(GL_FRAMEBUFFER, stream_fbo);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, stream_rb);
+        const bool fbo_ok = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        glBindFramebuffer(GL_FRAMEBUFFER, output_fbo);
+        stream_readback_ok = readback_ring_init(stream_readback);
+        if (fbo_ok && stream_readback_ok) stream = mpp_stream_open(sc, opt_verbose);
+        if (stream) {
+            const std::string sdp = mpp_stream_sdp(sc);
+            if (!opt_stream_sdp.empty()) {
+                std::ofstream f(opt_stream_sdp, std::ios::binary | std::ios::trunc);
+                if (!(f << sdp)) std::cerr << "Warning: --stream-sdp: writing " << opt_stream_sdp << " failed\n";
+            }
+            vlogln("startup: streaming to rtp://" + opt_stream_dest + (opt_stream_sdp.empty() ? ", SDP:\n" + sdp : ", SDP in " + opt_stream_sdp));
+        } else {
+            std::cerr << "Warning: --stream unavailable, not streaming\n";
+            glDeleteFramebuffers(1, &stream_fbo); glDeleteRenderbuffers(1, &stream_rb); stream_fbo = stream_rb = 0;
+        }
+    }
+    // after the draw, before the overlay: start the next stream readback when one is due
+    auto stream_capture = [&]() {
+        const int64_t now = steady_us(), period = 1000000 / opt_stream_fps;
+        if (now < stream_next_us) return;
+        stream_next_us = (stream_next_us == 0 || now - stream_next_us > period) ? now + period : stream_next_us + period;
+        if (stream_worker.full()) { metrics.stream_dropped.fetch_add(1, std::memory_order_relaxed); return; }
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, output_fbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, stream_fbo);
+        glBlitFramebuffer(0, 0, win_w, win_h, 0, opt_stream_height, opt_stream_width, 0, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, stream_fbo);
+        if (!readback_start(stream_readback, opt_stream_width, opt_stream_height)) metrics.stream_dropped.fetch_add(1, std::memory_order_relaxed);
+        glBindFramebuffer(GL_FRAMEBUFFER, output_fbo);
+    };
+#endif
+
+    // Sources other than 0 (render thread): the newest frame is copied whole into the source's own textures,
+    // semi-planar chroma swapped on the CPU where it is not in the order the shader reads for source 0. The
+    // frame goes straight back to the capture thread, which also gets its buffer release acknowledged here.
+    auto take_source_frame = [&](CaptureSource &s) {
+        FrameHandoff &h = s.handoff;
+        if (h.release_requested.exchange(false, std::memory_order_acq_rel)) {
+            std::lock_guard<std::mutex> lk(h.release_mutex);
+            h.released = true;
+            h.release_cv.notify_all();
+        }
+        if (s.capture_signal_lost.exchange(false) && !s.signal_lost) { s.signal_lost = true; need_redraw = true; }
+        s.need_gl_update.store(false, std::memory_order_release); // the textures follow the frames themselves
+        int64_t token = h.latest.exchange(-1, std::memory_order_acq_rel);
+        if (token < 0 || FrameHandoff::token_generation(token) != h.generation.load(std::memory_order_acquire)) return;
+        unsigned index = FrameHandoff::token_index(token);
+        const CapturedFrame &m = h.meta[index];
+        const PixelLayout lay = pixel_layout(m.pixfmt);
+        if (!s.texY) {
+            for (GLuint *t : { &s.texY, &s.texUV }) {
+                glGenTextures(1, t); glBindTexture(GL_TEXTURE_2D, *t);
+                glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_NEAREST); glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+                glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE); glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+            }
+        }
+        if (m.width != s.tex_width || m.height != s.tex_height || m.pixfmt != s.tex_pixfmt) {
+            reallocate_textures(s.texY, s.texUV, m.pixfmt, (int)m.width, (int)m.height);
+            s.tex_width = m.width; s.tex_height = m.height; s.tex_pixfmt = m.pixfmt;
+            source_log(s, "textures " + std::to_string(m.width) + "x" + std::to_string(m.height) + " " + fourcc_to_str(m.pixfmt));
+        }
+        const FramePlanes fp = frame_planes(lay, s.buffers[index], m.num_planes, m.bytesused0, m.width, m.height);
+        if (fp.ybase) {
+            const int uv_w = (int)m.width >> lay.x_shift, uv_h = (int)m.height >> lay.y_shift;
+            glActiveTexture(GL_TEXTURE0);
+            upload_plane(lay.packed ? GL_RG : GL_RED, lay.packed ? 2 : 1, s.texY, fp.ybase, (int)(fp.y_stride / (lay.packed ? 2 : 1)),
+                         0, 0, (int)m.width, (int)m.height, gl_max_tex);
+            glActiveTexture(GL_TEXTURE1);
+            if (lay.packed) {
+                upload_plane(GL_RGBA, 4, s.texUV, fp.ybase, (int)(fp.y_stride / 4), 0, 0, uv_w, uv_h, gl_max_tex);
+            } else if (fp.uvbase && lay.vu != (!opt_cpu_uv_swap && uv_swap && !tex_rga)) {
+                s.uv_swapped.resize((size_t)uv_w * uv_h * 2);
+                for (int y = 0; y < uv_h; ++y) {
+                    const unsigned char *in = fp.uvbase + (size_t)y * fp.uv_stride;
+                    unsigned char *out = s.uv_swapped.data() + (size_t)y * uv_w * 2;
+                    for (int x = 0; x < uv_w; ++x) { out[2 * x] = in[2 * x + 1]; out[2 * x + 1] = in[2 * x]; }
                 }
+                upload_plane(GL_RG, 2, s.texUV, s.uv_swapped.data(), uv_w, 0, 0, uv_w, uv_h, gl_max_tex);
+            } else if (fp.uvbase) {
+                upload_plane(GL_RG, 2, s.texUV, fp.uvbase, (int)(fp.uv_stride / 2), 0, 0, uv_w, uv_h, gl_max_tex);
             }
-            auto_reopen_in_progress.store(false);
-            vlogln("Background reopen thread exiting");
-        }).detach();
+            glActiveTexture(GL_TEXTURE0);
+            if (s.signal_lost) { s.signal_lost = false; source_log(s, "Recovered to live (new frame)"); }
+            need_redraw = true;
+        }
+        h.returned.push(token);
+        FrameHandoff::signal(h.capture_efd);
     };
 
-    // The main loop:
+    // earliest time-based state change: the pattern timeout of each source (held back by the recovery grace), the
+    // next --stats report, the next overlay text refresh, the end of a pacer hold and the next stream frame;
+    // 0 = nothing scheduled
+    auto next_deadline = [&]() -> int64_t {
+        int64_t d = 0;
+        auto earliest = [&](int64_t t) { if (d == 0 || t < d) d = t; };
+        for (const auto &src : sources) {
+            if (source_lost(src->index)) continue;
+            int64_t t = src->last_good_frame_ms.load() + PATTERN_TIMEOUT_MS + 1;
+            int64_t recovered = src->last_recovered_ms.load();
+            if (recovered != 0) t = std::max(t, recovered + RECOVERY_GRACE_MS);
+            earliest(t);
+        }
+        if (opt_stats_interval_s > 0) earliest(stats.last_report_ms + (int64_t)opt_stats_interval_s * 1000);
+        if (profile_overlay) earliest(overlay_next_ms);
+        if (pacer.hold_until_us > 0) earliest((pacer.hold_until_us + 999) / 1000);
+#ifdef HDMI_HAVE_MPP
+        if (stream) earliest((stream_next_us + 999) / 1000);
+#endif
+        return std::max<int64_t>(d, 0);
+    };
+
+    // The main loop (render thread): sleep in the reactor until a frame, a capture/config event, input,
+    // a KMS flip or a deadline, then upload/bind, handle input, draw, swap.
     while (true) {
-      int ret = poll(&pfd, 1, POLL_TIMEOUT_MS);
-      if (ret < 0) { if (errno == EINTR) continue; perror("poll"); break; }
+      if (quit_signal_received) break;
+      metrics.signal_lost.store(signal_lost ? 1 : 0, std::memory_order_relaxed);
+      { int lost = 0; for (const auto &src : sources) if (source_lost(src->index)) ++lost; metrics.sources_lost.store(lost, std::memory_order_relaxed); }
+      profiling = stats_enabled || profile_overlay || sweep_running;
+      loop.arm(next_deadline());
+      int timeout = (win && !input_fd_ok) ? INPUT_POLL_MS : -1;
+      if (sweep_running) timeout = 0; // the sweep draws back to back
+      bool gpu_pending = output_capture_remaining > 0 || (readback_ok && readback_pending(readback));
+#ifdef HDMI_HAVE_MPP
+      gpu_pending = gpu_pending || (stream && readback_pending(stream_readback));
+#endif
+#ifdef HDMI_HAVE_EGL_DMABUF
+      gpu_pending = gpu_pending || !dmabuf_retiring.empty();
+#endif
+      if (gpu_pending && (timeout < 0 || timeout > FENCE_POLL_MS)) timeout = FENCE_POLL_MS;
+      // events Xlib already read off the socket (e.g. during the swap) would not make the fd readable
+      if (win) { SDL_PumpEvents(); if (SDL_HasEvents(SDL_FIRSTEVENT, SDL_LASTEVENT)) timeout = 0; }
+      int fired = loop.wait(timeout);
+      if (fired < 0) { perror("epoll_wait"); break; }
+      if (fired & EventLoop::SRC_WAKE) FrameHandoff::drain(handoff.render_efd);
+#ifdef HDMI_HAVE_KMS
+      if (kms && (fired & EventLoop::SRC_KMS)) {
+          kms_dispatch(kms); kms_return_released();
+          if (kms_last_flip_us(kms) != kms_seen_flip_us) { kms_seen_flip_us = kms_last_flip_us(kms); pacer_vblank(pacer, kms_seen_flip_us, nominal_refresh_us); }
+      }
+#endif
+      if (quit_signal_received) break;
+      if (capture_quit.load()) break;
 
-      // If background reopen succeeded and wants GL update: do it here (GL thread)
-      if (need_gl_update.load(std::memory_order_acquire)) {
-          std::lock_guard<std::mutex> lk(restart_mutex);
-          int new_uv_w = (cur_pixfmt == V4L2_PIX_FMT_NV12 || cur_pixfmt == V4L2_PIX_FMT_NV21) ? (int)(cur_width/2) : (int)cur_width;
-          int new_uv_h = (cur_pixfmt == V4L2_PIX_FMT_NV12 || cur_pixfmt == V4L2_PIX_FMT_NV21) ? (int)(cur_height/2) : (int)cur_height;
-          reallocate_textures(texY, texUV, (int)cur_width, (int)cur_height, new_uv_w, new_uv_h);
-          if (opt_auto_resize_window) SDL_SetWindowSize(win, (int)cur_width, (int)cur_height);
-          if (opt_uv_swap_override < 0 && !opt_cpu_uv_swap) {
-              int old_uv = uv_swap;
-              if (cur_pixfmt == V4L2_PIX_FMT_NV21) uv_swap = 1;
-              else if (cur_pixfmt == V4L2_PIX_FMT_NV12) uv_swap = 0;
-              if (uv_swap != old_uv && loc_uv_swap >= 0) { glUseProgram(program); glUniform1i(loc_uv_swap, uv_swap); }
-          }
-          if (loc_textureIsFull >= 0) {
-              int textureIsFull = ((int)cur_width == (int)ctrl.fullInputW && (int)cur_height == (int)ctrl.fullInputH) ? 1 : 0;
-              glUseProgram(program); glUniform1i(loc_textureIsFull, textureIsFull);
+      if (capture_signal_lost.exchange(false)) { signal_lost = true; }
+
+      // frame boundary: take a newly published control_ini.txt snapshot (parsed by config_watcher)
+      if (std::shared_ptr<const ConfigSnapshot> snap = config_watcher.current()) {
+          if (snap != config) {
+              config = snap; ctrl = snap->ctrl;
+              if (ctrl.verbose >= 0) opt_verbose = ctrl.verbose != 0;
+              activeSegment = std::min(activeSegment, (int)config->offsets.size());
+              upload_layout_table();
+              load_offsets();
+              mark_remap_dirty();
+              refresh_upload_rect();
+              need_redraw = true; // texLayout is not part of the layout block
+              if (!cli_present_mode && ctrl.presentMode >= 0 && ctrl.presentMode != opt_present_mode) {
+                  opt_present_mode = (PresentMode)ctrl.presentMode; pacer.hold_until_us = 0;
+                  metrics.present_mode.store(opt_present_mode, std::memory_order_relaxed);
+                  if (win && !opt_headless) set_swap_interval(opt_present_mode);
+              }
+              if (!cli_profile && ctrl.profileOverlay >= 0 && (ctrl.profileOverlay != 0) != profile_overlay) {
+                  profile_overlay = ctrl.profileOverlay != 0; overlay_next_ms = 0;
+              }
           }
-          // Hide test pattern now that GL textures are ready
-          signal_lost = false;
-          setPattern(false);
+      }
+
+      // After a recovery: prepare GL for the (possibly new) format. The test pattern stays up until the
+      // first frame of the restarted stream arrives.
+      if (need_gl_update.load(std::memory_order_acquire)) {
+          uint32_t w, h, pf;
+          { std::lock_guard<std::mutex> lk(restart_mutex); w = cur_width; h = cur_height; pf = cur_pixfmt; }
+          // RGA frames bring their own format along, the first one after the restart applies it
+          if (!tex_rga && (w != tex_width || h != tex_height || pf != tex_pixfmt)) apply_capture_format(w, h, pf);
           need_gl_update.store(false, std::memory_order_release);
-          vlogln("Main thread: completed GL reinit after background reopen");
+          vlogln("Main thread: GL ready for " + std::to_string(w) + "x" + std::to_string(h) + " after recovery");
       }
 
-      // If background reopen in progress, skip DQBUF handling (avoid races)
-      if (auto_reopen_in_progress.load()) {
-          // still process events and render pattern (so user sees pattern while reopening)
-      } else {
-          // Normal DQBUF handling (same as before)
-          v4l2_buffer buf; v4l2_plane planes[VIDEO_MAX_PLANES];
-          memset(&buf,0,sizeof(buf)); memset(planes,0,sizeof(planes));
-          buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE; buf.memory = V4L2_MEMORY_MMAP; buf.m.planes = planes; buf.length = VIDEO_MAX_PLANES;
-
-          bool dequeued = false;
-          auto now = clock::now();
-          if (xioctl(fd, VIDIOC_DQBUF, &buf) < 0) {
-            int e = errno;
-            if (e == EAGAIN || e == EWOULDBLOCK) {
-                // no frame
-            } else if (e == EINVAL) {
-                einval_count++;
-                signal_lost = true; setPattern(true);
-                vlogln(std::string("VIDIOC_DQBUF returned EINVAL -> immediate signal_lost (count=") + std::to_string(einval_count) + ")");
-                if (einval_count >= EINVAL_RESTART_THRESHOLD) {
-                    bool restarted=false;
-                    for (int r=0;r<STREAM_RESTART_RETRIES;++r) {
-                        std::lock_guard<std::mutex> lk(restart_mutex);
-                        if (restart_v4l_stream(fd, buffers)) { restarted=true; break; }
-                        std::this_thread::sleep_for(std::chrono::milliseconds(STREAM_RESTART_BACKOFF_MS));
+#ifdef HDMI_HAVE_EGL_DMABUF
+      dmabuf_retire();
+#endif
+#ifdef HDMI_HAVE_RGA
+      publish_rga_request();
+#endif
+
+      // Take the newest published frame (if any). With KMS presentation is paced by page flips: while one
+      // is outstanding the frame stays in the handoff slot (newer ones replace it) until the flip event.
+      bool can_present = true;
+#ifdef HDMI_HAVE_KMS
+      if (kms && kms_flip_pending(kms)) can_present = false;
+#endif
+      // --present-mode=capture: a frame that would only be replaced before the next vblank stays in the slot
+      const bool pacing = opt_present_mode == PRESENT_CAPTURE && !signal_lost && !opt_headless;
+      const int64_t frame_start_us = steady_us();
+      if (can_present && pacing && handoff.latest.load(std::memory_order_acquire) >= 0) {
+          bool was_holding = pacer.hold_until_us > 0;
+          if (pacer_hold(pacer, frame_start_us) > 0) { can_present = false; if (!was_holding) ++pacer.held; }
+      }
+      int64_t frame_token = can_present ? handoff.latest.exchange(-1, std::memory_order_acq_rel) : -1;
+      if (frame_token >= 0 && FrameHandoff::token_generation(frame_token) != handoff.generation.load(std::memory_order_acquire)) frame_token = -1;
+      if (frame_token >= 0) {
+            unsigned index = FrameHandoff::token_index(frame_token);
+            const CapturedFrame &m = handoff.meta[index];
+            if (m.width != tex_width || m.height != tex_height || m.pixfmt != tex_pixfmt || m.source_pixfmt != tex_source_pixfmt ||
+                m.rga != tex_rga || (m.rga && (m.rga_full != tex_rga_full || m.rga_flip_y != tex_rga_flip_y))) {
+#ifdef HDMI_HAVE_EGL_DMABUF
+                dmabuf_forget(true);
+#endif
+#ifdef HDMI_HAVE_KMS
+                kms_forget(true);
+#endif
+                tex_rga = m.rga; tex_rga_full = m.rga_full; tex_rga_flip_y = m.rga_flip_y; tex_source_pixfmt = m.source_pixfmt;
+#ifdef HDMI_HAVE_RGA
+                // every RGA output of this geometry has the same row pitch
+                if (m.rga) for (auto &b : rga_buffers) b[0].stride = rga_output_stride(m.width);
+#endif
+                apply_capture_format(m.width, m.height, m.pixfmt);
+            }
+#ifdef HDMI_HAVE_EGL_DMABUF
+            else if (dmabuf_stale) dmabuf_rebuild();
+            dmabuf_stale = false;
+#endif
+            // capture buffer, or its RGA output
+            const std::vector<std::vector<PlaneMap>> &frame_buffers = m.rga ? rga_buffers : buffers;
+            if (signal_lost) { signal_lost = false; vlogln("Recovered to live (new frame)"); }
+            stats.pending = true; stats.capture_us = m.capture_us; stats.dqbuf_us = m.dqbuf_us;
+            pacer_frame(pacer, m.capture_us, m.dqbuf_us, m.sequence);
+            frame_fresh = true;
+#ifndef HDMI_GLES
+            if (profiling) gpu_timer_begin(gpu_timers[GPU_PASS_UPLOAD]);
+#endif
+
+            // plane geometry at the driver's bytesperline; no ybase (unsupported fourcc) keeps the last frame
+            const PixelLayout lay = pixel_layout(m.pixfmt);
+            const FramePlanes planes = frame_planes(lay, frame_buffers[index], m.num_planes, m.bytesused0, m.width, m.height);
+            const size_t y_stride = planes.y_stride, uv_stride = planes.uv_stride, Y_len = planes.Y_len, UV_len = planes.UV_len;
+            const int y_texel = lay.packed ? 2 : 1;
+            const bool cpu_uv_swap = opt_cpu_uv_swap && lay.vu && !lay.packed;
+            unsigned char* ybase = planes.ybase; unsigned char* uvbase = planes.uvbase;
+
+            // zero-copy: the buffer itself becomes the texture (or goes on the overlay plane); it is handed back
+            // once the GPU/display is done with it
+            bool zero_copy = false, scanned_out = false;
+#ifdef HDMI_HAVE_KMS
+            if (uvbase && frame_buffers[index][0].dmabuf_fd >= 0 && overlay_eligible() && kms_mode_set(kms)) {
+                bool two = (planes.two_planes && frame_buffers[index][1].dmabuf_fd >= 0);
+                KmsScanoutFrame sf;
+                sf.width = m.width; sf.height = m.height; sf.v4l2_pixfmt = m.pixfmt;
+                sf.planes[0].fd = frame_buffers[index][0].dmabuf_fd; sf.planes[0].offset = 0; sf.planes[0].pitch = (uint32_t)y_stride;
+                if (!lay.packed) {
+                    sf.planes[1].fd = two ? frame_buffers[index][1].dmabuf_fd : frame_buffers[index][0].dmabuf_fd;
+                    sf.planes[1].offset = two ? 0 : (uint32_t)Y_len;
+                    sf.planes[1].pitch = (uint32_t)uv_stride;
+                }
+                sf.src_w = m.width; sf.src_h = m.height;
+                sf.bt709 = opt_use_bt709 != 0; sf.full_range = opt_full_range != 0;
+                if (kms_overlay_present(kms, sf, frame_token)) zero_copy = scanned_out = true;
+                else { kms_overlay_failed = true; vlogln("kms: overlay scanout rejected, staying on the GL path"); }
+            }
+#endif
+#ifdef HDMI_HAVE_EGL_DMABUF
+            if (!zero_copy && upload_path == UPLOAD_DMABUF && dmabuf.valid() && index < dmabuf.texY.size()) {
+                if (dmabuf_shown >= 0) dmabuf_retiring.push_back({dmabuf_shown, dmabuf_shown_fence});
+                dmabuf_shown = frame_token; dmabuf_shown_fence = 0;
+                zero_copy = true;
+            }
+#endif
+
+            // chroma rectangle in chroma texels (packed: RGBA texels covering two pixels each)
+            const int uv_x = upload_rect.x >> lay.x_shift, uv_y = upload_rect.y >> lay.y_shift;
+            const int uv_w = upload_rect.w >> lay.x_shift, uv_h = upload_rect.h >> lay.y_shift;
+
+            // PBO ring: copy the (cropped) planes tightly packed into a mapped buffer, then source the
+            // texture updates from it; the capture buffer is free again as soon as the memcpy is done.
+            // Packed 4:2:2 is copied once and uploaded twice from the same bytes.
+            bool pbo_uploaded = false;
+            if (pbo_ok && upload_path == UPLOAD_PBO && !zero_copy && ybase) {
+                size_t yRow = (size_t)upload_rect.w * (size_t)y_texel;
+                size_t yBytes = yRow * (size_t)upload_rect.h;
+                size_t uvOffset = (yBytes + 15) & ~(size_t)15;
+                size_t uvRow = (size_t)uv_w * 2;
+                size_t uvBytes = (uvbase && !lay.packed) ? uvRow * (size_t)uv_h : 0;
+                unsigned char* dst = pbo_ring_map(pbo, uvOffset + uvBytes);
+                if (dst) {
+                    const unsigned char* ysrc = ybase + (size_t)upload_rect.y * y_stride + (size_t)upload_rect.x * (size_t)y_texel;
+                    if (y_stride == yRow) memcpy(dst, ysrc, yBytes);
+                    else for (int y=0;y<upload_rect.h;++y) memcpy(dst + (size_t)y*yRow, ysrc + (size_t)y*y_stride, yRow);
+                    if (uvBytes) {
+                        unsigned char* uvdst = dst + uvOffset;
+                        const unsigned char* uvsrc = uvbase + (size_t)uv_y * uv_stride + (size_t)uv_x * 2;
+                        if (uv_stride == uvRow && !cpu_uv_swap) memcpy(uvdst, uvsrc, uvBytes);
+                        else for (int y=0;y<uv_h;++y) {
+                            const unsigned char* srcRow = uvsrc + (size_t)y*uv_stride;
+                            unsigned char* dstRow = uvdst + (size_t)y*uvRow;
+                            if (!cpu_uv_swap) { memcpy(dstRow, srcRow, uvRow); continue; }
+                            for (int x=0;x<uv_w;++x) { dstRow[x*2+0]=srcRow[x*2+1]; dstRow[x*2+1]=srcRow[x*2+0]; }
+                        }
                     }
-                    if (restarted) {
-                        einval_count=0; last_good_frame = clock::now(); last_recovered_time = clock::now();
-                        signal_lost=false; setPattern(false);
-                        vlogln("Stream restart succeeded after EINVALs");
-                    } else {
-                        vlogln("Stream restart failed after repeated EINVALs; starting background full reopen attempts");
-                        start_background_reopen();
+                    if (pbo_ring_unmap(pbo)) {
+                        const unsigned char* pbo_base = nullptr; // offsets into the bound unpack buffer
+                        glActiveTexture(GL_TEXTURE0);
+                        upload_plane(lay.packed ? GL_RG : GL_RED, y_texel, texY, pbo_base, upload_rect.w, 0, 0, upload_rect.w, upload_rect.h, gl_max_tex);
+                        if (lay.packed) {
+                            glActiveTexture(GL_TEXTURE1);
+                            upload_plane(GL_RGBA, 4, texUV, pbo_base, uv_w, 0, 0, uv_w, uv_h, gl_max_tex);
+                        } else if (uvBytes) {
+                            glActiveTexture(GL_TEXTURE1);
+                            upload_plane(GL_RG, 2, texUV, (const unsigned char*)(uintptr_t)uvOffset, uv_w, 0, 0, uv_w, uv_h, gl_max_tex);
+                        }
+                        pbo_uploaded = true;
                     }
-                } else {
-                    // start background reopen early to be more responsive
-                    start_background_reopen();
+                    pbo_ring_submit(pbo);
                 }
-            } else {
-                vlogln(std::string("VIDIOC_DQBUF non-fatal failure: ") + strerror(e));
             }
-          } else {
-            dequeued = true;
-            unsigned char* base = (unsigned char*)buffers[buf.index][0].addr;
-            size_t bytesused0 = planes[0].bytesused;
-            size_t Y_len = (size_t)cur_width * (size_t)cur_height;
-            size_t UV_len = 0;
-            bool isNV12_NV21 = (cur_pixfmt == V4L2_PIX_FMT_NV12 || cur_pixfmt == V4L2_PIX_FMT_NV21);
-            if (isNV12_NV21) UV_len = (size_t)cur_width * ((size_t)cur_height / 2);
-            else UV_len = (size_t)cur_width * (size_t)cur_height * 2;
-            size_t total_expected = Y_len + UV_len;
-
-            if (bytesused0 == 0) {
-                signal_lost = true; setPattern(true);
-                vlogln("Dequeued buffer with bytesused==0 -> immediate signal_lost");
-                // start background reopen to try to recover
-                start_background_reopen();
+
+            if (ybase && !zero_copy && !pbo_uploaded) {
+                glActiveTexture(GL_TEXTURE0);
+                upload_plane(lay.packed ? GL_RG : GL_RED, y_texel, texY, ybase, (int)(y_stride / (size_t)y_texel),
+                             upload_rect.x, upload_rect.y, upload_rect.w, upload_rect.h, gl_max_tex);
             }
 
-            unsigned char* ybase=nullptr; unsigned char* uvbase=nullptr;
-            if (buf.length >= 2 && buffers[buf.index].size() >= 2) {
-                ybase = (unsigned char*)buffers[buf.index][0].addr; uvbase = (unsigned char*)buffers[buf.index][1].addr;
-            } else if (bytesused0 >= total_expected) {
-                ybase = base; uvbase = base + Y_len;
-            } else { ybase = base; uvbase = nullptr; }
-
-            if (ybase && !signal_lost) {
-                if ((int)cur_width <= gl_max_tex && (int)cur_height <= gl_max_tex) {
-                    glActiveTexture(GL_TEXTURE0); glBindTexture(GL_TEXTURE_2D, texY);
-                    glPixelStorei(GL_UNPACK_ALIGNMENT,1); glTexSubImage2D(GL_TEXTURE_2D,0,0,0,(int)cur_width,(int)cur_height,GL_RED,GL_UNSIGNED_BYTE,ybase);
-                } else upload_texture_tiled(GL_RED, texY, (int)cur_width, (int)cur_height, ybase, gl_max_tex, 1);
-
-                last_pixfmt = cur_pixfmt;
-                if (isNV12_NV21 && ybase && uvbase) {
-                    size_t ylen = (size_t)cur_width * (size_t)cur_height; size_t uvlen = (size_t)cur_width * ((size_t)cur_height / 2);
-                    if (lastY.size() < ylen) lastY.resize(ylen);
-                    if (lastUV.size() < uvlen) lastUV.resize(uvlen);
-                    memcpy(lastY.data(), ybase, ylen); memcpy(lastUV.data(), uvbase, uvlen);
-                    last_width = (int)cur_width; last_height = (int)cur_height; lastIsNV12_NV21 = true;
-                    lastPacked.clear(); lastPackedSize=0; last_stride=0;
+            if (snapshot_requested && ybase) {
+                ScreenshotJob job;
+                job.width = (int)m.width; job.height = (int)m.height; job.pixfmt = m.pixfmt;
+                // same colours as on screen: the shader reads the raw chroma bytes as (U,V) unless uv_swap
+                // (with --cpu-uv-swap the V-first formats are swapped before the upload instead)
+                bool shown_vu = !m.rga && (uv_swap || cpu_uv_swap); // RGA output is already in display order
+                job.color.bt709 = opt_use_bt709 != 0; job.color.full_range = opt_full_range != 0; job.color.swap_uv = shown_vu != lay.vu;
+                job.format = opt_screenshot_format;
+                job.filename = screenshot_filename("input", ctrl.moduleSerials, job.width, job.height, job.format);
+                job.y_stride = y_stride; job.uv_stride = uv_stride;
+                if (lay.packed) {
+                    job.y.assign(ybase, ybase + std::min(Y_len, frame_buffers[index][0].length));
                 } else {
-                    if (uvbase==nullptr) {
-                        unsigned char* packedPtr = base; size_t packedSize = bytesused0>0?bytesused0:(size_t)cur_width*(size_t)cur_height*2;
-                        if (lastPacked.size() < packedSize) lastPacked.resize(packedSize);
-                        memcpy(lastPacked.data(), packedPtr, packedSize);
-                        lastPackedSize=packedSize; last_stride=(int)cur_width*2; last_width=(int)cur_width; last_height=(int)cur_height; lastIsNV12_NV21=false;
-                    } else {
-                        size_t ylen=(size_t)cur_width*(size_t)cur_height; size_t uvlen=(size_t)cur_width*((size_t)cur_height/2);
-                        size_t packedSize = ylen + uvlen;
-                        if (lastPacked.size() < packedSize) lastPacked.resize(packedSize);
-                        memcpy(lastPacked.data(), ybase, ylen); memcpy(lastPacked.data()+ylen, uvbase, uvlen);
-                        lastPackedSize=packedSize; last_width=(int)cur_width; last_height=(int)cur_height; lastIsNV12_NV21=false;
-                    }
+                    job.y.assign(ybase, ybase + Y_len);
+                    if (uvbase) job.uv.assign(uvbase, uvbase + UV_len);
                 }
+                if (screenshot_worker.submit(std::move(job))) vlogln("Screenshot: frame captured, saving in background");
+                else vlogln("Screenshot: worker busy, request dropped");
+                snapshot_requested = false;
             }
 
-            if (uvbase && !signal_lost) {
-                int upload_w = isNV12_NV21 ? (int)(cur_width/2) : (int)cur_width;
-                int upload_h = isNV12_NV21 ? (int)(cur_height/2) : (int)cur_height;
-                if (opt_cpu_uv_swap && cur_pixfmt == V4L2_PIX_FMT_NV21) {
-                    size_t need = (size_t)upload_w*(size_t)upload_h*2; if (tmpUVbuf.size() < need) tmpUVbuf.resize(need);
+            if (uvbase && !zero_copy && !pbo_uploaded) {
+                glActiveTexture(GL_TEXTURE1);
+                if (lay.packed) {
+                    upload_plane(GL_RGBA, 4, texUV, ybase, (int)(y_stride / 4), uv_x, uv_y, uv_w, uv_h, gl_max_tex);
+                } else if (cpu_uv_swap) {
+                    size_t need = (size_t)uv_w*(size_t)uv_h*2; if (tmpUVbuf.size() < need) tmpUVbuf.resize(need);
                     unsigned char* dst = tmpUVbuf.data();
-                    if (isNV12_NV21) {
-                        for (int y=0;y<upload_h;++y) {
-                            const unsigned char* srcRow = uvbase + (size_t)y*(size_t)cur_width;
-                            unsigned char* dstRow = dst + (size_t)y*(size_t)upload_w*2;
-                            for (int x=0;x<upload_w;++x) { unsigned char v = srcRow[x*2+0]; unsigned char u = srcRow[x*2+1]; dstRow[x*2+0]=u; dstRow[x*2+1]=v; }
-                        }
-                    } else {
-                        for (int y=0;y<upload_h;++y) {
-                            const unsigned char* srcRow = uvbase + (size_t)y*(size_t)upload_w*2;
-                            unsigned char* dstRow = dst + (size_t)y*(size_t)upload_w*2;
-                            for (int x=0;x<upload_w;++x) { unsigned char v = srcRow[x*2+0]; unsigned char u = srcRow[x*2+1]; dstRow[x*2+0]=u; dstRow[x*2+1]=v; }
-                        }
+                    for (int y=0;y<uv_h;++y) {
+                        const unsigned char* srcRow = uvbase + (size_t)(uv_y + y)*uv_stride + (size_t)uv_x*2;
+                        unsigned char* dstRow = dst + (size_t)y*(size_t)uv_w*2;
+                        for (int x=0;x<uv_w;++x) { unsigned char v = srcRow[x*2+0]; unsigned char u = srcRow[x*2+1]; dstRow[x*2+0]=u; dstRow[x*2+1]=v; }
                     }
-                    if (upload_w <= gl_max_tex && upload_h <= gl_max_tex) {
-                        glActiveTexture(GL_TEXTURE1); glBindTexture(GL_TEXTURE_2D, texUV);
-                        glPixelStorei(GL_UNPACK_ALIGNMENT,1); glTexSubImage2D(GL_TEXTURE_2D,0,0,0,upload_w,upload_h,GL_RG,GL_UNSIGNED_BYTE,tmpUVbuf.data());
-                    } else upload_texture_tiled(GL_RG, texUV, upload_w, upload_h, tmpUVbuf.data(), gl_max_tex, 2);
+                    upload_plane(GL_RG, 2, texUV, tmpUVbuf.data(), uv_w, 0, 0, uv_w, uv_h, gl_max_tex);
                 } else {
-                    if (upload_w <= gl_max_tex && upload_h <= gl_max_tex) {
-                        glActiveTexture(GL_TEXTURE1); glBindTexture(GL_TEXTURE_2D, texUV);
-                        glPixelStorei(GL_UNPACK_ALIGNMENT,1); glTexSubImage2D(GL_TEXTURE_2D,0,0,0,upload_w,upload_h,GL_RG,GL_UNSIGNED_BYTE,uvbase);
-                    } else upload_texture_tiled(GL_RG, texUV, upload_w, upload_h, uvbase, gl_max_tex, 2);
+                    upload_plane(GL_RG, 2, texUV, uvbase, (int)(uv_stride / 2), uv_x, uv_y, uv_w, uv_h, gl_max_tex);
                 }
             }
 
-            // requeue buffer
-            bool qbuf_ok=false;
-            for (int attempt=0; attempt < QBUF_RETRIES; ++attempt) {
-                if (xioctl(fd, VIDIOC_QBUF, &buf) == 0) { qbuf_ok=true; if (opt_verbose && attempt>0) vlogln(std::string("VIDIOC_QBUF succeeded after ") + std::to_string(attempt) + " retries"); break; }
-                else { int e = errno; if (opt_verbose) vlogln(std::string("VIDIOC_QBUF failed (attempt ") + std::to_string(attempt+1) + "): " + strerror(e)); usleep(QBUF_RETRY_MS*1000); }
-            }
-            if (!qbuf_ok) std::cerr<<"VIDIOC_QBUF failed after retries; will fallback to pattern if no subsequent good frames\n";
-            else {
-                last_good_frame = now; last_recovered_time = now; einval_count = 0;
-                if (signal_lost) { signal_lost = false; setPattern(false); vlogln("Recovered to live (QBUF success)"); }
-            }
-          } // end normal DQBUF handling
-      }
+#ifndef HDMI_GLES
+            gpu_timer_end(gpu_timers[GPU_PASS_UPLOAD]);
+#endif
+            stats.upload_us = steady_us();
+            if (scanned_out) { pacer_presenting(pacer, frame_start_us, stats.upload_us); stats_presented(); }
 
-      // Check SOURCE_CHANGE events if any
-      if (pfd.revents & POLLPRI) {
-          v4l2_event ev;
-          while (ioctl(fd, VIDIOC_DQEVENT, &ev) == 0) {
-              if (ev.type == V4L2_EVENT_SOURCE_CHANGE) {
-                  uint32_t new_w=0,new_h=0,new_pf=0;
-                  bool got = get_v4l2_format(fd, new_w, new_h, new_pf);
-                  if (!got || new_w==0 || new_h==0) { signal_lost=true; setPattern(true); vlogln("SOURCE_CHANGE: invalid format -> signal_lost"); start_background_reopen(); }
-                  else {
-                      std::lock_guard<std::mutex> lk(restart_mutex);
-                      if (new_w != cur_width || new_h != cur_height || new_pf != cur_pixfmt) {
-                          cur_width=new_w; cur_height=new_h; cur_pixfmt=new_pf;
-                          int new_uv_w = (cur_pixfmt == V4L2_PIX_FMT_NV12 || cur_pixfmt == V4L2_PIX_FMT_NV21) ? (int)(cur_width/2) : (int)cur_width;
-                          int new_uv_h = (cur_pixfmt == V4L2_PIX_FMT_NV12 || cur_pixfmt == V4L2_PIX_FMT_NV21) ? (int)(cur_height/2) : (int)cur_height;
-                          reallocate_textures(texY, texUV, (int)cur_width, (int)cur_height, new_uv_w, new_uv_h);
-                          if (opt_auto_resize_window) SDL_SetWindowSize(win, (int)cur_width, (int)cur_height);
-                          if (opt_uv_swap_override < 0 && !opt_cpu_uv_swap) {
-                              int old_uv = uv_swap;
-                              if (cur_pixfmt == V4L2_PIX_FMT_NV21) uv_swap = 1; else if (cur_pixfmt == V4L2_PIX_FMT_NV12) uv_swap = 0;
-                              if (uv_swap != old_uv && loc_uv_swap >= 0) { glUseProgram(program); glUniform1i(loc_uv_swap, uv_swap); }
-                          }
-                          if (loc_textureIsFull >= 0) {
-                              int textureIsFull = ((int)cur_width == (int)ctrl.fullInputW && (int)cur_height == (int)ctrl.fullInputH) ? 1 : 0;
-                              glUseProgram(program); glUniform1i(loc_textureIsFull, textureIsFull);
-                          }
-                      }
-                  }
-              }
-          }
+            // glTexSubImage2D has consumed the client memory: hand the buffer back for requeueing
+            if (!zero_copy) return_frame(frame_token);
+            need_redraw = true;
       }
 
-      // Timeout -> set pattern if no good frames recently (respect recovery grace)
-      auto now2 = clock::now();
-      auto elapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(now2 - last_good_frame).count();
-      if (!signal_lost && elapsedMs > PATTERN_TIMEOUT_MS) {
+      for (size_t i = 1; i < sources.size(); ++i) take_source_frame(*sources[i]);
+
+      // Timeout -> set pattern if no good frames recently (respect recovery grace), per source
+      int64_t now2 = steady_ms();
+      for (auto &src : sources) {
+          CaptureSource &s = *src;
+          int64_t elapsedMs = now2 - s.last_good_frame_ms.load();
+          if (source_lost(s.index) || elapsedMs <= PATTERN_TIMEOUT_MS) continue;
           bool within_recovery_grace = false;
-          if (last_recovered_time != clock::time_point()) {
-              auto since_recovered = std::chrono::duration_cast<std::chrono::milliseconds>(now2 - last_recovered_time).count();
+          int64_t recovered = s.last_recovered_ms.load();
+          if (recovered != 0) {
+              int64_t since_recovered = now2 - recovered;
               if (since_recovered < RECOVERY_GRACE_MS) within_recovery_grace = true;
           }
           if (!within_recovery_grace) {
-              signal_lost = true; vlogln("signal_lost: timeout reached -> showing pattern"); setPattern(true);
-              start_background_reopen();
+              (s.index == 0 ? signal_lost : s.signal_lost) = true;
+              source_log(s, "signal_lost: timeout reached -> showing pattern");
+              if (s.index != 0) need_redraw = true;
+              request_reopen(s);
           } else if (opt_verbose) {
-              vlogln(std::string("Skipping signal_lost due to recovery grace (") + std::to_string(elapsedMs) + "ms since last_good_frame)");
+              source_log(s, std::string("Skipping signal_lost due to recovery grace (") + std::to_string(elapsedMs) + "ms since last_good_frame)");
           }
       }
 
-      // Render
-      glClear(GL_COLOR_BUFFER_BIT);
-      glUseProgram(program);
-      if (loc_rot >= 0) glUniform1i(loc_rot, rotation);
-      if (loc_flip_x >= 0) glUniform1i(loc_flip_x, flip_x);
-      if (loc_flip_y >= 0) glUniform1i(loc_flip_y, flip_y);
-      if (loc_gap_count >= 0) glUniform1i(loc_gap_count, gap_count);
-      if (loc_gap_rows >= 0) glUniform1iv(loc_gap_rows, GAP_ARRAY_SIZE, gap_rows_arr);
-      if (loc_u_fullInputSize >= 0) glUniform2f(loc_u_fullInputSize, ctrl.fullInputW, ctrl.fullInputH);
-      if (loc_u_segmentsX >= 0) glUniform1i(loc_u_segmentsX, ctrl.segmentsX);
-      if (loc_u_segmentsY >= 0) glUniform1i(loc_u_segmentsY, ctrl.segmentsY);
-      if (loc_u_subBlockSize >= 0) glUniform2f(loc_u_subBlockSize, ctrl.subBlockW, ctrl.subBlockH);
-      if (loc_u_tileW >= 0) glUniform1f(loc_u_tileW, ctrl.tileW);
-      if (loc_u_tileH >= 0) glUniform1f(loc_u_tileH, ctrl.tileH);
-      if (loc_u_spacingX >= 0) glUniform1f(loc_u_spacingX, ctrl.spacingX);
-      if (loc_u_spacingY >= 0) glUniform1f(loc_u_spacingY, ctrl.spacingY);
-      if (loc_u_marginX >= 0) glUniform1f(loc_u_marginX, ctrl.marginX);
-      if (loc_u_numTilesPerRow >= 0) glUniform1i(loc_u_numTilesPerRow, ctrl.numTilesPerRow);
-      if (loc_u_numTilesPerCol >= 0) glUniform1i(loc_u_numTilesPerCol, ctrl.numTilesPerCol);
-      if (loc_inputTilesTopToBottom >= 0) glUniform1i(loc_inputTilesTopToBottom, ctrl.inputTilesTopToBottom);
-      if (loc_moduleSerials >= 0) glUniform1iv(loc_moduleSerials, 3, ctrl.moduleSerials);
-      if (!opt_cpu_uv_swap && loc_uv_swap >= 0) glUniform1i(loc_uv_swap, uv_swap);
-      if (loc_use_bt709 >= 0) glUniform1i(loc_use_bt709, opt_use_bt709);
-      if (loc_full_range >= 0) glUniform1i(loc_full_range, opt_full_range);
-      if (loc_textureIsFull >= 0) {
-          int textureIsFull = ((int)cur_width == (int)ctrl.fullInputW && (int)cur_height == (int)ctrl.fullInputH) ? 1 : 0;
-          glUniform1i(loc_textureIsFull, textureIsFull);
-      }
-      if (loc_u_windowSize >= 0) glUniform2f(loc_u_windowSize, (float)win_w, (float)win_h);
-      if (loc_u_outputSize >= 0) glUniform2f(loc_u_outputSize, ctrl.subBlockW, ctrl.subBlockH);
-      if (loc_u_alignTopLeft >= 0) glUniform1i(loc_u_alignTopLeft, 1);
-      if (loc_segmentIndex >= 0) {
-          int maxSeg = std::max(1, ctrl.segmentsX * ctrl.segmentsY);
-          int segToSet = std::min(std::max(1, activeSegment), maxSeg);
-          glUniform1i(loc_segmentIndex, segToSet);
-      }
-
-      // Updated: show pattern if signal_lost OR manual_show_pattern (toggle with 't')
-      int showPatternFlag = (ENABLE_SHADER_TEST_PATTERN && (signal_lost || manual_show_pattern)) ? 1 : 0;
-      if (loc_u_showPattern >= 0) glUniform1i(loc_u_showPattern, showPatternFlag);
-
-      if (haveTestPattern && ENABLE_SHADER_TEST_PATTERN) { glActiveTexture(GL_TEXTURE2); glBindTexture(GL_TEXTURE_2D, texPattern); }
-      glActiveTexture(GL_TEXTURE0); glBindTexture(GL_TEXTURE_2D, texY);
-      glActiveTexture(GL_TEXTURE1); glBindTexture(GL_TEXTURE_2D, texUV);
-      glBindVertexArray(vao); glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-      SDL_GL_SwapWindow(win);
-
-      // SDL events
+      // SDL events (before drawing, so a key press shows up in this iteration)
       SDL_Event e;
-      while (SDL_PollEvent(&e)) {
+      while (win && SDL_PollEvent(&e)) {
           if (e.type == SDL_QUIT) { goto shutdown; }
+          else if (e.type == SDL_WINDOWEVENT) {
+              if (e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED && !opt_headless) { SDL_GetWindowSize(win,&win_w,&win_h); glViewport(0,0,win_w,win_h); need_redraw = true; }
+              else if (e.window.event == SDL_WINDOWEVENT_EXPOSED) need_redraw = true;
+          }
           else if (e.type == SDL_KEYDOWN) {
               SDL_Keycode k = e.key.keysym.sym;
               if (k == SDLK_ESCAPE) { goto shutdown; }
@@ -1155,65 +4048,275 @@ int main(int argc, char** argv) {
                   if (SDL_GetWindowFlags(win) & SDL_WINDOW_FULLSCREEN_DESKTOP) SDL_SetWindowFullscreen(win,0);
                   else SDL_SetWindowFullscreen(win, SDL_WINDOW_FULLSCREEN_DESKTOP);
                   SDL_GetWindowSize(win,&win_w,&win_h); glViewport(0,0,win_w,win_h);
-                  if (loc_u_windowSize >= 0) { glUseProgram(program); glUniform2f(loc_u_windowSize, (float)win_w, (float)win_h); if (loc_u_alignTopLeft >= 0) glUniform1i(loc_u_alignTopLeft,1); }
               } else if (k == SDLK_k) {
-                  ControlParams newCtrl; if (loadControlIni("control_ini.txt", newCtrl)) {
-                      ctrl = newCtrl; glUseProgram(program);
-                      if (loc_u_fullInputSize >= 0) glUniform2f(loc_u_fullInputSize, ctrl.fullInputW, ctrl.fullInputH);
-                      if (loc_u_segmentsX >= 0) glUniform1i(loc_u_segmentsX, ctrl.segmentsX);
-                      if (loc_u_segmentsY >= 0) glUniform1i(loc_u_segmentsY, ctrl.segmentsY);
-                      if (loc_u_subBlockSize >= 0) glUniform2f(loc_u_subBlockSize, ctrl.subBlockW, ctrl.subBlockH);
-                      if (loc_u_tileW >= 0) glUniform1f(loc_u_tileW, ctrl.tileW);
-                      if (loc_u_tileH >= 0) glUniform1f(loc_u_tileH, ctrl.tileH);
-                      if (loc_u_spacingX >= 0) glUniform1f(loc_u_spacingX, ctrl.spacingX);
-                      if (loc_u_spacingY >= 0) glUniform1f(loc_u_spacingY, ctrl.spacingY);
-                      if (loc_u_marginX >= 0) glUniform1f(loc_u_marginX, ctrl.marginX);
-                      if (loc_u_numTilesPerRow >= 0) glUniform1i(loc_u_numTilesPerRow, ctrl.numTilesPerRow);
-                      if (loc_u_numTilesPerCol >= 0) glUniform1i(loc_u_numTilesPerCol, ctrl.numTilesPerCol);
-                      if (loc_inputTilesTopToBottom >= 0) glUniform1i(loc_inputTilesTopToBottom, ctrl.inputTilesTopToBottom);
-                      if (loc_moduleSerials >= 0) glUniform1iv(loc_moduleSerials, 3, ctrl.moduleSerials);
-                      modFiles = buildModuleFilenames(ctrl);
-                      std::vector<GLint> newOffsets; if (loadOffsetsFromModuleFiles(modFiles, newOffsets)) {
-                          if (loc_offsetxy1 >= 0 && newOffsets.size() >= 150*2) { glUseProgram(program); glUniform2iv(loc_offsetxy1, 150, newOffsets.data()); offsetData.swap(newOffsets); }
-                      }
-                  }
-              } else if (k == SDLK_h) { flip_x = !flip_x; if (loc_flip_x >= 0) { glUseProgram(program); glUniform1i(loc_flip_x, flip_x); } }
-              else if (k == SDLK_v) { flip_y = !flip_y; if (loc_flip_y >= 0) { glUseProgram(program); glUniform1i(loc_flip_y, flip_y); } }
-              else if (k == SDLK_r) { rotation = (rotation + 2) & 3; if (loc_rot >= 0) { glUseProgram(program); glUniform1i(loc_rot, rotation); } }
+                  config_watcher.request_reload(); // applied below once the snapshot is published
+              } else if (k == SDLK_h) { flip_x = !flip_x; mark_remap_dirty(); }
+              else if (k == SDLK_v) { flip_y = !flip_y; mark_remap_dirty(); }
+              else if (k == SDLK_r) { rotation = (rotation + 2) & 3; mark_remap_dirty(); }
               else if (k == SDLK_o) {
                   vlogln("User requested manual restart (key 'o')");
-                  start_background_reopen(); // reuse same v4l-only path but triggered immediately
+                  for (auto &src : sources) request_reopen(*src); // reuse same v4l-only path but triggered immediately
               } else if (k == SDLK_t) {
                   // NEW: toggle manual test pattern override
                   manual_show_pattern = !manual_show_pattern;
                   vlogln(std::string("Manual test-pattern toggle: ") + (manual_show_pattern ? "ON" : "OFF"));
-                  // update shader immediately as well (keeps UI responsive)
-                  setPattern(manual_show_pattern || signal_lost);
               } else if (k == SDLK_1 || k == SDLK_2 || k == SDLK_3) {
                   int requested = -1; if (k==SDLK_1) requested=1; if (k==SDLK_2) requested=2; if (k==SDLK_3) requested=3;
-                  if (requested>0) { int maxSeg = std::max(1, ctrl.segmentsX * ctrl.segmentsY); if (requested <= maxSeg) { activeSegment = requested; if (loc_segmentIndex >= 0) { glUseProgram(program); glUniform1i(loc_segmentIndex, activeSegment); } } }
+                  if (requested>0) { int maxSeg = std::max(1, ctrl.segmentsX * ctrl.segmentsY); if (requested <= maxSeg) { activeSegment = requested; load_offsets(); mark_remap_dirty(); refresh_upload_rect(); need_redraw = true; } }
               } else if (k == SDLK_s) {
-                  if (last_width>0 && last_height>0) {
-                      std::vector<unsigned char> copyY, copyUV, copyPacked;
-                      if (lastIsNV12_NV21) { copyY = lastY; copyUV = lastUV; } else copyPacked = lastPacked;
-                      int w = last_width, h = last_height; uint32_t fmt = last_pixfmt;
-                      int uv_swap_flag = uv_swap; int use_bt709_flag = opt_use_bt709; int full_range_flag = opt_full_range;
-                      std::thread t(async_save_frame_to_png, std::move(copyY), std::move(copyUV), std::move(copyPacked), lastPackedSize, w, h, fmt, uv_swap_flag, use_bt709_flag, full_range_flag, std::string("display.png"));
-                      t.detach();
+                  if (screenshot_worker.full()) vlogln("Screenshot: worker queue full, ignoring 's'");
+                  else { snapshot_requested = true; vlogln("Screenshot: requested, waiting for next frame"); }
+              } else if (k == SDLK_p) {
+                  if (e.key.keysym.mod & KMOD_SHIFT) sweep_start(); // results on stdout
+                  else {
+                      profile_overlay = !profile_overlay; overlay_next_ms = 0; need_redraw = true;
+                      vlogln(std::string("Profile overlay: ") + (profile_overlay ? "ON" : "OFF"));
                   }
+              } else if (k == SDLK_c) {
+                  if (!readback_ok) vlogln("Capture: no pixel pack buffers, output capture unavailable");
+                  else { output_capture_remaining = opt_capture_burst; need_redraw = true; vlogln("Capture: reading back the next " + std::to_string(opt_capture_burst) + " output frame(s)"); }
               }
           }
       } // end event handling
+
+      if (remap_dirty) rebuild_remap();
+      if (tiles_dirty) rebuild_tiles();
+      if (profile_overlay && steady_ms() >= overlay_next_ms) {
+          if (overlay_init()) { overlay_refresh(); need_redraw = true; }
+          else profile_overlay = false;
+      }
+      if (sweep_running) need_redraw = true;
+
+      // Render (with --render-on-demand only when something visible changed; the last image stays up otherwise)
+      glUseProgram(program);
+      if (sync_layout_ubo()) need_redraw = true;
+      bool gl_output = true;
+#ifdef HDMI_HAVE_KMS
+      if (kms) {
+          if (kms_overlay_active(kms)) {
+              if (overlay_eligible()) gl_output = false; // the overlay plane shows the frame
+              else need_redraw = true;                   // back to the shader picture; kms_present() drops the overlay
+          }
+          if (kms_flip_pending(kms)) gl_output = false;  // drawn once the flip event is in
+      }
+#endif
+      // capture-locked: no repeats of the same frame (each takes a vblank the next frame may need); other
+      // redraws wait for the latch point when a frame is due before it and go out with that frame
+      if (pacing && gl_output && frame_token < 0) {
+          if (!need_redraw) gl_output = false;
+          else if (pacer_hold(pacer, steady_us()) > 0) gl_output = false;
+      }
+#ifdef HDMI_HAVE_MPP
+      if (stream && steady_us() >= stream_next_us) need_redraw = true; // --render-on-demand: the stream keeps its rate
+#endif
+      if (gl_output && (need_redraw || !opt_render_on_demand)) {
+#ifndef HDMI_GLES
+        if (profiling) gpu_timer_begin(gpu_timers[GPU_PASS_DRAW]);
+#endif
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        if (haveTestPattern && ENABLE_SHADER_TEST_PATTERN) { glActiveTexture(GL_TEXTURE2); glBindTexture(GL_TEXTURE_2D, texPattern); }
+        if (remap_active) { glActiveTexture(GL_TEXTURE3); glBindTexture(GL_TEXTURE_2D, texRemap); }
+        if (texLayout) { glActiveTexture(GL_TEXTURE4); glBindTexture(GL_TEXTURE_2D, texLayout); }
+        if (texColorLut) { glActiveTexture(GL_TEXTURE5); glBindTexture(GL_TEXTURE_2D, texColorLut); }
+        GLuint drawTexY = texY, drawTexUV = texUV;
+#ifdef HDMI_HAVE_EGL_DMABUF
+        if (dmabuf_shown >= 0) {
+            unsigned shown = FrameHandoff::token_index(dmabuf_shown);
+            if (shown < dmabuf.texY.size()) { drawTexY = dmabuf.texY[shown]; drawTexUV = dmabuf.texUV[shown]; }
+        }
+#endif
+        glActiveTexture(GL_TEXTURE0); glBindTexture(GL_TEXTURE_2D, drawTexY);
+        glActiveTexture(GL_TEXTURE1); glBindTexture(GL_TEXTURE_2D, drawTexUV);
+        // --all-segments: segment N goes into cell N of a segmentsX x segmentsY grid over the window (row 0 at
+        // the top), each sampling the textures of its capture source
+        const int segments_drawn = opt_all_segments ? wall_segments : 1;
+        const int cols = std::max(1, ctrl.segmentsX), rows = std::max(1, (wall_segments + cols - 1) / cols);
+        bool tiles_bound = false;
+        glBindVertexArray(vao);
+        for (int seg = 0; seg < segments_drawn; ++seg) {
+            const int segment = opt_all_segments ? seg + 1 : activeSegment;
+            const int src = segment_source(segment);
+            // --tile-mode=instanced: one quad per tile; a segment showing the test pattern keeps the full-screen quad
+            const bool seg_pattern = ENABLE_SHADER_TEST_PATTERN && (manual_show_pattern || source_lost(src));
+            const bool draw_tiles = tile_program && !seg_pattern;
+            if (draw_tiles != tiles_bound) {
+                glUseProgram(draw_tiles ? tile_program : program); glBindVertexArray(draw_tiles ? tile_vao : vao);
+                tiles_bound = draw_tiles;
+            }
+            if (sources.size() > 1) {
+                const CaptureSource *cs = src > 0 ? sources[(size_t)src].get() : nullptr;
+                glActiveTexture(GL_TEXTURE0); glBindTexture(GL_TEXTURE_2D, cs ? cs->texY : drawTexY);
+                glActiveTexture(GL_TEXTURE1); glBindTexture(GL_TEXTURE_2D, cs ? cs->texUV : drawTexUV);
+                patch_layout_flags(seg_pattern ? 1 : 0, cs ? ((int)cs->tex_width == ctrl.fullInputW && (int)cs->tex_height == ctrl.fullInputH ? 1 : 0)
+                                                           : layout_uploaded.textureIsFull);
+            }
+            if (opt_all_segments) {
+                int col = seg % cols, row = seg / cols;
+                int x0 = win_w * col / cols, x1 = win_w * (col + 1) / cols;
+                int y0 = win_h - win_h * (row + 1) / rows, y1 = win_h - win_h * row / rows;
+                GLint lv = draw_tiles ? tile_loc_viewport : loc_viewport, ls = draw_tiles ? tile_loc_drawSegment : loc_drawSegment;
+                glViewport(x0, y0, x1 - x0, y1 - y0);
+                if (lv >= 0) glUniform4f(lv, (float)x0, (float)y0, (float)(x1 - x0), (float)(y1 - y0));
+                if (ls >= 0) glUniform1i(ls, seg + 1);
+            }
+            if (!draw_tiles) glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+            else if (seg < (int)tile_count.size() && tile_count[seg] > 0) {
+                bind_tile_instances(tile_first[seg]);
+                glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, tile_count[seg]);
+            }
+        }
+        if (opt_all_segments) glViewport(0, 0, win_w, win_h);
+        if (tiles_bound) glUseProgram(program);
+        if (sources.size() > 1) patch_layout_flags(layout_uploaded.showPattern, layout_uploaded.textureIsFull);
+#ifndef HDMI_GLES
+        gpu_timer_end(gpu_timers[GPU_PASS_DRAW]);
+#endif
+        // the finished picture, before it is presented (back buffer / headless FBO)
+        if (output_capture_remaining > 0) {
+            if (readback_start(readback, win_w, win_h)) --output_capture_remaining;
+            else vlogln("Capture: readback slots busy, retrying next frame");
+        }
+#ifdef HDMI_HAVE_MPP
+        if (stream) stream_capture();
+#endif
+        if (profile_overlay) overlay_draw(); // not part of output captures
+#ifdef HDMI_HAVE_EGL_DMABUF
+        if (dmabuf_shown >= 0) { if (dmabuf_shown_fence) glDeleteSync(dmabuf_shown_fence); dmabuf_shown_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0); }
+#endif
+        if (!opt_headless) pacer_presenting(pacer, frame_start_us, steady_us());
+#ifdef HDMI_HAVE_KMS
+        if (kms) { if (!kms_present(kms)) vlogln("kms: present failed"); }
+        else
+#endif
+        if (opt_headless) {
+            // no swap to pace us: keep at most two frames queued on the GPU
+            GLsync &f = headless_fences[headless_fence_next];
+            if (f) { glClientWaitSync(f, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull); glDeleteSync(f); }
+            f = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            headless_fence_next ^= 1;
+        } else {
+            // with vsync a swap that blocked returned right after a vblank: that gives the pacer its phase
+            int64_t swap_start = steady_us();
+            SDL_GL_SwapWindow(win);
+            int64_t swap_end = steady_us();
+            if (swap_end - swap_start > SWAP_BLOCKED_US) pacer_vblank(pacer, swap_end, nominal_refresh_us);
+        }
+        need_redraw = false;
+        stats_presented();
+      }
+#ifndef HDMI_GLES
+      if (profiling) {
+          gpu_timer_collect(gpu_timers[GPU_PASS_UPLOAD], stats.gpu, &metrics.latency[STAGE_GPU_UPLOAD]);
+          gpu_timer_collect(gpu_timers[GPU_PASS_DRAW], stats.gpu_draw, &metrics.latency[STAGE_GPU_DRAW]);
+          gpu_timer_collect(gpu_timers[GPU_PASS_OVERLAY], stats.gpu_overlay);
+      }
+#endif
+      stats_report();
+      if (bench_step()) goto shutdown;
+      if (sweep_step()) goto shutdown;
+
+      // hand finished output readbacks to the screenshot worker
+      {
+          ScreenshotJob job;
+          while (readback_ok && readback_collect(readback, job.rgba, job.width, job.height)) {
+              job.format = opt_screenshot_format;
+              job.filename = screenshot_filename("output", ctrl.moduleSerials, job.width, job.height, job.format);
+              if (!screenshot_worker.submit(std::move(job))) vlogln("Capture: worker queue full, output frame dropped");
+              job = ScreenshotJob();
+          }
+          if (output_capture_remaining > 0) need_redraw = true; // --render-on-demand: keep drawing for the burst
+      }
+#ifdef HDMI_HAVE_MPP
+      // hand finished stream readbacks to the encoder worker
+      if (stream) {
+          StreamJob job; int w = 0, h = 0;
+          while (readback_collect(stream_readback, job.rgba, w, h, &job.pts_us)) {
+              if (!stream_worker.submit(std::move(job))) metrics.stream_dropped.fetch_add(1, std::memory_order_relaxed);
+              job = StreamJob();
+          }
+      }
+#endif
+
+
+      // capture thread wants to tear down/reallocate its buffers: drop every GPU reference first
+      if (handoff.release_requested.exchange(false, std::memory_order_acq_rel)) {
+#ifdef HDMI_HAVE_EGL_DMABUF
+          dmabuf_forget(false);
+          dmabuf_stale = dmabuf_ok;
+#endif
+#ifdef HDMI_HAVE_KMS
+          kms_forget(false);
+#endif
+          std::lock_guard<std::mutex> lk(handoff.release_mutex);
+          handoff.released = true;
+          handoff.release_cv.notify_all();
+      }
       ++frame_count;
     } // end main loop
 
 shutdown:
+    capture_quit.store(true);
+    for (auto &src : sources) {
+        FrameHandoff::signal(src->handoff.capture_efd);
+        // unblock a pending release handshake so the capture thread can exit
+        std::lock_guard<std::mutex> lk(src->handoff.release_mutex);
+        src->handoff.release_cv.notify_all();
+    }
+    if (capture_thread.joinable()) capture_thread.join();
+    for (auto &src : sources) if (src->thread.joinable()) src->thread.join();
+    screenshot_worker.stop();
+#ifdef HDMI_HAVE_MPP
+    stream_worker.stop();
+    mpp_stream_close(stream);
+    if (stream_fbo) { glDeleteFramebuffers(1, &stream_fbo); glDeleteRenderbuffers(1, &stream_rb); }
+    if (stream_readback_ok) readback_ring_release(stream_readback);
+#endif
+    config_watcher.stop();
+    metrics_exporter.stop();
+#ifdef HDMI_HAVE_EGL_DMABUF
+    dmabuf_forget(false);
+#endif
     if (texPattern) glDeleteTextures(1,&texPattern);
+    if (texRemap) glDeleteTextures(1,&texRemap);
+    if (texLayout) glDeleteTextures(1,&texLayout);
+    if (texColorLut) glDeleteTextures(1,&texColorLut);
+    if (texText) glDeleteTextures(1,&texText);
+    if (overlay_program) glDeleteProgram(overlay_program);
+    if (pbo_ok) pbo_ring_release(pbo);
+    if (readback_ok) readback_ring_release(readback);
+#ifndef HDMI_GLES
+    for (GpuTimer &t : gpu_timers) gpu_timer_release(t);
+#endif
+    for (GLsync f : headless_fences) if (f) glDeleteSync(f);
+    if (headless_fbo) { glBindFramebuffer(GL_FRAMEBUFFER, 0); glDeleteFramebuffers(1, &headless_fbo); glDeleteRenderbuffers(1, &headless_rb); }
+    glDeleteBuffers(1,&layoutUbo);
     glDeleteTextures(1,&texY); glDeleteTextures(1,&texUV);
+    for (size_t i = 1; i < sources.size(); ++i) {
+        if (sources[i]->texY) glDeleteTextures(1, &sources[i]->texY);
+        if (sources[i]->texUV) glDeleteTextures(1, &sources[i]->texUV);
+    }
     glDeleteBuffers(1,&vbo); glDeleteVertexArrays(1,&vao); glDeleteProgram(program);
-    SDL_GL_DeleteContext(glc); SDL_DestroyWindow(win); SDL_Quit();
-    for (auto &bufv : buffers) for (auto &pm : bufv) if (pm.addr && pm.length) munmap(pm.addr, pm.length);
-    close(fd);
+    if (tile_program) { glDeleteBuffers(1,&tile_corner_vbo); glDeleteBuffers(1,&tile_instance_vbo); glDeleteVertexArrays(1,&tile_vao); glDeleteProgram(tile_program); }
+    if (win) { SDL_GL_DeleteContext(glc); SDL_DestroyWindow(win); SDL_Quit(); }
+#ifdef HDMI_HAVE_KMS
+    kms_close(kms); // before the capture buffers its overlay framebuffers point at are unmapped
+#endif
+    unmap_buffers(buffers);
+#ifdef HDMI_HAVE_RGA
+    rga_buffers.clear();
+    rga_close(rga);
+#endif
+    replay_close(replay);
+    if (fd >= 0) close(fd);
+    for (size_t i = 1; i < sources.size(); ++i) {
+        unmap_buffers(sources[i]->buffers);
+        if (sources[i]->fd >= 0) close(sources[i]->fd);
+        close(sources[i]->handoff.capture_efd);
+    }
+    quit_signal_efd = -1;
+    loop.close_fds();
+    close(handoff.render_efd); close(handoff.capture_efd);
     vlogln("shutdown: normal exit");
     return 0;
 }
@@ -0,0 +1,17 @@
+// image_writer.h
+// Encoders for the screenshot worker: PNG (stb_image_write at low compression, fast), QOI and raw pixel
+// dumps. All take top-down rows of 3 (RGB) or 4 (RGBA) bytes per pixel.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+enum class ImageFormat { PNG, QOI, RAW };
+
+bool parse_image_format(const std::string &name, ImageFormat &out); // "png" | "qoi" | "raw"
+const char* image_file_extension(ImageFormat format, int channels); // "png", "qoi", "rgb"/"rgba"
+
+// 'stride' in bytes, 0 = width * channels. false (with errno set by stdio) if the file could not be written.
+bool write_image(const std::string &path, ImageFormat format, int width, int height, int channels,
+                 const uint8_t *pixels, size_t stride = 0);
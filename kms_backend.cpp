@@ -0,0 +1,510 @@
+// kms_backend.cpp
+// KMS/DRM atomic scanout for hdmi_simple_display (--output=kms), see kms_backend.h.
+
+#include "kms_backend.h"
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <iterator>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <linux/videodev2.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <drm_fourcc.h>
+#include <gbm.h>
+
+#ifndef EGL_NO_X11
+#define EGL_NO_X11
+#endif
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+static const int FLIP_WAIT_MS = 1000; // upper bound for a blocking wait on an outstanding flip
+
+struct PlaneProps {
+    uint32_t fb_id = 0, crtc_id = 0;
+    uint32_t src_x = 0, src_y = 0, src_w = 0, src_h = 0;
+    uint32_t crtc_x = 0, crtc_y = 0, crtc_w = 0, crtc_h = 0;
+    uint32_t color_encoding = 0, color_range = 0; // optional (YUV planes only)
+};
+
+// Framebuffer wrapping an exported capture buffer; keyed by the fd/offset of its first plane.
+struct CaptureFb {
+    int fd0 = -1; uint32_t offset0 = 0;
+    uint32_t width = 0, height = 0, fourcc = 0;
+    uint32_t fb_id = 0;
+    uint32_t handles[2] = {0, 0};
+};
+
+struct KmsOutput {
+    int fd = -1;
+    bool verbose = false;
+
+    uint32_t connector_id = 0, crtc_id = 0, crtc_index = 0;
+    uint32_t primary_plane = 0, overlay_plane = 0;
+    drmModeModeInfo mode;
+    uint32_t mode_blob = 0;
+    bool modeset_done = false;
+
+    uint32_t conn_crtc_id = 0;
+    uint32_t crtc_mode_id = 0, crtc_active = 0;
+    PlaneProps primary_props, overlay_props;
+    std::vector<uint32_t> overlay_formats;
+
+    gbm_device* gbm = nullptr;
+    gbm_surface* surface = nullptr;
+    EGLDisplay dpy = EGL_NO_DISPLAY;
+    EGLContext ctx = EGL_NO_CONTEXT;
+    EGLSurface egl_surface = EGL_NO_SURFACE;
+
+    // flip bookkeeping: what is on screen and what the outstanding commit will put there
+    bool flip_pending = false;
+    int64_t last_flip_us = 0; // vblank timestamp of the last flip event (DRM timestamps are CLOCK_MONOTONIC)
+    gbm_bo* bo_shown = nullptr;
+    gbm_bo* bo_pending = nullptr;
+    bool overlay_on = false;
+    bool overlay_changing = false;    // outstanding commit touches the overlay plane
+    int64_t cookie_shown = -1, cookie_pending = -1;
+    std::vector<int64_t> released;
+
+    std::vector<CaptureFb> capture_fbs;
+};
+
+static void klog(const KmsOutput* k, const std::string &s) { if (k->verbose) std::cerr << "kms: " << s << std::endl; }
+
+static uint32_t find_prop(int fd, uint32_t obj, uint32_t type, const char* name, uint64_t* value = nullptr) {
+    drmModeObjectProperties* props = drmModeObjectGetProperties(fd, obj, type);
+    if (!props) return 0;
+    uint32_t id = 0;
+    for (uint32_t i = 0; i < props->count_props && !id; ++i) {
+        drmModePropertyRes* p = drmModeGetProperty(fd, props->props[i]);
+        if (!p) continue;
+        if (strcmp(p->name, name) == 0) { id = p->prop_id; if (value) *value = props->prop_values[i]; }
+        drmModeFreeProperty(p);
+    }
+    drmModeFreeObjectProperties(props);
+    return id;
+}
+
+static bool plane_props(int fd, uint32_t plane, PlaneProps &pp) {
+    pp.fb_id = find_prop(fd, plane, DRM_MODE_OBJECT_PLANE, "FB_ID");
+    pp.crtc_id = find_prop(fd, plane, DRM_MODE_OBJECT_PLANE, "CRTC_ID");
+    pp.src_x = find_prop(fd, plane, DRM_MODE_OBJECT_PLANE, "SRC_X");
+    pp.src_y = find_prop(fd, plane, DRM_MODE_OBJECT_PLANE, "SRC_Y");
+    pp.src_w = find_prop(fd, plane, DRM_MODE_OBJECT_PLANE, "SRC_W");
+    pp.src_h = find_prop(fd, plane, DRM_MODE_OBJECT_PLANE, "SRC_H");
+    pp.crtc_x = find_prop(fd, plane, DRM_MODE_OBJECT_PLANE, "CRTC_X");
+    pp.crtc_y = find_prop(fd, plane, DRM_MODE_OBJECT_PLANE, "CRTC_Y");
+    pp.crtc_w = find_prop(fd, plane, DRM_MODE_OBJECT_PLANE, "CRTC_W");
+    pp.crtc_h = find_prop(fd, plane, DRM_MODE_OBJECT_PLANE, "CRTC_H");
+    pp.color_encoding = find_prop(fd, plane, DRM_MODE_OBJECT_PLANE, "COLOR_ENCODING");
+    pp.color_range = find_prop(fd, plane, DRM_MODE_OBJECT_PLANE, "COLOR_RANGE");
+    return pp.fb_id && pp.crtc_id && pp.src_x && pp.src_y && pp.src_w && pp.src_h && pp.crtc_x && pp.crtc_y && pp.crtc_w && pp.crtc_h;
+}
+
+// value of the enum entry 'name' of property 'prop' (false if the driver does not offer it)
+static bool enum_value(int fd, uint32_t prop, const char* name, uint64_t &value) {
+    drmModePropertyRes* p = prop ? drmModeGetProperty(fd, prop) : nullptr;
+    if (!p) return false;
+    bool found = false;
+    for (int i = 0; i < p->count_enums && !found; ++i)
+        if (strcmp(p->enums[i].name, name) == 0) { value = p->enums[i].value; found = true; }
+    drmModeFreeProperty(p);
+    return found;
+}
+
+static void add_plane(drmModeAtomicReq* req, uint32_t plane, const PlaneProps &pp, uint32_t crtc, uint32_t fb,
+                      uint32_t sx, uint32_t sy, uint32_t sw, uint32_t sh, int32_t dx, int32_t dy, uint32_t dw, uint32_t dh) {
+    drmModeAtomicAddProperty(req, plane, pp.fb_id, fb);
+    drmModeAtomicAddProperty(req, plane, pp.crtc_id, crtc);
+    drmModeAtomicAddProperty(req, plane, pp.src_x, (uint64_t)sx << 16);
+    drmModeAtomicAddProperty(req, plane, pp.src_y, (uint64_t)sy << 16);
+    drmModeAtomicAddProperty(req, plane, pp.src_w, (uint64_t)sw << 16);
+    drmModeAtomicAddProperty(req, plane, pp.src_h, (uint64_t)sh << 16);
+    drmModeAtomicAddProperty(req, plane, pp.crtc_x, (uint64_t)(int64_t)dx);
+    drmModeAtomicAddProperty(req, plane, pp.crtc_y, (uint64_t)(int64_t)dy);
+    drmModeAtomicAddProperty(req, plane, pp.crtc_w, dw);
+    drmModeAtomicAddProperty(req, plane, pp.crtc_h, dh);
+}
+
+static void add_plane_off(drmModeAtomicReq* req, uint32_t plane, const PlaneProps &pp) {
+    drmModeAtomicAddProperty(req, plane, pp.fb_id, 0);
+    drmModeAtomicAddProperty(req, plane, pp.crtc_id, 0);
+}
+
+static uint32_t drm_fourcc_for(uint32_t pixfmt) {
+    switch (pixfmt) {
+        case V4L2_PIX_FMT_NV12: return DRM_FORMAT_NV12;
+        case V4L2_PIX_FMT_NV21: return DRM_FORMAT_NV21;
+        case V4L2_PIX_FMT_NV16: return DRM_FORMAT_NV16;
+        case V4L2_PIX_FMT_NV61: return DRM_FORMAT_NV61;
+        case V4L2_PIX_FMT_NV24: return DRM_FORMAT_NV24;
+        case V4L2_PIX_FMT_NV42: return DRM_FORMAT_NV42;
+        case V4L2_PIX_FMT_YUYV: return DRM_FORMAT_YUYV;
+        case V4L2_PIX_FMT_UYVY: return DRM_FORMAT_UYVY;
+        default: return 0;
+    }
+}
+
+static void on_page_flip(int, unsigned int, unsigned int tv_sec, unsigned int tv_usec, void* data) {
+    KmsOutput* k = (KmsOutput*)data;
+    k->last_flip_us = (int64_t)tv_sec * 1000000 + tv_usec;
+    if (k->bo_pending) {
+        if (k->bo_shown) gbm_surface_release_buffer(k->surface, k->bo_shown);
+        k->bo_shown = k->bo_pending; k->bo_pending = nullptr;
+    }
+    if (k->overlay_changing) {
+        if (k->cookie_shown >= 0) k->released.push_back(k->cookie_shown);
+        k->cookie_shown = k->cookie_pending; k->cookie_pending = -1;
+        k->overlay_changing = false;
+    }
+    k->flip_pending = false;
+}
+
+static bool wait_flip(KmsOutput* k) {
+    for (int waited = 0; k->flip_pending && waited < FLIP_WAIT_MS; waited += 100) {
+        struct pollfd p; p.fd = k->fd; p.events = POLLIN; p.revents = 0;
+        int r = poll(&p, 1, 100);
+        if (r < 0 && errno != EINTR) break;
+        if (r > 0) kms_dispatch(k);
+    }
+    if (k->flip_pending) { klog(k, "page flip did not complete"); return false; }
+    return true;
+}
+
+// DRM framebuffer for a GBM front buffer; created once per bo and destroyed with it
+static void destroy_bo_fb(gbm_bo* bo, void* data) {
+    uint32_t fb = (uint32_t)(uintptr_t)data;
+    if (fb) drmModeRmFB(gbm_device_get_fd(gbm_bo_get_device(bo)), fb);
+}
+
+static uint32_t fb_for_bo(KmsOutput* k, gbm_bo* bo) {
+    uint32_t fb = (uint32_t)(uintptr_t)gbm_bo_get_user_data(bo);
+    if (fb) return fb;
+    uint32_t handles[4] = { gbm_bo_get_handle(bo).u32, 0, 0, 0 };
+    uint32_t pitches[4] = { gbm_bo_get_stride(bo), 0, 0, 0 };
+    uint32_t offsets[4] = { 0, 0, 0, 0 };
+    if (drmModeAddFB2(k->fd, gbm_bo_get_width(bo), gbm_bo_get_height(bo), GBM_FORMAT_XRGB8888, handles, pitches, offsets, &fb, 0) != 0) {
+        klog(k, std::string("drmModeAddFB2 (primary) failed: ") + strerror(errno));
+        return 0;
+    }
+    gbm_bo_set_user_data(bo, (void*)(uintptr_t)fb, destroy_bo_fb);
+    return fb;
+}
+
+static bool pick_output(KmsOutput* k) {
+    drmModeRes* res = drmModeGetResources(k->fd);
+    if (!res) { std::cerr << "kms: drmModeGetResources failed: " << strerror(errno) << "\n"; return false; }
+    drmModeConnector* conn = nullptr;
+    for (int i = 0; i < res->count_connectors && !conn; ++i) {
+        drmModeConnector* c = drmModeGetConnector(k->fd, res->connectors[i]);
+        if (c && c->connection == DRM_MODE_CONNECTED && c->count_modes > 0) conn = c;
+        else if (c) drmModeFreeConnector(c);
+    }
+    if (!conn) { std::cerr << "kms: no connected connector\n"; drmModeFreeResources(res); return false; }
+    k->connector_id = conn->connector_id;
+    k->mode = conn->modes[0];
+    for (int i = 0; i < conn->count_modes; ++i) if (conn->modes[i].type & DRM_MODE_TYPE_PREFERRED) { k->mode = conn->modes[i]; break; }
+
+    // keep the CRTC the connector is already driven by, otherwise the first one an encoder can reach
+    if (conn->encoder_id) {
+        drmModeEncoder* enc = drmModeGetEncoder(k->fd, conn->encoder_id);
+        if (enc) { k->crtc_id = enc->crtc_id; drmModeFreeEncoder(enc); }
+    }
+    for (int e = 0; e < conn->count_encoders && !k->crtc_id; ++e) {
+        drmModeEncoder* enc = drmModeGetEncoder(k->fd, conn->encoders[e]);
+        if (!enc) continue;
+        for (int c = 0; c < res->count_crtcs; ++c) if (enc->possible_crtcs & (1u << c)) { k->crtc_id = res->crtcs[c]; break; }
+        drmModeFreeEncoder(enc);
+    }
+    for (int c = 0; c < res->count_crtcs; ++c) if (res->crtcs[c] == k->crtc_id) k->crtc_index = (uint32_t)c;
+    drmModeFreeConnector(conn);
+    drmModeFreeResources(res);
+    if (!k->crtc_id) { std::cerr << "kms: no CRTC for connector " << k->connector_id << "\n"; return false; }
+    return true;
+}
+
+static bool pick_planes(KmsOutput* k) {
+    drmModePlaneRes* pres = drmModeGetPlaneResources(k->fd);
+    if (!pres) { std::cerr << "kms: drmModeGetPlaneResources failed\n"; return false; }
+    for (uint32_t i = 0; i < pres->count_planes; ++i) {
+        drmModePlane* p = drmModeGetPlane(k->fd, pres->planes[i]);
+        if (!p) continue;
+        uint64_t type = 0;
+        if ((p->possible_crtcs & (1u << k->crtc_index)) && find_prop(k->fd, p->plane_id, DRM_MODE_OBJECT_PLANE, "type", &type)) {
+            if (type == DRM_PLANE_TYPE_PRIMARY && !k->primary_plane) k->primary_plane = p->plane_id;
+            else if (type == DRM_PLANE_TYPE_OVERLAY) {
+                bool nv12 = std::find(p->formats, p->formats + p->count_formats, (uint32_t)DRM_FORMAT_NV12) != p->formats + p->count_formats;
+                // first overlay wins, one that takes NV12 is preferred
+                if (!k->overlay_plane || (nv12 && std::find(k->overlay_formats.begin(), k->overlay_formats.end(), (uint32_t)DRM_FORMAT_NV12) == k->overlay_formats.end())) {
+                    k->overlay_plane = p->plane_id;
+                    k->overlay_formats.assign(p->formats, p->formats + p->count_formats);
+                }
+            }
+        }
+        drmModeFreePlane(p);
+    }
+    drmModeFreePlaneResources(pres);
+    if (!k->primary_plane || !plane_props(k->fd, k->primary_plane, k->primary_props)) { std::cerr << "kms: no usable primary plane\n"; return false; }
+    if (k->overlay_plane && !plane_props(k->fd, k->overlay_plane, k->overlay_props)) { k->overlay_plane = 0; k->overlay_formats.clear(); }
+    klog(k, "primary plane " + std::to_string(k->primary_plane) + ", overlay plane " + (k->overlay_plane ? std::to_string(k->overlay_plane) : std::string("none")));
+    return true;
+}
+
+static bool init_egl(KmsOutput* k) {
+    k->gbm = gbm_create_device(k->fd);
+    if (!k->gbm) { std::cerr << "kms: gbm_create_device failed\n"; return false; }
+    k->surface = gbm_surface_create(k->gbm, k->mode.hdisplay, k->mode.vdisplay, GBM_FORMAT_XRGB8888, GBM_BO_USE_SCANOUT | GBM_BO_USE_RENDERING);
+    if (!k->surface) { std::cerr << "kms: gbm_surface_create failed\n"; return false; }
+
+    auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay) k->dpy = getPlatformDisplay(EGL_PLATFORM_GBM_KHR, k->gbm, nullptr);
+    if (k->dpy == EGL_NO_DISPLAY) k->dpy = eglGetDisplay((EGLNativeDisplayType)k->gbm);
+    EGLint major = 0, minor = 0;
+    if (k->dpy == EGL_NO_DISPLAY || !eglInitialize(k->dpy, &major, &minor)) { std::cerr << "kms: eglInitialize failed\n"; return false; }
+#ifdef HDMI_GLES
+    if (!eglBindAPI(EGL_OPENGL_ES_API)) { std::cerr << "kms: EGL has no OpenGL ES\n"; return false; }
+    const EGLint renderable = EGL_OPENGL_ES3_BIT_KHR;
+#else
+    if (!eglBindAPI(EGL_OPENGL_API)) { std::cerr << "kms: EGL has no desktop OpenGL\n"; return false; }
+    const EGLint renderable = EGL_OPENGL_BIT;
+#endif
+
+    const EGLint cfgAttr[] = { EGL_SURFACE_TYPE, EGL_WINDOW_BIT, EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+                               EGL_ALPHA_SIZE, 0, EGL_RENDERABLE_TYPE, renderable, EGL_NONE };
+    EGLint n = 0;
+    if (!eglChooseConfig(k->dpy, cfgAttr, nullptr, 0, &n) || n <= 0) { std::cerr << "kms: no EGL config\n"; return false; }
+    std::vector<EGLConfig> configs((size_t)n);
+    eglChooseConfig(k->dpy, cfgAttr, configs.data(), n, &n);
+    EGLConfig cfg = nullptr;
+    for (EGLint i = 0; i < n && !cfg; ++i) {
+        EGLint id = 0;
+        if (eglGetConfigAttrib(k->dpy, configs[i], EGL_NATIVE_VISUAL_ID, &id) && (uint32_t)id == GBM_FORMAT_XRGB8888) cfg = configs[i];
+    }
+    if (!cfg) { std::cerr << "kms: no EGL config matching XRGB8888\n"; return false; }
+
+    const EGLint ctxAttr[] = { EGL_CONTEXT_MAJOR_VERSION_KHR, 3, EGL_CONTEXT_MINOR_VERSION_KHR, 0, EGL_NONE };
+    k->ctx = eglCreateContext(k->dpy, cfg, EGL_NO_CONTEXT, ctxAttr);
+    if (k->ctx == EGL_NO_CONTEXT) { std::cerr << "kms: eglCreateContext failed\n"; return false; }
+    k->egl_surface = eglCreateWindowSurface(k->dpy, cfg, (EGLNativeWindowType)(uintptr_t)k->surface, nullptr);
+    if (k->egl_surface == EGL_NO_SURFACE) { std::cerr << "kms: eglCreateWindowSurface failed\n"; return false; }
+    if (!eglMakeCurrent(k->dpy, k->egl_surface, k->egl_surface, k->ctx)) { std::cerr << "kms: eglMakeCurrent failed\n"; return false; }
+    klog(k, "EGL " + std::to_string(major) + "." + std::to_string(minor) + " context on GBM surface");
+    return true;
+}
+
+KmsOutput* kms_open(const char* card, bool verbose) {
+    KmsOutput* k = new KmsOutput();
+    k->verbose = verbose;
+    k->fd = open(card, O_RDWR | O_CLOEXEC);
+    if (k->fd < 0) { std::cerr << "kms: open " << card << ": " << strerror(errno) << "\n"; kms_close(k); return nullptr; }
+    if (drmSetClientCap(k->fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1) != 0 || drmSetClientCap(k->fd, DRM_CLIENT_CAP_ATOMIC, 1) != 0) {
+        std::cerr << "kms: " << card << " does not support atomic modesetting\n"; kms_close(k); return nullptr;
+    }
+    if (!pick_output(k) || !pick_planes(k)) { kms_close(k); return nullptr; }
+
+    k->conn_crtc_id = find_prop(k->fd, k->connector_id, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID");
+    k->crtc_mode_id = find_prop(k->fd, k->crtc_id, DRM_MODE_OBJECT_CRTC, "MODE_ID");
+    k->crtc_active = find_prop(k->fd, k->crtc_id, DRM_MODE_OBJECT_CRTC, "ACTIVE");
+    if (!k->conn_crtc_id || !k->crtc_mode_id || !k->crtc_active) { std::cerr << "kms: missing connector/CRTC properties\n"; kms_close(k); return nullptr; }
+    if (drmModeCreatePropertyBlob(k->fd, &k->mode, sizeof(k->mode), &k->mode_blob) != 0) { std::cerr << "kms: mode blob failed\n"; kms_close(k); return nullptr; }
+    klog(k, std::string("connector ") + std::to_string(k->connector_id) + ", crtc " + std::to_string(k->crtc_id) + ", mode " + k->mode.name +
+            " @" + std::to_string(k->mode.vrefresh) + "Hz");
+
+    if (!init_egl(k)) { kms_close(k); return nullptr; }
+    return k;
+}
+
+void kms_close(KmsOutput* k) {
+    if (!k) return;
+    if (k->fd >= 0) {
+        kms_forget_framebuffers(k);
+        wait_flip(k);
+    }
+    if (k->dpy != EGL_NO_DISPLAY) {
+        eglMakeCurrent(k->dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (k->egl_surface != EGL_NO_SURFACE) eglDestroySurface(k->dpy, k->egl_surface);
+        if (k->ctx != EGL_NO_CONTEXT) eglDestroyContext(k->dpy, k->ctx);
+        eglTerminate(k->dpy);
+    }
+    if (k->surface) {
+        if (k->bo_pending) gbm_surface_release_buffer(k->surface, k->bo_pending);
+        if (k->bo_shown) gbm_surface_release_buffer(k->surface, k->bo_shown);
+        gbm_surface_destroy(k->surface);
+    }
+    if (k->gbm) gbm_device_destroy(k->gbm);
+    if (k->mode_blob) drmModeDestroyPropertyBlob(k->fd, k->mode_blob);
+    if (k->fd >= 0) close(k->fd);
+    delete k;
+}
+
+int kms_width(const KmsOutput* k) { return k->mode.hdisplay; }
+int kms_height(const KmsOutput* k) { return k->mode.vdisplay; }
+int kms_fd(const KmsOutput* k) { return k->fd; }
+bool kms_flip_pending(const KmsOutput* k) { return k->flip_pending; }
+bool kms_mode_set(const KmsOutput* k) { return k->modeset_done; }
+bool kms_overlay_active(const KmsOutput* k) { return k->overlay_on; }
+int64_t kms_last_flip_us(const KmsOutput* k) { return k->last_flip_us; }
+
+double kms_refresh_hz(const KmsOutput* k) {
+    // exact rate from the timings (vrefresh is rounded, 59.94 Hz modes report 60)
+    if (k->mode.htotal && k->mode.vtotal) {
+        double hz = k->mode.clock * 1000.0 / ((double)k->mode.htotal * k->mode.vtotal);
+        if (k->mode.flags & DRM_MODE_FLAG_INTERLACE) hz *= 2;
+        if (k->mode.flags & DRM_MODE_FLAG_DBLSCAN) hz /= 2;
+        if (k->mode.vscan > 1) hz /= k->mode.vscan;
+        return hz;
+    }
+    return k->mode.vrefresh;
+}
+
+void kms_dispatch(KmsOutput* k) {
+    drmEventContext ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.version = 2;
+    ev.page_flip_handler = on_page_flip;
+    drmHandleEvent(k->fd, &ev);
+}
+
+bool kms_present(KmsOutput* k) {
+    if (k->flip_pending) return false;
+    if (!eglSwapBuffers(k->dpy, k->egl_surface)) { klog(k, "eglSwapBuffers failed"); return false; }
+    gbm_bo* bo = gbm_surface_lock_front_buffer(k->surface);
+    if (!bo) { klog(k, "gbm_surface_lock_front_buffer failed"); return false; }
+    uint32_t fb = fb_for_bo(k, bo);
+    if (!fb) { gbm_surface_release_buffer(k->surface, bo); return false; }
+
+    drmModeAtomicReq* req = drmModeAtomicAlloc();
+    uint32_t flags = DRM_MODE_PAGE_FLIP_EVENT;
+    if (!k->modeset_done) {
+        drmModeAtomicAddProperty(req, k->connector_id, k->conn_crtc_id, k->crtc_id);
+        drmModeAtomicAddProperty(req, k->crtc_id, k->crtc_mode_id, k->mode_blob);
+        drmModeAtomicAddProperty(req, k->crtc_id, k->crtc_active, 1);
+        flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+    } else flags |= DRM_MODE_ATOMIC_NONBLOCK;
+    add_plane(req, k->primary_plane, k->primary_props, k->crtc_id, fb, 0, 0, k->mode.hdisplay, k->mode.vdisplay, 0, 0, k->mode.hdisplay, k->mode.vdisplay);
+    if (k->overlay_on) add_plane_off(req, k->overlay_plane, k->overlay_props);
+    int r = drmModeAtomicCommit(k->fd, req, flags, k);
+    drmModeAtomicFree(req);
+    if (r != 0) {
+        klog(k, std::string("atomic commit (primary) failed: ") + strerror(errno));
+        gbm_surface_release_buffer(k->surface, bo);
+        return false;
+    }
+    if (!k->modeset_done) { k->modeset_done = true; klog(k, "modeset done"); }
+    k->bo_pending = bo;
+    if (k->overlay_on) { k->overlay_on = false; k->overlay_changing = true; k->cookie_pending = -1; }
+    k->flip_pending = true;
+    return true;
+}
+
+bool kms_overlay_supported(const KmsOutput* k, uint32_t v4l2_pixfmt) {
+    uint32_t fourcc = drm_fourcc_for(v4l2_pixfmt);
+    return k->overlay_plane && fourcc && std::find(k->overlay_formats.begin(), k->overlay_formats.end(), fourcc) != k->overlay_formats.end();
+}
+
+// packed 4:2:2 is one plane, the semi-planar formats two
+static unsigned drm_plane_count(uint32_t fourcc) {
+    return (fourcc == DRM_FORMAT_YUYV || fourcc == DRM_FORMAT_UYVY) ? 1 : 2;
+}
+
+// prime imports of the same buffer share one GEM handle: close each once, and none that a framebuffer
+// still in capture_fbs uses
+static void close_gem_handles(KmsOutput* k, std::vector<uint32_t> handles) {
+    std::sort(handles.begin(), handles.end());
+    handles.erase(std::unique(handles.begin(), handles.end()), handles.end());
+    for (uint32_t h : handles) {
+        bool used = h == 0;
+        for (auto &c : k->capture_fbs) used = used || std::find(std::begin(c.handles), std::end(c.handles), h) != std::end(c.handles);
+        if (used) continue;
+        struct drm_gem_close gc; memset(&gc, 0, sizeof(gc)); gc.handle = h;
+        drmIoctl(k->fd, DRM_IOCTL_GEM_CLOSE, &gc);
+    }
+}
+
+static uint32_t capture_fb(KmsOutput* k, const KmsScanoutFrame &f, uint32_t fourcc) {
+    for (auto &c : k->capture_fbs)
+        if (c.fd0 == f.planes[0].fd && c.offset0 == f.planes[0].offset && c.width == f.width && c.height == f.height && c.fourcc == fourcc) return c.fb_id;
+    CaptureFb c; c.fd0 = f.planes[0].fd; c.offset0 = f.planes[0].offset; c.width = f.width; c.height = f.height; c.fourcc = fourcc;
+    uint32_t handles[4] = {0, 0, 0, 0}, pitches[4] = {0, 0, 0, 0}, offsets[4] = {0, 0, 0, 0};
+    for (unsigned p = 0; p < drm_plane_count(fourcc); ++p) {
+        if (drmPrimeFDToHandle(k->fd, f.planes[p].fd, &handles[p]) != 0) {
+            klog(k, std::string("drmPrimeFDToHandle failed: ") + strerror(errno));
+            close_gem_handles(k, std::vector<uint32_t>(handles, handles + p));
+            return 0;
+        }
+        c.handles[p] = handles[p];
+        pitches[p] = f.planes[p].pitch; offsets[p] = f.planes[p].offset;
+    }
+    if (drmModeAddFB2(k->fd, f.width, f.height, fourcc, handles, pitches, offsets, &c.fb_id, 0) != 0) {
+        klog(k, std::string("drmModeAddFB2 (capture buffer) failed: ") + strerror(errno));
+        close_gem_handles(k, std::vector<uint32_t>(handles, handles + drm_plane_count(fourcc)));
+        return 0;
+    }
+    k->capture_fbs.push_back(c);
+    return c.fb_id;
+}
+
+bool kms_overlay_present(KmsOutput* k, const KmsScanoutFrame& frame, int64_t cookie) {
+    uint32_t fourcc = drm_fourcc_for(frame.v4l2_pixfmt);
+    if (!k->modeset_done || k->flip_pending || !k->overlay_plane || !kms_overlay_supported(k, frame.v4l2_pixfmt)) return false;
+    if (frame.planes[0].fd < 0 || (drm_plane_count(fourcc) > 1 && frame.planes[1].fd < 0) || frame.src_w == 0 || frame.src_h == 0) return false;
+    uint32_t fb = capture_fb(k, frame, fourcc);
+    if (!fb) return false;
+
+    // letterbox the source rectangle into the mode, keeping its aspect ratio
+    uint32_t W = k->mode.hdisplay, H = k->mode.vdisplay;
+    uint32_t dw = W, dh = (uint32_t)((uint64_t)frame.src_h * W / frame.src_w);
+    if (dh > H) { dh = H; dw = (uint32_t)((uint64_t)frame.src_w * H / frame.src_h); }
+    drmModeAtomicReq* req = drmModeAtomicAlloc();
+    add_plane(req, k->overlay_plane, k->overlay_props, k->crtc_id, fb, frame.src_x, frame.src_y, frame.src_w, frame.src_h,
+              (int32_t)((W - dw) / 2), (int32_t)((H - dh) / 2), dw, dh);
+    uint64_t v = 0;
+    if (enum_value(k->fd, k->overlay_props.color_encoding, frame.bt709 ? "ITU-R BT.709 YCbCr" : "ITU-R BT.601 YCbCr", v))
+        drmModeAtomicAddProperty(req, k->overlay_plane, k->overlay_props.color_encoding, v);
+    if (enum_value(k->fd, k->overlay_props.color_range, frame.full_range ? "YCbCr full range" : "YCbCr limited range", v))
+        drmModeAtomicAddProperty(req, k->overlay_plane, k->overlay_props.color_range, v);
+    int r = drmModeAtomicCommit(k->fd, req, DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_ATOMIC_NONBLOCK, k);
+    drmModeAtomicFree(req);
+    if (r != 0) { klog(k, std::string("atomic commit (overlay) failed: ") + strerror(errno)); return false; }
+    k->overlay_on = true; k->overlay_changing = true; k->cookie_pending = cookie;
+    k->flip_pending = true;
+    return true;
+}
+
+void kms_overlay_disable(KmsOutput* k) {
+    wait_flip(k);
+    if (!k->overlay_on) return;
+    drmModeAtomicReq* req = drmModeAtomicAlloc();
+    add_plane_off(req, k->overlay_plane, k->overlay_props);
+    if (drmModeAtomicCommit(k->fd, req, 0, nullptr) != 0) klog(k, std::string("atomic commit (overlay off) failed: ") + strerror(errno));
+    drmModeAtomicFree(req);
+    k->overlay_on = false;
+    if (k->cookie_shown >= 0) k->released.push_back(k->cookie_shown);
+    k->cookie_shown = -1;
+}
+
+void kms_forget_framebuffers(KmsOutput* k) {
+    kms_overlay_disable(k);
+    std::vector<uint32_t> handles;
+    for (auto &c : k->capture_fbs) {
+        if (c.fb_id) drmModeRmFB(k->fd, c.fb_id);
+        handles.insert(handles.end(), std::begin(c.handles), std::end(c.handles));
+    }
+    k->capture_fbs.clear();
+    close_gem_handles(k, handles);
+}
+
+bool kms_take_released(KmsOutput* k, int64_t& cookie) {
+    if (k->released.empty()) return false;
+    cookie = k->released.front();
+    k->released.erase(k->released.begin());
+    return true;
+}
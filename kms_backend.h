@@ -0,0 +1,62 @@
+// kms_backend.h
+// Direct KMS/DRM output without SDL/X: atomic modesetting on the first connected connector, an EGL
+// context rendering into a GBM surface on the primary plane, and optionally the captured YUV buffer
+// scanned out unchanged on a hardware overlay plane. Every commit requests a page-flip event; at most
+// one commit is in flight and the next frame is only presented once kms_dispatch() has seen the flip.
+//
+// Only built with HDMI_ENABLE_KMS (libdrm + gbm + EGL), see CMakeLists.txt.
+#pragma once
+
+#include <cstdint>
+
+struct KmsOutput; // opaque: DRM fd, GBM/EGL objects, plane state
+
+// One plane of a capture buffer exported with VIDIOC_EXPBUF.
+struct KmsPlaneBuffer {
+    int fd = -1;
+    uint32_t offset = 0;
+    uint32_t pitch = 0;
+};
+
+// Capture buffer described for scanout: luma and chroma plane (the same fd for single-plane buffers,
+// planes[1] unused for packed YUYV/UYVY); src_* select the visible part (e.g. the active segment).
+struct KmsScanoutFrame {
+    uint32_t width = 0, height = 0;
+    uint32_t v4l2_pixfmt = 0;
+    KmsPlaneBuffer planes[2];
+    uint32_t src_x = 0, src_y = 0, src_w = 0, src_h = 0;
+    bool bt709 = true, full_range = false; // YCbCr->RGB the plane applies (--matrix / --range)
+};
+
+// Opens 'card' (e.g. /dev/dri/card0), picks connector/CRTC/mode and makes an EGL context current on a
+// GBM surface of the mode's size, with the same API as the SDL path (desktop GL 3.0, or GLES 3.0 with
+// HDMI_USE_GLES). nullptr on failure (reason on stderr).
+KmsOutput* kms_open(const char* card, bool verbose);
+void kms_close(KmsOutput* k);
+
+int kms_width(const KmsOutput* k);
+int kms_height(const KmsOutput* k);
+int kms_fd(const KmsOutput* k);           // POLLIN -> kms_dispatch()
+
+void kms_dispatch(KmsOutput* k);          // handle page-flip events
+bool kms_flip_pending(const KmsOutput* k);
+bool kms_mode_set(const KmsOutput* k);   // first kms_present() has done the modeset
+double kms_refresh_hz(const KmsOutput* k);
+int64_t kms_last_flip_us(const KmsOutput* k); // CLOCK_MONOTONIC vblank of the last completed flip, 0 = none yet
+
+// eglSwapBuffers + nonblocking atomic commit of the new GBM front buffer (the first one does the modeset).
+// Must not be called while a flip is pending. Disables the overlay plane if it was in use.
+bool kms_present(KmsOutput* k);
+
+// Scanout of a capture buffer on the overlay plane, letterboxed to the screen. 'cookie' identifies the
+// buffer; it is handed back through kms_take_released() once the next flip has replaced it.
+// false if there is no suitable plane/format, no mode set yet, a flip is pending or the commit failed.
+bool kms_overlay_supported(const KmsOutput* k, uint32_t v4l2_pixfmt);
+bool kms_overlay_present(KmsOutput* k, const KmsScanoutFrame& frame, int64_t cookie);
+bool kms_overlay_active(const KmsOutput* k);
+// blocking: waits for a pending flip, turns the overlay plane off and releases its buffer
+void kms_overlay_disable(KmsOutput* k);
+// drop the framebuffers created for capture buffers (call before they are unmapped/reallocated)
+void kms_forget_framebuffers(KmsOutput* k);
+
+bool kms_take_released(KmsOutput* k, int64_t& cookie);
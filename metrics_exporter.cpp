@@ -0,0 +1,218 @@
+// metrics_exporter.cpp
+// Prometheus exporter for the capture/render pipeline, see metrics_exporter.h.
+
+#include "metrics_exporter.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+const int64_t MetricsHistogram::BOUNDS_US[MetricsHistogram::BUCKETS] = {
+    500, 1000, 2000, 4000, 8000, 16000, 33000, 50000, 100000, 250000, 500000, 1000000
+};
+
+static const int IO_TIMEOUT_MS = 1000;
+static const size_t MAX_REQUEST = 4096;
+
+void MetricsHistogram::observe_us(int64_t us) {
+    if (us < 0) us = 0;
+    int i = 0;
+    while (i < BUCKETS && us > BOUNDS_US[i]) ++i;
+    bucket[i].fetch_add(1, std::memory_order_relaxed);
+    sum_us.fetch_add((uint64_t)us, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+}
+
+void PipelineMetrics::count_dqbuf_error(int err) {
+    int i = err == EINVAL ? DQBUF_EINVAL : err == EPIPE ? DQBUF_EPIPE : err == ENODEV ? DQBUF_ENODEV : err == EIO ? DQBUF_EIO : DQBUF_OTHER;
+    dqbuf_errors[i].fetch_add(1, std::memory_order_relaxed);
+}
+
+namespace {
+
+struct Writer {
+    std::string out;
+    void header(const char* name, const char* type, const char* help) {
+        out += "# HELP "; out += name; out += ' '; out += help; out += '\n';
+        out += "# TYPE "; out += name; out += ' '; out += type; out += '\n';
+    }
+    void sample(const char* name, const char* labels, double v) {
+        char buf[64]; snprintf(buf, sizeof(buf), "%.9g", v);
+        out += name;
+        if (labels && *labels) { out += '{'; out += labels; out += '}'; }
+        out += ' '; out += buf; out += '\n';
+    }
+    void metric(const char* name, const char* type, const char* help, double v) { header(name, type, help); sample(name, nullptr, v); }
+};
+
+uint64_t load(const std::atomic<uint64_t>& a) { return a.load(std::memory_order_relaxed); }
+
+} // namespace
+
+std::string metrics_render(const PipelineMetrics& m) {
+    Writer w;
+    w.metric("hdmi_frames_captured_total", "counter", "Frames dequeued from the capture device.", (double)load(m.frames_captured));
+    w.metric("hdmi_frames_presented_total", "counter", "Presents (swap or overlay commit) that showed a new frame.", (double)load(m.frames_presented));
+    w.metric("hdmi_frames_duplicated_total", "counter", "Presents that repeated the previous frame.", (double)load(m.frames_duplicated));
+
+    w.header("hdmi_frames_dropped_total", "counter", "Frames that were never shown, by reason.");
+    w.sample("hdmi_frames_dropped_total", "reason=\"source\"", (double)load(m.dropped_by_source));
+    w.sample("hdmi_frames_dropped_total", "reason=\"superseded\"", (double)load(m.superseded));
+    w.sample("hdmi_frames_dropped_total", "reason=\"stale\"", (double)load(m.stale));
+
+    static const char* const ERRNO_LABEL[DQBUF_ERROR_COUNT] = { "errno=\"EINVAL\"", "errno=\"EPIPE\"", "errno=\"ENODEV\"", "errno=\"EIO\"", "errno=\"other\"" };
+    w.header("hdmi_dqbuf_errors_total", "counter", "Failed VIDIOC_DQBUF calls, by errno.");
+    for (int i = 0; i < DQBUF_ERROR_COUNT; ++i) w.sample("hdmi_dqbuf_errors_total", ERRNO_LABEL[i], (double)load(m.dqbuf_errors[i]));
+
+    w.metric("hdmi_recoveries_total", "counter", "Finished stream recoveries (restart or reopen).", (double)load(m.recoveries));
+    w.metric("hdmi_recovery_seconds_total", "counter", "Time spent recovering, from signal loss to streaming again.", load(m.recovery_ms_total) / 1000.0);
+    w.metric("hdmi_last_recovery_seconds", "gauge", "Duration of the last finished recovery.", m.last_recovery_ms.load(std::memory_order_relaxed) / 1000.0);
+    w.metric("hdmi_recovering", "gauge", "Capture sources with a recovery in progress (1 with a single source).", m.recovering.load(std::memory_order_relaxed));
+    w.metric("hdmi_signal_lost", "gauge", "1 while the test pattern is shown because no frames arrive (source 0).", m.signal_lost.load(std::memory_order_relaxed));
+    w.metric("hdmi_capture_sources", "gauge", "Configured capture sources (--device and captureSource<N>).", m.capture_sources.load(std::memory_order_relaxed));
+    w.metric("hdmi_capture_sources_lost", "gauge", "Capture sources whose segments show the test pattern.", m.sources_lost.load(std::memory_order_relaxed));
+    w.metric("hdmi_startup_seconds", "gauge", "Time from process start to the first captured frame on screen, 0 until then.", m.startup_ms.load(std::memory_order_relaxed) / 1000.0);
+
+    static const char* const PRESENT_MODE[] = { "mode=\"vsync\"", "mode=\"immediate\"", "mode=\"adaptive\"", "mode=\"capture\"" };
+    int pm = m.present_mode.load(std::memory_order_relaxed);
+    w.header("hdmi_present_mode_info", "gauge", "Presentation mode (swap interval / capture-locked pacing).");
+    w.sample("hdmi_present_mode_info", pm >= 0 && pm < 4 ? PRESENT_MODE[pm] : "mode=\"\"", 1);
+    w.metric("hdmi_input_frame_period_seconds", "gauge", "Input frame period estimated from capture timestamps, 0 = unknown.", m.input_period_us.load(std::memory_order_relaxed) / 1e6);
+    w.metric("hdmi_refresh_period_seconds", "gauge", "Display refresh period estimated from vblanks, 0 = unknown.", m.refresh_period_us.load(std::memory_order_relaxed) / 1e6);
+    w.metric("hdmi_frames_held_total", "counter", "Frames the capture-locked pacer left in the slot because a newer one was due before the vblank.", (double)load(m.frames_held));
+    w.metric("hdmi_stream_frames_total", "counter", "Frames of the --stream monitoring output encoded and sent.", (double)load(m.stream_frames));
+    w.metric("hdmi_stream_bytes_total", "counter", "Encoded bytes of the --stream monitoring output.", (double)load(m.stream_bytes));
+    w.metric("hdmi_stream_dropped_total", "counter", "Stream frames skipped because the readback or the encoder was busy, or that failed to encode.", (double)load(m.stream_dropped));
+
+    uint32_t f = m.pixfmt.load(std::memory_order_relaxed);
+    w.metric("hdmi_capture_width", "gauge", "Current capture width in pixels.", m.width.load(std::memory_order_relaxed));
+    w.metric("hdmi_capture_height", "gauge", "Current capture height in pixels.", m.height.load(std::memory_order_relaxed));
+    char label[32];
+    snprintf(label, sizeof(label), "fourcc=\"%c%c%c%c\"", (char)(f & 0xFF), (char)((f >> 8) & 0xFF), (char)((f >> 16) & 0xFF), (char)((f >> 24) & 0xFF));
+    w.header("hdmi_capture_format_info", "gauge", "Current capture pixel format.");
+    w.sample("hdmi_capture_format_info", f ? label : "fourcc=\"\"", 1);
+
+    static const char* const STAGE[STAGE_COUNT] = { "driver", "upload", "present", "total", "gpu_upload", "gpu_draw" };
+    w.header("hdmi_latency_seconds", "histogram",
+             "Per-frame latency by stage: driver = capture timestamp to DQBUF, upload = DQBUF to upload done, "
+             "present = upload to swap, total = capture to swap, gpu_* = GL_TIME_ELAPSED (desktop GL only).");
+    for (int s = 0; s < STAGE_COUNT; ++s) {
+        const MetricsHistogram& h = m.latency[s];
+        uint64_t cumulative = 0;
+        char lb[96];
+        for (int i = 0; i <= MetricsHistogram::BUCKETS; ++i) {
+            cumulative += load(h.bucket[i]);
+            if (i < MetricsHistogram::BUCKETS) snprintf(lb, sizeof(lb), "stage=\"%s\",le=\"%g\"", STAGE[s], MetricsHistogram::BOUNDS_US[i] / 1e6);
+            else snprintf(lb, sizeof(lb), "stage=\"%s\",le=\"+Inf\"", STAGE[s]);
+            w.sample("hdmi_latency_seconds_bucket", lb, (double)cumulative);
+        }
+        snprintf(lb, sizeof(lb), "stage=\"%s\"", STAGE[s]);
+        w.sample("hdmi_latency_seconds_sum", lb, load(h.sum_us) / 1e6);
+        // the buckets are read one by one while frames come in; keep _count consistent with +Inf
+        w.sample("hdmi_latency_seconds_count", lb, (double)cumulative);
+    }
+    return w.out;
+}
+
+bool MetricsExporter::start(const std::string& listen, const PipelineMetrics* metrics, std::string& err) {
+    metrics_ = metrics;
+    if (listen.compare(0, 5, "unix:") == 0) {
+        std::string path = listen.substr(5);
+        struct sockaddr_un sa; memset(&sa, 0, sizeof(sa)); sa.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(sa.sun_path)) { err = "invalid socket path"; return false; }
+        memcpy(sa.sun_path, path.c_str(), path.size());
+        lfd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (lfd_ < 0) { err = std::string("socket: ") + strerror(errno); return false; }
+        unlink(path.c_str()); // left over from an earlier run
+        if (bind(lfd_, (struct sockaddr*)&sa, sizeof(sa)) != 0) { err = "bind " + path + ": " + strerror(errno); stop(); return false; }
+        unix_path_ = path;
+    } else {
+        std::string host, port = listen;
+        size_t colon = listen.rfind(':');
+        if (colon != std::string::npos) { host = listen.substr(0, colon); port = listen.substr(colon + 1); }
+        if (host.size() >= 2 && host.front() == '[' && host.back() == ']') host = host.substr(1, host.size() - 2);
+        struct addrinfo hints; memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC; hints.ai_socktype = SOCK_STREAM; hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+        struct addrinfo* res = nullptr;
+        int gai = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &res);
+        if (gai != 0) { err = "address " + listen + ": " + gai_strerror(gai); return false; }
+        for (struct addrinfo* ai = res; ai && lfd_ < 0; ai = ai->ai_next) {
+            lfd_ = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+            if (lfd_ < 0) continue;
+            int one = 1; setsockopt(lfd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            if (bind(lfd_, ai->ai_addr, ai->ai_addrlen) != 0) { err = "bind " + listen + ": " + strerror(errno); close(lfd_); lfd_ = -1; }
+        }
+        freeaddrinfo(res);
+        if (lfd_ < 0) { if (err.empty()) err = "no usable address for " + listen; return false; }
+    }
+    if (::listen(lfd_, 8) != 0) { err = std::string("listen: ") + strerror(errno); stop(); return false; }
+    efd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (efd_ < 0) { err = std::string("eventfd: ") + strerror(errno); stop(); return false; }
+    thread_ = std::thread([this]() { run(); });
+    return true;
+}
+
+void MetricsExporter::stop() {
+    if (thread_.joinable()) {
+        uint64_t one = 1; ssize_t r = write(efd_, &one, sizeof(one)); (void)r;
+        thread_.join();
+    }
+    if (lfd_ >= 0) close(lfd_);
+    if (efd_ >= 0) close(efd_);
+    lfd_ = efd_ = -1;
+    if (!unix_path_.empty()) { unlink(unix_path_.c_str()); unix_path_.clear(); }
+}
+
+void MetricsExporter::run() {
+    while (true) {
+        struct pollfd p[2];
+        p[0].fd = lfd_; p[0].events = POLLIN; p[0].revents = 0;
+        p[1].fd = efd_; p[1].events = POLLIN; p[1].revents = 0;
+        int ret = poll(p, 2, -1);
+        if (ret < 0) { if (errno == EINTR) continue; return; }
+        if (p[1].revents & POLLIN) return;
+        if (!(p[0].revents & POLLIN)) continue;
+        int cfd = accept4(lfd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (cfd < 0) continue;
+        serve(cfd);
+        close(cfd);
+    }
+}
+
+void MetricsExporter::serve(int cfd) {
+    struct timeval tv; tv.tv_sec = IO_TIMEOUT_MS / 1000; tv.tv_usec = (IO_TIMEOUT_MS % 1000) * 1000;
+    setsockopt(cfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(cfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    std::string req;
+    char buf[1024];
+    while (req.size() < MAX_REQUEST && req.find("\r\n\r\n") == std::string::npos && req.find("\n\n") == std::string::npos) {
+        ssize_t n = recv(cfd, buf, sizeof(buf), 0);
+        if (n <= 0) { if (n < 0 && errno == EINTR) continue; break; }
+        req.append(buf, (size_t)n);
+    }
+    std::string status = "200 OK", body;
+    size_t sp = req.find(' '), sp2 = sp == std::string::npos ? sp : req.find(' ', sp + 1);
+    std::string method = req.substr(0, sp), path = sp2 == std::string::npos ? std::string() : req.substr(sp + 1, sp2 - sp - 1);
+    path = path.substr(0, path.find('?'));
+    if (method != "GET" && method != "HEAD") { status = "405 Method Not Allowed"; body = "GET /metrics\n"; }
+    else if (path == "/metrics" || path == "/") body = metrics_render(*metrics_);
+    else { status = "404 Not Found"; body = "GET /metrics\n"; }
+    std::string resp = "HTTP/1.0 " + status + "\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\nContent-Length: " +
+                       std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n";
+    if (method != "HEAD") resp += body;
+    for (size_t off = 0; off < resp.size();) {
+        ssize_t n = send(cfd, resp.data() + off, resp.size() - off, MSG_NOSIGNAL);
+        if (n <= 0) { if (n < 0 && errno == EINTR) continue; break; }
+        off += (size_t)n;
+    }
+}
@@ -0,0 +1,72 @@
+// metrics_exporter.h
+// Pipeline health for fleet monitoring (--metrics): counters, gauges and latency histograms that the
+// capture and render threads update with relaxed atomics, served in the Prometheus text format by a
+// small HTTP server on its own thread (TCP or a UNIX socket). A scrape only reads atomics, so it never
+// waits for the pipeline and the pipeline never waits for a scrape.
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+// Latency distribution of one pipeline stage: microseconds in, Prometheus "le" buckets in seconds out.
+struct MetricsHistogram {
+    static const int BUCKETS = 12;
+    static const int64_t BOUNDS_US[BUCKETS];
+    std::atomic<uint64_t> bucket[BUCKETS + 1] = {}; // per bucket (not cumulative), last = above every bound
+    std::atomic<uint64_t> sum_us{0}, count{0};
+    void observe_us(int64_t us);
+};
+
+enum MetricsStage { STAGE_DRIVER, STAGE_UPLOAD, STAGE_PRESENT, STAGE_TOTAL, STAGE_GPU_UPLOAD, STAGE_GPU_DRAW, STAGE_COUNT };
+enum MetricsDqbufError { DQBUF_EINVAL, DQBUF_EPIPE, DQBUF_ENODEV, DQBUF_EIO, DQBUF_OTHER, DQBUF_ERROR_COUNT };
+
+struct PipelineMetrics {
+    // capture thread
+    std::atomic<uint64_t> frames_captured{0};
+    // frames the driver never delivered (sequence gaps), replaced in the handoff slot before the render
+    // thread took them, dequeued behind a newer one and requeued unseen (latency queue mode)
+    std::atomic<uint64_t> dropped_by_source{0}, superseded{0}, stale{0};
+    std::atomic<uint64_t> dqbuf_errors[DQBUF_ERROR_COUNT] = {};
+    std::atomic<uint64_t> recoveries{0}, recovery_ms_total{0}; // finished recoveries, time from loss to streaming again
+    std::atomic<int64_t> last_recovery_ms{0};
+    std::atomic<int> recovering{0}; // sources with a recovery in progress
+    std::atomic<int> capture_sources{1};
+    std::atomic<uint32_t> width{0}, height{0}, pixfmt{0};   // current capture format
+    // render thread
+    std::atomic<uint64_t> frames_presented{0};  // presents showing a new frame
+    std::atomic<uint64_t> frames_duplicated{0}; // presents repeating the previous one (redraws, pattern)
+    std::atomic<int> signal_lost{0};  // source 0 (--device)
+    std::atomic<int> sources_lost{0}; // capture sources whose segments show the test pattern
+    std::atomic<int64_t> startup_ms{0}; // process start to the first new frame on screen, 0 until then
+    std::atomic<int> present_mode{0};    // PresentMode of hdmi_simple_display.cpp (index into the exporter's names)
+    std::atomic<int64_t> input_period_us{0}, refresh_period_us{0}; // frame pacer estimates, 0 = unknown
+    std::atomic<uint64_t> frames_held{0}; // capture-locked pacing left a frame in the slot for a newer one
+    // --stream (encoder worker / render thread): frames sent, their encoded bytes, frames skipped or lost
+    std::atomic<uint64_t> stream_frames{0}, stream_bytes{0}, stream_dropped{0};
+    MetricsHistogram latency[STAGE_COUNT];
+
+    void count_dqbuf_error(int err);
+};
+
+// Prometheus text exposition format 0.0.4
+std::string metrics_render(const PipelineMetrics& m);
+
+// GET /metrics (or /) on 'listen': "PORT" (all interfaces), "HOST:PORT" or "unix:PATH". One connection
+// at a time, each with a short I/O timeout, so a stuck client cannot hold the thread for long.
+class MetricsExporter {
+public:
+    ~MetricsExporter() { stop(); }
+    bool start(const std::string& listen, const PipelineMetrics* metrics, std::string& err);
+    void stop();
+
+private:
+    void run();
+    void serve(int cfd);
+
+    const PipelineMetrics* metrics_ = nullptr;
+    int lfd_ = -1, efd_ = -1;
+    std::string unix_path_;
+    std::thread thread_;
+};
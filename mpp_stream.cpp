@@ -0,0 +1,238 @@
+// mpp_stream.cpp
+// MPP encoder and RTP sender for the --stream monitoring output, see mpp_stream.h.
+
+#include "mpp_stream.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <rockchip/rk_mpi.h>
+#include <rockchip/rk_venc_cfg.h>
+#include <rockchip/mpp_buffer.h>
+
+static const size_t RTP_HEADER = 12;
+static const size_t RTP_PAYLOAD_MAX = 1400; // stays below a 1500 byte MTU with IP/UDP headers
+static const int RTP_PAYLOAD_TYPE = 96;
+static const int NAL_FU_H264 = 28, NAL_FU_HEVC = 49;
+
+static int align16(int v) { return (v + 15) & ~15; }
+
+struct MppStream {
+    MppStreamConfig cfg;
+    bool verbose = false;
+    int fd = -1;
+    MppCtx ctx = nullptr;
+    MppApi* mpi = nullptr;
+    MppBufferGroup group = nullptr;
+    MppBuffer input = nullptr; // DMABUF the encoder reads, hor_stride x ver_stride
+    int hor_stride = 0, ver_stride = 0; // bytes per row (RGBA), rows
+    uint16_t seq = 0;
+    uint32_t ssrc = 0, ts_base = 0;
+    uint8_t packet[RTP_HEADER + RTP_PAYLOAD_MAX];
+    std::vector<std::pair<const uint8_t*, size_t>> nals;
+    std::string last_error; // failures are reported once each
+};
+
+static void slog(const MppStream* s, const std::string& msg) { if (s->verbose) std::cerr << "stream: " << msg << std::endl; }
+static void fail_once(MppStream* s, const std::string& why) {
+    if (why != s->last_error) { std::cerr << "stream: " << why << ", frame dropped" << std::endl; s->last_error = why; }
+}
+
+bool mpp_stream_parse_destination(const std::string& dest, MppStreamConfig& cfg) {
+    size_t colon = dest.rfind(':');
+    if (colon == std::string::npos || colon == 0 || colon + 1 >= dest.size()) return false;
+    std::string host = dest.substr(0, colon);
+    if (host.size() >= 2 && host.front() == '[' && host.back() == ']') host = host.substr(1, host.size() - 2);
+    if (host.empty()) return false;
+    cfg.host = host; cfg.port = dest.substr(colon + 1);
+    return true;
+}
+
+std::string mpp_stream_sdp(const MppStreamConfig& cfg) {
+    const char* ip = cfg.host.find(':') != std::string::npos ? "IP6" : "IP4";
+    std::string sdp;
+    sdp += "v=0\r\n";
+    sdp += std::string("o=- 0 0 IN ") + ip + " " + cfg.host + "\r\n";
+    sdp += "s=hdmi_simple_display\r\n";
+    sdp += std::string("c=IN ") + ip + " " + cfg.host + "\r\n";
+    sdp += "t=0 0\r\n";
+    sdp += "m=video " + cfg.port + " RTP/AVP " + std::to_string(RTP_PAYLOAD_TYPE) + "\r\n";
+    sdp += "a=rtpmap:" + std::to_string(RTP_PAYLOAD_TYPE) + (cfg.hevc ? " H265/90000\r\n" : " H264/90000\r\n");
+    if (!cfg.hevc) sdp += "a=fmtp:" + std::to_string(RTP_PAYLOAD_TYPE) + " packetization-mode=1\r\n";
+    sdp += "a=framerate:" + std::to_string(cfg.fps) + "\r\n";
+    return sdp;
+}
+
+static bool configure_encoder(MppStream* s) {
+    const MppStreamConfig& c = s->cfg;
+    MppEncCfg cfg = nullptr;
+    if (mpp_enc_cfg_init(&cfg) != MPP_OK) return false;
+    bool ok = s->mpi->control(s->ctx, MPP_ENC_GET_CFG, cfg) == MPP_OK;
+    const RK_S32 bps = c.bitrate_kbps * 1000;
+    mpp_enc_cfg_set_s32(cfg, "prep:width", c.width);
+    mpp_enc_cfg_set_s32(cfg, "prep:height", c.height);
+    mpp_enc_cfg_set_s32(cfg, "prep:hor_stride", s->hor_stride);
+    mpp_enc_cfg_set_s32(cfg, "prep:ver_stride", s->ver_stride);
+    mpp_enc_cfg_set_s32(cfg, "prep:format", MPP_FMT_RGBA8888); // bytes R,G,B,A as glReadPixels returns them
+    mpp_enc_cfg_set_s32(cfg, "rc:mode", MPP_ENC_RC_MODE_CBR);
+    mpp_enc_cfg_set_s32(cfg, "rc:bps_target", bps);
+    mpp_enc_cfg_set_s32(cfg, "rc:bps_max", bps / 16 * 17);
+    mpp_enc_cfg_set_s32(cfg, "rc:bps_min", bps / 16 * 15);
+    mpp_enc_cfg_set_s32(cfg, "rc:fps_in_flex", 0);
+    mpp_enc_cfg_set_s32(cfg, "rc:fps_in_num", c.fps);
+    mpp_enc_cfg_set_s32(cfg, "rc:fps_in_denom", 1);
+    mpp_enc_cfg_set_s32(cfg, "rc:fps_out_flex", 0);
+    mpp_enc_cfg_set_s32(cfg, "rc:fps_out_num", c.fps);
+    mpp_enc_cfg_set_s32(cfg, "rc:fps_out_denom", 1);
+    mpp_enc_cfg_set_s32(cfg, "rc:gop", c.fps * 2); // a receiver that joins late waits at most 2 s for an IDR
+    mpp_enc_cfg_set_s32(cfg, "codec:type", c.hevc ? MPP_VIDEO_CodingHEVC : MPP_VIDEO_CodingAVC);
+    if (!c.hevc) {
+        mpp_enc_cfg_set_s32(cfg, "h264:profile", 100);
+        mpp_enc_cfg_set_s32(cfg, "h264:level", 40);
+        mpp_enc_cfg_set_s32(cfg, "h264:cabac_en", 1);
+        mpp_enc_cfg_set_s32(cfg, "h264:cabac_idc", 0);
+        mpp_enc_cfg_set_s32(cfg, "h264:trans8x8", 1);
+    }
+    ok = ok && s->mpi->control(s->ctx, MPP_ENC_SET_CFG, cfg) == MPP_OK;
+    mpp_enc_cfg_deinit(cfg);
+    // parameter sets in front of every IDR, so there is nothing a receiver must have seen from the start
+    MppEncHeaderMode header = MPP_ENC_HEADER_MODE_EACH_IDR;
+    ok = ok && s->mpi->control(s->ctx, MPP_ENC_SET_HEADER_MODE, &header) == MPP_OK;
+    return ok;
+}
+
+MppStream* mpp_stream_open(const MppStreamConfig& cfg, bool verbose) {
+    MppStream* s = new MppStream();
+    s->cfg = cfg; s->verbose = verbose;
+    std::random_device rd;
+    s->ssrc = rd(); s->ts_base = rd(); s->seq = (uint16_t)rd();
+
+    struct addrinfo hints; memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC; hints.ai_socktype = SOCK_DGRAM; hints.ai_flags = AI_NUMERICSERV;
+    struct addrinfo* res = nullptr;
+    int gai = getaddrinfo(cfg.host.c_str(), cfg.port.c_str(), &hints, &res);
+    if (gai != 0) { std::cerr << "stream: " << cfg.host << ":" << cfg.port << ": " << gai_strerror(gai) << std::endl; mpp_stream_close(s); return nullptr; }
+    for (struct addrinfo* ai = res; ai && s->fd < 0; ai = ai->ai_next) {
+        s->fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (s->fd >= 0 && connect(s->fd, ai->ai_addr, ai->ai_addrlen) != 0) { close(s->fd); s->fd = -1; }
+    }
+    freeaddrinfo(res);
+    if (s->fd < 0) { std::cerr << "stream: no usable address for " << cfg.host << ":" << cfg.port << std::endl; mpp_stream_close(s); return nullptr; }
+
+    s->hor_stride = align16(cfg.width) * 4; s->ver_stride = align16(cfg.height);
+    if (mpp_create(&s->ctx, &s->mpi) != MPP_OK || !s->ctx) { std::cerr << "stream: mpp_create failed" << std::endl; s->ctx = nullptr; mpp_stream_close(s); return nullptr; }
+    if (mpp_init(s->ctx, MPP_CTX_ENC, cfg.hevc ? MPP_VIDEO_CodingHEVC : MPP_VIDEO_CodingAVC) != MPP_OK) {
+        std::cerr << "stream: no " << (cfg.hevc ? "H.265" : "H.264") << " encoder (mpp_init)" << std::endl; mpp_stream_close(s); return nullptr;
+    }
+    MppPollType block = MPP_POLL_BLOCK;
+    s->mpi->control(s->ctx, MPP_SET_OUTPUT_TIMEOUT, &block);
+    if (!configure_encoder(s)) { std::cerr << "stream: the encoder rejected " << cfg.width << "x" << cfg.height << "@" << cfg.fps << std::endl; mpp_stream_close(s); return nullptr; }
+    if (mpp_buffer_group_get_internal(&s->group, MPP_BUFFER_TYPE_DRM) != MPP_OK ||
+        mpp_buffer_get(s->group, &s->input, (size_t)s->hor_stride * s->ver_stride) != MPP_OK) {
+        std::cerr << "stream: allocating the encoder input buffer failed" << std::endl; s->input = nullptr; mpp_stream_close(s); return nullptr;
+    }
+    slog(s, std::string(cfg.hevc ? "H.265 " : "H.264 ") + std::to_string(cfg.width) + "x" + std::to_string(cfg.height) + "@" +
+            std::to_string(cfg.fps) + " " + std::to_string(cfg.bitrate_kbps) + " kbit/s -> rtp://" + cfg.host + ":" + cfg.port);
+    return s;
+}
+
+void mpp_stream_close(MppStream* s) {
+    if (!s) return;
+    if (s->ctx) { s->mpi->reset(s->ctx); mpp_destroy(s->ctx); }
+    if (s->input) mpp_buffer_put(s->input);
+    if (s->group) mpp_buffer_group_put(s->group);
+    if (s->fd >= 0) close(s->fd);
+    delete s;
+}
+
+// One RTP packet: payload header(s) 'head' then 'len' bytes of 'data'. A receiver that is not there
+// (ECONNREFUSED from an earlier ICMP) or a full socket buffer drops the packet, nothing waits.
+static bool rtp_send(MppStream* s, const uint8_t* head, size_t head_len, const uint8_t* data, size_t len, bool marker, uint32_t ts) {
+    uint8_t* b = s->packet;
+    b[0] = 0x80; // version 2, no padding / extension / CSRC
+    b[1] = (uint8_t)((marker ? 0x80 : 0) | RTP_PAYLOAD_TYPE);
+    b[2] = (uint8_t)(s->seq >> 8); b[3] = (uint8_t)s->seq; ++s->seq;
+    for (int i = 0; i < 4; ++i) { b[4 + i] = (uint8_t)(ts >> (24 - 8 * i)); b[8 + i] = (uint8_t)(s->ssrc >> (24 - 8 * i)); }
+    memcpy(b + RTP_HEADER, head, head_len);
+    memcpy(b + RTP_HEADER + head_len, data, len);
+    if (send(s->fd, b, RTP_HEADER + head_len + len, MSG_DONTWAIT | MSG_NOSIGNAL) >= 0) return true;
+    if (errno != ECONNREFUSED && errno != EAGAIN && errno != EWOULDBLOCK) fail_once(s, std::string("send: ") + strerror(errno));
+    return false;
+}
+
+// A NAL unit as one packet, or split into fragmentation units (H.264 FU-A, H.265 FU) when it is too large.
+static void send_nal(MppStream* s, const uint8_t* nal, size_t len, bool last, uint32_t ts) {
+    if (len <= RTP_PAYLOAD_MAX) { rtp_send(s, nullptr, 0, nal, len, last, ts); return; }
+    uint8_t fu[3]; size_t fu_len, nal_header;
+    uint8_t type;
+    if (s->cfg.hevc) {
+        fu[0] = (uint8_t)((nal[0] & 0x81) | (NAL_FU_HEVC << 1)); fu[1] = nal[1];
+        type = (uint8_t)((nal[0] >> 1) & 0x3F); fu_len = 3; nal_header = 2;
+    } else {
+        fu[0] = (uint8_t)((nal[0] & 0xE0) | NAL_FU_H264);
+        type = (uint8_t)(nal[0] & 0x1F); fu_len = 2; nal_header = 1;
+    }
+    const uint8_t* p = nal + nal_header;
+    size_t left = len - nal_header;
+    for (bool first = true; left > 0; first = false) {
+        size_t chunk = std::min(left, RTP_PAYLOAD_MAX - fu_len);
+        bool end = chunk == left;
+        fu[fu_len - 1] = (uint8_t)((first ? 0x80 : 0) | (end ? 0x40 : 0) | type);
+        rtp_send(s, fu, fu_len, p, chunk, last && end, ts);
+        p += chunk; left -= chunk;
+    }
+}
+
+// NAL units of an Annex B bitstream, start codes and trailing zero bytes stripped
+static void split_annexb(const uint8_t* p, size_t n, std::vector<std::pair<const uint8_t*, size_t>>& out) {
+    out.clear();
+    size_t start = SIZE_MAX;
+    auto finish = [&](size_t end) {
+        while (end > start && p[end - 1] == 0) --end;
+        if (end > start) out.push_back({ p + start, end - start });
+    };
+    for (size_t i = 0; i + 3 <= n; ) {
+        if (p[i] == 0 && p[i + 1] == 0 && p[i + 2] == 1) {
+            if (start != SIZE_MAX) finish(i);
+            i += 3; start = i;
+        } else ++i;
+    }
+    if (start != SIZE_MAX) finish(n);
+}
+
+size_t mpp_stream_send(MppStream* s, const uint8_t* rgba, int64_t pts_us) {
+    const MppStreamConfig& c = s->cfg;
+    uint8_t* dst = (uint8_t*)mpp_buffer_get_ptr(s->input);
+    if (!dst) { fail_once(s, "encoder input buffer not mapped"); return 0; }
+    for (int y = 0; y < c.height; ++y) memcpy(dst + (size_t)y * s->hor_stride, rgba + (size_t)y * c.width * 4, (size_t)c.width * 4);
+
+    MppFrame frame = nullptr;
+    if (mpp_frame_init(&frame) != MPP_OK) { fail_once(s, "mpp_frame_init failed"); return 0; }
+    mpp_frame_set_width(frame, c.width); mpp_frame_set_height(frame, c.height);
+    mpp_frame_set_hor_stride(frame, s->hor_stride); mpp_frame_set_ver_stride(frame, s->ver_stride);
+    mpp_frame_set_fmt(frame, MPP_FMT_RGBA8888);
+    mpp_frame_set_buffer(frame, s->input);
+    mpp_frame_set_pts(frame, pts_us);
+    mpp_frame_set_eos(frame, 0);
+    MPP_RET ret = s->mpi->encode_put_frame(s->ctx, frame);
+    mpp_frame_deinit(&frame);
+    if (ret != MPP_OK) { fail_once(s, "encode_put_frame: " + std::to_string(ret)); return 0; }
+    MppPacket pkt = nullptr;
+    ret = s->mpi->encode_get_packet(s->ctx, &pkt);
+    if (ret != MPP_OK || !pkt) { fail_once(s, "encode_get_packet: " + std::to_string(ret)); return 0; }
+
+    const uint8_t* data = (const uint8_t*)mpp_packet_get_pos(pkt);
+    size_t len = mpp_packet_get_length(pkt);
+    const uint32_t ts = s->ts_base + (uint32_t)(pts_us * 9 / 100); // 90 kHz
+    split_annexb(data, len, s->nals);
+    for (size_t i = 0; i < s->nals.size(); ++i) send_nal(s, s->nals[i].first, s->nals[i].second, i + 1 == s->nals.size(), ts);
+    mpp_packet_deinit(&pkt);
+    return len;
+}
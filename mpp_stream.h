@@ -0,0 +1,37 @@
+// mpp_stream.h
+// Monitoring stream of the rendered wall output (--stream): the render thread scales the finished
+// picture down on the GPU and reads it back through a PBO ring without waiting; a bounded worker thread
+// then hands each frame to the RK3588 hardware encoder (H.264 or H.265 via Rockchip MPP) and sends the
+// bitstream as RTP over UDP (RFC 6184 / RFC 7798, FU fragmentation). Receivers open the SDP description
+// (--stream-sdp), e.g. `ffplay -protocol_whitelist file,udp,rtp stream.sdp`.
+//
+// Only built with HDMI_ENABLE_MPP (rockchip_mpp), see CMakeLists.txt.
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+struct MppStream; // opaque: encoder context, input DMABUF, RTP socket
+
+struct MppStreamConfig {
+    std::string host;        // RTP destination (unicast or multicast)
+    std::string port;
+    int width = 960, height = 540; // encoded size, even
+    int fps = 10;
+    bool hevc = false;
+    int bitrate_kbps = 2000;
+};
+
+// "HOST:PORT" ([v6]:PORT); false if either part is missing
+bool mpp_stream_parse_destination(const std::string& dest, MppStreamConfig& cfg);
+
+// SDP description of the stream for players (one video media line, payload type 96)
+std::string mpp_stream_sdp(const MppStreamConfig& cfg);
+
+// nullptr if there is no encoder or the destination does not resolve (reason on stderr).
+MppStream* mpp_stream_open(const MppStreamConfig& cfg, bool verbose);
+void mpp_stream_close(MppStream* s);
+
+// Encode one width x height RGBA frame (top row first, rows tightly packed) and send it; blocks for the
+// encode, so only the worker thread calls it. pts in microseconds. Returns the encoded size, 0 on failure.
+size_t mpp_stream_send(MppStream* s, const uint8_t* rgba, int64_t pts_us);
@@ -0,0 +1,253 @@
+// rga_offload.cpp
+// RGA pre-processing for hdmi_simple_display (--rga), see rga_offload.h.
+
+#include "rga_offload.h"
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/videodev2.h>
+#include <linux/dma-heap.h>
+#include <linux/dma-buf.h>
+
+#include <rga/rga.h>
+#include <rga/im2d.h>
+
+static const char* const DEFAULT_HEAPS[] = {
+    "/dev/dma_heap/system-uncached-dma32", // RGA2 only addresses the low 4 GiB; uncached: the CPU rarely reads
+    "/dev/dma_heap/system-dma32",
+    "/dev/dma_heap/system-uncached",
+    "/dev/dma_heap/system",
+};
+
+struct RgaPoolBuffer {
+    RgaOutputBuffer out;
+    rga_buffer_handle_t handle = 0;
+    bool cpu_access = false; // DMA_BUF_SYNC_START issued for the last result
+};
+
+// capture buffer imported into the RGA, keyed by its DMABUF fd
+struct RgaImported {
+    int fd = -1;
+    rga_buffer_handle_t handle = 0;
+};
+
+struct RgaEngine {
+    int heap_fd = -1;
+    bool verbose = false;
+    std::vector<RgaPoolBuffer> pool;
+    std::vector<RgaImported> imported;
+    std::string last_error; // failures are reported once each
+};
+
+static void rlog(const RgaEngine* e, const std::string &s) { if (e->verbose) std::cerr << "rga: " << s << std::endl; }
+
+static bool fail(RgaEngine* e, const std::string &why) {
+    if (why != e->last_error) { std::cerr << "rga: " << why << ", showing the capture buffer instead" << std::endl; e->last_error = why; }
+    return false;
+}
+
+static std::string fourcc_name(uint32_t f) {
+    char s[5] = { (char)(f & 0xFF), (char)((f>>8)&0xFF), (char)((f>>16)&0xFF), (char)((f>>24)&0xFF), 0 };
+    return s;
+}
+
+// RK_FORMAT_* for a V4L2 fourcc; 'cr_first' picks the Cr,Cb variant of the family. 0 = not supported.
+static int rk_format(uint32_t pixfmt, bool cr_first) {
+    switch (pixfmt) {
+        case V4L2_PIX_FMT_NV12: case V4L2_PIX_FMT_NV21: {
+            bool vu = (pixfmt == V4L2_PIX_FMT_NV21) != cr_first;
+            return vu ? RK_FORMAT_YCrCb_420_SP : RK_FORMAT_YCbCr_420_SP;
+        }
+        case V4L2_PIX_FMT_NV16: case V4L2_PIX_FMT_NV61: {
+            bool vu = (pixfmt == V4L2_PIX_FMT_NV61) != cr_first;
+            return vu ? RK_FORMAT_YCrCb_422_SP : RK_FORMAT_YCbCr_422_SP;
+        }
+        case V4L2_PIX_FMT_NV24: case V4L2_PIX_FMT_NV42: {
+            bool vu = (pixfmt == V4L2_PIX_FMT_NV42) != cr_first;
+            return vu ? RK_FORMAT_YCrCb_444_SP : RK_FORMAT_YCbCr_444_SP;
+        }
+        case V4L2_PIX_FMT_YUYV: return cr_first ? RK_FORMAT_YVYU_422 : RK_FORMAT_YUYV_422;
+        case V4L2_PIX_FMT_UYVY: return cr_first ? RK_FORMAT_VYUY_422 : RK_FORMAT_UYVY_422;
+        default: return 0;
+    }
+}
+
+bool rga_format_supported(uint32_t v4l2_pixfmt) { return rk_format(v4l2_pixfmt, false) != 0; }
+uint32_t rga_output_stride(uint32_t width) { return (width + 15) & ~15u; } // RGA3 wants 16-pixel aligned rows
+
+// bytes of one output frame per luma byte (x2): 4:2:0 = 3, 4:2:2 = 4, 4:4:4 = 6
+static size_t out_bytes_x2(uint32_t pixfmt) {
+    switch (pixfmt) {
+        case V4L2_PIX_FMT_NV12: case V4L2_PIX_FMT_NV21: return 3;
+        case V4L2_PIX_FMT_NV16: case V4L2_PIX_FMT_NV61: return 4;
+        case V4L2_PIX_FMT_NV24: case V4L2_PIX_FMT_NV42: return 6;
+        default: return 0;
+    }
+}
+
+// 2x2 signed permutation acting on centred, normalised image coordinates (x right, y down):
+// destination pixel q shows source pixel M*q.
+struct Xform { int a, b, c, d; };
+static Xform mul(const Xform &l, const Xform &r) {
+    return { l.a*r.a + l.b*r.c, l.a*r.b + l.b*r.d, l.c*r.a + l.d*r.c, l.c*r.b + l.d*r.d };
+}
+static bool same(const Xform &l, const Xform &r) { return l.a == r.a && l.b == r.b && l.c == r.c && l.d == r.d; }
+
+// The shader samples the texture at F(R(p)) (rotate90_centered, then the mirrors) and shows an upright
+// texture with flip_y = 1 alone. So the RGA has to produce M'(q) = M(F R Fy q). The diagonal mirrors
+// need a turn plus a flip, whose order librga does not pin down: for those the RGA only does F R and
+// the shader keeps flip_y = 0.
+static bool rga_usage(int rot, int flip_x, int flip_y, int &usage, int &shader_flip_y, bool &swap_dims) {
+    static const Xform R[4] = { {1,0,0,1}, {0,1,-1,0}, {-1,0,0,-1}, {0,-1,1,0} };
+    const Xform Fy = {1,0,0,-1};
+    Xform F = { flip_x ? -1 : 1, 0, 0, flip_y ? -1 : 1 };
+    Xform m = mul(mul(F, R[rot & 3]), Fy);
+    shader_flip_y = 1;
+    if (m.a == 0 && m.b == m.c) { m = mul(F, R[rot & 3]); shader_flip_y = 0; }
+    static const struct { Xform m; int usage; } OPS[] = {
+        { {1,0,0,1}, 0 },
+        { {0,1,-1,0}, IM_HAL_TRANSFORM_ROT_90 },
+        { {-1,0,0,-1}, IM_HAL_TRANSFORM_ROT_180 },
+        { {0,-1,1,0}, IM_HAL_TRANSFORM_ROT_270 },
+        { {-1,0,0,1}, IM_HAL_TRANSFORM_FLIP_H },
+        { {1,0,0,-1}, IM_HAL_TRANSFORM_FLIP_V },
+    };
+    for (const auto &op : OPS) {
+        if (!same(op.m, m)) continue;
+        usage = op.usage; swap_dims = m.a == 0;
+        return true;
+    }
+    return false;
+}
+
+static void cpu_sync(RgaPoolBuffer &b, bool start) {
+    struct dma_buf_sync s; s.flags = (start ? DMA_BUF_SYNC_START : DMA_BUF_SYNC_END) | DMA_BUF_SYNC_READ;
+    if (ioctl(b.out.fd, DMA_BUF_IOCTL_SYNC, &s) == 0) b.cpu_access = start;
+}
+
+static void release_pool(RgaEngine* e) {
+    for (auto &b : e->pool) {
+        if (b.cpu_access) cpu_sync(b, false);
+        if (b.handle) releasebuffer_handle(b.handle);
+        if (b.out.addr) munmap(b.out.addr, b.out.length);
+        if (b.out.fd >= 0) close(b.out.fd);
+    }
+    e->pool.clear();
+    for (auto &i : e->imported) releasebuffer_handle(i.handle);
+    e->imported.clear();
+}
+
+RgaEngine* rga_open(const char* heap, bool verbose) {
+    if (access("/dev/rga", R_OK | W_OK) != 0) { std::cerr << "rga: /dev/rga: " << strerror(errno) << std::endl; return nullptr; }
+    RgaEngine* e = new RgaEngine();
+    e->verbose = verbose;
+    std::string used;
+    if (heap && *heap) {
+        e->heap_fd = open(heap, O_RDWR | O_CLOEXEC); used = heap;
+    } else {
+        for (const char* h : DEFAULT_HEAPS) {
+            e->heap_fd = open(h, O_RDWR | O_CLOEXEC);
+            if (e->heap_fd >= 0) { used = h; break; }
+        }
+    }
+    if (e->heap_fd < 0) {
+        std::cerr << "rga: no dma-heap for the output buffers" << (used.empty() ? "" : " (" + used + ": " + strerror(errno) + ")") << std::endl;
+        delete e; return nullptr;
+    }
+    rlog(e, std::string(querystring(RGA_VERSION)) + ", output buffers from " + used);
+    return e;
+}
+
+void rga_close(RgaEngine* e) {
+    if (!e) return;
+    release_pool(e);
+    if (e->heap_fd >= 0) close(e->heap_fd);
+    delete e;
+}
+
+bool rga_alloc(RgaEngine* e, unsigned count, uint32_t width, uint32_t height) {
+    release_pool(e);
+    e->last_error.clear();
+    size_t len = std::max((size_t)rga_output_stride(width) * height, (size_t)rga_output_stride(height) * width) * 3;
+    len = (len + 4095) & ~(size_t)4095;
+    for (unsigned i = 0; i < count; ++i) {
+        RgaPoolBuffer b;
+        struct dma_heap_allocation_data d; memset(&d, 0, sizeof(d));
+        d.len = len; d.fd_flags = O_RDWR | O_CLOEXEC;
+        if (ioctl(e->heap_fd, DMA_HEAP_IOCTL_ALLOC, &d) != 0) { std::cerr << "rga: DMA_HEAP_IOCTL_ALLOC: " << strerror(errno) << std::endl; release_pool(e); return false; }
+        b.out.fd = (int)d.fd; b.out.length = len;
+        void* a = mmap(nullptr, len, PROT_READ, MAP_SHARED, b.out.fd, 0);
+        if (a != MAP_FAILED) b.out.addr = a;
+        b.handle = importbuffer_fd(b.out.fd, (int)len);
+        e->pool.push_back(b);
+        if (!b.handle) { std::cerr << "rga: importbuffer_fd failed for an output buffer" << std::endl; release_pool(e); return false; }
+    }
+    rlog(e, std::to_string(count) + " output buffers of " + std::to_string(len >> 10) + " KiB for " +
+            std::to_string(width) + "x" + std::to_string(height));
+    return true;
+}
+
+unsigned rga_buffer_count(const RgaEngine* e) { return (unsigned)e->pool.size(); }
+const RgaOutputBuffer& rga_buffer(const RgaEngine* e, unsigned index) { return e->pool[index].out; }
+
+static rga_buffer_handle_t import_source(RgaEngine* e, int fd, size_t length) {
+    for (const auto &i : e->imported) if (i.fd == fd) return i.handle;
+    RgaImported i; i.fd = fd; i.handle = importbuffer_fd(fd, (int)length);
+    if (i.handle) e->imported.push_back(i);
+    return i.handle;
+}
+
+bool rga_process(RgaEngine* e, unsigned index, const RgaSource& s, const RgaTransform& t, RgaResult& out) {
+    if (index >= e->pool.size() || s.fd < 0 || s.stride == 0) return false;
+    int sfmt = rk_format(s.v4l2_pixfmt, t.swap_uv), dfmt = rk_format(t.out_pixfmt, false);
+    size_t per2 = out_bytes_x2(t.out_pixfmt);
+    if (!sfmt) return fail(e, "no RGA format for " + fourcc_name(s.v4l2_pixfmt));
+    if (!dfmt || !per2) return fail(e, "unsupported output format " + fourcc_name(t.out_pixfmt));
+    bool packed = s.v4l2_pixfmt == V4L2_PIX_FMT_YUYV || s.v4l2_pixfmt == V4L2_PIX_FMT_UYVY;
+
+    // crop rectangle, even for the chroma planes
+    uint32_t cx = 0, cy = 0, cw = s.width, ch = s.height;
+    if (t.crop_w && t.crop_h && t.crop_x + t.crop_w <= s.width && t.crop_y + t.crop_h <= s.height) {
+        cx = t.crop_x; cy = t.crop_y; cw = t.crop_w; ch = t.crop_h;
+    }
+    cx &= ~1u; cy &= ~1u; cw &= ~1u; ch &= ~1u;
+    if (cw == 0 || ch == 0) return false;
+
+    int usage = 0; bool swap_dims = false;
+    if (!rga_usage(t.rot, t.flip_x, t.flip_y, usage, out.shader_flip_y, swap_dims)) return fail(e, "no RGA transform for this rotation");
+    uint32_t ow = swap_dims ? ch : cw, oh = swap_dims ? cw : ch;
+    uint32_t ostride = rga_output_stride(ow);
+    size_t obytes = (size_t)ostride * oh * per2 / 2;
+    RgaPoolBuffer &dst_buf = e->pool[index];
+    if (obytes > dst_buf.out.length) return fail(e, "output does not fit the pool (" + std::to_string(ow) + "x" + std::to_string(oh) + ")");
+
+    rga_buffer_handle_t sh = import_source(e, s.fd, s.length);
+    if (!sh) return fail(e, "importbuffer_fd failed for a capture buffer");
+    int wstride = packed ? (int)(s.stride / 2) : (int)s.stride;
+    int hstride = packed ? (int)s.height : (int)(s.uv_offset / s.stride);
+    rga_buffer_t src = wrapbuffer_handle(sh, (int)s.width, (int)s.height, sfmt, wstride, hstride);
+    rga_buffer_t dst = wrapbuffer_handle(dst_buf.handle, (int)ow, (int)oh, dfmt, (int)ostride, (int)oh);
+    rga_buffer_t pat; memset(&pat, 0, sizeof(pat));
+    im_rect srect = { (int)cx, (int)cy, (int)cw, (int)ch };
+    im_rect drect = { 0, 0, (int)ow, (int)oh };
+    im_rect prect; memset(&prect, 0, sizeof(prect));
+
+    if (dst_buf.cpu_access) cpu_sync(dst_buf, false);
+    IM_STATUS st = improcess(src, dst, pat, srect, drect, prect, usage | IM_SYNC);
+    cpu_sync(dst_buf, true);
+    if (st != IM_STATUS_SUCCESS && st != IM_STATUS_NOERROR)
+        return fail(e, std::string("improcess ") + fourcc_name(s.v4l2_pixfmt) + " -> " + fourcc_name(t.out_pixfmt) + ": " + imStrError(st));
+    if (!e->last_error.empty()) { rlog(e, "converting again"); e->last_error.clear(); }
+
+    out.width = ow; out.height = oh; out.bytes = obytes;
+    out.cropped = cw != s.width || ch != s.height;
+    return true;
+}
@@ -0,0 +1,69 @@
+// rga_offload.h
+// Optional pre-processing of captured frames on the RK3588 RGA 2D engine (--rga): the capture thread
+// hands each dequeued DMABUF to librga, which crops the active segment, rotates/mirrors, converts the
+// chroma subsampling (e.g. NV24 -> NV12) and puts Cb/Cr in display order, writing into a second pool of
+// DMABUFs (allocated from a dma-heap) that the GPU imports or the overlay plane scans out instead.
+// Output buffer i belongs to capture buffer i and is only rewritten after that buffer came back from
+// the render thread, so the pool needs no lifetime handling of its own.
+//
+// Only built with HDMI_ENABLE_RGA (librga), see CMakeLists.txt.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+struct RgaEngine; // opaque: dma-heap fd, output pool, imported buffer handles
+
+// One output buffer: luma at offset 0, chroma (semi-planar formats) right after 'height' rows of 'stride'.
+struct RgaOutputBuffer {
+    int fd = -1;
+    void* addr = nullptr; // read-only CPU mapping (screenshots, copy upload)
+    size_t length = 0;
+};
+
+// A captured frame: one DMABUF with luma at offset 0 and chroma at 'uv_offset' (semi-planar formats).
+struct RgaSource {
+    int fd = -1;
+    size_t length = 0;
+    uint32_t width = 0, height = 0, v4l2_pixfmt = 0;
+    uint32_t stride = 0;    // bytes per luma row (packed 4:2:2: per row of the only plane)
+    size_t uv_offset = 0;
+};
+
+// What to do with it. rot/flip_x/flip_y are the LayoutParams values (quarter turns as in the shader's
+// rotate90_centered, flip_y = 1 is the upright default); swap_uv reads the chroma bytes as Cr,Cb.
+struct RgaTransform {
+    uint32_t crop_x = 0, crop_y = 0, crop_w = 0, crop_h = 0; // crop_w/h 0 = whole frame
+    int rot = 0, flip_x = 0, flip_y = 1;
+    bool swap_uv = false;
+    uint32_t out_pixfmt = 0; // V4L2 fourcc of the output, semi-planar (NV12, NV16, NV24)
+};
+
+struct RgaResult {
+    uint32_t width = 0, height = 0;
+    size_t bytes = 0;       // used part of the output buffer
+    bool cropped = false;   // only the crop rectangle, not the whole frame
+    // Rotations and plain mirrors are done by the RGA; the two diagonal mirrors (a quarter turn with a
+    // single flip) leave the vertical mirror to the shader, which then runs with this flip_y.
+    int shader_flip_y = 1;
+};
+
+// 'heap': dma-heap device for the output pool, empty = the first of the uncached DMA32 / uncached /
+// system heaps that exists. nullptr if there is no RGA or no usable heap (reason on stderr).
+RgaEngine* rga_open(const char* heap, bool verbose);
+void rga_close(RgaEngine* e);
+
+// (Re)create 'count' output buffers large enough for a width x height frame in any orientation at
+// 4:4:4 and forget all imported capture buffers. Capture thread, only while no output is referenced
+// (at startup and after release_gpu_buffers()).
+bool rga_alloc(RgaEngine* e, unsigned count, uint32_t width, uint32_t height);
+unsigned rga_buffer_count(const RgaEngine* e);
+const RgaOutputBuffer& rga_buffer(const RgaEngine* e, unsigned index);
+
+bool rga_format_supported(uint32_t v4l2_pixfmt);
+// Bytes per luma row of an output 'width' pixels wide (the same for every buffer of the pool).
+uint32_t rga_output_stride(uint32_t width);
+
+// Convert 'src' into output buffer 'index' (blocking, a few ms for 4K). false if the RGA rejects the
+// job; the caller then shows the capture buffer itself. Each distinct failure is reported once.
+bool rga_process(RgaEngine* e, unsigned index, const RgaSource& src, const RgaTransform& t, RgaResult& out);
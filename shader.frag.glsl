@@ -5,44 +5,56 @@ out vec4 FragColor;
 
 uniform sampler2D texY;
 uniform sampler2D texUV;
+uniform sampler2D texColorLut;  // unit 5: 256 x modules RGBA8 calibration LUTs
 uniform sampler2D texPattern;   // new: test pattern RGB texture (unit 2)
 
-uniform int segmentIndex; // 1..16
-uniform vec2 u_fullInputSize;    // e.g. 3840,2160
-uniform int  u_segmentsX;
-uniform int  u_segmentsY;
-uniform vec2 u_subBlockSize;     // e.g. 1280,2160
-
-uniform float u_tileW;           // 128
-uniform float u_tileH;           // 144
-uniform float u_spacingX;        // controlled by control_ini (use as-is)
-uniform float u_spacingY;        // controlled by control_ini (use as-is)
-uniform float u_marginX;         // left margin
-uniform int   u_numTilesPerRow;  // 10
-uniform int   u_numTilesPerCol;  // 15
-
-uniform ivec2 offsetxy1[150];
-
-uniform int rot;
-uniform int flip_x;
-uniform int flip_y;
-
-uniform int gap_count;
-uniform int gap_rows[8];
-
-uniform int inputTilesTopToBottom;
-
-uniform int uv_swap;
-uniform int full_range;
-uniform int use_bt709;
-uniform int view_mode;
-
-uniform int u_textureIsFull;     // 1 = full input texture bound, 0 = subblock
-uniform vec2 u_windowSize;       // SDL window in pixels
-uniform vec2 u_outputSize;       // legacy / fallback
-uniform int  u_alignTopLeft;     // 1 = align top-left, 0 = center
-
-uniform int u_showPattern;       // 1 = show pattern (no input), 0 = normal
+// Per-config tables (unit 4, RGBA32I, row-major, any size): entry r < u_numTilesPerCol has x = 1 if tile
+// row r has no spacing above it; from u_layoutTable.x the tile offsets (xy) and texColorLut row (z),
+// u_layoutTable.y entries per segment.
+uniform isampler2D texLayout;
+
+// All layout/colour parameters in one std140 block, filled by LayoutParamsStd140 on the CPU
+// (keep both in the same order).
+layout(std140) uniform LayoutParams {
+    vec2  u_fullInputSize;   // e.g. 3840,2160
+    vec2  u_subBlockSize;    // e.g. 1280,2160
+    vec2  u_windowSize;      // SDL window in pixels
+    vec2  u_outputSize;      // legacy / fallback
+    vec2  u_gridSize;        // logical grid size (texRemap / tile instances)
+    float u_tileW;           // 128
+    float u_tileH;           // 144
+    float u_spacingX;        // controlled by control_ini (use as-is)
+    float u_spacingY;        // controlled by control_ini (use as-is)
+    float u_marginX;         // left margin
+    int   u_segmentsX;
+    int   u_segmentsY;
+    int   u_numTilesPerRow;  // 10
+    int   u_numTilesPerCol;  // 15
+    int   segmentIndex;      // 1..segmentsX*segmentsY
+    int   rot;
+    int   flip_x;
+    int   flip_y;
+    int   gap_count;         // gap rows inside the grid (flags in texLayout)
+    int   inputTilesTopToBottom;
+    int   view_mode;
+    int   u_textureIsFull;   // 1 = full input texture bound, 0 = subblock
+    int   u_alignTopLeft;    // 1 = align top-left, 0 = center
+    int   u_showPattern;     // 1 = show pattern (no input), 0 = normal
+    int   u_useRemap;        // 1 = use texRemap instead of the tile search below
+    int   u_colorLut;        // 1 = per-module calibration in texColorLut (row per tile in texLayout .z)
+    ivec4 u_layoutTable;     // texLayout: first tile entry, tiles per segment, segments (w unused)
+    vec4  u_colorMatrix[3];  // rows of the 3x4 YCbCr -> RGB matrix (matrix, range and Cb/Cr order folded in)
+};
+
+uniform usampler2D texRemap;     // --tile-mode=remap: texY texel per logical grid pixel (unit 3)
+
+// --all-segments: the quad is drawn once per segment into its own viewport. u_viewport = origin and size of
+// that viewport in window pixels, u_drawSegment = the segment drawn (1..N); 0 = segmentIndex, whole window.
+uniform vec4 u_viewport;
+uniform int  u_drawSegment;
+
+vec2 viewSize() { return max(u_drawSegment > 0 ? u_viewport.zw : u_windowSize, vec2(1.0)); }
+vec2 viewPx()   { return u_drawSegment > 0 ? gl_FragCoord.xy - u_viewport.xy : gl_FragCoord.xy; }
 
 // helper: rotate a point (u,v) around center (0.5,0.5) by k*90deg clockwise
 vec2 rotate90_centered(vec2 uv, int k) {
@@ -57,12 +69,14 @@ vec2 rotate90_centered(vec2 uv, int k) {
     return r + c;
 }
 
+ivec4 layoutEntry(int i) {
+    int w = textureSize(texLayout, 0).x;
+    return texelFetch(texLayout, ivec2(i % w, i / w), 0);
+}
+
 bool isGapZero(int gapIdx) {
-    for (int i = 0; i < 8; ++i) {
-        if (i >= gap_count) break;
-        if (gap_rows[i] == gapIdx) return true;
-    }
-    return false;
+    if (gap_count == 0 || gapIdx < 1 || gapIdx >= u_numTilesPerCol) return false;
+    return layoutEntry(gapIdx).x != 0;
 }
 
 // compute total grid height considering vertical gaps (exact pixel values from control_ini)
@@ -77,6 +91,20 @@ float computeTotalGridHeight(int numRows, float tileH, float spacingY) {
     return h;
 }
 
+// YCbCr samples as read from texY/texUV (0..1) -> RGB, one matrix for every matrix/range/swap setting
+vec3 yuvToRgb(vec3 ycc) {
+    vec4 s = vec4(ycc, 1.0);
+    return clamp(vec3(dot(u_colorMatrix[0], s), dot(u_colorMatrix[1], s), dot(u_colorMatrix[2], s)), vec3(0.0), vec3(1.0));
+}
+
+// Module calibration: per-channel 1D LUT, row 'row' of texColorLut (0 = module without calibration)
+vec3 calibrate(vec3 rgb, int row) {
+    if (u_colorLut == 0 || row <= 0) return rgb;
+    ivec3 i = ivec3(rgb * 255.0 + 0.5);
+    return vec3(texelFetch(texColorLut, ivec2(i.r, row), 0).r, texelFetch(texColorLut, ivec2(i.g, row), 0).g,
+                texelFetch(texColorLut, ivec2(i.b, row), 0).b);
+}
+
 vec3 tileIndexToColor(int idx) {
     float r = float((idx * 37) & 0xFF) / 255.0;
     float g = float((idx * 73) & 0xFF) / 255.0;
@@ -103,7 +131,7 @@ void main()
         float spacingX = u_spacingX;
         float spacingY = u_spacingY;
         float marginX = u_marginX;
-        vec2 win = max(u_windowSize, vec2(1.0));
+        vec2 win = viewSize();
         vec2 grid = vec2(2.0 * marginX + float(u_numTilesPerRow) * tileW + float(u_numTilesPerRow - 1) * spacingX,
                          computeTotalGridHeight(u_numTilesPerCol, tileH, spacingY));
         // Map TexCoord to logical coordinates (approx)
@@ -125,12 +153,36 @@ void main()
         return;
     }
 
+    // --- Precomputed mapping: one lookup replaces the tile search (debug view modes need the full path) ---
+    if (u_useRemap == 1 && view_mode == 0) {
+        vec2 rwin = viewSize();
+        vec2 rgrid = max(u_gridSize, vec2(1.0));
+        float rscale = max(1.0, min(floor(rwin.x / rgrid.x), floor(rwin.y / rgrid.y)));
+        vec2 rorigin = (u_alignTopLeft == 1) ? vec2(0.0, rwin.y - rgrid.y * rscale) : (rwin - rgrid * rscale) * 0.5;
+        vec2 lb = (viewPx() - rorigin) / rscale;
+        if (lb.x < 0.0 || lb.y < 0.0 || lb.x >= rgrid.x || lb.y >= rgrid.y) {
+            FragColor = vec4(0.0,0.0,0.0,1.0);
+            return;
+        }
+        ivec2 rsize = textureSize(texRemap, 0);
+        ivec2 l = ivec2(floor(lb));
+        uvec2 src = texelFetch(texRemap, ivec2(l.x, rsize.y - 1 - l.y), 0).rg;
+        if (src.x == 65535u) {
+            FragColor = vec4(0.0,0.0,0.0,1.0);
+            return;
+        }
+        ivec2 yc = ivec2(src);
+        ivec2 uvc = yc * textureSize(texUV, 0) / textureSize(texY, 0);
+        FragColor = vec4(yuvToRgb(vec3(texelFetch(texY, yc, 0).r, texelFetch(texUV, uvc, 0).rg)), 1.0);
+        return;
+    }
+
     // --- Compute logical grid size from control params (use spacing exactly as given) ---
     float gridW = 2.0 * u_marginX + float(u_numTilesPerRow) * u_tileW + float(u_numTilesPerRow - 1) * u_spacingX;
     float gridH = computeTotalGridHeight(u_numTilesPerCol, u_tileH, u_spacingY);
 
     // --- Determine integer scale to map logical grid onto window pixels ---
-    vec2 win = max(u_windowSize, vec2(1.0));
+    vec2 win = viewSize();
     vec2 grid = max(vec2(gridW, gridH), vec2(1.0));
     float sx = floor(win.x / grid.x);
     float sy = floor(win.y / grid.y);
@@ -144,7 +196,7 @@ void main()
         origin = (win - usedPx) * 0.5;
     }
 
-    vec2 winPx = gl_FragCoord.xy;
+    vec2 winPx = viewPx();
     vec2 logicalBottom = (winPx - origin) / scale;
 
     if (logicalBottom.x < 0.0 || logicalBottom.y < 0.0 || logicalBottom.x >= grid.x || logicalBottom.y >= grid.y) {
@@ -154,7 +206,7 @@ void main()
 
     vec2 outPxTL = vec2(logicalBottom.x, grid.y - 1.0 - logicalBottom.y);
 
-    int segIdx = clamp(segmentIndex, 1, 16) - 1;
+    int segIdx = clamp(u_drawSegment > 0 ? u_drawSegment : segmentIndex, 1, max(1, u_segmentsX * u_segmentsY)) - 1;
     int segCol = segIdx % max(1, u_segmentsX);
     int segRow = segIdx / max(1, u_segmentsX);
     vec2 subBlockOrigin = vec2(float(segCol) * u_subBlockSize.x, float(segRow) * u_subBlockSize.y);
@@ -191,8 +243,8 @@ void main()
     }
 
     int tileIndexWithinSubblock = tileRow * u_numTilesPerRow + tileCol;
-    int clampedIndex = clamp(tileIndexWithinSubblock, 0, 149);
-    ivec2 off_i = offsetxy1[clampedIndex];
+    int tableSeg = min(segIdx, max(1, u_layoutTable.z) - 1);
+    ivec4 off_i = layoutEntry(u_layoutTable.x + tableSeg * u_layoutTable.y + clamp(tileIndexWithinSubblock, 0, u_layoutTable.y - 1));
     float offx = float(off_i.x);
     float offy = float(off_i.y);
 
@@ -252,24 +304,6 @@ void main()
         return;
     }
 
-    float Y = texture(texY, uvTrans).r * 255.0;
-    vec2 uv = texture(texUV, uvTrans).rg * 255.0;
-    float U = uv.x, V = uv.y;
-    if (uv_swap == 1) { float tmp = U; U = V; V = tmp; }
-
-    float yVal = (full_range == 1) ? Y : 1.164383 * (Y - 16.0);
-    float uVal = U - 128.0;
-    float vVal = V - 128.0;
-    vec3 rgb;
-    if (use_bt709 == 1) {
-        rgb.r = yVal + 1.792741 * vVal;
-        rgb.g = yVal - 0.213249 * uVal - 0.532909 * vVal;
-        rgb.b = yVal + 2.112402 * uVal;
-    } else {
-        rgb.r = yVal + 1.596027 * vVal;
-        rgb.g = yVal - 0.391762 * uVal - 0.812968 * vVal;
-        rgb.b = yVal + 2.017232 * uVal;
-    }
-    rgb = clamp(rgb / 255.0, vec3(0.0), vec3(1.0));
-    FragColor = vec4(rgb, 1.0);
+    vec3 rgb = yuvToRgb(vec3(texture(texY, uvTrans).r, texture(texUV, uvTrans).rg));
+    FragColor = vec4(calibrate(rgb, off_i.z), 1.0);
 }
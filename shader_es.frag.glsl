@@ -0,0 +1,314 @@
+#version 300 es
+// OpenGL ES 3.0 variant of shader.frag.glsl (HDMI_USE_GLES builds) -- keep both in sync.
+// Tile/coordinate math and the layout block need highp (4K pixel coordinates, offsets);
+// texture reads and the YUV->RGB conversion are fine at mediump.
+precision highp float;
+precision highp int;
+
+in vec2 TexCoord;
+out mediump vec4 FragColor;
+
+uniform mediump sampler2D texY;
+uniform mediump sampler2D texUV;
+uniform mediump sampler2D texColorLut;  // unit 5: 256 x modules RGBA8 calibration LUTs
+uniform mediump sampler2D texPattern;   // new: test pattern RGB texture (unit 2)
+
+// Per-config tables (unit 4, RGBA32I, row-major, any size): entry r < u_numTilesPerCol has x = 1 if tile
+// row r has no spacing above it; from u_layoutTable.x the tile offsets (xy) and texColorLut row (z),
+// u_layoutTable.y entries per segment.
+uniform highp isampler2D texLayout;
+
+// All layout/colour parameters in one std140 block, filled by LayoutParamsStd140 on the CPU
+// (keep both in the same order).
+layout(std140) uniform LayoutParams {
+    vec2  u_fullInputSize;   // e.g. 3840,2160
+    vec2  u_subBlockSize;    // e.g. 1280,2160
+    vec2  u_windowSize;      // SDL window in pixels
+    vec2  u_outputSize;      // legacy / fallback
+    vec2  u_gridSize;        // logical grid size (texRemap / tile instances)
+    float u_tileW;           // 128
+    float u_tileH;           // 144
+    float u_spacingX;        // controlled by control_ini (use as-is)
+    float u_spacingY;        // controlled by control_ini (use as-is)
+    float u_marginX;         // left margin
+    int   u_segmentsX;
+    int   u_segmentsY;
+    int   u_numTilesPerRow;  // 10
+    int   u_numTilesPerCol;  // 15
+    int   segmentIndex;      // 1..segmentsX*segmentsY
+    int   rot;
+    int   flip_x;
+    int   flip_y;
+    int   gap_count;         // gap rows inside the grid (flags in texLayout)
+    int   inputTilesTopToBottom;
+    int   view_mode;
+    int   u_textureIsFull;   // 1 = full input texture bound, 0 = subblock
+    int   u_alignTopLeft;    // 1 = align top-left, 0 = center
+    int   u_showPattern;     // 1 = show pattern (no input), 0 = normal
+    int   u_useRemap;        // 1 = use texRemap instead of the tile search below
+    int   u_colorLut;        // 1 = per-module calibration in texColorLut (row per tile in texLayout .z)
+    ivec4 u_layoutTable;     // texLayout: first tile entry, tiles per segment, segments (w unused)
+    vec4  u_colorMatrix[3];  // rows of the 3x4 YCbCr -> RGB matrix (matrix, range and Cb/Cr order folded in)
+};
+
+uniform highp usampler2D texRemap;     // --tile-mode=remap: texY texel per logical grid pixel (unit 3)
+
+// --all-segments: the quad is drawn once per segment into its own viewport. u_viewport = origin and size of
+// that viewport in window pixels, u_drawSegment = the segment drawn (1..N); 0 = segmentIndex, whole window.
+uniform vec4 u_viewport;
+uniform int  u_drawSegment;
+
+vec2 viewSize() { return max(u_drawSegment > 0 ? u_viewport.zw : u_windowSize, vec2(1.0)); }
+vec2 viewPx()   { return u_drawSegment > 0 ? gl_FragCoord.xy - u_viewport.xy : gl_FragCoord.xy; }
+
+// helper: rotate a point (u,v) around center (0.5,0.5) by k*90deg clockwise
+vec2 rotate90_centered(vec2 uv, int k) {
+    vec2 c = vec2(0.5, 0.5);
+    vec2 p = uv - c;
+    vec2 r;
+    int kk = k & 3;
+    if (kk == 0) r = p;
+    else if (kk == 1) r = vec2(p.y, -p.x);
+    else if (kk == 2) r = vec2(-p.x, -p.y);
+    else r = vec2(-p.y, p.x);
+    return r + c;
+}
+
+ivec4 layoutEntry(int i) {
+    int w = textureSize(texLayout, 0).x;
+    return texelFetch(texLayout, ivec2(i % w, i / w), 0);
+}
+
+bool isGapZero(int gapIdx) {
+    if (gap_count == 0 || gapIdx < 1 || gapIdx >= u_numTilesPerCol) return false;
+    return layoutEntry(gapIdx).x != 0;
+}
+
+// compute total grid height considering vertical gaps (exact pixel values from control_ini)
+float computeTotalGridHeight(int numRows, float tileH, float spacingY) {
+    float h = 0.0;
+    for (int r = 0; r < numRows; ++r) {
+        h += tileH;
+        if (r < numRows - 1) {
+            if (!isGapZero(r + 1)) h += spacingY;
+        }
+    }
+    return h;
+}
+
+// YCbCr samples as read from texY/texUV (0..1) -> RGB, one matrix for every matrix/range/swap setting
+mediump vec3 yuvToRgb(mediump vec3 ycc) {
+    mediump vec4 s = vec4(ycc, 1.0);
+    return clamp(vec3(dot(u_colorMatrix[0], s), dot(u_colorMatrix[1], s), dot(u_colorMatrix[2], s)), vec3(0.0), vec3(1.0));
+}
+
+// Module calibration: per-channel 1D LUT, row 'row' of texColorLut (0 = module without calibration)
+mediump vec3 calibrate(mediump vec3 rgb, int row) {
+    if (u_colorLut == 0 || row <= 0) return rgb;
+    ivec3 i = ivec3(rgb * 255.0 + 0.5);
+    return vec3(texelFetch(texColorLut, ivec2(i.r, row), 0).r, texelFetch(texColorLut, ivec2(i.g, row), 0).g,
+                texelFetch(texColorLut, ivec2(i.b, row), 0).b);
+}
+
+vec3 tileIndexToColor(int idx) {
+    float r = float((idx * 37) & 0xFF) / 255.0;
+    float g = float((idx * 73) & 0xFF) / 255.0;
+    float b = float((idx * 151) & 0xFF) / 255.0;
+    return vec3(r,g,b);
+}
+
+void main()
+{
+    // If test pattern requested, render it immediately (pattern texture if bound, else procedural)
+    if (u_showPattern == 1) {
+        // If a pattern texture is provided (bound to unit 2), show it.
+        // We invert v so user-supplied images map naturally.
+        vec4 tcol = texture(texPattern, vec2(TexCoord.x, 1.0 - TexCoord.y));
+        // If pattern texture is empty or not provided (will sample black), fall back to procedural.
+        if (tcol.r > 0.0 || tcol.g > 0.0 || tcol.b > 0.0) {
+            FragColor = tcol;
+            return;
+        }
+        // Procedural fallback pattern: three vertical columns (red, green, blue) with white tile borders.
+        // Use u_outputSize/u_tileW to draw grid-like tiles similar to your test image.
+        float tileW = u_tileW;
+        float tileH = u_tileH;
+        float spacingX = u_spacingX;
+        float spacingY = u_spacingY;
+        float marginX = u_marginX;
+        vec2 win = viewSize();
+        vec2 grid = vec2(2.0 * marginX + float(u_numTilesPerRow) * tileW + float(u_numTilesPerRow - 1) * spacingX,
+                         computeTotalGridHeight(u_numTilesPerCol, tileH, spacingY));
+        // Map TexCoord to logical coordinates (approx)
+        vec2 px = TexCoord * win;
+        // Determine column in 3 vertical bands
+        float band = floor(3.0 * px.x / win.x);
+        vec3 col = vec3(0.5,0.0,0.0);
+        if (band < 1.0) col = vec3(0.8, 0.1, 0.1);
+        else if (band < 2.0) col = vec3(0.1, 0.8, 0.1);
+        else col = vec3(0.15, 0.15, 0.9);
+        // draw thin white grid lines: create virtual tile coordinates
+        float gx = mod(px.x, tileW + spacingX);
+        float gy = mod(px.y, tileH + spacingY);
+        if (gx < 2.0 || gy < 2.0) {
+            FragColor = vec4(1.0,1.0,1.0,1.0);
+        } else {
+            FragColor = vec4(col, 1.0);
+        }
+        return;
+    }
+
+    // --- Precomputed mapping: one lookup replaces the tile search (debug view modes need the full path) ---
+    if (u_useRemap == 1 && view_mode == 0) {
+        vec2 rwin = viewSize();
+        vec2 rgrid = max(u_gridSize, vec2(1.0));
+        float rscale = max(1.0, min(floor(rwin.x / rgrid.x), floor(rwin.y / rgrid.y)));
+        vec2 rorigin = (u_alignTopLeft == 1) ? vec2(0.0, rwin.y - rgrid.y * rscale) : (rwin - rgrid * rscale) * 0.5;
+        vec2 lb = (viewPx() - rorigin) / rscale;
+        if (lb.x < 0.0 || lb.y < 0.0 || lb.x >= rgrid.x || lb.y >= rgrid.y) {
+            FragColor = vec4(0.0,0.0,0.0,1.0);
+            return;
+        }
+        ivec2 rsize = textureSize(texRemap, 0);
+        ivec2 l = ivec2(floor(lb));
+        uvec2 src = texelFetch(texRemap, ivec2(l.x, rsize.y - 1 - l.y), 0).rg;
+        if (src.x == 65535u) {
+            FragColor = vec4(0.0,0.0,0.0,1.0);
+            return;
+        }
+        ivec2 yc = ivec2(src);
+        ivec2 uvc = yc * textureSize(texUV, 0) / textureSize(texY, 0);
+        FragColor = vec4(yuvToRgb(vec3(texelFetch(texY, yc, 0).r, texelFetch(texUV, uvc, 0).rg)), 1.0);
+        return;
+    }
+
+    // --- Compute logical grid size from control params (use spacing exactly as given) ---
+    float gridW = 2.0 * u_marginX + float(u_numTilesPerRow) * u_tileW + float(u_numTilesPerRow - 1) * u_spacingX;
+    float gridH = computeTotalGridHeight(u_numTilesPerCol, u_tileH, u_spacingY);
+
+    // --- Determine integer scale to map logical grid onto window pixels ---
+    vec2 win = viewSize();
+    vec2 grid = max(vec2(gridW, gridH), vec2(1.0));
+    float sx = floor(win.x / grid.x);
+    float sy = floor(win.y / grid.y);
+    float scale = max(1.0, min(sx, sy));
+    vec2 usedPx = grid * scale;
+
+    vec2 origin;
+    if (u_alignTopLeft == 1) {
+        origin = vec2(0.0, win.y - usedPx.y);
+    } else {
+        origin = (win - usedPx) * 0.5;
+    }
+
+    vec2 winPx = viewPx();
+    vec2 logicalBottom = (winPx - origin) / scale;
+
+    if (logicalBottom.x < 0.0 || logicalBottom.y < 0.0 || logicalBottom.x >= grid.x || logicalBottom.y >= grid.y) {
+        FragColor = vec4(0.0,0.0,0.0,1.0);
+        return;
+    }
+
+    vec2 outPxTL = vec2(logicalBottom.x, grid.y - 1.0 - logicalBottom.y);
+
+    int segIdx = clamp(u_drawSegment > 0 ? u_drawSegment : segmentIndex, 1, max(1, u_segmentsX * u_segmentsY)) - 1;
+    int segCol = segIdx % max(1, u_segmentsX);
+    int segRow = segIdx / max(1, u_segmentsX);
+    vec2 subBlockOrigin = vec2(float(segCol) * u_subBlockSize.x, float(segRow) * u_subBlockSize.y);
+
+    float cellW = u_tileW + u_spacingX;
+    int tileCol = int(floor((outPxTL.x - u_marginX + 1e-6) / cellW));
+
+    int tileRow = -1;
+    float yAcc = 0.0;
+    for (int r = 0; r < u_numTilesPerCol; ++r) {
+        float rowStart = yAcc;
+        float rowEnd = rowStart + u_tileH;
+        if (outPxTL.y >= rowStart && outPxTL.y < rowEnd) {
+            tileRow = r;
+            break;
+        }
+        bool gapAfter = isGapZero(r + 1);
+        if (!gapAfter) yAcc = rowEnd + u_spacingY;
+        else yAcc = rowEnd;
+    }
+
+    if (tileCol < 0 || tileCol >= u_numTilesPerRow || tileRow < 0 || tileRow >= u_numTilesPerCol) {
+        FragColor = vec4(0.0,0.0,0.0,1.0);
+        return;
+    }
+
+    float tileStartX = u_marginX + float(tileCol) * (u_tileW + u_spacingX);
+
+    float tileStartY_top = 0.0;
+    for (int r = 0; r < tileRow; ++r) {
+        tileStartY_top += u_tileH;
+        bool gapAfter = isGapZero(r + 1);
+        if (!gapAfter) tileStartY_top += u_spacingY;
+    }
+
+    int tileIndexWithinSubblock = tileRow * u_numTilesPerRow + tileCol;
+    int tableSeg = min(segIdx, max(1, u_layoutTable.z) - 1);
+    ivec4 off_i = layoutEntry(u_layoutTable.x + tableSeg * u_layoutTable.y + clamp(tileIndexWithinSubblock, 0, u_layoutTable.y - 1));
+    float offx = float(off_i.x);
+    float offy = float(off_i.y);
+
+    vec2 tileRectStart = vec2(tileStartX, tileStartY_top);
+    vec2 tileRectEnd = tileRectStart + vec2(u_tileW, u_tileH);
+
+    if (!(outPxTL.x >= tileRectStart.x && outPxTL.x < tileRectEnd.x &&
+          outPxTL.y >= tileRectStart.y && outPxTL.y < tileRectEnd.y)) {
+        FragColor = vec4(0.0,0.0,0.0,1.0);
+        return;
+    }
+
+    float pxInTileX = outPxTL.x - tileRectStart.x;
+    float pxInTileY = outPxTL.y - tileRectStart.y;
+
+    int sourceTileRow = inputTilesTopToBottom == 1 ? tileRow : (u_numTilesPerCol - 1 - tileRow);
+
+    float fetchX = u_tileW * float(tileCol) + pxInTileX - offx;
+    float fetchY = u_tileH * float(sourceTileRow) + pxInTileY - offy;
+
+    float tileSrcX0 = u_tileW * float(tileCol);
+    float tileSrcX1 = tileSrcX0 + u_tileW;
+    float tileSrcY0 = u_tileH * float(sourceTileRow);
+    float tileSrcY1 = tileSrcY0 + u_tileH;
+
+    if (fetchX < tileSrcX0 || fetchX >= tileSrcX1 || fetchY < tileSrcY0 || fetchY >= tileSrcY1) {
+        FragColor = vec4(0.0,0.0,0.0,1.0);
+        return;
+    }
+
+    vec2 inputCoord = subBlockOrigin + vec2(fetchX, fetchY);
+    inputCoord = clamp(inputCoord, vec2(0.0), u_fullInputSize - vec2(1.0));
+
+    vec2 inputUV;
+    if (u_textureIsFull == 1) {
+        inputUV.x = inputCoord.x / u_fullInputSize.x;
+        inputUV.y = 1.0 - (inputCoord.y / u_fullInputSize.y);
+    } else {
+        vec2 local = inputCoord - subBlockOrigin;
+        inputUV.x = local.x / u_subBlockSize.x;
+        inputUV.y = 1.0 - (local.y / u_subBlockSize.y);
+    }
+    inputUV = clamp(inputUV, vec2(0.0), vec2(1.0));
+
+    vec2 uvTrans = rotate90_centered(inputUV, rot);
+    if (flip_x == 1) uvTrans.x = 1.0 - uvTrans.x;
+    if (flip_y == 1) uvTrans.y = 1.0 - uvTrans.y;
+    uvTrans = clamp(uvTrans, vec2(0.0), vec2(1.0));
+
+    if (view_mode == 1) {
+        vec3 col = vec3(fract(inputUV.x * 8.0), fract((1.0 - inputUV.y) * 8.0), 0.0);
+        FragColor = vec4(smoothstep(vec3(0.15), vec3(0.85), col), 1.0);
+        return;
+    } else if (view_mode == 2) {
+        vec3 c = tileIndexToColor(tileIndexWithinSubblock);
+        FragColor = vec4(c, 1.0);
+        return;
+    }
+
+    vec3 rgb = yuvToRgb(vec3(texture(texY, uvTrans).r, texture(texUV, uvTrans).rg));
+    FragColor = vec4(calibrate(rgb, off_i.z), 1.0);
+}
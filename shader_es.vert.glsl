@@ -0,0 +1,13 @@
+#version 300 es
+// OpenGL ES 3.0 variant of shader.vert.glsl (HDMI_USE_GLES builds) -- keep both in sync.
+precision highp float;
+
+layout(location = 0) in vec2 position;
+layout(location = 1) in vec2 texcoord;
+
+out vec2 TexCoord;
+
+void main() {
+    TexCoord = vec2(texcoord.x, 1.0 - texcoord.y); // flip vertical
+    gl_Position = vec4(position, 0.0, 1.0);
+}
\ No newline at end of file
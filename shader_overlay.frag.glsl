@@ -0,0 +1,11 @@
+#version 140
+
+in vec2 TexCoord;
+out vec4 FragColor;
+
+uniform sampler2D texText; // R8 glyph coverage from text_rasterize()
+
+void main() {
+    float a = texture(texText, TexCoord).r;
+    FragColor = mix(vec4(0.0, 0.0, 0.0, 0.6), vec4(1.0, 1.0, 0.3, 1.0), a); // yellow on translucent black
+}
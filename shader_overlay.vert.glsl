@@ -0,0 +1,13 @@
+#version 140
+
+// --profile overlay: a screen-space quad at u_rect (NDC x0, y0, x1, y1) built from gl_VertexID, so it
+// needs no vertex buffer of its own (drawn as a 4-vertex triangle strip with any VAO bound)
+uniform vec4 u_rect;
+
+out vec2 TexCoord;
+
+void main() {
+    vec2 corner = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1));
+    TexCoord = vec2(corner.x, 1.0 - corner.y); // text bitmap rows are top-down
+    gl_Position = vec4(mix(u_rect.xy, u_rect.zw, corner), 0.0, 1.0);
+}
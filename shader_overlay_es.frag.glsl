@@ -0,0 +1,13 @@
+#version 300 es
+// OpenGL ES 3.0 variant of shader_overlay.frag.glsl (HDMI_USE_GLES builds) -- keep both in sync.
+precision mediump float;
+
+in vec2 TexCoord;
+out vec4 FragColor;
+
+uniform sampler2D texText; // R8 glyph coverage from text_rasterize()
+
+void main() {
+    float a = texture(texText, TexCoord).r;
+    FragColor = mix(vec4(0.0, 0.0, 0.0, 0.6), vec4(1.0, 1.0, 0.3, 1.0), a); // yellow on translucent black
+}
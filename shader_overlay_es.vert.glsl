@@ -0,0 +1,14 @@
+#version 300 es
+// OpenGL ES 3.0 variant of shader_overlay.vert.glsl (HDMI_USE_GLES builds) -- keep both in sync.
+precision highp float;
+precision highp int;
+
+uniform vec4 u_rect;
+
+out vec2 TexCoord;
+
+void main() {
+    vec2 corner = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1));
+    TexCoord = vec2(corner.x, 1.0 - corner.y); // text bitmap rows are top-down
+    gl_Position = vec4(mix(u_rect.xy, u_rect.zw, corner), 0.0, 1.0);
+}
@@ -0,0 +1,81 @@
+#version 140
+// --tile-mode=instanced: fragment stage for shader_tile.vert.glsl. Tile placement and offsets are resolved
+// per vertex, so this only samples, converts and calibrates colour (same conversion as shader.frag.glsl).
+
+in vec2 InputUV;
+in vec2 TexUV;
+flat in int TileIndex;
+flat in int LutRow;       // texColorLut row of the tile's module, 0 = none
+out vec4 FragColor;
+
+uniform sampler2D texY;
+uniform sampler2D texUV;
+uniform sampler2D texColorLut;  // unit 5: 256 x modules RGBA8 calibration LUTs
+
+// Same block as shader.frag.glsl (LayoutParamsStd140 on the CPU), keep all copies in the same order.
+layout(std140) uniform LayoutParams {
+    vec2  u_fullInputSize;   // e.g. 3840,2160
+    vec2  u_subBlockSize;    // e.g. 1280,2160
+    vec2  u_windowSize;      // SDL window in pixels
+    vec2  u_outputSize;      // legacy / fallback
+    vec2  u_gridSize;        // logical grid size (texRemap / tile instances)
+    float u_tileW;           // 128
+    float u_tileH;           // 144
+    float u_spacingX;        // controlled by control_ini (use as-is)
+    float u_spacingY;        // controlled by control_ini (use as-is)
+    float u_marginX;         // left margin
+    int   u_segmentsX;
+    int   u_segmentsY;
+    int   u_numTilesPerRow;  // 10
+    int   u_numTilesPerCol;  // 15
+    int   segmentIndex;      // 1..segmentsX*segmentsY
+    int   rot;
+    int   flip_x;
+    int   flip_y;
+    int   gap_count;         // gap rows inside the grid (flags in texLayout)
+    int   inputTilesTopToBottom;
+    int   view_mode;
+    int   u_textureIsFull;   // 1 = full input texture bound, 0 = subblock
+    int   u_alignTopLeft;    // 1 = align top-left, 0 = center
+    int   u_showPattern;     // 1 = show pattern (no input), 0 = normal
+    int   u_useRemap;        // 1 = use texRemap instead of the tile search below
+    int   u_colorLut;        // 1 = per-module calibration in texColorLut (row per tile in texLayout .z)
+    ivec4 u_layoutTable;     // texLayout: first tile entry, tiles per segment, segments (w unused)
+    vec4  u_colorMatrix[3];  // rows of the 3x4 YCbCr -> RGB matrix (matrix, range and Cb/Cr order folded in)
+};
+
+// YCbCr samples as read from texY/texUV (0..1) -> RGB, one matrix for every matrix/range/swap setting
+vec3 yuvToRgb(vec3 ycc) {
+    vec4 s = vec4(ycc, 1.0);
+    return clamp(vec3(dot(u_colorMatrix[0], s), dot(u_colorMatrix[1], s), dot(u_colorMatrix[2], s)), vec3(0.0), vec3(1.0));
+}
+
+// Module calibration: per-channel 1D LUT, row 'row' of texColorLut (0 = module without calibration)
+vec3 calibrate(vec3 rgb, int row) {
+    if (u_colorLut == 0 || row <= 0) return rgb;
+    ivec3 i = ivec3(rgb * 255.0 + 0.5);
+    return vec3(texelFetch(texColorLut, ivec2(i.r, row), 0).r, texelFetch(texColorLut, ivec2(i.g, row), 0).g,
+                texelFetch(texColorLut, ivec2(i.b, row), 0).b);
+}
+
+vec3 tileIndexToColor(int idx) {
+    float r = float((idx * 37) & 0xFF) / 255.0;
+    float g = float((idx * 73) & 0xFF) / 255.0;
+    float b = float((idx * 151) & 0xFF) / 255.0;
+    return vec3(r,g,b);
+}
+
+void main()
+{
+    if (view_mode == 1) {
+        vec3 col = vec3(fract(InputUV.x * 8.0), fract((1.0 - InputUV.y) * 8.0), 0.0);
+        FragColor = vec4(smoothstep(vec3(0.15), vec3(0.85), col), 1.0);
+        return;
+    } else if (view_mode == 2) {
+        FragColor = vec4(tileIndexToColor(TileIndex), 1.0);
+        return;
+    }
+    vec2 uv = clamp(TexUV, vec2(0.0), vec2(1.0));
+    vec3 rgb = yuvToRgb(vec3(texture(texY, uv).r, texture(texUV, uv).rg));
+    FragColor = vec4(calibrate(rgb, LutRow), 1.0);
+}
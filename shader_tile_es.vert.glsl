@@ -0,0 +1,102 @@
+#version 300 es
+// OpenGL ES 3.0 variant of shader_tile.vert.glsl (HDMI_USE_GLES builds) -- keep both in sync.
+precision highp float;
+precision highp int;
+
+// per-vertex: quad corner 0..1 (triangle strip); per instance (one tile, built by build_tile_instances()):
+// tileDst = visible part of the tile in logical grid pixels (x, y top-down as outPxTL in shader.frag.glsl, w, h),
+// tileSrc = sub-block pixel shown at tileDst.xy, tileIndex = tile index within the sub-block
+layout(location = 0) in vec2 corner;
+layout(location = 1) in vec4 tileDst;
+layout(location = 2) in vec2 tileSrc;
+layout(location = 3) in float tileIndex;
+
+out vec2 InputUV;   // before rotation/mirroring (view mode 1)
+out vec2 TexUV;     // texY/texUV coordinate
+flat out int TileIndex;
+flat out int LutRow;      // texColorLut row of the tile's module (u_colorLut == 1), else 0
+
+// Same block as shader.frag.glsl (LayoutParamsStd140 on the CPU), keep all copies in the same order.
+layout(std140) uniform LayoutParams {
+    vec2  u_fullInputSize;   // e.g. 3840,2160
+    vec2  u_subBlockSize;    // e.g. 1280,2160
+    vec2  u_windowSize;      // SDL window in pixels
+    vec2  u_outputSize;      // legacy / fallback
+    vec2  u_gridSize;        // logical grid size (texRemap / tile instances)
+    float u_tileW;           // 128
+    float u_tileH;           // 144
+    float u_spacingX;        // controlled by control_ini (use as-is)
+    float u_spacingY;        // controlled by control_ini (use as-is)
+    float u_marginX;         // left margin
+    int   u_segmentsX;
+    int   u_segmentsY;
+    int   u_numTilesPerRow;  // 10
+    int   u_numTilesPerCol;  // 15
+    int   segmentIndex;      // 1..segmentsX*segmentsY
+    int   rot;
+    int   flip_x;
+    int   flip_y;
+    int   gap_count;         // gap rows inside the grid (flags in texLayout)
+    int   inputTilesTopToBottom;
+    int   view_mode;
+    int   u_textureIsFull;   // 1 = full input texture bound, 0 = subblock
+    int   u_alignTopLeft;    // 1 = align top-left, 0 = center
+    int   u_showPattern;     // 1 = show pattern (no input), 0 = normal
+    int   u_useRemap;        // 1 = use texRemap instead of the tile search below
+    int   u_colorLut;        // 1 = per-module calibration in texColorLut (row per tile in texLayout .z)
+    ivec4 u_layoutTable;     // texLayout: first tile entry, tiles per segment, segments (w unused)
+    vec4  u_colorMatrix[3];  // rows of the 3x4 YCbCr -> RGB matrix (matrix, range and Cb/Cr order folded in)
+};
+
+// texLayout of shader.frag.glsl, only the .z (texColorLut row) of the tile entries is read here
+uniform highp isampler2D texLayout;
+
+// --all-segments, see shader.frag.glsl
+uniform vec4 u_viewport;
+uniform int  u_drawSegment;
+
+// helper: rotate a point (u,v) around center (0.5,0.5) by k*90deg clockwise
+vec2 rotate90_centered(vec2 uv, int k) {
+    vec2 c = vec2(0.5, 0.5);
+    vec2 p = uv - c;
+    vec2 r;
+    int kk = k & 3;
+    if (kk == 0) r = p;
+    else if (kk == 1) r = vec2(p.y, -p.x);
+    else if (kk == 2) r = vec2(-p.x, -p.y);
+    else r = vec2(-p.y, p.x);
+    return r + c;
+}
+
+// Same placement as the fragment path of shader.frag.glsl: integer scale of the logical grid, top-left
+// aligned or centred, so both tile modes put every pixel on the same spot. Everything that is linear in
+// the pixel position is done here; the fragment shader only samples.
+void main() {
+    vec2 win = max(u_drawSegment > 0 ? u_viewport.zw : u_windowSize, vec2(1.0));
+    vec2 grid = max(u_gridSize, vec2(1.0));
+    float scale = max(1.0, min(floor(win.x / grid.x), floor(win.y / grid.y)));
+    vec2 origin = (u_alignTopLeft == 1) ? vec2(0.0, win.y - grid.y * scale) : (win - grid * scale) * 0.5;
+
+    vec2 outPxTL = tileDst.xy + corner * tileDst.zw;
+    vec2 logicalBottom = vec2(outPxTL.x, grid.y - 1.0 - outPxTL.y);
+    gl_Position = vec4((origin + logicalBottom * scale) / win * 2.0 - 1.0, 0.0, 1.0);
+
+    int segIdx = clamp(u_drawSegment > 0 ? u_drawSegment : segmentIndex, 1, max(1, u_segmentsX * u_segmentsY)) - 1;
+    vec2 subBlockOrigin = vec2(float(segIdx % max(1, u_segmentsX)) * u_subBlockSize.x, float(segIdx / max(1, u_segmentsX)) * u_subBlockSize.y);
+    vec2 inputCoord = subBlockOrigin + tileSrc + corner * tileDst.zw;
+    if (u_textureIsFull == 1) InputUV = vec2(inputCoord.x / u_fullInputSize.x, 1.0 - inputCoord.y / u_fullInputSize.y);
+    else InputUV = vec2((inputCoord.x - subBlockOrigin.x) / u_subBlockSize.x, 1.0 - (inputCoord.y - subBlockOrigin.y) / u_subBlockSize.y);
+
+    vec2 uvTrans = rotate90_centered(InputUV, rot);
+    if (flip_x == 1) uvTrans.x = 1.0 - uvTrans.x;
+    if (flip_y == 1) uvTrans.y = 1.0 - uvTrans.y;
+    TexUV = uvTrans;
+    TileIndex = int(tileIndex + 0.5);
+    LutRow = 0;
+    if (u_colorLut == 1) {
+        int tableSeg = min(segIdx, max(1, u_layoutTable.z) - 1);
+        int i = u_layoutTable.x + tableSeg * u_layoutTable.y + clamp(TileIndex, 0, u_layoutTable.y - 1);
+        int w = textureSize(texLayout, 0).x;
+        LutRow = texelFetch(texLayout, ivec2(i % w, i / w), 0).z;
+    }
+}
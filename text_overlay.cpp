@@ -0,0 +1,59 @@
+// text_overlay.cpp
+// Status text rasteriser for the --profile overlay, see text_overlay.h.
+
+#include "text_overlay.h"
+
+#include <algorithm>
+#include <cctype>
+
+namespace {
+
+const int GLYPH_W = 5, GLYPH_H = 7, CELL_W = 6, CELL_H = 9;
+
+// 5x7 glyphs, one byte per column (bit 0 = top row)
+struct Glyph { char c; uint8_t col[GLYPH_W]; };
+const Glyph FONT[] = {
+    { '0', {0x3E,0x51,0x49,0x45,0x3E} }, { '1', {0x00,0x42,0x7F,0x40,0x00} }, { '2', {0x42,0x61,0x51,0x49,0x46} },
+    { '3', {0x21,0x41,0x45,0x4B,0x31} }, { '4', {0x18,0x14,0x12,0x7F,0x10} }, { '5', {0x27,0x45,0x45,0x45,0x39} },
+    { '6', {0x3C,0x4A,0x49,0x49,0x30} }, { '7', {0x01,0x71,0x09,0x05,0x03} }, { '8', {0x36,0x49,0x49,0x49,0x36} },
+    { '9', {0x06,0x49,0x49,0x29,0x1E} },
+    { 'A', {0x7E,0x11,0x11,0x11,0x7E} }, { 'B', {0x7F,0x49,0x49,0x49,0x36} }, { 'C', {0x3E,0x41,0x41,0x41,0x22} },
+    { 'D', {0x7F,0x41,0x41,0x22,0x1C} }, { 'E', {0x7F,0x49,0x49,0x49,0x41} }, { 'F', {0x7F,0x09,0x09,0x09,0x01} },
+    { 'G', {0x3E,0x41,0x49,0x49,0x7A} }, { 'H', {0x7F,0x08,0x08,0x08,0x7F} }, { 'I', {0x00,0x41,0x7F,0x41,0x00} },
+    { 'J', {0x20,0x40,0x41,0x3F,0x01} }, { 'K', {0x7F,0x08,0x14,0x22,0x41} }, { 'L', {0x7F,0x40,0x40,0x40,0x40} },
+    { 'M', {0x7F,0x02,0x0C,0x02,0x7F} }, { 'N', {0x7F,0x04,0x08,0x10,0x7F} }, { 'O', {0x3E,0x41,0x41,0x41,0x3E} },
+    { 'P', {0x7F,0x09,0x09,0x09,0x06} }, { 'Q', {0x3E,0x41,0x51,0x21,0x5E} }, { 'R', {0x7F,0x09,0x19,0x29,0x46} },
+    { 'S', {0x46,0x49,0x49,0x49,0x31} }, { 'T', {0x01,0x01,0x7F,0x01,0x01} }, { 'U', {0x3F,0x40,0x40,0x40,0x3F} },
+    { 'V', {0x1F,0x20,0x40,0x20,0x1F} }, { 'W', {0x3F,0x40,0x38,0x40,0x3F} }, { 'X', {0x63,0x14,0x08,0x14,0x63} },
+    { 'Y', {0x07,0x08,0x70,0x08,0x07} }, { 'Z', {0x61,0x51,0x49,0x45,0x43} },
+    { '.', {0x00,0x60,0x60,0x00,0x00} }, { ',', {0x00,0x50,0x30,0x00,0x00} }, { ':', {0x00,0x36,0x36,0x00,0x00} },
+    { '/', {0x20,0x10,0x08,0x04,0x02} }, { '-', {0x08,0x08,0x08,0x08,0x08} }, { '+', {0x08,0x08,0x3E,0x08,0x08} },
+    { '=', {0x14,0x14,0x14,0x14,0x14} }, { '%', {0x23,0x13,0x08,0x64,0x62} }, { '(', {0x00,0x1C,0x22,0x41,0x00} },
+    { ')', {0x00,0x41,0x22,0x1C,0x00} }, { '|', {0x00,0x00,0x7F,0x00,0x00} }, { '_', {0x40,0x40,0x40,0x40,0x40} },
+};
+
+const uint8_t* glyph(char c) {
+    c = (char)std::toupper((unsigned char)c);
+    for (const Glyph& g : FONT) if (g.c == c) return g.col;
+    return nullptr;
+}
+
+} // namespace
+
+void text_rasterize(const std::vector<std::string>& lines, TextBitmap& out, int pad) {
+    size_t cols = 0;
+    for (const std::string& l : lines) cols = std::max(cols, l.size());
+    out.width = ((int)cols * CELL_W + 2 * pad + 3) & ~3;
+    out.height = (int)lines.size() * CELL_H + 2 * pad;
+    out.pixels.assign((size_t)out.width * out.height, 0);
+    for (size_t r = 0; r < lines.size(); ++r) {
+        for (size_t i = 0; i < lines[r].size(); ++i) {
+            const uint8_t* g = glyph(lines[r][i]);
+            if (!g) continue;
+            int x0 = pad + (int)i * CELL_W, y0 = pad + (int)r * CELL_H + 1;
+            for (int x = 0; x < GLYPH_W; ++x)
+                for (int y = 0; y < GLYPH_H; ++y)
+                    if (g[x] & (1 << y)) out.pixels[(size_t)(y0 + y) * out.width + x0 + x] = 255;
+        }
+    }
+}
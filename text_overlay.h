@@ -0,0 +1,18 @@
+// text_overlay.h
+// A few lines of status text (the --profile overlay) rasterised on the CPU with a built-in 5x7 font
+// into a coverage mask the render thread uploads as an R8 texture. No font files, no GL in here.
+// Letters are shown upper case; characters outside the font become blanks.
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct TextBitmap {
+    int width = 0, height = 0;
+    std::vector<uint8_t> pixels; // width x height, top row first, 255 = glyph, 0 = background
+};
+
+// Cell 6x9 pixels per character (1 pixel spacing, 2 between lines), 'pad' pixels of border. The width is
+// that of the longest line, rounded up to a multiple of 4.
+void text_rasterize(const std::vector<std::string>& lines, TextBitmap& out, int pad = 2);
@@ -0,0 +1,290 @@
+// yuv_convert.cpp
+// Fixed-point YCbCr -> RGB24 (screenshots etc.), see yuv_convert.h.
+
+#include "yuv_convert.h"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include <linux/videodev2.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define YUV_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define YUV_SSE2 1
+#endif
+
+// Samples are centred and multiplied by 64, coefficients are Q12 and every product is (a * c) >> 15
+// (vqdmulhq_s16, or _mm_mulhi_epi16 with 2c), so the sums keep 3 fractional bits and fit 16-bit lanes.
+// Result = saturate((sum + 4) >> 3), i.e. rounded and clamped to 0..255.
+struct YuvCoeffs {
+    int16_t y_offset, y_scale;   // Y' = (Y - y_offset) * y_scale
+    int16_t v_r, u_g, v_g, u_b;  // R = Y' + v_r*V', G = Y' - u_g*U' - v_g*V', B = Y' + u_b*U'
+};
+
+static constexpr int16_t q12(double c) { return (int16_t)(c * 4096.0 + 0.5); }
+
+// The one set of conversion constants: the fixed-point coefficients below and the float matrix the
+// shaders get (yuv_color_matrix) are both derived from it. [bt709]; limited range luma gain y_scale,
+// full range uses 1.0 with the same chroma terms.
+struct YuvConstants { double y_scale, v_r, u_g, v_g, u_b; };
+static const YuvConstants CONSTANTS[2] = {
+    { 1.164383, 1.596027, 0.391762, 0.812968, 2.017232 }, // BT.601
+    { 1.164383, 1.792741, 0.213249, 0.532909, 2.112402 }, // BT.709
+};
+
+static YuvCoeffs yuv_coeffs(const YuvColor &color) {
+    const YuvConstants &c = CONSTANTS[color.bt709 ? 1 : 0];
+    return { (int16_t)(color.full_range ? 0 : 16), q12(color.full_range ? 1.0 : c.y_scale), q12(c.v_r), q12(c.u_g), q12(c.v_g), q12(c.u_b) };
+}
+
+void yuv_color_matrix(const YuvColor &color, float m[12]) {
+    const YuvConstants &c = CONSTANTS[color.bt709 ? 1 : 0];
+    const double ys = color.full_range ? 1.0 : c.y_scale, yo = color.full_range ? 0.0 : 16.0 / 255.0, mid = 128.0 / 255.0;
+    // rows R, G, B; columns Y, Cb, Cr, constant
+    const double k[3][4] = {
+        { ys, 0.0,    c.v_r, -ys * yo - c.v_r * mid },
+        { ys, -c.u_g, -c.v_g, -ys * yo + (c.u_g + c.v_g) * mid },
+        { ys, c.u_b,  0.0,   -ys * yo - c.u_b * mid },
+    };
+    for (int r = 0; r < 3; ++r) {
+        m[r * 4 + 0] = (float)k[r][0];
+        m[r * 4 + 1] = (float)k[r][color.swap_uv ? 2 : 1];
+        m[r * 4 + 2] = (float)k[r][color.swap_uv ? 1 : 2];
+        m[r * 4 + 3] = (float)k[r][3];
+    }
+}
+
+enum class YuvLayout { SEMI_420, SEMI_422, SEMI_444, PACKED_422 };
+
+// 4:2:0 and 4:2:2 rows look the same (one CbCr pair per two pixels), only the chroma row they use differs
+static inline bool half_width_chroma(YuvLayout l) { return l == YuvLayout::SEMI_420 || l == YuvLayout::SEMI_422; }
+
+struct YuvFormat {
+    YuvLayout layout;
+    bool vu;           // semi-planar: chroma stored Cr,Cb
+    int y0, u, y1, v;  // packed 4:2:2: byte positions within a pixel pair
+};
+
+static bool yuv_format(uint32_t f, YuvFormat &out) {
+    switch (f) {
+    case V4L2_PIX_FMT_NV12: out = { YuvLayout::SEMI_420, false, 0, 0, 0, 0 }; return true;
+    case V4L2_PIX_FMT_NV21: out = { YuvLayout::SEMI_420, true,  0, 0, 0, 0 }; return true;
+    case V4L2_PIX_FMT_NV16: out = { YuvLayout::SEMI_422, false, 0, 0, 0, 0 }; return true;
+    case V4L2_PIX_FMT_NV61: out = { YuvLayout::SEMI_422, true,  0, 0, 0, 0 }; return true;
+    case V4L2_PIX_FMT_NV24: out = { YuvLayout::SEMI_444, false, 0, 0, 0, 0 }; return true;
+    case V4L2_PIX_FMT_NV42: out = { YuvLayout::SEMI_444, true,  0, 0, 0, 0 }; return true;
+    case V4L2_PIX_FMT_YUYV: out = { YuvLayout::PACKED_422, false, 0, 1, 2, 3 }; return true;
+    case V4L2_PIX_FMT_UYVY: out = { YuvLayout::PACKED_422, false, 1, 0, 3, 2 }; return true;
+    default: return false;
+    }
+}
+
+bool yuv_convert_supported(uint32_t v4l2_pixfmt) { YuvFormat f; return yuv_format(v4l2_pixfmt, f); }
+
+static size_t default_y_stride(const YuvFormat &f, int width) { return f.layout == YuvLayout::PACKED_422 ? (size_t)width * 2 : (size_t)width; }
+static size_t default_uv_stride(const YuvFormat &f, int width) { return f.layout == YuvLayout::SEMI_444 ? (size_t)width * 2 : (size_t)((width + 1) / 2) * 2; }
+
+size_t yuv_frame_size(uint32_t v4l2_pixfmt, int width, int height) {
+    YuvFormat f;
+    if (!yuv_format(v4l2_pixfmt, f) || width <= 0 || height <= 0) return 0;
+    size_t luma = default_y_stride(f, width) * (size_t)height;
+    if (f.layout == YuvLayout::PACKED_422) return luma;
+    size_t chroma_rows = f.layout == YuvLayout::SEMI_420 ? (size_t)(height + 1) / 2 : (size_t)height;
+    return luma + default_uv_stride(f, width) * chroma_rows;
+}
+
+static inline int mulq(int a, int c) { return (a * c) >> 15; }
+static inline uint8_t clamp_q3(int v) { v = (v + 4) >> 3; return (uint8_t)(v < 0 ? 0 : (v > 255 ? 255 : v)); }
+
+static inline void pixel_scalar(int Y, int U, int V, const YuvCoeffs &k, uint8_t *d) {
+    int y = mulq((Y - k.y_offset) * 64, k.y_scale);
+    int u = (U - 128) * 64, v = (V - 128) * 64;
+    d[0] = clamp_q3(y + mulq(v, k.v_r));
+    d[1] = clamp_q3(y - mulq(u, k.u_g) - mulq(v, k.v_g));
+    d[2] = clamp_q3(y + mulq(u, k.u_b));
+}
+
+#if YUV_NEON
+// 8 pixels: 8-bit Y/U/V in, 8-bit R/G/B out
+static inline void kernel8_neon(uint8x8_t y8, uint8x8_t u8, uint8x8_t v8, const YuvCoeffs &k,
+                                uint8x8_t &r, uint8x8_t &g, uint8x8_t &b) {
+    int16x8_t y = vshlq_n_s16(vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(y8)), vdupq_n_s16(k.y_offset)), 6);
+    int16x8_t u = vshlq_n_s16(vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(u8)), vdupq_n_s16(128)), 6);
+    int16x8_t v = vshlq_n_s16(vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(v8)), vdupq_n_s16(128)), 6);
+    y = vqdmulhq_s16(y, vdupq_n_s16(k.y_scale));
+    r = vqrshrun_n_s16(vaddq_s16(y, vqdmulhq_s16(v, vdupq_n_s16(k.v_r))), 3);
+    g = vqrshrun_n_s16(vsubq_s16(vsubq_s16(y, vqdmulhq_s16(u, vdupq_n_s16(k.u_g))), vqdmulhq_s16(v, vdupq_n_s16(k.v_g))), 3);
+    b = vqrshrun_n_s16(vaddq_s16(y, vqdmulhq_s16(u, vdupq_n_s16(k.u_b))), 3);
+}
+
+// converts x in [0, width & ~15), returns the first column left for the scalar tail
+static int row_simd(const YuvFormat &f, bool vu, const uint8_t *yrow, const uint8_t *uvrow, int width,
+                    const YuvCoeffs &k, uint8_t *dst) {
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        uint8x8_t rl, gl, bl, rh, gh, bh;
+        if (half_width_chroma(f.layout)) {
+            uint8x16_t y = vld1q_u8(yrow + x);
+            uint8x8x2_t uv = vld2_u8(uvrow + x);
+            uint8x8x2_t uu = vzip_u8(uv.val[vu ? 1 : 0], uv.val[vu ? 1 : 0]);
+            uint8x8x2_t vv = vzip_u8(uv.val[vu ? 0 : 1], uv.val[vu ? 0 : 1]);
+            kernel8_neon(vget_low_u8(y), uu.val[0], vv.val[0], k, rl, gl, bl);
+            kernel8_neon(vget_high_u8(y), uu.val[1], vv.val[1], k, rh, gh, bh);
+        } else if (f.layout == YuvLayout::SEMI_444) {
+            uint8x16_t y = vld1q_u8(yrow + x);
+            uint8x16x2_t uv = vld2q_u8(uvrow + (size_t)x * 2);
+            uint8x16_t u = uv.val[vu ? 1 : 0], v = uv.val[vu ? 0 : 1];
+            kernel8_neon(vget_low_u8(y), vget_low_u8(u), vget_low_u8(v), k, rl, gl, bl);
+            kernel8_neon(vget_high_u8(y), vget_high_u8(u), vget_high_u8(v), k, rh, gh, bh);
+        } else {
+            // even pixels share U/V with the following odd one: convert both halves, then interleave
+            uint8x8x4_t p = vld4_u8(yrow + (size_t)x * 2);
+            uint8x8_t u = p.val[vu ? f.v : f.u], v = p.val[vu ? f.u : f.v];
+            uint8x8_t re, ge, be, ro, go, bo;
+            kernel8_neon(p.val[f.y0], u, v, k, re, ge, be);
+            kernel8_neon(p.val[f.y1], u, v, k, ro, go, bo);
+            uint8x8x2_t r = vzip_u8(re, ro), g = vzip_u8(ge, go), b = vzip_u8(be, bo);
+            rl = r.val[0]; rh = r.val[1]; gl = g.val[0]; gh = g.val[1]; bl = b.val[0]; bh = b.val[1];
+        }
+        uint8x16x3_t out;
+        out.val[0] = vcombine_u8(rl, rh); out.val[1] = vcombine_u8(gl, gh); out.val[2] = vcombine_u8(bl, bh);
+        vst3q_u8(dst + (size_t)x * 3, out);
+    }
+    return x;
+}
+#elif YUV_SSE2
+struct SseCoeffs { __m128i y_offset, y_scale2, v_r2, u_g2, v_g2, u_b2, c128, round; };
+
+static SseCoeffs sse_coeffs(const YuvCoeffs &k) {
+    return { _mm_set1_epi16(k.y_offset), _mm_set1_epi16((short)(k.y_scale * 2)), _mm_set1_epi16((short)(k.v_r * 2)),
+             _mm_set1_epi16((short)(k.u_g * 2)), _mm_set1_epi16((short)(k.v_g * 2)), _mm_set1_epi16((short)(k.u_b * 2)),
+             _mm_set1_epi16(128), _mm_set1_epi16(4) };
+}
+
+// 8 pixels: Y/U/V in 16-bit lanes (0..255) in, rounded R/G/B in 16-bit lanes out (not yet clamped)
+static inline void kernel8_sse2(__m128i y, __m128i u, __m128i v, const SseCoeffs &k, __m128i &r, __m128i &g, __m128i &b) {
+    y = _mm_mulhi_epi16(_mm_slli_epi16(_mm_sub_epi16(y, k.y_offset), 6), k.y_scale2);
+    u = _mm_slli_epi16(_mm_sub_epi16(u, k.c128), 6);
+    v = _mm_slli_epi16(_mm_sub_epi16(v, k.c128), 6);
+    r = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(y, _mm_mulhi_epi16(v, k.v_r2)), k.round), 3);
+    g = _mm_srai_epi16(_mm_add_epi16(_mm_sub_epi16(_mm_sub_epi16(y, _mm_mulhi_epi16(u, k.u_g2)), _mm_mulhi_epi16(v, k.v_g2)), k.round), 3);
+    b = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(y, _mm_mulhi_epi16(u, k.u_b2)), k.round), 3);
+}
+
+// packed 4:2:2 pixel pairs -> per-pixel Y and the two chroma bytes of each pair duplicated
+static inline void unpack_422_sse2(__m128i p, bool y_first, __m128i &y, __m128i &c0, __m128i &c1) {
+    const __m128i lo8 = _mm_set1_epi16(0x00FF), lo16 = _mm_set1_epi32(0xFFFF);
+    __m128i c = y_first ? _mm_srli_epi16(p, 8) : _mm_and_si128(p, lo8);
+    y = y_first ? _mm_and_si128(p, lo8) : _mm_srli_epi16(p, 8);
+    __m128i a = _mm_and_si128(c, lo16), s = _mm_srli_epi32(c, 16);
+    c0 = _mm_or_si128(a, _mm_slli_epi32(a, 16));
+    c1 = _mm_or_si128(s, _mm_slli_epi32(s, 16));
+}
+
+static int row_simd(const YuvFormat &f, bool vu, const uint8_t *yrow, const uint8_t *uvrow, int width,
+                    const YuvCoeffs &kc, uint8_t *dst) {
+    const SseCoeffs k = sse_coeffs(kc);
+    const __m128i zero = _mm_setzero_si128(), lo8 = _mm_set1_epi16(0x00FF);
+    alignas(16) uint8_t R[16], G[16], B[16];
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i yl, yh, ul, uh, vl, vh;
+        if (half_width_chroma(f.layout)) {
+            __m128i y = _mm_loadu_si128((const __m128i*)(yrow + x));
+            __m128i uv = _mm_loadu_si128((const __m128i*)(uvrow + x));
+            __m128i c0 = _mm_and_si128(uv, lo8), c1 = _mm_srli_epi16(uv, 8);
+            __m128i u = vu ? c1 : c0, v = vu ? c0 : c1;
+            yl = _mm_unpacklo_epi8(y, zero); yh = _mm_unpackhi_epi8(y, zero);
+            ul = _mm_unpacklo_epi16(u, u); uh = _mm_unpackhi_epi16(u, u);
+            vl = _mm_unpacklo_epi16(v, v); vh = _mm_unpackhi_epi16(v, v);
+        } else if (f.layout == YuvLayout::SEMI_444) {
+            __m128i y = _mm_loadu_si128((const __m128i*)(yrow + x));
+            __m128i uv0 = _mm_loadu_si128((const __m128i*)(uvrow + (size_t)x * 2));
+            __m128i uv1 = _mm_loadu_si128((const __m128i*)(uvrow + (size_t)x * 2 + 16));
+            yl = _mm_unpacklo_epi8(y, zero); yh = _mm_unpackhi_epi8(y, zero);
+            ul = _mm_and_si128(uv0, lo8); vl = _mm_srli_epi16(uv0, 8);
+            uh = _mm_and_si128(uv1, lo8); vh = _mm_srli_epi16(uv1, 8);
+            if (vu) { std::swap(ul, vl); std::swap(uh, vh); }
+        } else {
+            // YUYV / UYVY: the first chroma byte of a pair is U
+            bool y_first = f.y0 == 0;
+            __m128i c0l, c1l, c0h, c1h;
+            unpack_422_sse2(_mm_loadu_si128((const __m128i*)(yrow + (size_t)x * 2)), y_first, yl, c0l, c1l);
+            unpack_422_sse2(_mm_loadu_si128((const __m128i*)(yrow + (size_t)x * 2 + 16)), y_first, yh, c0h, c1h);
+            ul = vu ? c1l : c0l; vl = vu ? c0l : c1l;
+            uh = vu ? c1h : c0h; vh = vu ? c0h : c1h;
+        }
+        __m128i rl, gl, bl, rh, gh, bh;
+        kernel8_sse2(yl, ul, vl, k, rl, gl, bl);
+        kernel8_sse2(yh, uh, vh, k, rh, gh, bh);
+        _mm_store_si128((__m128i*)R, _mm_packus_epi16(rl, rh));
+        _mm_store_si128((__m128i*)G, _mm_packus_epi16(gl, gh));
+        _mm_store_si128((__m128i*)B, _mm_packus_epi16(bl, bh));
+        uint8_t *d = dst + (size_t)x * 3;
+        for (int i = 0; i < 16; ++i) { d[i*3+0] = R[i]; d[i*3+1] = G[i]; d[i*3+2] = B[i]; }
+    }
+    return x;
+}
+#else
+static int row_simd(const YuvFormat&, bool, const uint8_t*, const uint8_t*, int, const YuvCoeffs&, uint8_t*) { return 0; }
+#endif
+
+static void row_scalar(const YuvFormat &f, bool vu, const uint8_t *yrow, const uint8_t *uvrow, int x, int width,
+                       const YuvCoeffs &k, uint8_t *dst) {
+    int ci = vu ? 1 : 0, vi = vu ? 0 : 1;
+    for (; x < width; ++x) {
+        uint8_t *d = dst + (size_t)x * 3;
+        if (half_width_chroma(f.layout)) {
+            const uint8_t *c = uvrow + (size_t)(x / 2) * 2;
+            pixel_scalar(yrow[x], c[ci], c[vi], k, d);
+        } else if (f.layout == YuvLayout::SEMI_444) {
+            const uint8_t *c = uvrow + (size_t)x * 2;
+            pixel_scalar(yrow[x], c[ci], c[vi], k, d);
+        } else {
+            const uint8_t *p = yrow + (size_t)(x / 2) * 4;
+            pixel_scalar(p[(x & 1) ? f.y1 : f.y0], p[vu ? f.v : f.u], p[vu ? f.u : f.v], k, d);
+        }
+    }
+}
+
+static void convert_rows(const YuvFrame &in, const YuvFormat &f, bool vu, const YuvCoeffs &k,
+                         size_t y_stride, size_t uv_stride, uint8_t *rgb, size_t rgb_stride, int row0, int row1) {
+    for (int row = row0; row < row1; ++row) {
+        const uint8_t *yrow = in.y + (size_t)row * y_stride;
+        const uint8_t *uvrow = nullptr;
+        if (f.layout == YuvLayout::SEMI_420) uvrow = in.uv + (size_t)(row / 2) * uv_stride;
+        else if (f.layout != YuvLayout::PACKED_422) uvrow = in.uv + (size_t)row * uv_stride;
+        uint8_t *dst = rgb + (size_t)row * rgb_stride;
+        int x = row_simd(f, vu, yrow, uvrow, in.width, k, dst);
+        row_scalar(f, vu, yrow, uvrow, x, in.width, k, dst);
+    }
+}
+
+bool yuv_to_rgb24(const YuvFrame &in, const YuvColor &color, uint8_t *rgb, size_t rgb_stride, int threads) {
+    YuvFormat f;
+    if (!yuv_format(in.v4l2_pixfmt, f) || !rgb || !in.y || in.width <= 0 || in.height <= 0) return false;
+    if (f.layout != YuvLayout::PACKED_422 && !in.uv) return false;
+    const YuvCoeffs k = yuv_coeffs(color);
+    bool vu = f.vu != color.swap_uv;
+    size_t y_stride = in.y_stride ? in.y_stride : default_y_stride(f, in.width);
+    size_t uv_stride = in.uv_stride ? in.uv_stride : default_uv_stride(f, in.width);
+    if (!rgb_stride) rgb_stride = (size_t)in.width * 3;
+
+    const int MIN_ROWS_PER_THREAD = 32;
+    int n = threads > 0 ? threads : (int)std::min(8u, std::max(1u, std::thread::hardware_concurrency()));
+    n = std::max(1, std::min(n, in.height / MIN_ROWS_PER_THREAD));
+    int band = (in.height + n - 1) / n;
+    std::vector<std::thread> pool;
+    for (int i = 1; i < n; ++i) {
+        int r0 = i * band, r1 = std::min(in.height, r0 + band);
+        if (r0 >= r1) break;
+        try { pool.emplace_back(convert_rows, std::cref(in), std::cref(f), vu, std::cref(k), y_stride, uv_stride, rgb, rgb_stride, r0, r1); }
+        catch (...) { convert_rows(in, f, vu, k, y_stride, uv_stride, rgb, rgb_stride, r0, r1); }
+    }
+    convert_rows(in, f, vu, k, y_stride, uv_stride, rgb, rgb_stride, 0, std::min(in.height, band));
+    for (auto &t : pool) t.join();
+    return true;
+}
@@ -0,0 +1,38 @@
+// yuv_convert.h
+// CPU YCbCr -> RGB24 conversion for screenshots (and any other path that needs RGB on the CPU, e.g.
+// replayed frames or an encoder). Fixed-point with precomputed BT.709/BT.601 x limited/full coefficients,
+// NEON on ARM, SSE2 on x86, a scalar path elsewhere and for row tails; all three give identical output.
+// The fragment shaders get the same constants through yuv_color_matrix(), so a screenshot matches the screen.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// One frame in memory. Semi-planar formats (NV12/NV21/NV16/NV61/NV24/NV42) use 'y' and 'uv', packed 4:2:2
+// (YUYV/UYVY) only 'y'. Strides are in bytes; 0 means tightly packed.
+struct YuvFrame {
+    uint32_t v4l2_pixfmt = 0;
+    int width = 0, height = 0;
+    const uint8_t* y = nullptr;
+    const uint8_t* uv = nullptr;
+    size_t y_stride = 0, uv_stride = 0;
+};
+
+struct YuvColor {
+    bool bt709 = true;
+    bool full_range = false;
+    bool swap_uv = false; // exchange Cb/Cr relative to the order the fourcc implies (--uv-swap)
+};
+
+bool yuv_convert_supported(uint32_t v4l2_pixfmt);
+
+// Bytes of one tightly packed frame, 0 for unsupported formats.
+size_t yuv_frame_size(uint32_t v4l2_pixfmt, int width, int height);
+
+// The same conversion as a row-major 3x4 matrix for the shaders: RGB = M * (Y, Cb, Cr, 1) with all
+// values normalised to 0..1 (8-bit code / 255), clamping left to the caller. swap_uv swaps the Cb/Cr columns.
+void yuv_color_matrix(const YuvColor& color, float m[12]);
+
+// Convert to RGB24 rows of 'rgb_stride' bytes (0 = width * 3). Rows are split across 'threads' worker
+// threads (0 = one per core, at most 8). false for unsupported formats or missing planes.
+bool yuv_to_rgb24(const YuvFrame& in, const YuvColor& color, uint8_t* rgb, size_t rgb_stride = 0, int threads = 0);